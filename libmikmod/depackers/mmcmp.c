@@ -138,302 +138,379 @@ static const ULONG MMCMP16BitFetch[16] =
 };
 
 
-BOOL MMCMP_Unpack(MREADER* reader, void** out, long* outlen)
+/* The blocks are unpacked in order, as far as the data is read. Blocks may
+   unpack anywhere in the data, so each block has the lowest position which
+   it and the blocks after it unpack: all data before it is unpacked once
+   the blocks before are. */
+typedef struct MMCMPSTATE
 {
+	MREADER *reader;
 	ULONG srclen, destlen;
-	UBYTE *destbuf, *destptr, *destend;
-	MMCMPHEADER mmh;
+	ULONG nblocks;
 	ULONG *pblk_table;
+	ULONG *lowest;
+	ULONG next; /* next block to unpack */
 	MMCMPSUBBLOCK *subblocks;
-	ULONG i, blockidx, numsubs;
-	UBYTE *buf;  ULONG bufsize;
-
-	_mm_fseek(reader,0,SEEK_END);
-	srclen = _mm_ftell(reader);
-	if (srclen < 256) return 0;
-
-	_mm_rewind(reader);
-	if (_mm_read_I_ULONG(reader) != 0x4352697A)	/* 'ziRC' */
-		return 0;
-	if (_mm_read_I_ULONG(reader) != 0x61694e4f)	/* 'ONia' */
+	ULONG numsubs;
+	UBYTE *buf;
+	ULONG bufsize;
+} MMCMPSTATE;
+
+/* Reads and checks the header and the sub-blocks of a block, and sets the
+   position of its data. Returns 0 if the block is invalid. */
+static BOOL MMCMP_ReadBlock(MMCMPSTATE* st, ULONG blockidx, MMCMPBLOCK* block, ULONG* datapos)
+{
+	MREADER *reader = st->reader;
+	ULONG srcpos = st->pblk_table[blockidx];
+	ULONG i;
+
+	if (srcpos + 20 >= st->srclen) return 0;
+
+	_mm_fseek(reader,srcpos,SEEK_SET);
+	block->unpk_size = _mm_read_I_ULONG(reader);
+	block->pk_size = _mm_read_I_ULONG(reader);
+	block->xor_chk = _mm_read_I_ULONG(reader);
+	block->sub_blk = _mm_read_I_UWORD(reader);
+	block->flags = _mm_read_I_UWORD(reader);
+	block->tt_entries = _mm_read_I_UWORD(reader);
+	block->num_bits = _mm_read_I_UWORD(reader);
+
+	if (!block->unpk_size || !block->pk_size || !block->sub_blk)
 		return 0;
-	if (_mm_read_I_UWORD(reader) != 14)		/* header size */
+	if (block->pk_size <= block->tt_entries)
 		return 0;
+	if (block->flags & MMCMP_COMP) {
+		if (block->flags & MMCMP_16BIT) {
+			if (block->num_bits >= 16)
+				return 0;
+		}
+		else {
+			if (block->num_bits >=  8)
+				return 0;
+		}
+	}
 
-	mmh.version = _mm_read_I_UWORD(reader);
-	mmh.nblocks = _mm_read_I_UWORD(reader);
-	mmh.filesize = _mm_read_I_ULONG(reader);
-	mmh.blktable = _mm_read_I_ULONG(reader);
-	mmh.glb_comp = _mm_read_UBYTE(reader);
-	mmh.fmt_comp = _mm_read_UBYTE(reader);
+	srcpos += 20 + block->sub_blk*8;
+	if (srcpos >= st->srclen) return 0;
 
-	if ((!mmh.nblocks) || (mmh.filesize < 16) || (mmh.filesize > 0x8000000) ||
-	    (mmh.blktable >= srclen) || (mmh.blktable + 4*mmh.nblocks > srclen)) {
-		return 0;
+	if (st->numsubs < block->sub_blk) {
+		st->numsubs = (block->sub_blk + 31) & ~31;
+		MikMod_free(st->subblocks);
+		st->subblocks = (MMCMPSUBBLOCK*)MikMod_malloc(st->numsubs*sizeof(MMCMPSUBBLOCK));
+		if (!st->subblocks) {
+			st->numsubs = 0;
+			return 0;
+		}
 	}
-	destlen = mmh.filesize;
-	numsubs = 32;
-	bufsize = 65536;
-
-	destbuf = (UBYTE*)MikMod_malloc(destlen);
-	buf = (UBYTE*)MikMod_malloc(bufsize);
-	pblk_table = (ULONG*)MikMod_malloc(mmh.nblocks*4);
-	subblocks = (MMCMPSUBBLOCK*)MikMod_malloc(numsubs*sizeof(MMCMPSUBBLOCK));
-	if (!destbuf || !buf || !pblk_table || !subblocks)
-		goto err;
-	destend = destbuf + destlen;
-
-	_mm_fseek(reader,mmh.blktable,SEEK_SET);
-	for (blockidx = 0; blockidx < mmh.nblocks; blockidx++) {
-		pblk_table[blockidx] = _mm_read_I_ULONG(reader);
+	for (i = 0; i < block->sub_blk; i++) {
+		st->subblocks[i].unpk_pos = _mm_read_I_ULONG(reader);
+		st->subblocks[i].unpk_size = _mm_read_I_ULONG(reader);
+		if (st->subblocks[i].unpk_pos >= st->destlen) return 0;
+		if (st->subblocks[i].unpk_size > st->destlen - st->subblocks[i].unpk_pos) return 0;
 	}
 
-	for (blockidx = 0; blockidx < mmh.nblocks; blockidx++)
-	{
-		ULONG srcpos = pblk_table[blockidx];
-		MMCMPBLOCK block;
-
-		if (srcpos + 20 >= srclen) goto err;
-
-		_mm_fseek(reader,srcpos,SEEK_SET);
-		block.unpk_size = _mm_read_I_ULONG(reader);
-		block.pk_size = _mm_read_I_ULONG(reader);
-		block.xor_chk = _mm_read_I_ULONG(reader);
-		block.sub_blk = _mm_read_I_UWORD(reader);
-		block.flags = _mm_read_I_UWORD(reader);
-		block.tt_entries = _mm_read_I_UWORD(reader);
-		block.num_bits = _mm_read_I_UWORD(reader);
-
-		if (!block.unpk_size || !block.pk_size || !block.sub_blk)
-			goto err;
-		if (block.pk_size <= block.tt_entries)
-			goto err;
-		if (block.flags & MMCMP_COMP) {
-			if (block.flags & MMCMP_16BIT) {
-				if (block.num_bits >= 16)
-					goto err;
-			}
-			else {
-				if (block.num_bits >=  8)
-					goto err;
-			}
-		}
+	*datapos = srcpos;
+	return 1;
+}
 
-		srcpos += 20 + block.sub_blk*8;
-		if (srcpos >= srclen) goto err;
+static BOOL MMCMP_UnpackBlock(MMCMPSTATE* st, ULONG blockidx, UBYTE* destbuf)
+{
+	MREADER *reader = st->reader;
+	UBYTE *destptr, *destend = destbuf + st->destlen;
+	MMCMPBLOCK block;
+	ULONG i, srcpos;
 
-		if (numsubs < block.sub_blk) {
-			numsubs = (block.sub_blk + 31) & ~31;
-			MikMod_free(subblocks);
-			subblocks = (MMCMPSUBBLOCK*)MikMod_malloc(numsubs*sizeof(MMCMPSUBBLOCK));
-			if (!subblocks) goto err;
-		}
-		for (i = 0; i < block.sub_blk; i++) {
-			subblocks[i].unpk_pos = _mm_read_I_ULONG(reader);
-			subblocks[i].unpk_size = _mm_read_I_ULONG(reader);
-			if (subblocks[i].unpk_pos >= destlen) goto err;
-			if (subblocks[i].unpk_size > destlen - subblocks[i].unpk_pos) goto err;
-		}
+	if (!MMCMP_ReadBlock(st, blockidx, &block, &srcpos))
+		return 0;
 
 #ifdef MMCMP_DEBUG
-		fprintf(stderr, "block %u: flags=%04X sub_blocks=%u",
-				  blockidx, (unsigned)block.flags, (unsigned)block.sub_blk);
-		fprintf(stderr, " pksize=%u unpksize=%u", block.pk_size, block.unpk_size);
-		fprintf(stderr, " tt_entries=%u num_bits=%u\n", block.tt_entries, block.num_bits);
+	fprintf(stderr, "block %u: flags=%04X sub_blocks=%u",
+			  blockidx, (unsigned)block.flags, (unsigned)block.sub_blk);
+	fprintf(stderr, " pksize=%u unpksize=%u", block.pk_size, block.unpk_size);
+	fprintf(stderr, " tt_entries=%u num_bits=%u\n", block.tt_entries, block.num_bits);
 #endif
-		if (!(block.flags & MMCMP_COMP))
-		{ /* Data is not packed */
-			_mm_fseek(reader,srcpos,SEEK_SET);
-			destptr = destbuf + subblocks[0].unpk_pos;
-			i = 0;
+	if (!(block.flags & MMCMP_COMP))
+	{ /* Data is not packed */
+		_mm_fseek(reader,srcpos,SEEK_SET);
+		i = 0;
 
-			while (1) {
+		while (1) {
 #ifdef MMCMP_DEBUG
-				fprintf(stderr, "  Unpacked sub-block %u: offset %u, size=%u\n",
-						i, subblocks[i].unpk_pos, subblocks[i].unpk_size);
+			fprintf(stderr, "  Unpacked sub-block %u: offset %u, size=%u\n",
+					i, st->subblocks[i].unpk_pos, st->subblocks[i].unpk_size);
 #endif
-				_mm_read_UBYTES(destptr,subblocks[i].unpk_size,reader);
-				destptr += subblocks[i].unpk_size;
-				if (++i == block.sub_blk) break;
-			}
+			/* each sub-block goes where it says, which was checked */
+			destptr = destbuf + st->subblocks[i].unpk_pos;
+			_mm_read_UBYTES(destptr,st->subblocks[i].unpk_size,reader);
+			if (++i == block.sub_blk) break;
 		}
-		else if (block.flags & MMCMP_16BIT)
-		{ /* Data is 16-bit packed */
-			MMCMPBITBUFFER bb;
-			ULONG size;
-			ULONG pos = 0;
-			ULONG numbits = block.num_bits;
-			ULONG oldval = 0;
+	}
+	else if (block.flags & MMCMP_16BIT)
+	{ /* Data is 16-bit packed */
+		MMCMPBITBUFFER bb;
+		ULONG size;
+		ULONG pos = 0;
+		ULONG numbits = block.num_bits;
+		ULONG oldval = 0;
 
 #ifdef MMCMP_DEBUG
-			fprintf(stderr, "  16-bit block: pos=%u size=%u ",
-					subblocks[0].unpk_pos, subblocks[0].unpk_size);
-			if (block.flags & MMCMP_DELTA) fprintf(stderr, "DELTA ");
-			if (block.flags & MMCMP_ABS16) fprintf(stderr, "ABS16 ");
-			fprintf(stderr, "\n");
+		fprintf(stderr, "  16-bit block: pos=%u size=%u ",
+				st->subblocks[0].unpk_pos, st->subblocks[0].unpk_size);
+		if (block.flags & MMCMP_DELTA) fprintf(stderr, "DELTA ");
+		if (block.flags & MMCMP_ABS16) fprintf(stderr, "ABS16 ");
+		fprintf(stderr, "\n");
 #endif
-			size = block.pk_size - block.tt_entries;
-			if (bufsize < size) {
-				while (bufsize < size) bufsize += 65536;
-				MikMod_free(buf);
-				if (!(buf = (UBYTE*)MikMod_malloc(bufsize)))
-					goto err;
-			}
+		size = block.pk_size - block.tt_entries;
+		if (st->bufsize < size) {
+			while (st->bufsize < size) st->bufsize += 65536;
+			MikMod_free(st->buf);
+			if (!(st->buf = (UBYTE*)MikMod_malloc(st->bufsize)))
+				return 0;
+		}
 
-			bb.bitcount = 0;
-			bb.bitbuffer = 0;
-			bb.start = buf;
-			bb.end = buf + size;
+		bb.bitcount = 0;
+		bb.bitbuffer = 0;
+		bb.start = st->buf;
+		bb.end = st->buf + size;
 
-			_mm_fseek(reader,srcpos+block.tt_entries,SEEK_SET);
-			_mm_read_UBYTES(buf,size,reader);
-			destptr = destbuf + subblocks[0].unpk_pos;
-			size = subblocks[0].unpk_size;
-			i = 0;
+		_mm_fseek(reader,srcpos+block.tt_entries,SEEK_SET);
+		_mm_read_UBYTES(st->buf,size,reader);
+		destptr = destbuf + st->subblocks[0].unpk_pos;
+		size = st->subblocks[0].unpk_size;
+		i = 0;
 
-			while (1)
-			{
-				ULONG newval = 0x10000;
-				ULONG d = MMCMP_GetBits(&bb, numbits+1);
+		while (1)
+		{
+			ULONG newval = 0x10000;
+			ULONG d = MMCMP_GetBits(&bb, numbits+1);
 
-				if (d >= MMCMP16BitCommands[numbits])
+			if (d >= MMCMP16BitCommands[numbits])
+			{
+				ULONG nFetch = MMCMP16BitFetch[numbits];
+				ULONG newbits = MMCMP_GetBits(&bb, nFetch) + ((d - MMCMP16BitCommands[numbits]) << nFetch);
+				if (newbits != numbits)
 				{
-					ULONG nFetch = MMCMP16BitFetch[numbits];
-					ULONG newbits = MMCMP_GetBits(&bb, nFetch) + ((d - MMCMP16BitCommands[numbits]) << nFetch);
-					if (newbits != numbits)
-					{
-						numbits = newbits & 0x0F;
-					} else
-					{
-						if ((d = MMCMP_GetBits(&bb, 4)) == 0x0F)
-						{
-							if (MMCMP_GetBits(&bb, 1)) break;
-							newval = 0xFFFF;
-						} else
-						{
-							newval = 0xFFF0 + d;
-						}
-					}
+					numbits = newbits & 0x0F;
 				} else
 				{
-					newval = d;
-				}
-				if (newval < 0x10000)
-				{
-					newval = (newval & 1) ? (ULONG)(-(SLONG)((newval+1) >> 1)) : (ULONG)(newval >> 1);
-					if (block.flags & MMCMP_DELTA)
+					if ((d = MMCMP_GetBits(&bb, 4)) == 0x0F)
 					{
-						newval += oldval;
-						oldval = newval;
+						if (MMCMP_GetBits(&bb, 1)) break;
+						newval = 0xFFFF;
 					} else
-					if (!(block.flags & MMCMP_ABS16))
 					{
-						newval ^= 0x8000;
+						newval = 0xFFF0 + d;
 					}
-					if (destend - destptr < 2) goto err;
-					pos += 2;
-					*destptr++ = (UBYTE) (((UWORD)newval) & 0xff);
-					*destptr++ = (UBYTE) (((UWORD)newval) >> 8);
 				}
-				if (pos >= size)
+			} else
+			{
+				newval = d;
+			}
+			if (newval < 0x10000)
+			{
+				newval = (newval & 1) ? (ULONG)(-(SLONG)((newval+1) >> 1)) : (ULONG)(newval >> 1);
+				if (block.flags & MMCMP_DELTA)
 				{
-					if (++i == block.sub_blk) break;
-					size = subblocks[i].unpk_size;
-					destptr = destbuf + subblocks[i].unpk_pos;
-					pos = 0;
+					newval += oldval;
+					oldval = newval;
+				} else
+				if (!(block.flags & MMCMP_ABS16))
+				{
+					newval ^= 0x8000;
 				}
+				if (destend - destptr < 2) return 0;
+				pos += 2;
+				*destptr++ = (UBYTE) (((UWORD)newval) & 0xff);
+				*destptr++ = (UBYTE) (((UWORD)newval) >> 8);
 			}
-		}
-		else
-		{ /* Data is 8-bit packed */
-			MMCMPBITBUFFER bb;
-			ULONG size;
-			ULONG pos = 0;
-			ULONG numbits = block.num_bits;
-			ULONG oldval = 0;
-			UBYTE ptable[0x100];
-
-			size = block.pk_size - block.tt_entries;
-			if (bufsize < size) {
-				while (bufsize < size) bufsize += 65536;
-				MikMod_free(buf);
-				if (!(buf = (UBYTE*)MikMod_malloc(bufsize)))
-					goto err;
+			if (pos >= size)
+			{
+				if (++i == block.sub_blk) break;
+				size = st->subblocks[i].unpk_size;
+				destptr = destbuf + st->subblocks[i].unpk_pos;
+				pos = 0;
 			}
+		}
+	}
+	else
+	{ /* Data is 8-bit packed */
+		MMCMPBITBUFFER bb;
+		ULONG size;
+		ULONG pos = 0;
+		ULONG numbits = block.num_bits;
+		ULONG oldval = 0;
+		UBYTE ptable[0x100];
+
+		size = block.pk_size - block.tt_entries;
+		if (st->bufsize < size) {
+			while (st->bufsize < size) st->bufsize += 65536;
+			MikMod_free(st->buf);
+			if (!(st->buf = (UBYTE*)MikMod_malloc(st->bufsize)))
+				return 0;
+		}
 
-			bb.bitcount = 0;
-			bb.bitbuffer = 0;
-			bb.start = buf;
-			bb.end = buf + size;
+		bb.bitcount = 0;
+		bb.bitbuffer = 0;
+		bb.start = st->buf;
+		bb.end = st->buf + size;
 
-			_mm_read_UBYTES(ptable,0x100,reader);
-			_mm_fseek(reader,srcpos+block.tt_entries,SEEK_SET);
-			_mm_read_UBYTES(buf,size,reader);
-			destptr = destbuf + subblocks[0].unpk_pos;
-			size = subblocks[0].unpk_size;
-			i = 0;
+		_mm_read_UBYTES(ptable,0x100,reader);
+		_mm_fseek(reader,srcpos+block.tt_entries,SEEK_SET);
+		_mm_read_UBYTES(st->buf,size,reader);
+		destptr = destbuf + st->subblocks[0].unpk_pos;
+		size = st->subblocks[0].unpk_size;
+		i = 0;
 
-			while (1)
-			{
-				ULONG newval = 0x100;
-				ULONG d = MMCMP_GetBits(&bb, numbits+1);
+		while (1)
+		{
+			ULONG newval = 0x100;
+			ULONG d = MMCMP_GetBits(&bb, numbits+1);
 
-				if (d >= MMCMP8BitCommands[numbits])
+			if (d >= MMCMP8BitCommands[numbits])
+			{
+				ULONG nFetch = MMCMP8BitFetch[numbits];
+				ULONG newbits = MMCMP_GetBits(&bb, nFetch) + ((d - MMCMP8BitCommands[numbits]) << nFetch);
+				if (newbits != numbits)
 				{
-					ULONG nFetch = MMCMP8BitFetch[numbits];
-					ULONG newbits = MMCMP_GetBits(&bb, nFetch) + ((d - MMCMP8BitCommands[numbits]) << nFetch);
-					if (newbits != numbits)
-					{
-						numbits = newbits & 0x07;
-					} else
-					{
-						if ((d = MMCMP_GetBits(&bb, 3)) == 7)
-						{
-							if (MMCMP_GetBits(&bb, 1)) break;
-							newval = 0xFF;
-						} else
-						{
-							newval = 0xF8 + d;
-						}
-					}
+					numbits = newbits & 0x07;
 				} else
 				{
-					newval = d;
-				}
-				if (newval < 0x100)
-				{
-					int n = ptable[newval];
-					if (block.flags & MMCMP_DELTA)
+					if ((d = MMCMP_GetBits(&bb, 3)) == 7)
 					{
-						n += oldval;
-						oldval = n;
+						if (MMCMP_GetBits(&bb, 1)) break;
+						newval = 0xFF;
+					} else
+					{
+						newval = 0xF8 + d;
 					}
-					destptr[pos++] = (UBYTE)n;
 				}
-				if (pos >= size)
+			} else
+			{
+				newval = d;
+			}
+			if (newval < 0x100)
+			{
+				int n = ptable[newval];
+				if (block.flags & MMCMP_DELTA)
 				{
-					if (++i == block.sub_blk) break;
-					size = subblocks[i].unpk_size;
-					destptr = destbuf + subblocks[i].unpk_pos;
-					pos = 0;
+					n += oldval;
+					oldval = n;
 				}
+				destptr[pos++] = (UBYTE)n;
+			}
+			if (pos >= size)
+			{
+				if (++i == block.sub_blk) break;
+				size = st->subblocks[i].unpk_size;
+				destptr = destbuf + st->subblocks[i].unpk_pos;
+				pos = 0;
 			}
 		}
 	}
 
-	MikMod_free(buf);
-	MikMod_free(pblk_table);
-	MikMod_free(subblocks);
-	*out = destbuf;
-	*outlen = destlen;
 	return 1;
+}
+
+static void MMCMP_Close(void* state)
+{
+	MMCMPSTATE *st = (MMCMPSTATE*)state;
+
+	MikMod_free(st->buf);
+	MikMod_free(st->pblk_table);
+	MikMod_free(st->lowest);
+	MikMod_free(st->subblocks);
+	MikMod_free(st);
+}
+
+static void* MMCMP_Open(MREADER* reader, long* outlen)
+{
+	ULONG srclen;
+	MMCMPHEADER mmh;
+	MMCMPSTATE *st;
+	MMCMPBLOCK block;
+	ULONG i, blockidx, srcpos;
+
+	_mm_fseek(reader,0,SEEK_END);
+	srclen = _mm_ftell(reader);
+	if (srclen < 256) return NULL;
+
+	_mm_rewind(reader);
+	if (_mm_read_I_ULONG(reader) != 0x4352697A)	/* 'ziRC' */
+		return NULL;
+	if (_mm_read_I_ULONG(reader) != 0x61694e4f)	/* 'ONia' */
+		return NULL;
+	if (_mm_read_I_UWORD(reader) != 14)		/* header size */
+		return NULL;
+
+	mmh.version = _mm_read_I_UWORD(reader);
+	mmh.nblocks = _mm_read_I_UWORD(reader);
+	mmh.filesize = _mm_read_I_ULONG(reader);
+	mmh.blktable = _mm_read_I_ULONG(reader);
+	mmh.glb_comp = _mm_read_UBYTE(reader);
+	mmh.fmt_comp = _mm_read_UBYTE(reader);
+
+	if ((!mmh.nblocks) || (mmh.filesize < 16) || (mmh.filesize > 0x8000000) ||
+	    (mmh.blktable >= srclen) || (mmh.blktable + 4*mmh.nblocks > srclen)) {
+		return NULL;
+	}
+
+	if (!(st = (MMCMPSTATE*)MikMod_calloc(1, sizeof(MMCMPSTATE))))
+		return NULL;
+	st->reader = reader;
+	st->srclen = srclen;
+	st->destlen = mmh.filesize;
+	st->nblocks = mmh.nblocks;
+	st->numsubs = 32;
+	st->bufsize = 65536;
+
+	st->buf = (UBYTE*)MikMod_malloc(st->bufsize);
+	st->pblk_table = (ULONG*)MikMod_malloc(st->nblocks*4);
+	st->lowest = (ULONG*)MikMod_malloc(st->nblocks*4);
+	st->subblocks = (MMCMPSUBBLOCK*)MikMod_malloc(st->numsubs*sizeof(MMCMPSUBBLOCK));
+	if (!st->buf || !st->pblk_table || !st->lowest || !st->subblocks)
+		goto err;
+
+	_mm_fseek(reader,mmh.blktable,SEEK_SET);
+	for (blockidx = 0; blockidx < st->nblocks; blockidx++) {
+		st->pblk_table[blockidx] = _mm_read_I_ULONG(reader);
+	}
+
+	/* only the block headers are read until the data is */
+	for (blockidx = st->nblocks; blockidx-- > 0; ) {
+		if (!MMCMP_ReadBlock(st, blockidx, &block, &srcpos))
+			goto err;
+		st->lowest[blockidx] = (blockidx + 1 < st->nblocks) ?
+					st->lowest[blockidx + 1] : st->destlen;
+		for (i = 0; i < block.sub_blk; i++)
+			if (st->subblocks[i].unpk_pos < st->lowest[blockidx])
+				st->lowest[blockidx] = st->subblocks[i].unpk_pos;
+	}
+
+	*outlen = st->destlen;
+	return st;
 
   err:
-	MikMod_free(buf);
-	MikMod_free(pblk_table);
-	MikMod_free(subblocks);
-	MikMod_free(destbuf);
-	return 0;
+	MMCMP_Close(st);
+	return NULL;
 }
 
+static long MMCMP_Unpack(void* state, UBYTE* destbuf, long wanted)
+{
+	MMCMPSTATE *st = (MMCMPSTATE*)state;
+
+	while ((st->next < st->nblocks) && ((long)st->lowest[st->next] < wanted)) {
+		if (!MMCMP_UnpackBlock(st, st->next, destbuf))
+			return -1;
+		st->next++;
+	}
+	return (st->next < st->nblocks) ? (long)st->lowest[st->next] : (long)st->destlen;
+}
+
+const MUNPACKER MMCMP_Unpacker = {
+	MMCMP_Open,
+	MMCMP_Unpack,
+	MMCMP_Close,
+	0
+};
+
 #endif /* NO_DEPACKERS */
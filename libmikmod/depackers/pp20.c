@@ -134,12 +134,19 @@ static BOOL ppDecrunch(const UBYTE *src, UBYTE *dest,
   /* return (src == buf_src) ? 1 : 0; */
 }
 
-BOOL PP20_Unpack(MREADER* reader, void** out, long* outlen)
+/* PP20 data is decrunched from its end: it is all unpacked at once */
+typedef struct PP20STATE {
+	MREADER *reader;
+	ULONG srclen, destlen;
+	UBYTE offset_lens[4];
+	UBYTE skip;
+} PP20STATE;
+
+static void* PP20_Open(MREADER* reader, long* outlen)
 {
+	PP20STATE *st;
 	ULONG srclen, destlen;
-	UBYTE *destbuf, *srcbuf;
 	UBYTE tmp[4], skip;
-	BOOL ret;
 
 	/* PP FORMAT:
 	 *  1 longword identifier       'PP20' or 'PX20'
@@ -151,13 +158,13 @@ BOOL PP20_Unpack(MREADER* reader, void** out, long* outlen)
 
 	_mm_fseek(reader,0,SEEK_END);
 	srclen = _mm_ftell(reader);
-	if (srclen < 256) return 0;
+	if (srclen < 256) return NULL;
 	/* file length should be a multiple of 4 */
-	if (srclen & 3) return 0;
+	if (srclen & 3) return NULL;
 
 	_mm_rewind(reader);
 	if (_mm_read_I_ULONG(reader) != 0x30325050)	/* 'PP20' */
-		return 0;
+		return NULL;
 
 	_mm_fseek(reader,srclen-4,SEEK_SET);
 	_mm_read_UBYTES(tmp,4,reader);
@@ -165,7 +172,7 @@ BOOL PP20_Unpack(MREADER* reader, void** out, long* outlen)
 	destlen |= tmp[1] << 8;
 	destlen |= tmp[2];
 	skip = tmp[3];
-	if (skip > 32) return 0;
+	if (skip > 32) return NULL;
 
 	_mm_fseek(reader,4,SEEK_SET);
 	_mm_read_UBYTES(tmp,4,reader);
@@ -180,34 +187,54 @@ BOOL PP20_Unpack(MREADER* reader, void** out, long* outlen)
 	 * and.l #$f0f0f0f0,d0
 	 * bne.s .Exit
 	 */
-	if ((tmp[0] < 9) || (tmp[0] & 0xf0)) return 0;
-	if ((tmp[1] < 9) || (tmp[1] & 0xf0)) return 0;
-	if ((tmp[2] < 9) || (tmp[2] & 0xf0)) return 0;
-	if ((tmp[3] < 9) || (tmp[3] & 0xf0)) return 0;
+	if ((tmp[0] < 9) || (tmp[0] & 0xf0)) return NULL;
+	if ((tmp[1] < 9) || (tmp[1] & 0xf0)) return NULL;
+	if ((tmp[2] < 9) || (tmp[2] & 0xf0)) return NULL;
+	if ((tmp[3] < 9) || (tmp[3] & 0xf0)) return NULL;
 
 	if ((destlen < 512) || (destlen > 0x400000) || (destlen > 16*srclen))
-		return 0;
-	if ((destbuf = (UBYTE*)MikMod_malloc(destlen)) == NULL)
-		return 0;
-
-	srclen -= 12;
-	if ((srcbuf = (UBYTE*)MikMod_malloc(srclen)) == NULL) {
-		MikMod_free(destbuf);
-		return 0;
-	}
-	_mm_read_UBYTES(srcbuf,srclen,reader);
-
-	ret = ppDecrunch(srcbuf, destbuf, tmp, srclen, destlen, skip);
+		return NULL;
+
+	if ((st = (PP20STATE*)MikMod_malloc(sizeof(PP20STATE))) == NULL)
+		return NULL;
+	st->reader = reader;
+	st->srclen = srclen - 12;
+	st->destlen = destlen;
+	memcpy(st->offset_lens, tmp, 4);
+	st->skip = skip;
+
+	*outlen = destlen;
+	return st;
+}
+
+static long PP20_Unpack(void* state, UBYTE* dest, long wanted)
+{
+	PP20STATE *st = (PP20STATE*)state;
+	UBYTE *srcbuf;
+	BOOL ret;
+
+	(void)wanted;
+	if ((srcbuf = (UBYTE*)MikMod_malloc(st->srclen)) == NULL)
+		return -1;
+	_mm_fseek(st->reader,8,SEEK_SET);
+	_mm_read_UBYTES(srcbuf,st->srclen,st->reader);
+
+	ret = ppDecrunch(srcbuf, dest, st->offset_lens, st->srclen, st->destlen, st->skip);
 	MikMod_free(srcbuf);
 
-	if (!ret) {
-		MikMod_free(destbuf);
-	}
-	else {
-		*out = destbuf;
-		*outlen = destlen;
-	}
-	return ret;
+	return ret ? (long)st->destlen : -1;
+}
+
+static void PP20_Close(void* state)
+{
+	MikMod_free(state);
 }
 
+const MUNPACKER PP20_Unpacker = {
+	PP20_Open,
+	PP20_Unpack,
+	PP20_Close,
+	0
+};
+
 #endif /* NO_DEPACKERS */
@@ -353,19 +353,24 @@ static int decompressS404(UBYTE *src, UBYTE *orgdst,
   return 0;
 }
 
-BOOL S404_Unpack(MREADER *reader, void **out, long *outlen)
+/* S404 data is decompressed from its end: it is all unpacked at once */
+typedef struct S404STATE {
+	MREADER *reader;
+	SLONG iLen, oLen, pLen;
+} S404STATE;
+
+static void *S404_Open(MREADER *reader, long *outlen)
 {
+	S404STATE *st;
 	SLONG iLen, sLen, oLen, pLen;
-	UBYTE *src, *dst = NULL;
-	int err;
 
 	_mm_fseek(reader,0,SEEK_END);
 	iLen = _mm_ftell(reader);
-	if (iLen <= 16) return 0;
+	if (iLen <= 16) return NULL;
 
 	_mm_rewind(reader);
 	if (_mm_read_M_ULONG(reader) != 0x53343034) /* S404 */
-		return 0;
+		return NULL;
 
 	sLen = _mm_read_M_SLONG(reader); /* Security length */
 	oLen = _mm_read_M_SLONG(reader); /* Depacked length */
@@ -378,7 +383,7 @@ BOOL S404_Unpack(MREADER *reader, void **out, long *outlen)
 		#ifdef STC_DEBUG
 		fprintf(stderr, "S404: bad lengths\n");
 		#endif
-		return 0;
+		return NULL;
 	}
 
 	/**
@@ -390,28 +395,48 @@ BOOL S404_Unpack(MREADER *reader, void **out, long *outlen)
 	 *  23+:  9b + 3b + 8b * floor((n-23)/255) + 7b + (>=0b) -> n B -> ~255:1
 	 */
 	if (pLen < (oLen / 255)) {
-		return 0;
+		return NULL;
 	}
 
-	if (!(src = (UBYTE*) MikMod_malloc(iLen - 16)))
-		return 0;
-	if (!(dst = (UBYTE*) MikMod_malloc(oLen))) {
-		MikMod_free(src);
-		return 0;
-	}
+	if (!(st = (S404STATE*) MikMod_malloc(sizeof(S404STATE))))
+		return NULL;
+	st->reader = reader;
+	st->iLen = iLen;
+	st->oLen = oLen;
+	st->pLen = pLen;
+
+	*outlen = oLen;
+	return st;
+}
+
+static long S404_Unpack(void *state, UBYTE *dst, long wanted)
+{
+	S404STATE *st = (S404STATE*) state;
+	UBYTE *src;
+	int err;
+
+	(void)wanted;
+	if (!(src = (UBYTE*) MikMod_malloc(st->iLen - 16)))
+		return -1;
 
-	_mm_read_UBYTES(src, iLen - 16, reader);
-	err = decompressS404(src, dst, oLen, pLen);
+	_mm_fseek(st->reader, 16, SEEK_SET);
+	_mm_read_UBYTES(src, st->iLen - 16, st->reader);
+	err = decompressS404(src, dst, st->oLen, st->pLen);
 	MikMod_free(src);
 
-	if (!err) {
-		*out = dst;
-		*outlen = oLen;
-		return 1;
-	}
+	return err ? -1 : st->oLen;
+}
 
-	MikMod_free(dst);
-	return 0;
+static void S404_Close(void *state)
+{
+	MikMod_free(state);
 }
 
+const MUNPACKER S404_Unpacker = {
+	S404_Open,
+	S404_Unpack,
+	S404_Close,
+	0
+};
+
 #endif /* NO_DEPACKERS */
@@ -349,47 +349,106 @@ static int unsqsh_block(struct io *io, UBYTE *dest_start, UBYTE *dest_end)
 	return 0;
 }
 
-static int unsqsh(UBYTE *src, SLONG srclen, UBYTE *dest, SLONG destlen)
+/* SQSH data is a series of chunks, which are read and unpacked one after
+   another, as far as the data is read */
+typedef struct XPKSTATE {
+	MREADER *reader;
+	SLONG srclen;
+	SLONG destlen;
+	SLONG pos;		/* offset of the next chunk in the packed data */
+	SLONG len;		/* bytes left to unpack */
+	UBYTE *chunk;
+} XPKSTATE;
+
+/* The packed data of a chunk and the few bytes read past it */
+#define XPK_CHUNKSIZE (0xffff + 8)
+
+/* Reads packed data as if it were all in memory, followed by zeros */
+static int xpk_read(XPKSTATE *st, SLONG offs, UBYTE *buf, SLONG count)
 {
-	SLONG len = destlen;
-	SLONG decrunched = 0;
+	SLONG avail = st->srclen - 8 - offs;
+
+	if (avail < 0) avail = 0;
+	if (avail > count) avail = count;
+	memset(buf + avail, 0, count - avail);
+	if (!avail) return 1;
+
+	_mm_fseek(st->reader, 16 + offs, SEEK_SET);
+	return _mm_read_UBYTES(buf, avail, st->reader);
+}
+
+static void *XPK_Open(MREADER *reader, long *outlen)
+{
+	XPKSTATE *st;
+	SLONG inlen, srclen, destlen;
+
+	_mm_fseek(reader,0,SEEK_END);
+	inlen = _mm_ftell(reader);
+	if (inlen <= 8 || inlen > 0x100000)
+		return NULL;
+
+	_mm_rewind(reader);
+	if (_mm_read_M_ULONG(reader) != 0x58504b46) /* XPKF */
+		return NULL;
+	srclen = _mm_read_M_SLONG(reader);
+	if (srclen <= 8 || srclen > 0x100000 || srclen > inlen-8)
+		return NULL;
+	if (_mm_read_M_ULONG(reader) != 0x53515348) /* SQSH */
+		return NULL;
+	destlen = _mm_read_M_SLONG(reader);
+	if (destlen < 0 || destlen > 0x200000)
+		return NULL;
+
+	if ((st = (XPKSTATE*) MikMod_malloc(sizeof(XPKSTATE))) == NULL)
+		return NULL;
+	if ((st->chunk = (UBYTE*) MikMod_malloc(XPK_CHUNKSIZE)) == NULL) {
+		MikMod_free(st);
+		return NULL;
+	}
+	st->reader = reader;
+	st->srclen = srclen;
+	st->destlen = destlen;
+	st->pos = 20;
+	st->len = destlen;
+
+	*outlen = destlen;
+	return st;
+}
+
+static long XPK_Unpack(void *state, UBYTE *dest, long wanted)
+{
+	XPKSTATE *st = (XPKSTATE*) state;
+	SLONG decrunched = st->destlen - st->len;
 	UBYTE type;
 	SLONG packed_size, unpacked_size;
 	ULONG sum, lchk;
-	UBYTE *c, *dest_start, *dest_end;
-	UBYTE bc[3];
+	UBYTE *c = st->chunk;
+	UBYTE hdr[8], bc[3];
 	struct io io;
 
-	io.src = src;
-	io.dest = dest;
-
-	dest_start = io.dest;
-
-	c = src + 20;
-
-	while (len) {
+	while (st->len && decrunched < wanted) {
 		/* Sanity check */
-		if (c >= src + srclen) {
+		if (st->pos >= st->srclen) {
 			return -1;
 		}
 
-		type = *c++;
-		c++;			/* hchk */
-
-		sum = readmem16b(c);
-		c += 2;			/* checksum */
-
-		packed_size = readmem16b(c);	/* packed */
-		c += 2;
-
-		unpacked_size = readmem16b(c);	/* unpacked */
-		c += 2;
+		if (!xpk_read(st, st->pos, hdr, 8)) {
+			return -1;
+		}
+		type = hdr[0];		/* hdr[1] is hchk */
+		sum = readmem16b(hdr + 2);		/* checksum */
+		packed_size = readmem16b(hdr + 4);	/* packed */
+		unpacked_size = readmem16b(hdr + 6);	/* unpacked */
+		st->pos += 8;
 
 		/* Sanity check */
 		if (packed_size <= 0 || unpacked_size <= 0) {
 			return -1;
 		}
-		if (c + packed_size + 3 > src + srclen) {
+		if (st->pos + packed_size + 3 > st->srclen) {
+			return -1;
+		}
+		if (!xpk_read(st, st->pos, c, packed_size + 8)) {
 			return -1;
 		}
 
@@ -401,95 +460,57 @@ static int unsqsh(UBYTE *src, SLONG srclen, UBYTE *dest, SLONG destlen)
 		memcpy(c + packed_size, bc, 3);
 
 		if (lchk != sum) {
-			return decrunched;
+			return -1;
 		}
 
 		if (type == 0) {
 			/* verbatim block */
-			decrunched += packed_size;
-			if (decrunched > destlen) {
+			if (decrunched + packed_size > st->destlen) {
 				return -1;
 			}
-			memcpy(io.dest, c, packed_size);
-			io.dest += packed_size;
-			c += packed_size;
-			len -= packed_size;
+			memcpy(dest + decrunched, c, packed_size);
+			decrunched += packed_size;
+			st->pos += packed_size;
+			st->len -= packed_size;
 			continue;
 		}
 
 		if (type != 1) {
 			/* unknown type */
-			return decrunched;
+			return -1;
 		}
 
-		len -= unpacked_size;
-		decrunched += unpacked_size;
-
 		/* Sanity check */
-		if (decrunched > destlen) {
+		if (decrunched + unpacked_size > st->destlen) {
 			return -1;
 		}
 
-		packed_size = (packed_size + 3) & 0xfffc;
-		c += packed_size;
-		dest_end = io.dest + unpacked_size;
-
-		if (unsqsh_block(&io, dest_start, dest_end) < 0) {
+		io.dest = dest + decrunched;
+		if (unsqsh_block(&io, dest, io.dest + unpacked_size) < 0) {
 			return -1;
 		}
 
-		io.dest = dest_end;
+		decrunched += unpacked_size;
+		st->len -= unpacked_size;
+		st->pos += (packed_size + 3) & 0xfffc;
 	}
 
 	return decrunched;
 }
 
-BOOL XPK_Unpack(MREADER *reader, void **out, long *outlen)
+static void XPK_Close(void *state)
 {
-	UBYTE *src, *dest;
-	SLONG inlen, srclen, destlen;
-
-	_mm_fseek(reader,0,SEEK_END);
-	inlen = _mm_ftell(reader);
-	if (inlen <= 8 || inlen > 0x100000)
-		return 0;
+	XPKSTATE *st = (XPKSTATE*) state;
 
-	_mm_rewind(reader);
-	if (_mm_read_M_ULONG(reader) != 0x58504b46) /* XPKF */
-		return 0;
-	srclen = _mm_read_M_SLONG(reader);
-	if (srclen <= 8 || srclen > 0x100000 || srclen > inlen-8)
-		return 0;
-	if (_mm_read_M_ULONG(reader) != 0x53515348) /* SQSH */
-		return 0;
-	destlen = _mm_read_M_SLONG(reader);
-	if (destlen < 0 || destlen > 0x200000)
-		return 0;
-
-	if ((src = (UBYTE*) MikMod_calloc(1, srclen + 3)) == NULL)
-		return 0;
-	if ((dest = (UBYTE*) MikMod_malloc(destlen + 100)) == NULL) {
-		MikMod_free(src);
-		return 0;
-	}
-
-	if (!_mm_read_UBYTES(src, srclen - 8, reader))
-		goto err;
-
-	if (unsqsh(src, srclen, dest, destlen) != destlen)
-		goto err;
-
-	*out = dest;
-	*outlen = destlen;
-
-	MikMod_free(src);
-
-	return 1;
-
-    err:
-	MikMod_free(dest);
-	MikMod_free(src);
-	return 0;
+	MikMod_free(st->chunk);
+	MikMod_free(st);
 }
 
+const MUNPACKER XPK_Unpacker = {
+	XPK_Open,
+	XPK_Unpack,
+	XPK_Close,
+	100	/* unsqsh_block may write a little past the end of a block */
+};
+
 #endif /* NO_DEPACKERS */
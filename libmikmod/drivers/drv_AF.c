@@ -185,7 +185,7 @@ MIKMODAPI MDRIVER drv_AF={
 	NULL,
 	"AF driver",
 	"AudioFile driver v1.3",
-	0,255,
+	0,MAXSOFTVOICES,
 	"audiofile",
 	"machine:t::Audio server machine (hostname:port)\n",
 	AF_CommandLine,
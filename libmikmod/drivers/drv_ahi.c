@@ -166,7 +166,7 @@ MIKMODAPI MDRIVER drv_ahi = {
 	NULL,
 	"AHI",
 	"Native AHI Amiga Output driver",
-	0,255,
+	0,MAXSOFTVOICES,
 	"AHI",
 	NULL,
 	NULL,
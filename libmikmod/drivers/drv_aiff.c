@@ -248,7 +248,7 @@ MIKMODAPI MDRIVER drv_aiff = {
     NULL,
     "Disk writer (aiff)",
     "AIFF disk writer (music.aiff) v1.2",
-    0,255,
+    0,MAXSOFTVOICES,
     "aif",
     "file:t:music.aiff:Output file name\n",
     AIFF_CommandLine,
@@ -169,7 +169,7 @@ MIKMODAPI MDRIVER drv_aix={
 	NULL,
 	"AIX Audio",
 	"AIX Audio driver v1.2",
-	0,255,
+	0,MAXSOFTVOICES,
 	"AIX",
 	"buffer:r:12,19,15:Audio buffer log2 size\n",
 	AIX_CommandLine,
@@ -453,7 +453,7 @@ MIKMODAPI MDRIVER drv_alsa = {
 	NULL,
 	"ALSA",
 	"Advanced Linux Sound Architecture (ALSA) driver v1.11",
-	0,255,
+	0,MAXSOFTVOICES,
 	"alsa",
 	NULL,
 	ALSA_CommandLine,
@@ -278,7 +278,7 @@ MIKMODAPI MDRIVER drv_dart = {
 	NULL,
 	"Direct audio (DART)",
 	"OS/2 DART driver v1.2",
-	0, 255,
+	0, MAXSOFTVOICES,
 	"dart",
 	"device:r:0,8,0:Waveaudio device index to use (0 - default)\n"
         "buffer:r:12,16:Audio buffer log2 size\n"
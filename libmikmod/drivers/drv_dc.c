@@ -148,7 +148,7 @@ MIKMODAPI MDRIVER drv_dc = {
 	NULL,
 	"DC",
 	"Dreamcast AICA SPU driver v1.0",
-	0,255,
+	0,MAXSOFTVOICES,
 	"dc",
 	NULL,
 	DC_CommandLine,
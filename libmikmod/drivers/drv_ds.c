@@ -385,7 +385,7 @@ MIKMODAPI MDRIVER drv_ds=
 	NULL,
 	"DirectSound",
 	"DirectSound Driver (DX6+) v0.6",
-	0,255,
+	0,MAXSOFTVOICES,
 	"ds",
 	"buffer:r:12,19,16:Audio buffer log2 size\n"
 		"globalfocus:b:0:Play if window does not have the focus\n",
@@ -415,7 +415,7 @@ MIKMODAPI MDRIVER drv_esd={
 	"Enlightened sound daemon",
 	/* use the same version number as the EsounD release it works best with */
 	"Enlightened sound daemon (EsounD) driver v0.2.38",
-	0,255,
+	0,MAXSOFTVOICES,
 	"esd",
 	"machine:t::Audio server machine (hostname:port)\n",
 	ESD_CommandLine,
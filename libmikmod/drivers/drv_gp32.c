@@ -106,7 +106,7 @@ MIKMODAPI MDRIVER drv_gp32={
 	NULL,
 	"GP32 SDK Audio v0.2",
 	"GP32 SDK Audio driver v0.2",
-	0,255,
+	0,MAXSOFTVOICES,
 	"gp32",
 	NULL,
 	NULL,
@@ -164,7 +164,7 @@ MIKMODAPI MDRIVER drv_hp={
 	NULL,
 	"HP-UX Audio",
 	"HP-UX Audio driver v1.3",
-	0,255,
+	0,MAXSOFTVOICES,
 	"hp",
 	"buffer:r:12,19,15:Audio buffer log2 size\n"
 		"headphone:b:0:Use headphone\n",
@@ -478,7 +478,7 @@ MIKMODAPI MDRIVER drv_mac={
     NULL,
     "Mac Driver (Carbonized)",
     "Macintosh Sound Manager Driver v2.1",
-    0,255,
+    0,MAXSOFTVOICES,
     "mac",
     NULL,
     NULL,
@@ -93,7 +93,7 @@ MIKMODAPI MDRIVER drv_n64={
 	NULL,
 	"Nintendo 64",
 	"N64 Driver v1.2",
-	255,255,
+	255,MAXSOFTVOICES,
 	"n64",
 	NULL,
 	NULL,
@@ -402,7 +402,7 @@ MIKMODAPI MDRIVER drv_nas = {
   NULL,                         /* next */
   "Network Audio System",       /* Name */
   "Network Audio System driver v0.1", /* Version */
-  0, 255,                       /* NB: 0 hardware voices? */
+  0, MAXSOFTVOICES,             /* NB: 0 hardware voices? */
   "nas",                        /* Alias */
   "audioserver:t::NAS server name\n"
   "buffer:r:50:10000:Audio buffer size, ms\n"
@@ -74,7 +74,7 @@ MIKMODAPI MDRIVER drv_nos={
 	NULL,
 	"No Sound",
 	"Nosound Driver v3.0",
-	255,255,
+	255,MAXSOFTVOICES,
 	"nosound",
 	NULL,
 	NULL,
@@ -361,7 +361,7 @@ MIKMODAPI MDRIVER drv_openal =
 	NULL,
 	"OpenAL",
 	"OpenAL driver v0.4",
-	0,255,
+	0,MAXSOFTVOICES,
 	"openal",
 	"buffersize:r:32768,16777216,32768:Buffer size\n"
 		"bufferqueue:r:2,16,4:Buffer queue size\n",
@@ -345,7 +345,7 @@ MIKMODAPI MDRIVER drv_os2 = {
 	NULL,
 	"OS/2 MMPM/2",
 	"OS/2 MMPM/2 MCI driver v1.2",
-	0,255,
+	0,MAXSOFTVOICES,
 	"os2",
 	"device:r:0,8,0:Waveaudio device index to use (0 - default)\n"
 		"buffer:r:12,16:Audio buffer log2 size\n",
@@ -284,7 +284,7 @@ MIKMODAPI MDRIVER drv_osles = {
 	NULL,
 	"Android OpenSL ES Driver",
 	"Android Native Audio OpenSL ES Output v1.0",
-	0,255,
+	0,MAXSOFTVOICES,
 	"osles",
 	NULL,
 	NULL,
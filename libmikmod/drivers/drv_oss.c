@@ -374,7 +374,7 @@ MIKMODAPI MDRIVER drv_oss={
 	NULL,
 	"Open Sound System",
 	"Open Sound System driver v1.7",
-	0,255,
+	0,MAXSOFTVOICES,
 	"oss",
 #ifdef SNDCTL_DSP_SETFRAGMENT
 	"buffer:r:7,17,14:Audio buffer log2 size\n"
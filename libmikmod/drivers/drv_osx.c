@@ -686,7 +686,7 @@ MIKMODAPI MDRIVER drv_osx={
 	NULL,
 	"CoreAudio Driver",
 	"CoreAudio Driver v2.1",
-	0,255,
+	0,MAXSOFTVOICES,
 	"osx",
 	NULL,
 	NULL,
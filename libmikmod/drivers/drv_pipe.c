@@ -182,7 +182,7 @@ MIKMODAPI MDRIVER drv_pipe={
 	NULL,
 	"Piped writer",
 	"Piped Output driver v0.2",
-	0,255,
+	0,MAXSOFTVOICES,
 	"pipe",
 	"pipe:t::Pipe command\n",
 	pipe_CommandLine,
@@ -124,7 +124,7 @@ MIKMODAPI MDRIVER drv_psp = {
 	NULL,
 	"PSP Audio",
 	"PSP Output Driver v1.1 - by sweetlilmre, original by Jim Shaw",
-	0,255,
+	0,MAXSOFTVOICES,
 	"pspdrv",
 	NULL,
 	NULL,
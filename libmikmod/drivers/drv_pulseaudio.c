@@ -255,7 +255,7 @@ MIKMODAPI struct MDRIVER drv_pulseaudio =
 	NULL,
 	"PulseAudio",
 	"PulseAudio driver v0.2",
-	0, 255,
+	0, MAXSOFTVOICES,
 	"pulseaudio",
 	"server:t::PulseAudio server name\n"
 	"sink:t::Sink (resp. source) name\n",
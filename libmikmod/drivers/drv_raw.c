@@ -131,7 +131,7 @@ MIKMODAPI MDRIVER drv_raw={
 	NULL,
 	"Disk writer (raw data)",
 	"Raw disk writer (music.raw) v1.1",
-	0,255,
+	0,MAXSOFTVOICES,
 	"raw",
 	"file:t:music.raw:Output file name\n",
 	RAW_CommandLine,
@@ -388,7 +388,7 @@ static void update(void)
 	write(modfd, eventBuf, (char *)eventP-(char *)eventBuf);
 }
 
-static void voiceSetVolume(UBYTE voice, UWORD vol)
+static void voiceSetVolume(UWORD voice, UWORD vol)
 {
 	if(voice>=SAM_NUM_VOICES)
 		return;
@@ -397,12 +397,12 @@ static void voiceSetVolume(UBYTE voice, UWORD vol)
 	voices[voice].pending|=PENDING_VOLUME;
 }
 
-static UWORD voiceGetVolume(UBYTE voice)
+static UWORD voiceGetVolume(UWORD voice)
 {
 	return voice<SAM_NUM_VOICES ? voices[voice].vol : 0;
 }
 
-static void voiceSetFrequency(UBYTE voice, ULONG freq)
+static void voiceSetFrequency(UWORD voice, ULONG freq)
 {
 	if(voice>=SAM_NUM_VOICES)
 		return;
@@ -411,12 +411,12 @@ static void voiceSetFrequency(UBYTE voice, ULONG freq)
 	voices[voice].pending|=PENDING_FREQ;
 }
 
-static ULONG voiceGetFrequency(UBYTE voice)
+static ULONG voiceGetFrequency(UWORD voice)
 {
 	return voice<SAM_NUM_VOICES ? voices[voice].freq : 0;
 }
 
-static void voiceSetPanning(UBYTE voice, ULONG pan)
+static void voiceSetPanning(UWORD voice, ULONG pan)
 {
 	if(voice>=SAM_NUM_VOICES)
 		return;
@@ -425,12 +425,12 @@ static void voiceSetPanning(UBYTE voice, ULONG pan)
 	voices[voice].pending|=PENDING_VOLUME;
 }
 
-static ULONG voiceGetPanning(UBYTE voice)
+static ULONG voiceGetPanning(UWORD voice)
 {
 	return voice<SAM_NUM_VOICES ? voices[voice].pan : 0x80;
 }
 
-static void voicePlay(UBYTE voice, SWORD handle, ULONG start, ULONG length, ULONG loopstart, ULONG repend, UWORD flags)
+static void voicePlay(UWORD voice, SWORD handle, ULONG start, ULONG length, ULONG loopstart, ULONG repend, UWORD flags)
 {
 	Voice *voiceP;
 
@@ -451,7 +451,7 @@ static void voicePlay(UBYTE voice, SWORD handle, ULONG start, ULONG length, ULON
 	voiceP->pending|=PENDING_PLAY;
 }
 
-static void voiceStop(UBYTE voice)
+static void voiceStop(UWORD voice)
 {
 	if(voice>=SAM_NUM_VOICES)
 		return;
@@ -460,17 +460,17 @@ static void voiceStop(UBYTE voice)
 	voices[voice].pending|=PENDING_STOP;
 }
 
-static BOOL voiceStopped(UBYTE voice)
+static BOOL voiceStopped(UWORD voice)
 {
 	return (voice<SAM_NUM_VOICES)? !voices[voice].playing : 1;
 }
 
-static SLONG voiceGetPosition(UBYTE voice)
+static SLONG voiceGetPosition(UWORD voice)
 {
 	return -1;
 }
 
-static ULONG voiceRealVolume(UBYTE voice)
+static ULONG voiceRealVolume(UWORD voice)
 {
 	return 0;
 }
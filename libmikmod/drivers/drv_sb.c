@@ -182,7 +182,7 @@ MDRIVER drv_sb =
 	NULL,
 	"Sound Blaster",
 	"Sound Blaster Orig/2.0/Pro/16 v1.0",
-	0, 255,
+	0, MAXSOFTVOICES,
 	"sb",
 	"port:c:220,230,240,250,260,270,280,32C,530,604,E80,F40,220:Sound Blaster base I/O port\n"
 	"irq:c:2,3,5,7,10,5:Sound Blaster IRQ\n"
@@ -167,7 +167,7 @@ MIKMODAPI struct MDRIVER drv_sdl =
     NULL,
     "SDL",
     "SDL Driver v1.3",
-    0,255,
+    0,MAXSOFTVOICES,
     "sdl",
     NULL,
     NULL,
@@ -189,7 +189,7 @@ MIKMODAPI MDRIVER drv_sgi={
 	NULL,
 	"SGI Audio System",
 	"SGI Audio System driver v0.5",
-	0,255,
+	0,MAXSOFTVOICES,
 	"sgi",
 	"fragsize:r:0,99999,20000:Sound buffer fragment size\n"
         "bufsize:r:0,199999,40000:Sound buffer total size\n",
@@ -168,7 +168,7 @@ MIKMODAPI MDRIVER drv_sndio = {
 	NULL,
 	"OpenBSD sndio",
 	"OpenBSD sndio driver v1.01",
-	0, 255,
+	0, MAXSOFTVOICES,
 	"sndio",
 	"buffer:r:7,17,12:Audio buffer log2 size\n",
 	Sndio_CommandLine,
@@ -89,7 +89,7 @@ MIKMODAPI MDRIVER drv_stdout={
 	NULL,
 	"stdout",
 	"Standard output driver v1.1",
-	0,255,
+	0,MAXSOFTVOICES,
 	"stdout",
 	NULL,
 	NULL,
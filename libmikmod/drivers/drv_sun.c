@@ -470,7 +470,7 @@ MIKMODAPI MDRIVER drv_sun = {
 	"Solaris Audio",
 	"Solaris audio driver v1.4",
 #endif
-	0, 255,
+	0, MAXSOFTVOICES,
 	"audio",
         "buffer:r:7,17,12:Audio buffer log2 size\n"
 #if defined(SUNOS) || defined(SOLARIS)
@@ -843,7 +843,7 @@ static void Ultra_PlayStop(void)
 }
 
 /* Set the volume for the given voice */
-static void Ultra_VoiceSetVolume(UBYTE voice, UWORD vol)
+static void Ultra_VoiceSetVolume(UWORD voice, UWORD vol)
 {
 	if (voice < md_numchn)
 		if (vol != voices[voice].vol) {
@@ -854,13 +854,13 @@ static void Ultra_VoiceSetVolume(UBYTE voice, UWORD vol)
 }
 
 /* Returns the volume of the given voice */
-static UWORD Ultra_VoiceGetVolume(UBYTE voice)
+static UWORD Ultra_VoiceGetVolume(UWORD voice)
 {
 	return (voice < md_numchn) ? voices[voice].vol : 0;
 }
 
 /* Set the pitch for the given voice */
-static void Ultra_VoiceSetFrequency(UBYTE voice, ULONG frq)
+static void Ultra_VoiceSetFrequency(UWORD voice, ULONG frq)
 {
 	if (voice < md_numchn)
 		if (frq != voices[voice].frq) {
@@ -870,13 +870,13 @@ static void Ultra_VoiceSetFrequency(UBYTE voice, ULONG frq)
 }
 
 /* Returns the frequency of the given voice */
-static ULONG Ultra_VoiceGetFrequency(UBYTE voice)
+static ULONG Ultra_VoiceGetFrequency(UWORD voice)
 {
 	return (voice < md_numchn) ? voices[voice].frq : 0;
 }
 
 /* Set the panning position for the given voice */
-static void Ultra_VoiceSetPanning(UBYTE voice, ULONG pan)
+static void Ultra_VoiceSetPanning(UWORD voice, ULONG pan)
 {
 	if (voice < md_numchn)
 		if (pan != voices[voice].pan) {
@@ -886,13 +886,13 @@ static void Ultra_VoiceSetPanning(UBYTE voice, ULONG pan)
 }
 
 /* Returns the panning of the given voice */
-static ULONG Ultra_VoiceGetPanning(UBYTE voice)
+static ULONG Ultra_VoiceGetPanning(UWORD voice)
 {
 	return (voice < md_numchn) ? voices[voice].pan : 0;
 }
 
 /* Start a new sample on a voice */
-static void Ultra_VoicePlay(UBYTE voice, SWORD handle, ULONG start,
+static void Ultra_VoicePlay(UWORD voice, SWORD handle, ULONG start,
 							ULONG size, ULONG reppos, ULONG repend,
 							UWORD flags)
 {
@@ -917,14 +917,14 @@ static void Ultra_VoicePlay(UBYTE voice, SWORD handle, ULONG start,
 }
 
 /* Stops a voice */
-static void Ultra_VoiceStop(UBYTE voice)
+static void Ultra_VoiceStop(UWORD voice)
 {
 	if (voice < md_numchn)
 		voices[voice].active = 0;
 }
 
 /* Returns whether a voice is stopped */
-static BOOL Ultra_VoiceStopped(UBYTE voice)
+static BOOL Ultra_VoiceStopped(UWORD voice)
 {
 	if (voice >= md_numchn)
 		return 1;
@@ -953,14 +953,14 @@ static BOOL Ultra_VoiceStopped(UBYTE voice)
 }
 
 /* Returns current voice position */
-static SLONG Ultra_VoiceGetPosition(UBYTE voice)
+static SLONG Ultra_VoiceGetPosition(UWORD voice)
 {
 	/* NOTE This information can not be determined. */
 	return -1;
 }
 
 /* Returns voice real volume */
-static ULONG Ultra_VoiceRealVolume(UBYTE voice)
+static ULONG Ultra_VoiceRealVolume(UWORD voice)
 {
 	int retval = 0;
 	if (!Ultra_VoiceStopped (voice)) {
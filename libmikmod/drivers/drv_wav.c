@@ -188,7 +188,7 @@ MIKMODAPI MDRIVER drv_wav={
 	NULL,
 	"Disk writer (wav)",
 	"Wav disk writer (music.wav) v1.3",
-	0,255,
+	0,MAXSOFTVOICES,
 	"wav",
 	"file:t:music.wav:Output file name\n",
 	WAV_CommandLine,
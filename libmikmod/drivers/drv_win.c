@@ -218,7 +218,7 @@ MIKMODAPI MDRIVER drv_win={
 	NULL,
 	"Windows waveform-audio",
 	"Windows waveform-audio driver v0.2",
-	0,255,
+	0,MAXSOFTVOICES,
 	"winmm",
 	"buffer:r:50,1000,120:Audio buffer size in milliseconds\n"
 	"count:r:2,16,2:Audio buffer count\n",
@@ -165,7 +165,7 @@ MDRIVER drv_wss =
 	NULL,
 	"Windows Sound System",
 	"Windows Sound System (CS423*,ESS*) v1.0",
-	0, 255,
+	0, MAXSOFTVOICES,
 	"wss",
 	"port:c:32C,530,604,E80,F40,530:Windows Sound System base I/O port\n"
 	"irq:c:2,3,5,7,10,5:Windows Sound System IRQ\n"
@@ -404,7 +404,7 @@ MIKMODAPI MDRIVER drv_xaudio2 = {
 	NULL,
 	"XAudio2",
 	"DirectX XAudio2 Driver v0.3",
-	0,255,
+	0,MAXSOFTVOICES,
 	"xaudio2",
 	"",
 	XAudio2_CommandLine,
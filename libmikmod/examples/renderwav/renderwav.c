@@ -0,0 +1,178 @@
+/* renderwav.c
+ * An example on how to render a module to a WAV file with several
+ * processes, each one rendering a part of the song.
+ *
+ * This example is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRENTY; without event the implied warrenty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mikmod.h>
+
+#if !defined(_WIN32) && !defined(_MIKMOD_AMIGA)
+#define HAVE_FORK
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+#define FORMAT      (DMODE_16BITS | DMODE_STEREO)
+#define FRAMESIZE   4
+#define HEADERSIZE  44
+#define CHUNK       4096
+
+static void put_long(unsigned char *p, unsigned long v)
+{
+  p[0] = v & 0xff; p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff; p[3] = (v >> 24) & 0xff;
+}
+
+static void put_word(unsigned char *p, unsigned int v)
+{
+  p[0] = v & 0xff; p[1] = (v >> 8) & 0xff;
+}
+
+static int write_header(FILE *f, unsigned long frames)
+{
+  unsigned char h[HEADERSIZE];
+  unsigned long size = frames * FRAMESIZE;
+
+  memcpy(h, "RIFF", 4); put_long(h + 4, size + HEADERSIZE - 8);
+  memcpy(h + 8, "WAVEfmt ", 8); put_long(h + 16, 16);
+  put_word(h + 20, 1); put_word(h + 22, 2);
+  put_long(h + 24, md_mixfreq); put_long(h + 28, md_mixfreq * FRAMESIZE);
+  put_word(h + 32, FRAMESIZE); put_word(h + 34, 16);
+  memcpy(h + 36, "data", 4); put_long(h + 40, size);
+
+  return fwrite(h, HEADERSIZE, 1, f) == 1 ? 0 : -1;
+}
+
+/* Renders one segment of the song at its place in the file. WAV data is
+   little endian. */
+static int render_segment(MODULE *module, const MP_SEGMENT *seg, FILE *f)
+{
+  static SWORD buf[CHUNK * 2];
+  unsigned long left = seg->frames;
+  ULONG n, i;
+
+  if (Player_StartSegment(module, seg, FORMAT))
+    return -1;
+  if (fseek(f, HEADERSIZE + (long)seg->start * FRAMESIZE, SEEK_SET))
+    return -1;
+  while (left) {
+    n = Player_Render(module, buf, left < CHUNK ? left : CHUNK, FORMAT);
+    if (!n) break;
+    for (i = 0; i < n * 2; i++)
+      put_word((unsigned char *)&buf[i], (UWORD)buf[i]);
+    if (fwrite(buf, FRAMESIZE, n, f) != n)
+      return -1;
+    left -= n;
+  }
+  return fflush(f) ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+  MODULE *module;
+  MP_SEGMENT *segs;
+  FILE *f;
+  int jobs = 4, count, t, result = 0;
+
+  if (argc > 2 && !strncmp(argv[1], "-j", 2)) {
+    jobs = atoi(argv[1] + 2);
+    argc--; argv++;
+  }
+  if (argc < 3 || jobs < 1) {
+    fprintf(stderr, "Usage: ./renderwav [-jN] module file.wav\n");
+    return 1;
+  }
+
+  /* rendering needs a software mixer, but no sound output */
+  MikMod_RegisterDriver(&drv_nos);
+  MikMod_RegisterAllLoaders();
+  md_mode |= DMODE_SOFT_MUSIC | DMODE_INTERP;
+  md_mixfreq = 44100;
+  if (MikMod_Init("")) {
+    fprintf(stderr, "Could not initialize the library, reason: %s\n",
+            MikMod_strerror(MikMod_errno));
+    return 1;
+  }
+
+  module = Player_Load(argv[1], 64, 0);
+  if (!module) {
+    fprintf(stderr, "Could not load module, reason: %s\n",
+            MikMod_strerror(MikMod_errno));
+    MikMod_Exit();
+    return 1;
+  }
+  module->loop = 0;
+
+  /* a few more segments than workers keep them all busy until the end */
+  segs = Player_SplitSong(module, jobs * 4, FORMAT, &count);
+  if (!segs) {
+    fprintf(stderr, "Could not split the song, reason: %s\n",
+            MikMod_strerror(MikMod_errno));
+    Player_Free(module);
+    MikMod_Exit();
+    return 1;
+  }
+
+  if (!(f = fopen(argv[2], "wb")) ||
+      write_header(f, segs[count - 1].start + segs[count - 1].frames)) {
+    fprintf(stderr, "Could not write %s\n", argv[2]);
+    result = 1;
+    goto done;
+  }
+  printf("Rendering %s in %d segments with %d jobs\n",
+         module->songname, count, jobs);
+
+#ifdef HAVE_FORK
+  /* the player state is global to the library, so each worker is a process
+     with its own copy of it, writing to its own file descriptor */
+  fflush(f);
+  for (t = 0; t < jobs && t < count; t++) {
+    pid_t pid = fork();
+
+    if (pid == 0) {
+      FILE *out = fopen(argv[2], "r+b");
+      int s;
+
+      if (!out) _exit(1);
+      for (s = t; s < count; s += jobs)
+        if (render_segment(module, &segs[s], out)) _exit(1);
+      fclose(out);
+      _exit(0);
+    }
+    if (pid < 0) {
+      result = 1;
+      break;
+    }
+  }
+  while (t--) {
+    int status;
+
+    if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+      result = 1;
+  }
+#else
+  for (t = 0; t < count; t++)
+    if (render_segment(module, &segs[t], f)) {
+      result = 1;
+      break;
+    }
+#endif
+  if (result)
+    fprintf(stderr, "Could not render %s\n", argv[2]);
+
+done:
+  if (f) fclose(f);
+  Player_FreeSegments(segs, count);
+  Player_Free(module);
+  MikMod_Exit();
+
+  return result;
+}
@@ -154,12 +154,30 @@ typedef unsigned long int  ULONG;
 #endif
 #endif
 
+/* 8 bytes, signed: */
+#if !defined(_WIN32) && \
+   (defined(_LP64) || defined(__LP64__) || defined(__arch64__) || defined(__alpha) || defined(__x64_64) || defined(__powerpc64__))
+typedef long               SLONGLONG;
+#elif defined(_WIN64) /* win64 is LLP64, not LP64  */
+typedef long long          SLONGLONG;
+#elif defined(__WATCOMC__)
+typedef __int64            SLONGLONG;
+#elif defined(_WIN32) && !defined(__MWERKS__)
+typedef LONGLONG           SLONGLONG;
+#elif defined(macintosh) && !TYPE_LONGLONG
+#include <Types.h>
+typedef SInt64             SLONGLONG;
+#else
+typedef long long          SLONGLONG;
+#endif
+
 /* make sure types are of correct sizes: */
 typedef int __mikmod_typetest [
    (
         (sizeof(SBYTE)==1) && (sizeof(UBYTE)==1)
      && (sizeof(SWORD)==2) && (sizeof(UWORD)==2)
      && (sizeof(SLONG)==4) && (sizeof(ULONG)==4)
+     && (sizeof(SLONGLONG)==8)
 #ifndef _MIKMOD_AMIGA
      && (sizeof(BOOL) == sizeof(int))
 #endif
@@ -289,6 +307,14 @@ enum {
     MMERR_SNDIO_SETPARAMS,
     MMERR_SNDIO_BADPARAMS,
 
+    MMERR_MIX_VOICES,
+    MMERR_MIX_FULL,
+    MMERR_RENDER_DRIVER,
+    MMERR_RENDER_BUSY,
+    MMERR_SEEK,
+    MMERR_BAD_STATE,
+    MMERR_SPLIT,
+
     MMERR_MAX
 };
 
@@ -365,6 +391,9 @@ typedef struct MWRITER {
 /* Sample playback should not be interrupted */
 #define SFX_CRITICAL 1
 
+/* Sample_PlayPriority: voices playing at this priority are never taken over */
+#define SFX_PRIORITY_CRITICAL 255
+
 /* Sample format [loading and in-memory] flags: */
 #define SF_16BITS       0x0001
 #define SF_STEREO       0x0002
@@ -442,19 +471,20 @@ MIKMODAPI extern SAMPLE *Sample_LoadFP(FILE*);
 MIKMODAPI extern SAMPLE *Sample_LoadMem(const char *buf, int len);
 MIKMODAPI extern SAMPLE *Sample_LoadGeneric(MREADER*);
 MIKMODAPI extern void   Sample_Free(SAMPLE*);
-MIKMODAPI extern SBYTE  Sample_Play(SAMPLE*,ULONG,UBYTE);
-
-MIKMODAPI extern void   Voice_SetVolume(SBYTE,UWORD);
-MIKMODAPI extern UWORD  Voice_GetVolume(SBYTE);
-MIKMODAPI extern void   Voice_SetFrequency(SBYTE,ULONG);
-MIKMODAPI extern ULONG  Voice_GetFrequency(SBYTE);
-MIKMODAPI extern void   Voice_SetPanning(SBYTE,ULONG);
-MIKMODAPI extern ULONG  Voice_GetPanning(SBYTE);
-MIKMODAPI extern void   Voice_Play(SBYTE,SAMPLE*,ULONG);
-MIKMODAPI extern void   Voice_Stop(SBYTE);
-MIKMODAPI extern BOOL   Voice_Stopped(SBYTE);
-MIKMODAPI extern SLONG  Voice_GetPosition(SBYTE);
-MIKMODAPI extern ULONG  Voice_RealVolume(SBYTE);
+MIKMODAPI extern SWORD  Sample_Play(SAMPLE*,ULONG,UBYTE);
+MIKMODAPI extern SWORD  Sample_PlayPriority(SAMPLE*,ULONG,UBYTE);
+
+MIKMODAPI extern void   Voice_SetVolume(SWORD,UWORD);
+MIKMODAPI extern UWORD  Voice_GetVolume(SWORD);
+MIKMODAPI extern void   Voice_SetFrequency(SWORD,ULONG);
+MIKMODAPI extern ULONG  Voice_GetFrequency(SWORD);
+MIKMODAPI extern void   Voice_SetPanning(SWORD,ULONG);
+MIKMODAPI extern ULONG  Voice_GetPanning(SWORD);
+MIKMODAPI extern void   Voice_Play(SWORD,SAMPLE*,ULONG);
+MIKMODAPI extern void   Voice_Stop(SWORD);
+MIKMODAPI extern BOOL   Voice_Stopped(SWORD);
+MIKMODAPI extern SLONG  Voice_GetPosition(SWORD);
+MIKMODAPI extern ULONG  Voice_RealVolume(SWORD);
 
 /*
  *  ========== Internal module representation (UniMod)
@@ -521,10 +551,15 @@ typedef struct INSTRUMENT {
     UBYTE pitbeg;
     UBYTE pitend;
     ENVPT pitenv[ENVPOINTS];
+    /* resonant filter */
+    UBYTE filtercutoff;     /* bit 7: initial cutoff set, 0-6: cutoff */
+    UBYTE filterresonance;  /* bit 7: initial resonance set, 0-6: resonance */
 } INSTRUMENT;
 
 struct MP_CONTROL;
 struct MP_VOICE;
+struct MP_EVENTQUEUE;
+struct MP_VOICEHEAP;
 
 /*
     Module definition
@@ -558,7 +593,7 @@ typedef struct MODULE {
 
     UWORD       flags;       /* See module flags above */
     UBYTE       numchn;      /* number of module channels */
-    UBYTE       numvoices;   /* max # voices used for full NNA playback */
+    UWORD       numvoices;   /* max # voices used for full NNA playback */
     UWORD       numpos;      /* number of positions in this song */
     UWORD       numpat;      /* number of patterns in this song */
     UWORD       numins;      /* number of instruments */
@@ -567,8 +602,8 @@ typedef struct MODULE {
     struct INSTRUMENT* instruments; /* all instruments */
     struct SAMPLE*     samples;     /* all samples */
 
-    UBYTE       realchn;     /* real number of channels used */
-    UBYTE       totalchn;    /* total number of channels used (incl NNAs) */
+    UWORD       realchn;     /* real number of channels used */
+    UWORD       totalchn;    /* total number of channels used (incl NNAs) */
 
  /* playback settings */
     UWORD       reppos;      /* restart position */
@@ -615,6 +650,28 @@ typedef struct MODULE {
     UBYTE       patdly2;     /* patterndelay counter (real one) */
     SWORD       posjmp;      /* flag to indicate a jump is needed... */
     UWORD       bpmlimit;    /* threshold to detect bpm or speed values */
+
+    struct MP_EVENTQUEUE* events; /* playback event queue, or NULL */
+
+    struct MODULE* song;     /* module owning the song data, when this module
+                                is an instance made by Player_CreateInstance */
+    ULONG       refcount;    /* number of modules sharing this song data */
+
+    UWORD       voicebase;   /* first song voice used by this module */
+    ULONG       mixgain;     /* gain applied when mixed with other modules
+                                (65536 = unity) */
+
+    struct MP_VOICEHEAP* voiceheap; /* NNA voices, quietest first */
+    UWORD       bgvoices;    /* background NNA voices playing */
+    struct MP_TIMELINE*  timeline;  /* song position in output frames, and
+                                       seek checkpoints */
+    UWORD**     rowindex;    /* offset of each row in each track, or NULL */
+    struct MMAPPING* storage;/* file mapping which samples are used in place
+                                from, or NULL */
+    struct SLLAZY* lazy;     /* samples loaded when first played, or NULL */
+    UWORD       inipanning[UF_MAXCHAN]; /* panning positions when the song
+                                           starts, as 'panning' is changed
+                                           by panning effects */
 } MODULE;
 
 
@@ -628,6 +685,79 @@ typedef struct VOICEINFO {
     UBYTE       kick;         /* if true = sample has been restarted */
 } VOICEINFO;
 
+/* Playback events, as reported by Player_GetEvents */
+enum {
+    MP_EVENT_ROW = 1,   /* new row: arg1 = order, arg2 = row */
+    MP_EVENT_ORDER,     /* new order: arg1 = order, arg2 = first row */
+    MP_EVENT_JUMP,      /* position jump or pattern break: arg1 = order,
+                           arg2 = row */
+    MP_EVENT_LOOP,      /* pattern loop: arg1 = order, arg2 = row */
+    MP_EVENT_NOTE,      /* note trigger on 'channel': arg1 = note,
+                           arg2 = instrument (or sample) */
+    MP_EVENT_END        /* end of song: arg1 = restart order if the module
+                           wraps, or 0xffff if it stops */
+};
+
+typedef struct MP_EVENT {
+    SLONGLONG   frame;        /* output sample frame at which the tick that
+                                 caused the event starts, as mixed: it is
+                                 heard once the driver has played the
+                                 frames it buffers */
+    UBYTE       type;         /* MP_EVENT_xxx */
+    UBYTE       channel;      /* module channel, for MP_EVENT_NOTE */
+    UWORD       arg1;
+    UWORD       arg2;
+} MP_EVENT;
+
+/* Song timeline, as computed by Player_Analyze. Times are in milliseconds
+   from the start of the song. */
+#define MP_ROW_UNPLAYED 0xffffffffUL
+
+/* Description of a module, as returned by Player_Probe */
+typedef struct MODULEINFO {
+    CHAR*       songname;     /* name of the song */
+    CHAR*       modtype;      /* type of module, and tracker which made it */
+    CHAR*       comment;      /* module comments */
+
+    UWORD       flags;        /* See module flags above */
+    UBYTE       numchn;       /* number of module channels */
+    UWORD       numvoices;    /* max # voices used for full NNA playback */
+    UWORD       numpos;       /* number of positions in this song */
+    UWORD       numpat;       /* number of patterns in this song */
+    UWORD       numtrk;       /* number of tracks */
+    UWORD       numins;       /* number of instruments */
+    UWORD       numsmp;       /* number of samples */
+
+    UBYTE       initspeed;    /* initial song speed */
+    UWORD       inittempo;    /* initial song tempo */
+    UBYTE       initvolume;   /* initial global volume (0 - 128) */
+    ULONG       samplebytes;  /* memory the samples take once loaded in the
+                                 software mixer */
+} MODULEINFO;
+
+typedef struct MODULEANALYSIS {
+    ULONG       duration;     /* time at which the song ends or loops */
+    BOOL        loops;        /* song jumps back to a row already played */
+    UWORD       looppos;      /* position and row the song jumps back to */
+    UWORD       looprow;
+    ULONG       looptime;     /* time at which that row is first played */
+    UWORD       numpos;       /* number of song positions */
+    UWORD*      numrows;      /* number of rows at each position */
+    ULONG**     rowtime;      /* time at which each row of each position is
+                                 first played, or MP_ROW_UNPLAYED */
+} MODULEANALYSIS;
+
+/* Part of a song, as returned by Player_SplitSong. Positions are in output
+   frames from the start of the song. Rendered segments put together are
+   exactly a render of the whole song; songs are not split (MMERR_SPLIT) with
+   the reverb, the noise reduction, or DMODE_SIMDMIXER with DMODE_HQMIXER. */
+typedef struct MP_SEGMENT {
+    ULONG       start;        /* first frame of the segment */
+    ULONG       frames;       /* length of the segment */
+    ULONG       size;         /* size of the player state */
+    void*       state;        /* player state at the start of the segment */
+} MP_SEGMENT;
+
 /*
  *  ========== Module loaders
  */
@@ -672,9 +802,17 @@ MIKMODAPI extern CHAR*   Player_LoadTitle(const CHAR*);
 MIKMODAPI extern CHAR*   Player_LoadTitleFP(FILE*);
 MIKMODAPI extern CHAR*   Player_LoadTitleMem(const char *buffer,int len);
 MIKMODAPI extern CHAR*   Player_LoadTitleGeneric(MREADER*);
+MIKMODAPI extern MODULEINFO* Player_Probe(const CHAR*);
+MIKMODAPI extern MODULEINFO* Player_ProbeFP(FILE*);
+MIKMODAPI extern MODULEINFO* Player_ProbeMem(const char *buffer,int len);
+MIKMODAPI extern MODULEINFO* Player_ProbeGeneric(MREADER*);
+MIKMODAPI extern void    Player_FreeInfo(MODULEINFO*);
 
 MIKMODAPI extern void    Player_Free(MODULE*);
+MIKMODAPI extern MODULE* Player_CreateInstance(MODULE*);
 MIKMODAPI extern void    Player_Start(MODULE*);
+MIKMODAPI extern ULONG   Player_Render(MODULE*,void*,ULONG,UWORD);
+MIKMODAPI extern ULONG   Player_RenderStems(MODULE*,void*,void**,ULONG,UWORD);
 MIKMODAPI extern BOOL    Player_Active(void);
 MIKMODAPI extern void    Player_Stop(void);
 MIKMODAPI extern void    Player_TogglePause(void);
@@ -695,6 +833,22 @@ MIKMODAPI extern UWORD   Player_GetChannelPeriod(UBYTE);
 MIKMODAPI extern int     Player_QueryVoices(UWORD numvoices, VOICEINFO *vinfo);
 MIKMODAPI extern int     Player_GetRow(void);
 MIKMODAPI extern int     Player_GetOrder(void);
+MIKMODAPI extern int     Player_EnableEvents(MODULE*,int);
+MIKMODAPI extern int     Player_GetEvents(MODULE*,MP_EVENT*,int);
+MIKMODAPI extern MODULEANALYSIS* Player_Analyze(MODULE*);
+MIKMODAPI extern void    Player_FreeAnalysis(MODULEANALYSIS*);
+MIKMODAPI extern void*   Player_SaveState(MODULE*,ULONG*);
+MIKMODAPI extern int     Player_RestoreState(MODULE*,const void*,ULONG);
+MIKMODAPI extern int     Player_SetCheckpoints(MODULE*,ULONG);
+MIKMODAPI extern int     Player_Seek(MODULE*,ULONG);
+MIKMODAPI extern MP_SEGMENT* Player_SplitSong(MODULE*,int,UWORD,int*);
+MIKMODAPI extern void    Player_FreeSegments(MP_SEGMENT*,int);
+MIKMODAPI extern int     Player_StartSegment(MODULE*,const MP_SEGMENT*,UWORD);
+MIKMODAPI extern int     Player_AddToMix(MODULE*,int,int,ULONG);
+MIKMODAPI extern void    Player_RemoveFromMix(MODULE*);
+MIKMODAPI extern void    Player_SetMixVolume(MODULE*,SWORD);
+MIKMODAPI extern int     Player_FadeMix(MODULE*,SWORD,ULONG,ULONG,BOOL);
+MIKMODAPI extern int     Player_Crossfade(MODULE*,MODULE*,ULONG,ULONG);
 
 typedef void (*MikMod_player_t)(void);
 typedef void (*MikMod_callback_t)(unsigned char *data, size_t len);
@@ -733,6 +887,33 @@ enum {
 #define DMODE_REVERSE    0x0400 /* reverse stereo */
 #define DMODE_SIMDMIXER  0x0800 /* enable SIMD mixing */
 #define DMODE_NOISEREDUCTION 0x1000 /* Low pass filtering */
+#define DMODE_ADAPTIVE   0x2000 /* lower the quality when mixing is too slow */
+
+/* Adaptive mixing quality levels, from the best to the fastest */
+enum {
+    MIXQ_FULL = 0,  /* everything as requested by md_mode */
+    MIXQ_NOINTERP,  /* no interpolation (standard mixer only) */
+    MIXQ_CULL,      /* inaudible background voices are stopped */
+    MIXQ_NNACAP,    /* new notes cut their previous note when many
+                       background voices play */
+    MIXQ_MAX
+};
+
+/* Statistics of the adaptive mixing quality */
+typedef struct MIXLOAD {
+    UWORD level;               /* current level, MIXQ_xxx */
+    UWORD load;                /* average mixing time, 256 = real time */
+    ULONG buffers;             /* buffers mixed */
+    ULONG overruns;            /* buffers which took longer to mix than to
+                                  play */
+    ULONG triggered[MIXQ_MAX]; /* times each level was entered because of
+                                  the load */
+    ULONG restored;            /* times the quality went back up a level */
+} MIXLOAD;
+
+MIKMODAPI extern void MikMod_GetMixLoad(MIXLOAD*,BOOL);
+
+MIKMODAPI extern ULONG MikMod_NextTick(ULONG*,ULONG*);
 
 
 struct SAMPLOAD;
@@ -742,8 +923,8 @@ typedef struct MDRIVER {
     const CHAR* Name;
     const CHAR* Version;
 
-    UBYTE       HardVoiceLimit; /* Limit of hardware mixer voices */
-    UBYTE       SoftVoiceLimit; /* Limit of software mixer voices */
+    UWORD       HardVoiceLimit; /* Limit of hardware mixer voices */
+    UWORD       SoftVoiceLimit; /* Limit of software mixer voices */
 
     const CHAR* Alias;
     const CHAR* CmdLineHelp;
@@ -762,17 +943,17 @@ typedef struct MDRIVER {
     void        (*PlayStop)         (void);
     void        (*Update)           (void);
     void        (*Pause)            (void);
-    void        (*VoiceSetVolume)   (UBYTE,UWORD);
-    UWORD       (*VoiceGetVolume)   (UBYTE);
-    void        (*VoiceSetFrequency)(UBYTE,ULONG);
-    ULONG       (*VoiceGetFrequency)(UBYTE);
-    void        (*VoiceSetPanning)  (UBYTE,ULONG);
-    ULONG       (*VoiceGetPanning)  (UBYTE);
-    void        (*VoicePlay)        (UBYTE,SWORD,ULONG,ULONG,ULONG,ULONG,UWORD);
-    void        (*VoiceStop)        (UBYTE);
-    BOOL        (*VoiceStopped)     (UBYTE);
-    SLONG       (*VoiceGetPosition) (UBYTE);
-    ULONG       (*VoiceRealVolume)  (UBYTE);
+    void        (*VoiceSetVolume)   (UWORD,UWORD);
+    UWORD       (*VoiceGetVolume)   (UWORD);
+    void        (*VoiceSetFrequency)(UWORD,ULONG);
+    ULONG       (*VoiceGetFrequency)(UWORD);
+    void        (*VoiceSetPanning)  (UWORD,ULONG);
+    ULONG       (*VoiceGetPanning)  (UWORD);
+    void        (*VoicePlay)        (UWORD,SWORD,ULONG,ULONG,ULONG,ULONG,UWORD);
+    void        (*VoiceStop)        (UWORD);
+    BOOL        (*VoiceStopped)     (UWORD);
+    SLONG       (*VoiceGetPosition) (UWORD);
+    ULONG       (*VoiceRealVolume)  (UWORD);
 } MDRIVER;
 
 /* These variables can be changed at ANY time and results will be immediate */
@@ -790,6 +971,26 @@ MIKMODAPI extern UWORD md_device;      /* device */
 MIKMODAPI extern UWORD md_mixfreq;     /* mixing frequency */
 MIKMODAPI extern UWORD md_mode;        /* mode. See DMODE_? flags above */
 
+/* Number of threads decoding compressed samples when a module is loaded from
+   memory or from a file by name; 0 or 1 decodes them while they are loaded. */
+MIKMODAPI extern UBYTE md_loadthreads;
+
+/* When set, modules loaded from a file by name load their samples when they
+   are first played, and decode the samples of the next md_prefetchorders
+   orders in the background where threads are available. */
+MIKMODAPI extern UBYTE md_lazysamples;
+MIKMODAPI extern UBYTE md_prefetchorders;
+
+/* When set, the software mixer plays the 16 bit samples of modules loaded
+   from a file by name from the file mapping, instead of copying them. The
+   file must then not be changed while the module is loaded. */
+MIKMODAPI extern UBYTE md_mapsamples;
+
+/* When set, modules loaded from a file by name are kept in this directory,
+   parsed and with their samples decoded, and loaded from there the next time
+   the same file is loaded. */
+MIKMODAPI extern const CHAR* md_cachedir;
+
 /* The following variable should not be changed! */
 MIKMODAPI extern MDRIVER* md_driver;   /* Current driver in use. */
 
@@ -846,6 +1047,7 @@ MIKMODAPI extern int   VC_Init(void);
 MIKMODAPI extern void  VC_Exit(void);
 MIKMODAPI extern void  VC_SetCallback(MikMod_callback_t callback);
 MIKMODAPI extern int   VC_SetNumVoices(void);
+MIKMODAPI extern void  VC_SetFormat(UWORD);
 MIKMODAPI extern ULONG VC_SampleSpace(int);
 MIKMODAPI extern ULONG VC_SampleLength(int,SAMPLE*);
 
@@ -858,18 +1060,18 @@ MIKMODAPI extern void  VC_SampleUnload(SWORD);
 MIKMODAPI extern ULONG VC_WriteBytes(SBYTE*,ULONG);
 MIKMODAPI extern ULONG VC_SilenceBytes(SBYTE*,ULONG);
 
-MIKMODAPI extern void  VC_VoiceSetVolume(UBYTE,UWORD);
-MIKMODAPI extern UWORD VC_VoiceGetVolume(UBYTE);
-MIKMODAPI extern void  VC_VoiceSetFrequency(UBYTE,ULONG);
-MIKMODAPI extern ULONG VC_VoiceGetFrequency(UBYTE);
-MIKMODAPI extern void  VC_VoiceSetPanning(UBYTE,ULONG);
-MIKMODAPI extern ULONG VC_VoiceGetPanning(UBYTE);
-MIKMODAPI extern void  VC_VoicePlay(UBYTE,SWORD,ULONG,ULONG,ULONG,ULONG,UWORD);
-
-MIKMODAPI extern void  VC_VoiceStop(UBYTE);
-MIKMODAPI extern BOOL  VC_VoiceStopped(UBYTE);
-MIKMODAPI extern SLONG VC_VoiceGetPosition(UBYTE);
-MIKMODAPI extern ULONG VC_VoiceRealVolume(UBYTE);
+MIKMODAPI extern void  VC_VoiceSetVolume(UWORD,UWORD);
+MIKMODAPI extern UWORD VC_VoiceGetVolume(UWORD);
+MIKMODAPI extern void  VC_VoiceSetFrequency(UWORD,ULONG);
+MIKMODAPI extern ULONG VC_VoiceGetFrequency(UWORD);
+MIKMODAPI extern void  VC_VoiceSetPanning(UWORD,ULONG);
+MIKMODAPI extern ULONG VC_VoiceGetPanning(UWORD);
+MIKMODAPI extern void  VC_VoicePlay(UWORD,SWORD,ULONG,ULONG,ULONG,ULONG,UWORD);
+
+MIKMODAPI extern void  VC_VoiceStop(UWORD);
+MIKMODAPI extern BOOL  VC_VoiceStopped(UWORD);
+MIKMODAPI extern SLONG VC_VoiceGetPosition(UWORD);
+MIKMODAPI extern ULONG VC_VoiceRealVolume(UWORD);
 
 #ifdef __cplusplus
 }
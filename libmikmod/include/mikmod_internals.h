@@ -50,25 +50,12 @@ extern "C" {
 
 /*========== More type definitions */
 
-/* SLONGLONG: 64bit, signed */
-#if !defined(_WIN32) && \
-   (defined(_LP64) || defined(__LP64__) || defined(__arch64__) || defined(__alpha) || defined(__x64_64) || defined(__powerpc64__))
-typedef long            SLONGLONG;
+/* SLONGLONG: 64bit, signed, is defined in mikmod.h */
+#if (!defined(_WIN32) && \
+   (defined(_LP64) || defined(__LP64__) || defined(__arch64__) || defined(__alpha) || defined(__x64_64) || defined(__powerpc64__))) || \
+    defined(_WIN64) /* win64 is LLP64, not LP64  */
 #define NATIVE_64BIT_INT
-#elif defined(_WIN64) /* win64 is LLP64, not LP64  */
-#define NATIVE_64BIT_INT
-typedef long long       SLONGLONG;
-#elif defined(__WATCOMC__)
-typedef __int64         SLONGLONG;
-#elif defined(_WIN32) && !defined(__MWERKS__)
-typedef LONGLONG        SLONGLONG;
-#elif defined(macintosh) && !TYPE_LONGLONG
-#include <Types.h>
-typedef SInt64          SLONGLONG;
-#else
-typedef long long       SLONGLONG;
 #endif
-typedef int __s64_typetest [(sizeof(SLONGLONG)==8) * 2 - 1];
 
 /* pointer-sized signed int (ssize_t/intptr_t) : */
 #if defined(_WIN64) /* win64 is LLP64, not LP64  */
@@ -126,6 +113,7 @@ extern MikMod_handler_t _mm_errorhandler;
 
 DECLARE_MUTEX(lists);
 DECLARE_MUTEX(vars);
+DECLARE_MUTEX(events);
 
 /*========== Replacement funcs */
 
@@ -137,19 +125,59 @@ extern MREADER* _mm_new_mem_reader(const void *buffer, long len);
 extern void _mm_delete_mem_reader(MREADER *reader);
 
 extern MREADER* _mm_new_file_reader(FILE* fp);
-extern void _mm_delete_file_reader(MREADER*);
+extern BOOL _mm_delete_file_reader(MREADER*);
+
+/* A file mapped in memory. Samples may be used in place from it, for as long
+   as the module they belong to keeps a reference to the mapping. */
+typedef struct MMAPPING MMAPPING;
+
+extern MREADER* _mm_new_map_reader(const CHAR *filename);
+extern void _mm_delete_map_reader(MREADER*);
+extern void* _mm_reader_storage(MREADER*,size_t size,size_t align);
+extern MMAPPING* _mm_reader_mapping(MREADER*);
+extern MREADER* _mm_reader_view(MREADER*);
+extern MMAPPING* _mm_map_retain(MREADER*);
+extern void _mm_map_release(MMAPPING*);
+
+/* A reader of packed data, unpacked as it is read */
+typedef struct MUNPACKER MUNPACKER;
+
+extern MREADER* _mm_new_unpack_reader(MREADER*,const MUNPACKER*);
+extern void _mm_delete_unpack_reader(MREADER*);
 
 extern MWRITER* _mm_new_file_writer(FILE *fp);
 extern void _mm_delete_file_writer(MWRITER*);
 
 extern BOOL _mm_FileExists(const CHAR *fname);
+extern BOOL _mm_file_key(const CHAR *fname,CHAR *key,size_t size);
 
 #define _mm_write_SBYTE(x,y)    y->Put(y,(int)x)
 #define _mm_write_UBYTE(x,y)    y->Put(y,(int)x)
 
-#define _mm_read_SBYTE(x)       (SBYTE)x->Get(x)
-#define _mm_read_UBYTE(x)       (UBYTE)x->Get(x)
-#define _mm_skip_BYTE(x)        (void)x->Get(x)
+/* The library readers keep the bytes following the current position in a
+   window, which the inline reads below take directly, only going through
+   the reader functions when the window runs out. Readers provided by the
+   application are told apart by their Get function. */
+typedef struct MBUFREADER {
+    MREADER core;
+    const UBYTE *ptr;   /* next byte of the window */
+    const UBYTE *end;   /* end of the window */
+    BOOL (*Fill)(struct MBUFREADER*); /* refills an empty window, returns 0
+                                         at the end of the data */
+} MBUFREADER;
+
+extern int _mm_BufReader_Get(MREADER*);
+
+#define _mm_window(x,n)         ((x)->Get==&_mm_BufReader_Get && \
+                                 ((MBUFREADER*)(x))->end- \
+                                 ((MBUFREADER*)(x))->ptr>=(n))
+#define _mm_wbyte(x,n,i)        (((MBUFREADER*)(x))->ptr[(i)-(n)])
+#define _mm_wskip(x,n)          (((MBUFREADER*)(x))->ptr+=(n))
+
+#define _mm_read_UBYTE(x)       (UBYTE)(_mm_window(x,1)? \
+                                 *((MBUFREADER*)(x))->ptr++:(x)->Get(x))
+#define _mm_read_SBYTE(x)       (SBYTE)_mm_read_UBYTE(x)
+#define _mm_skip_BYTE(x)        (void)_mm_read_UBYTE(x)
 
 #define _mm_write_SBYTES(x,y,z) z->Write(z,(const void *)x,y)
 #define _mm_write_UBYTES(x,y,z) z->Write(z,(const void *)x,y)
@@ -189,6 +217,30 @@ extern BOOL _mm_read_I_SLONGS(SLONG*,int,MREADER*);
 extern BOOL _mm_read_M_ULONGS(ULONG*,int,MREADER*);
 extern BOOL _mm_read_I_ULONGS(ULONG*,int,MREADER*);
 
+/* The functions above also handle the end of the window and other readers */
+#define _mm_read_I_UWORD(x)     (_mm_window(x,2)?(_mm_wskip(x,2), \
+                                 (UWORD)(_mm_wbyte(x,2,0)| \
+                                 (_mm_wbyte(x,2,1)<<8))):_mm_read_I_UWORD(x))
+#define _mm_read_M_UWORD(x)     (_mm_window(x,2)?(_mm_wskip(x,2), \
+                                 (UWORD)((_mm_wbyte(x,2,0)<<8)| \
+                                 _mm_wbyte(x,2,1))):_mm_read_M_UWORD(x))
+#define _mm_read_I_ULONG(x)     (_mm_window(x,4)?(_mm_wskip(x,4), \
+                                 (ULONG)_mm_wbyte(x,4,0)| \
+                                 ((ULONG)_mm_wbyte(x,4,1)<<8)| \
+                                 ((ULONG)_mm_wbyte(x,4,2)<<16)| \
+                                 ((ULONG)_mm_wbyte(x,4,3)<<24)): \
+                                 _mm_read_I_ULONG(x))
+#define _mm_read_M_ULONG(x)     (_mm_window(x,4)?(_mm_wskip(x,4), \
+                                 ((ULONG)_mm_wbyte(x,4,0)<<24)| \
+                                 ((ULONG)_mm_wbyte(x,4,1)<<16)| \
+                                 ((ULONG)_mm_wbyte(x,4,2)<<8)| \
+                                 (ULONG)_mm_wbyte(x,4,3)): \
+                                 _mm_read_M_ULONG(x))
+#define _mm_read_I_SWORD(x)     (SWORD)_mm_read_I_UWORD(x)
+#define _mm_read_M_SWORD(x)     (SWORD)_mm_read_M_UWORD(x)
+#define _mm_read_I_SLONG(x)     (SLONG)_mm_read_I_ULONG(x)
+#define _mm_read_M_SLONG(x)     (SLONG)_mm_read_M_ULONG(x)
+
 extern void _mm_write_M_SWORD(SWORD,MWRITER*);
 extern void _mm_write_I_SWORD(SWORD,MWRITER*);
 extern void _mm_write_M_UWORD(UWORD,MWRITER*);
@@ -226,6 +278,8 @@ typedef struct SAMPLOAD {
     int      scalefactor;
     SAMPLE*  sample;
     MREADER* reader;
+    SWORD*   decoded;      /* sample decoded ahead, or NULL */
+    long     decodedpos;   /* reader position after the sample */
 } SAMPLOAD;
 
 /*========== Sample and waves loading interface */
@@ -238,6 +292,18 @@ extern void      SL_SampleUnsigned(SAMPLOAD*);
 extern int       SL_LoadSamples(void);
 extern SAMPLOAD* SL_RegisterSample(SAMPLE*,int,MREADER*);
 extern int       SL_Load(void*,SAMPLOAD*,ULONG);
+extern void*     SL_Borrow(SAMPLOAD*,ULONG);
+extern int       SL_DecodeSamples(void);
+extern SWORD*    SL_Decoded(SAMPLE*,UWORD*);
+
+/* Samples of a module loaded when they are first played */
+typedef struct SLLAZY SLLAZY;
+
+extern SLLAZY*   SL_DeferSamples(MREADER*,SAMPLE*,int);
+extern void      SL_LoadLazy(SLLAZY*,SAMPLE*,BOOL);
+extern void      SL_PrefetchLazy(SLLAZY*,SAMPLE*);
+extern int       SL_PrefetchPosition(SLLAZY*,int);
+extern void      SL_FreeLazy(SLLAZY*);
 extern BOOL      SL_Init(SAMPLOAD*);
 extern void      SL_Exit(SAMPLOAD*);
 
@@ -250,6 +316,9 @@ extern void   UniSetRow(UBYTE*);
 extern UBYTE  UniGetByte(void);
 extern UWORD  UniGetWord(void);
 extern UBYTE* UniFindRow(UBYTE*,UWORD);
+extern BOOL   UniIsRowStart(UBYTE*,ULONG);
+extern UWORD** UniIndexTracks(UBYTE**,UWORD);
+extern UBYTE* UniFindIndexedRow(UBYTE*,const UWORD*,UWORD);
 extern void   UniSkipOpcode(void);
 extern void   UniReset(void);
 extern void   UniWriteByte(UBYTE);
@@ -471,6 +540,15 @@ typedef struct ENVPR {
     UWORD  a;       /* envelope index a */
     UWORD  b;       /* envelope index b */
     ENVPT* env;     /* envelope points */
+    /* interpolation between points ia and ib at tick ip, kept to step to the
+       next tick without a division */
+    UWORD  ia;
+    UWORD  ib;
+    SWORD  ip;
+    ULONG  iq;      /* distance from the value of point ia */
+    ULONG  ir;      /* remainder of iq */
+    ULONG  sq;      /* step of iq per tick */
+    ULONG  sr;      /* step of ir per tick */
 } ENVPR;
 
 typedef struct MP_CHANNEL {
@@ -495,6 +573,8 @@ typedef struct MP_CHANNEL {
     SWORD  handle;      /* which sample-handle */
     UBYTE  notedelay;   /* (used for note delay) */
     SLONG  start;       /* The starting byte index in the sample */
+    UBYTE  cutoff;      /* resonant filter cutoff, 127 = open */
+    UBYTE  resonance;   /* resonant filter resonance */
 } MP_CHANNEL;
 
 typedef struct MP_CONTROL {
@@ -502,7 +582,7 @@ typedef struct MP_CONTROL {
 
     struct MP_VOICE*    slave;  /* Audio Slave of current effects control channel */
 
-    UBYTE   slavechn;   /* Audio Slave of current effects control channel */
+    UWORD   slavechn;   /* Audio Slave of current effects control channel */
     UBYTE   muted;      /* if set, channel not played */
     UWORD   ultoffset;  /* fine sample offset memory */
     UBYTE   anote;      /* the note that indexes the audible */
@@ -512,6 +592,7 @@ typedef struct MP_CONTROL {
     UBYTE   dca;        /* duplicate check action */
     UBYTE   dct;        /* duplicate check type */
     UBYTE*  row;        /* row currently playing on this channel */
+    UWORD   rowtrk;     /* track 'row' belongs to */
     SBYTE   retrig;     /* retrig value (0 means don't retrig) */
     ULONG   speed;      /* what finetune to use */
     SWORD   volume;     /* amiga volume (0 t/m 64) to play the sample at */
@@ -594,16 +675,31 @@ typedef struct MP_VOICE {
     UWORD   aswppos;    /* autovibrato sweep pos */
 
     ULONG   totalvol;   /* total volume of channel (before global mixings) */
+    ULONG   mixvol;     /* volume set at the last tick, before the mix gain */
 
     BOOL    mflag;
+    BOOL    background; /* playing without a master, counted in bgvoices */
     SWORD   masterchn;
     UWORD   masterperiod;
 
+    UWORD   freqperiod; /* period 'frequency' was computed for */
+    ULONG   frequency;
+
     MP_CONTROL* master; /* index of "master" effects channel */
 } MP_VOICE;
 
 /*========== Loaders */
 
+/* Bytes every module of a format holds at a given offset */
+typedef struct MLOADERSIG {
+    UWORD       offset;
+    UWORD       length;
+    const char* magic;
+} MLOADERSIG;
+
+/* size of the module header signatures are looked for in */
+#define ML_HEADERSIZE 1084
+
 typedef struct MLOADER {
     struct MLOADER*     next;
     const CHAR* type;
@@ -613,6 +709,9 @@ typedef struct MLOADER {
     BOOL  (*Load)(BOOL);
     void  (*Cleanup)(void);
     CHAR* (*LoadTitle)(void);
+    /* signatures ended by a zero length one, one of which a module must hold
+       for Test() to be called, or NULL to always call Test() */
+    const MLOADERSIG* signatures;
 } MLOADER;
 
 /* internal loader variables */
@@ -665,43 +764,100 @@ extern ULONG  getfrequency(UWORD,ULONG);
 #define STM_NTRACKERS   3
 extern const CHAR *STM_Signatures[STM_NTRACKERS];
 
+/* UN07 modules, written by the module cache. The version of their layout
+   and the byte order of their samples are part of their header: a cache file
+   which doesn't match the library is a miss. */
+#define UNI_CACHELAYOUT 1
+#ifdef WORDS_BIGENDIAN
+#define UNI_CACHEORDER  'B'
+#else
+#define UNI_CACHEORDER  'L'
+#endif
+extern BOOL   UNI_Write(MWRITER*,const CHAR*,MODULE*);
+extern BOOL   UNI_IsCache(MREADER*,const CHAR*);
+
 /*========== Player interface */
 
 extern int    Player_Init(MODULE*);
 extern void   Player_Exit(MODULE*);
 extern void   Player_HandleTick(void);
+extern void   Player_VoiceEnded(SWORD);
 
 /*========== UnPackers */
 
-typedef BOOL (*MUNPACKER) (struct MREADER*,
-                           void** /* unpacked data out */ ,
-                           long* /* unpacked data size */ );
-extern BOOL PP20_Unpack(MREADER*, void**, long*);
-extern BOOL MMCMP_Unpack(MREADER*, void**, long*);
-extern BOOL XPK_Unpack(MREADER*, void**, long*);
-extern BOOL S404_Unpack(MREADER*, void**, long*);
+/* A depacker recognizes packed data from its header, and unpacks it on
+   demand. Open returns the state of the unpacking of the data in a reader,
+   and sets the unpacked size, or returns NULL if the data isn't in its
+   format. Unpack makes at least the first 'wanted' bytes of the unpacked data
+   valid, and returns how many are, or -1 on error. */
+struct MUNPACKER {
+    void* (*Open)(MREADER*,long*);
+    long  (*Unpack)(void*,UBYTE*,long);
+    void  (*Close)(void*);
+    long  slack;        /* bytes it may write past the end of the data */
+};
+
+extern const MUNPACKER PP20_Unpacker;
+extern const MUNPACKER MMCMP_Unpacker;
+extern const MUNPACKER XPK_Unpacker;
+extern const MUNPACKER S404_Unpacker;
 
 /*========== Drivers */
 
 /* max. number of handles a driver has to provide. (not strict) */
 #define MAXSAMPLEHANDLES    384
 
+/* max. number of voices the software mixers can handle. */
+#define MAXSOFTVOICES       4096
+
 /* These variables can be changed at ANY time and results will be immediate */
 extern UWORD md_bpm;         /* current song / hardware BPM rate */
 
 /* Variables below can be changed via MD_SetNumVoices at any time. However, a
    call to MD_SetNumVoicess while the driver is active will cause the sound to
    skip slightly. */
-extern UBYTE md_numchn;      /* number of song + sound effects voices */
-extern UBYTE md_sngchn;      /* number of song voices */
-extern UBYTE md_sfxchn;      /* number of sound effects voices */
-extern UBYTE md_hardchn;     /* number of hardware mixed voices */
-extern UBYTE md_softchn;     /* number of software mixed voices */
+extern UWORD md_numchn;      /* number of song + sound effects voices */
+extern UWORD md_sngchn;      /* number of song voices */
+extern UWORD md_sfxchn;      /* number of sound effects voices */
+extern UWORD md_hardchn;     /* number of hardware mixed voices */
+extern UWORD md_softchn;     /* number of software mixed voices */
+
+/* Number of sample frames produced by the software mixer since playback
+   started. When the mixer calls md_player, this is the frame at which the
+   new tick starts. */
+extern SLONGLONG md_framepos;
+
+/* Frame at which the software mixer calls md_player next. If md_player
+   leaves it behind md_framepos, the mixer schedules the next call one tick
+   (derived from md_bpm) later. */
+extern SLONGLONG md_tickpos;
+
+/* Part of a frame by which a tick falls after the frame it is played at, in
+   1/den frame units. Carried from tick to tick so that the tick grid does not
+   drift from the tempo. */
+typedef struct MD_TICKFRAC {
+	ULONG rem;
+	ULONG den;
+} MD_TICKFRAC;
+
+/* Fraction of md_tickpos */
+extern MD_TICKFRAC md_tickfrac;
+
+/* Returns the length in frames of the next tick at tempo 'bpm', carrying the
+   fraction of a frame left over in 'frac'. It divides once per tick, for all
+   the voices. */
+extern ULONG MD_TickLength(ULONG bpm,MD_TICKFRAC *frac);
 
 /* This is for use by the hardware drivers only.  It points to the registered
    tickhandler function. */
 extern MikMod_player_t md_player;
 
+/* Current adaptive mixing quality level (MIXQ_xxx), MIXQ_FULL unless
+   DMODE_ADAPTIVE is set and mixing can't keep up */
+extern UBYTE md_mixquality;
+extern ULONG MD_MixClock(void);
+extern void  MD_MixLoad(ULONG,ULONG);
+
 extern SWORD  MD_SampleLoad(SAMPLOAD*,int);
 extern void   MD_SampleUnload(SWORD);
 extern ULONG  MD_SampleSpace(int);
@@ -713,10 +869,46 @@ extern void unsignedtoulaw(char *,int);
 /* Parameter extraction helper */
 extern CHAR  *MD_GetAtom(const CHAR*, const CHAR*, BOOL);
 
+/* Voice allocation: the voices of a pool are kept in a binary min-heap on
+   their stealing key, so the voice to use next is always at the top. Voices
+   with equal keys are taken in ascending order. */
+typedef struct MP_VOICEHEAP {
+    int     numvoices;
+    int*    heap;       /* voice numbers, in heap order */
+    int*    pos;        /* heap position of each voice */
+    ULONG*  key;        /* stealing key of each voice, lowest goes first */
+    BOOL    swept;      /* keys of stopped voices are up to date */
+} MP_VOICEHEAP;
+
+#define VOICEKEY_BUSY 0xffffffffUL /* voice can not be taken over */
+
+extern MP_VOICEHEAP* VoiceHeap_New(int);
+extern void VoiceHeap_Free(MP_VOICEHEAP*);
+extern void VoiceHeap_Update(MP_VOICEHEAP*,int,ULONG);
+#define VoiceHeap_Top(h) ((h)->heap[0])
+
+/* The software mixer calls MD_VoiceEnded when a voice stops playing; voices
+   played by other drivers have to be polled. */
+extern void MD_VoiceEnded(SWORD);
+#define MD_POLLVOICES (md_driver->VoicePlay!=VC_VoicePlay)
+
 /* Internal software mixer stuff */
 extern void VC_SetupPointers(void);
 extern int  VC1_Init(void);
 extern int  VC2_Init(void);
+extern ULONG VC_VoiceStateSize(void);
+extern void VC_VoiceSaveState(UWORD,void*);
+extern void VC_VoiceLoadState(UWORD,const void*);
+extern BOOL VC_VoiceCheckState(const void*,SAMPLE*);
+extern void VC_VoiceReset(UWORD);
+extern void VC_SkipSamples(ULONG);
+extern int  VC_SetStems(int);
+extern void VC_VoiceSetStem(UWORD,SWORD);
+extern void VC_WriteStems(SBYTE*,SBYTE**,ULONG);
+extern void VC_VoiceSetFilter(UWORD,UBYTE,UBYTE);
+
+/* Output format bits the software mixer can change without reinitializing */
+#define DMODE_FORMATMASK (DMODE_16BITS|DMODE_FLOAT|DMODE_STEREO)
 
 #if (MIKMOD_UNIX)
 /* POSIX helper functions */
@@ -735,18 +927,27 @@ extern void _mm_registerloader(struct MLOADER*);
 extern BOOL MikMod_Active_internal(void);
 extern void MikMod_DisableOutput_internal(void);
 extern int  MikMod_EnableOutput_internal(void);
+extern int  MikMod_StartRender_internal(UWORD);
+extern int  MikMod_FrameSize_internal(void);
 extern void MikMod_Exit_internal(void);
 extern int  MikMod_SetNumVoices_internal(int,int);
 extern void Player_Exit_internal(MODULE*);
 extern void Player_Stop_internal(void);
 extern BOOL Player_Paused_internal(void);
 extern void Sample_Free_internal(SAMPLE*);
-extern void Voice_Play_internal(SBYTE,SAMPLE*,ULONG);
-extern void Voice_SetFrequency_internal(SBYTE,ULONG);
-extern void Voice_SetPanning_internal(SBYTE,ULONG);
-extern void Voice_SetVolume_internal(SBYTE,UWORD);
-extern void Voice_Stop_internal(SBYTE);
-extern BOOL Voice_Stopped_internal(SBYTE);
+extern void Voice_Play_internal(SWORD,SAMPLE*,ULONG);
+extern ULONG Voice_StateSize_internal(void);
+extern void Voice_SaveState_internal(SWORD,void*);
+extern void Voice_LoadState_internal(SWORD,const void*,SAMPLE*);
+extern BOOL Voice_CheckState_internal(const void*,SAMPLE*);
+extern void Voice_SetFrequency_internal(SWORD,ULONG);
+extern void Voice_SetPanning_internal(SWORD,ULONG);
+extern void Voice_SetFilter_internal(SWORD,UBYTE,UBYTE);
+extern ULONG Voice_RealVolume_internal(SWORD);
+extern void Voice_SetVolume_internal(SWORD,UWORD);
+extern void Voice_Stop_internal(SWORD);
+extern void Voice_Reset_internal(SWORD);
+extern BOOL Voice_Stopped_internal(SWORD);
 
 extern int   VC1_PlayStart(void);
 extern int   VC2_PlayStart(void);
@@ -756,6 +957,9 @@ extern int  VC1_SetNumVoices(void);
 extern int  VC2_SetNumVoices(void);
 
 extern MikMod_callback_t vc_callback;
+/* set while a song is played silently, to seek or split it: the mixers leave
+   the sound effects voices as they are */
+extern BOOL vc_sfxhold;
 
 #ifdef __cplusplus
 }
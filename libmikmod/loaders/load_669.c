@@ -355,6 +355,12 @@ static CHAR *S69_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG S69_Magic[]={
+	{0,2,"if"},
+	{0,2,"JN"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_669={
 	NULL,
 	"669",
@@ -363,7 +369,8 @@ MIKMODAPI MLOADER load_669={
 	S69_Test,
 	S69_Load,
 	S69_Cleanup,
-	S69_LoadTitle
+	S69_LoadTitle,
+	S69_Magic
 };
 
 /* ex:set ts=4: */
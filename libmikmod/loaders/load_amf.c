@@ -678,6 +678,11 @@ static CHAR *AMF_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG AMF_Magic[]={
+	{0,3,"AMF"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_amf={
 	NULL,
 	"AMF",
@@ -686,7 +691,8 @@ MIKMODAPI MLOADER load_amf={
 	AMF_Test,
 	AMF_Load,
 	AMF_Cleanup,
-	AMF_LoadTitle
+	AMF_LoadTitle,
+	AMF_Magic
 };
 
 /* ex:set ts=4: */
@@ -409,6 +409,11 @@ static CHAR *ASY_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG ASY_Magic[] = {
+	{0,24,"ASYLUM Music Format V1.0"},
+	{0,0,NULL}
+};
+
 MLOADER load_asy = {
 	NULL,
 	"AMF",
@@ -417,7 +422,8 @@ MLOADER load_asy = {
 	ASY_Test,
 	ASY_Load,
 	ASY_Cleanup,
-	ASY_LoadTitle
+	ASY_LoadTitle,
+	ASY_Magic
 };
 
 /* ex:set ts=4: */
@@ -356,6 +356,11 @@ static CHAR *DSM_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG DSM_Magic[]={
+	{8,4,"DSMF"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_dsm={
 	NULL,
 	"DSM",
@@ -364,7 +369,8 @@ MIKMODAPI MLOADER load_dsm={
 	DSM_Test,
 	DSM_Load,
 	DSM_Cleanup,
-	DSM_LoadTitle
+	DSM_LoadTitle,
+	DSM_Magic
 };
 
 
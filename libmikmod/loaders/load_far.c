@@ -395,6 +395,11 @@ static CHAR *FAR_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG FAR_Magic[]={
+	{0,4,"FAR\xfe"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_far={
 	NULL,
 	"FAR",
@@ -403,7 +408,8 @@ MIKMODAPI MLOADER load_far={
 	FAR_Test,
 	FAR_Load,
 	FAR_Cleanup,
-	FAR_LoadTitle
+	FAR_LoadTitle,
+	FAR_Magic
 };
 
 /* ex:set ts=4: */
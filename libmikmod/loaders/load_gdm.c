@@ -546,6 +546,11 @@ static CHAR *GDM_LoadTitle(void)
 	return DupStr(s,28,0);
 }
 
+static const MLOADERSIG GDM_Magic[]={
+	{0,4,"GDM\xfe"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_gdm=
 {
 	NULL,
@@ -555,7 +560,8 @@ MIKMODAPI MLOADER load_gdm=
 	GDM_Test,
 	GDM_Load,
 	GDM_Cleanup,
-	GDM_LoadTitle
+	GDM_LoadTitle,
+	GDM_Magic
 };
 
 /* ex:set ts=4: */
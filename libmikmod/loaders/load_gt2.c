@@ -418,6 +418,11 @@ static CHAR *GT2_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG GT2_Magic[] = {
+	{0,3,"GT2"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_gt2 = {
 	NULL,
 	"GT2",
@@ -426,7 +431,8 @@ MIKMODAPI MLOADER load_gt2 = {
 	GT2_Test,
 	GT2_Load,
 	GT2_Cleanup,
-	GT2_LoadTitle
+	GT2_LoadTitle,
+	GT2_Magic
 };
 
 /* ex:set ts=8: */
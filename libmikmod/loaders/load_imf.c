@@ -757,6 +757,11 @@ static CHAR *IMF_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG IMF_Magic[]={
+	{0x3c,4,"IM10"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_imf={
 	NULL,
 	"IMF",
@@ -765,7 +770,8 @@ MIKMODAPI MLOADER load_imf={
 	IMF_Test,
 	IMF_Load,
 	IMF_Cleanup,
-	IMF_LoadTitle
+	IMF_LoadTitle,
+	IMF_Magic
 };
 
 /* ex:set ts=4: */
@@ -138,7 +138,9 @@ typedef struct ITINSTHEADER {
 	UBYTE	rpanvar;		/* random panning varations */
 	UWORD	numsmp;			/* Number of samples in instrument [files only] */
 	CHAR	name[26];		/* Instrument name */
-	UBYTE	blank01[6];
+	UBYTE	ifc;			/* Initial filter cutoff */
+	UBYTE	ifr;			/* Initial filter resonance */
+	UBYTE	blank01[4];
 	UWORD	samptable[ITNOTECNT];/* sample for each note [note / samp pairs] */
 	UBYTE	volenv[200];	     /* volume envelope (IT 1.x stuff) */
 	UBYTE	oldvoltick[ITENVCNT];/* volume tick position (IT 1.x stuff) */
@@ -757,7 +759,9 @@ static BOOL IT_Load(BOOL curious)
 			ih.numsmp    = _mm_read_UBYTE(modreader);
 			_mm_skip_BYTE(modreader);
 			_mm_read_string(ih.name,26,modreader);
-			_mm_read_UBYTES(ih.blank01,6,modreader);
+			ih.ifc       = _mm_read_UBYTE(modreader);
+			ih.ifr       = _mm_read_UBYTE(modreader);
+			_mm_read_UBYTES(ih.blank01,4,modreader);
 			_mm_read_I_UWORDS(ih.samptable,ITNOTECNT,modreader);
 			if(mh->cwt<0x200) {
 				/* load IT 1xx volume envelope */
@@ -859,6 +863,8 @@ static BOOL IT_Load(BOOL curious)
 					d->rvolvar = ih.rvolvar;
 					d->rpanvar = ih.rpanvar;
 				}
+				d->filtercutoff   =ih.ifc;
+				d->filterresonance=ih.ifr;
 
 #if defined __STDC__ || defined _MSC_VER || defined __WATCOMC__ || defined MPW_C
 #define IT_ProcessEnvelope(name) 										\
@@ -1026,6 +1032,11 @@ static CHAR *IT_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG IT_Magic[]={
+	{0,4,"IMPM"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_it={
 	NULL,
 	"IT",
@@ -1034,7 +1045,8 @@ MIKMODAPI MLOADER load_it={
 	IT_Test,
 	IT_Load,
 	IT_Cleanup,
-	IT_LoadTitle
+	IT_LoadTitle,
+	IT_Magic
 };
 
 /* ex:set ts=4: */
@@ -500,7 +500,8 @@ MIKMODAPI MLOADER load_m15={
 	M15_Test,
 	M15_Load,
 	M15_Cleanup,
-	M15_LoadTitle
+	M15_LoadTitle,
+	NULL	/* no signature, Test() decides */
 };
 
 /* ex:set ts=4: */
@@ -911,6 +911,12 @@ static CHAR *MED_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG MED_Magic[] = {
+	{0,4,"MMD0"},
+	{0,4,"MMD1"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_med = {
 	NULL,
 	"MED",
@@ -919,7 +925,8 @@ MIKMODAPI MLOADER load_med = {
 	MED_Test,
 	MED_Load,
 	MED_Cleanup,
-	MED_LoadTitle
+	MED_LoadTitle,
+	MED_Magic
 };
 
 /* ex:set ts=4: */
@@ -591,7 +591,8 @@ MIKMODAPI MLOADER load_mod = {
 	MOD_Test,
 	MOD_Load,
 	MOD_Cleanup,
-	MOD_LoadTitle
+	MOD_LoadTitle,
+	NULL	/* no signature, Test() decides */
 };
 
 /* ex:set ts=4: */
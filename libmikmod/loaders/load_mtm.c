@@ -279,6 +279,11 @@ static CHAR *MTM_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG MTM_Magic[]={
+	{0,3,"MTM"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_mtm={
 	NULL,
 	"MTM",
@@ -287,7 +292,8 @@ MIKMODAPI MLOADER load_mtm={
 	MTM_Test,
 	MTM_Load,
 	MTM_Cleanup,
-	MTM_LoadTitle
+	MTM_LoadTitle,
+	MTM_Magic
 };
 
 /* ex:set ts=4: */
@@ -447,6 +447,11 @@ static CHAR *OKT_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG OKT_Magic[] = {
+	{0,8,"OKTASONG"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_okt = {
 	NULL,
 	"OKT",
@@ -455,7 +460,8 @@ MIKMODAPI MLOADER load_okt = {
 	OKT_Test,
 	OKT_Load,
 	NULL,
-	OKT_LoadTitle
+	OKT_LoadTitle,
+	OKT_Magic
 };
 
 /* ex:set ts=4: */
@@ -467,6 +467,11 @@ static CHAR *S3M_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG S3M_Magic[]={
+	{0x2c,4,"SCRM"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_s3m={
 	NULL,
 	"S3M",
@@ -475,7 +480,8 @@ MIKMODAPI MLOADER load_s3m={
 	S3M_Test,
 	S3M_Load,
 	S3M_Cleanup,
-	S3M_LoadTitle
+	S3M_LoadTitle,
+	S3M_Magic
 };
 
 /* ex:set ts=4: */
@@ -415,6 +415,13 @@ static CHAR *STM_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG STM_Magic[]={
+	{20,8,"!Scream!"},
+	{20,8,"BMOD2STM"},
+	{20,8,"WUZAMOD!"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_stm={
 	NULL,
 	"STM",
@@ -423,7 +430,8 @@ MIKMODAPI MLOADER load_stm={
 	STM_Test,
 	STM_Load,
 	STM_Cleanup,
-	STM_LoadTitle
+	STM_LoadTitle,
+	STM_Magic
 };
 
 /* ex:set ts=4: */
@@ -435,6 +435,11 @@ static CHAR *STX_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG STX_Magic[]={
+	{0x3c,4,"SCRM"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_stx={
 	NULL,
 	"STX",
@@ -443,7 +448,8 @@ MIKMODAPI MLOADER load_stx={
 	STX_Test,
 	STX_Load,
 	STX_Cleanup,
-	STX_LoadTitle
+	STX_LoadTitle,
+	STX_Magic
 };
 
 /* ex:set ts=4: */
@@ -333,6 +333,11 @@ static CHAR * ULT_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG ULT_Magic[]={
+	{0,14,"MAS_UTrack_V00"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_ult={
 	NULL,
 	"ULT",
@@ -341,7 +346,8 @@ MIKMODAPI MLOADER load_ult={
 	ULT_Test,
 	ULT_Load,
 	ULT_Cleanup,
-	ULT_LoadTitle
+	ULT_LoadTitle,
+	ULT_Magic
 };
 
 
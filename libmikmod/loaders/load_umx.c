@@ -463,6 +463,11 @@ static CHAR *UMX_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG UMX_Magic[] = {
+	{0,4,"\xc1\x83\x2a\x9e"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_umx = {
 	NULL,
 	"UMX",
@@ -471,7 +476,8 @@ MIKMODAPI MLOADER load_umx = {
 	UMX_Test,
 	UMX_Load,
 	UMX_Cleanup,
-	UMX_LoadTitle
+	UMX_LoadTitle,
+	UMX_Magic
 };
 
 /* ex:set ts=8: */
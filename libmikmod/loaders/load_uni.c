@@ -89,6 +89,10 @@ typedef struct UNISMP05 {
 static UWORD universion;
 static UNIHEADER mh;
 
+/* UN07 modules are written by UNI_Write, with everything the player uses and
+   their samples decoded */
+#define UNI_CACHE 7
+
 #define UNI_SMPINCR 64
 static UNISMP05 *wh=NULL,*s=NULL;
 
@@ -114,9 +118,9 @@ static BOOL UNI_Test(void)
 
 	if(!_mm_read_UBYTES(id,6,modreader)) return 0;
 
-	/* UNIMod created by MikCvt */
+	/* UNIMod created by MikCvt, or by UNI_Write */
 	if(!(memcmp(id,"UN0",3))) {
-		if((id[3]>='4')&&(id[3]<='6')) return 1;
+		if((id[3]>='4')&&(id[3]<='0'+UNI_CACHE)) return 1;
 	}
 	/* UNIMod created by APlayer */
 	if(!(memcmp(id,"APUN\01",5))) {
@@ -189,7 +193,7 @@ static UBYTE* readtrack(void)
 						opcode = UNI_XMEFFECTP;
 						break;
 				}
-			} else {
+			} else if (universion != UNI_CACHE) {
 				/* APlayer < 1.05 does not have XMEFFECT6 */
 				if (opcode >= UNI_XMEFFECT6 && universion < 0x105)
 					opcode++;
@@ -201,7 +205,8 @@ static UBYTE* readtrack(void)
 					opcode++;
 			}
 
-			if((!opcode)||(opcode>=UNI_FORMAT_LAST)) {
+			if((!opcode)||(opcode>=((universion==UNI_CACHE)?
+			                        UNI_LAST:UNI_FORMAT_LAST))) {
 				MikMod_free(t);
 				return NULL;
 			}
@@ -507,6 +512,181 @@ static BOOL loadsmp5(void)
 	return 1;
 }
 
+/* Returns 1 if none of the 'count' indexes is past 'last', which stands for
+   none; UNI_Write writes no other */
+static BOOL checkindexes(const UWORD *index,int count,UWORD last)
+{
+	while(count--)
+		if(*index++>last) return 0;
+	return 1;
+}
+
+/* Reads the samples and instruments of an UN07 module */
+static BOOL loadsmp7(void)
+{
+	SAMPLE *q;
+	int t;
+
+	for(t=0,q=of.samples;t<of.numsmp;t++,q++) {
+		q->flags    =_mm_read_M_UWORD(modreader);
+		q->speed    =_mm_read_M_ULONG(modreader);
+		q->volume   =_mm_read_UBYTE(modreader);
+		q->panning  =_mm_read_M_SWORD(modreader);
+		q->length   =_mm_read_M_ULONG(modreader);
+		q->loopstart=_mm_read_M_ULONG(modreader);
+		q->loopend  =_mm_read_M_ULONG(modreader);
+		q->susbegin =_mm_read_M_ULONG(modreader);
+		q->susend   =_mm_read_M_ULONG(modreader);
+		q->globvol  =_mm_read_UBYTE(modreader);
+		q->vibflags =_mm_read_UBYTE(modreader);
+		q->vibtype  =_mm_read_UBYTE(modreader);
+		q->vibsweep =_mm_read_UBYTE(modreader);
+		q->vibdepth =_mm_read_UBYTE(modreader);
+		q->vibrate  =_mm_read_UBYTE(modreader);
+		q->seekpos  =_mm_read_M_ULONG(modreader);
+		q->samplename=readstring();
+
+		if(_mm_eof(modreader)) {
+			_mm_errno = MMERR_LOADING_SAMPLEINFO;
+			return 0;
+		}
+
+		/* loops within the sample, as the drivers make them */
+		if(q->loopend>q->length) q->loopend=q->length;
+		if(q->loopstart>=q->loopend) q->flags&=~SF_LOOP;
+	}
+	return 1;
+}
+
+static BOOL loadinstr7(void)
+{
+	INSTRUMENT *i;
+	int t;
+
+	for(t=0,i=of.instruments;t<of.numins;t++,i++) {
+		i->flags        = _mm_read_UBYTE(modreader);
+		i->nnatype      = _mm_read_UBYTE(modreader);
+		i->dca          = _mm_read_UBYTE(modreader);
+		i->dct          = _mm_read_UBYTE(modreader);
+		i->globvol      = _mm_read_UBYTE(modreader);
+		i->panning      = _mm_read_M_SWORD(modreader);
+		i->pitpansep    = _mm_read_UBYTE(modreader);
+		i->pitpancenter = _mm_read_UBYTE(modreader);
+		i->rvolvar      = _mm_read_UBYTE(modreader);
+		i->rpanvar      = _mm_read_UBYTE(modreader);
+		i->volfade      = _mm_read_M_UWORD(modreader);
+
+#define UNI_LoadEnvelope7(name) 										\
+		i-> name##flg=_mm_read_UBYTE(modreader);						\
+		i-> name##pts=_mm_read_UBYTE(modreader);						\
+		i-> name##susbeg=_mm_read_UBYTE(modreader);						\
+		i-> name##susend=_mm_read_UBYTE(modreader);						\
+		i-> name##beg=_mm_read_UBYTE(modreader);						\
+		i-> name##end=_mm_read_UBYTE(modreader);						\
+		_mm_read_M_SWORDS((SWORD*)i-> name##env,ENVPOINTS*2,modreader);
+
+		UNI_LoadEnvelope7(vol);
+		UNI_LoadEnvelope7(pan);
+		UNI_LoadEnvelope7(pit);
+#undef UNI_LoadEnvelope7
+
+		_mm_read_M_UWORDS(i->samplenumber,INSTNOTES,modreader);
+		_mm_read_UBYTES(i->samplenote,INSTNOTES,modreader);
+		i->filtercutoff   =_mm_read_UBYTE(modreader);
+		i->filterresonance=_mm_read_UBYTE(modreader);
+		i->insname=readstring();
+
+		if(!checkindexes(i->samplenumber,INSTNOTES,of.numsmp)) {
+			_mm_errno = MMERR_LOADING_SAMPLEINFO;
+			return 0;
+		}
+
+		if(_mm_eof(modreader)) {
+			_mm_errno = MMERR_LOADING_SAMPLEINFO;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Loads an UN07 module. Its samples are 16 bit words at the given positions,
+   which the drivers can use in place when the file is mapped. */
+static BOOL UNI_LoadCache(void)
+{
+	CHAR *key;
+	int t;
+
+	/* the layout is known, the samples say in which byte order they are */
+	if(_mm_read_UBYTE(modreader)!=UNI_CACHELAYOUT) {
+		_mm_errno=MMERR_NOT_A_MODULE;
+		return 0;
+	}
+	_mm_skip_BYTE(modreader);
+
+	/* the identity of the module it was made from */
+	key=readstring();
+	MikMod_free(key);
+
+	of.flags     =_mm_read_M_UWORD(modreader);
+	of.numchn    =_mm_read_UBYTE(modreader);
+	of.numvoices =_mm_read_M_UWORD(modreader);
+	of.numpos    =_mm_read_M_UWORD(modreader);
+	of.numpat    =_mm_read_M_UWORD(modreader);
+	of.numtrk    =_mm_read_M_UWORD(modreader);
+	of.numins    =_mm_read_M_UWORD(modreader);
+	of.numsmp    =_mm_read_M_UWORD(modreader);
+	of.reppos    =_mm_read_M_UWORD(modreader);
+	of.initspeed =_mm_read_UBYTE(modreader);
+	of.inittempo =_mm_read_M_UWORD(modreader);
+	of.initvolume=_mm_read_UBYTE(modreader);
+	of.bpmlimit  =_mm_read_M_UWORD(modreader);
+
+	of.songname=readstring();
+	if(!of.songname)
+		of.songname=MikMod_strdup("");
+	of.modtype=readstring();
+	of.comment=readstring();
+
+	if(_mm_eof(modreader)||(of.numchn>UF_MAXCHAN)) {
+		_mm_errno=MMERR_LOADING_HEADER;
+		return 0;
+	}
+
+	if(!AllocPositions(of.numpos)) return 0;
+	_mm_read_M_UWORDS(of.positions,of.numpos,modreader);
+	for(t=0;t<of.numpos;t++)
+		if((of.positions[t]!=LAST_PATTERN)&&(of.positions[t]>of.numpat)) {
+			_mm_errno = MMERR_LOADING_HEADER;
+			return 0;
+		}
+	_mm_read_M_UWORDS(of.panning,of.numchn,modreader);
+	_mm_read_UBYTES(of.chanvol,of.numchn,modreader);
+
+	if(!AllocSamples()) return 0;
+	if(!loadsmp7()) return 0;
+	if(of.flags&UF_INST) {
+		if(!AllocInstruments()) return 0;
+		if(!loadinstr7()) return 0;
+	}
+
+	if(!AllocPatterns()) return 0;
+	_mm_read_M_UWORDS(of.pattrows,of.numpat,modreader);
+	_mm_read_M_UWORDS(of.patterns,of.numpat*of.numchn,modreader);
+	if(!checkindexes(of.patterns,of.numpat*of.numchn,of.numtrk)) {
+		_mm_errno=MMERR_LOADING_PATTERN;
+		return 0;
+	}
+
+	if(!AllocTracks()) return 0;
+	for(t=0;t<of.numtrk;t++)
+		if(!(of.tracks[t]=readtrack())) {
+			_mm_errno=MMERR_LOADING_TRACK;
+			return 0;
+		}
+
+	return 1;
+}
+
 static BOOL UNI_Load(BOOL curious)
 {
 	int t;
@@ -520,6 +700,7 @@ static BOOL UNI_Load(BOOL curious)
 		universion=mh.id[3]-'0';
 	else
 		universion=0x100;
+	if(universion==UNI_CACHE) return UNI_LoadCache();
 
 	if(universion>=6) {
 		if (universion==6) {
@@ -713,6 +894,16 @@ static CHAR *UNI_LoadTitle(void)
 	_mm_fseek(modreader,3,SEEK_SET);
 	ver=_mm_read_UBYTE(modreader);
 	if(ver=='N') ver='6';
+	if(ver=='0'+UNI_CACHE) {
+		/* after the layout, the byte order, the module key and 23 bytes
+		   of header */
+		_mm_skip_BYTE(modreader);
+		_mm_skip_BYTE(modreader);
+		_mm_fseek(modreader,_mm_read_I_UWORD(modreader)+23,SEEK_CUR);
+		title=readstring();
+		if(!title) title=MikMod_strdup("");
+		return title;
+	}
 
 	_mm_fseek(modreader,posit[ver-'4'],SEEK_SET);
 	title=readstring();
@@ -720,8 +911,209 @@ static CHAR *UNI_LoadTitle(void)
 	return title;
 }
 
+/*========== Writer code */
+
+static void writestring(const CHAR *str,MWRITER *writer)
+{
+	UWORD len=str?strlen(str):0;
+
+	_mm_write_I_UWORD(len,writer);
+	if(len) _mm_write_UBYTES(str,len,writer);
+}
+
+/* Writes 'count' indexes, those past 'last' as 'last': the player takes
+   them all for none */
+static void writeindexes(const UWORD *index,int count,UWORD last,MWRITER *writer)
+{
+	for(;count--;index++)
+		_mm_write_M_UWORD((*index<last)?*index:last,writer);
+}
+
+/* Returns the length of a track, up to and including its final 0 */
+static UWORD tracklength(const UBYTE *t)
+{
+	UWORD len=0;
+
+	while(t[len]) len+=t[len]&0x1f;
+	return len+1;
+}
+
+/* Returns 1 if the module in the reader is an UN07 module made from the
+   module identified by 'key', with the layout and byte order of this
+   library */
+BOOL UNI_IsCache(MREADER *reader,const CHAR *key)
+{
+	UBYTE id[6];
+	UWORD len=strlen(key);
+	CHAR *str;
+	BOOL ok=0;
+
+	_mm_rewind(reader);
+	if(!_mm_read_UBYTES(id,6,reader)) return 0;
+	if(memcmp(id,"UN0",3)||(id[3]!='0'+UNI_CACHE)||
+	   (id[4]!=UNI_CACHELAYOUT)||(id[5]!=UNI_CACHEORDER)) return 0;
+	if(_mm_read_I_UWORD(reader)!=len) return 0;
+
+	if(!(str=(CHAR*)MikMod_malloc(len+1))) return 0;
+	if(_mm_read_UBYTES(str,len,reader))
+		ok=!memcmp(str,key,len);
+	MikMod_free(str);
+	_mm_rewind(reader);
+	return ok;
+}
+
+/* Writes a loaded module, whose samples have been decoded by
+   SL_DecodeSamples, as an UN07 module identified by 'key'. Tracks, patterns,
+   instruments and samples are stored as the player uses them, so loading it
+   back is only a matter of reading. */
+BOOL UNI_Write(MWRITER *writer,const CHAR *key,MODULE *mf)
+{
+	static const UBYTE pad[16]={0};
+	SAMPLE *q;
+	INSTRUMENT *i;
+	long *fields;
+	SWORD *data;
+	UWORD format;
+	int t;
+
+	for(t=0;t<mf->numtrk;t++)
+		if(!mf->tracks[t]) return 0;
+	if(!(fields=(long*)MikMod_calloc(mf->numsmp+1,sizeof(long)))) return 0;
+
+	_mm_write_UBYTES("UN0",3,writer);
+	_mm_write_UBYTE('0'+UNI_CACHE,writer);
+	_mm_write_UBYTE(UNI_CACHELAYOUT,writer);
+	_mm_write_UBYTE(UNI_CACHEORDER,writer);
+	writestring(key,writer);
+
+	_mm_write_M_UWORD(mf->flags,writer);
+	_mm_write_UBYTE(mf->numchn,writer);
+	_mm_write_M_UWORD(mf->numvoices,writer);
+	_mm_write_M_UWORD(mf->numpos,writer);
+	_mm_write_M_UWORD(mf->numpat,writer);
+	_mm_write_M_UWORD(mf->numtrk,writer);
+	_mm_write_M_UWORD(mf->numins,writer);
+	_mm_write_M_UWORD(mf->numsmp,writer);
+	_mm_write_M_UWORD(mf->reppos,writer);
+	_mm_write_UBYTE(mf->initspeed,writer);
+	_mm_write_M_UWORD(mf->inittempo,writer);
+	_mm_write_UBYTE(mf->initvolume,writer);
+	_mm_write_M_UWORD(mf->bpmlimit,writer);
+
+	writestring(mf->songname,writer);
+	writestring(mf->modtype,writer);
+	writestring(mf->comment,writer);
+
+	_mm_write_M_UWORDS(mf->positions,mf->numpos,writer);
+	_mm_write_M_UWORDS(mf->panning,mf->numchn,writer);
+	_mm_write_UBYTES(mf->chanvol,mf->numchn,writer);
+
+	for(t=0,q=mf->samples;t<mf->numsmp;t++,q++) {
+		format=0;
+		if(q->length&&!SL_Decoded(q,&format)) {
+			MikMod_free(fields);
+			return 0;
+		}
+		_mm_write_M_UWORD((q->flags&~SF_FORMATMASK)|format,writer);
+		_mm_write_M_ULONG(q->speed,writer);
+		_mm_write_UBYTE(q->volume,writer);
+		_mm_write_M_SWORD(q->panning,writer);
+		_mm_write_M_ULONG(q->length,writer);
+		_mm_write_M_ULONG(q->loopstart,writer);
+		_mm_write_M_ULONG(q->loopend,writer);
+		_mm_write_M_ULONG(q->susbegin,writer);
+		_mm_write_M_ULONG(q->susend,writer);
+		_mm_write_UBYTE(q->globvol,writer);
+		_mm_write_UBYTE(q->vibflags,writer);
+		_mm_write_UBYTE(q->vibtype,writer);
+		_mm_write_UBYTE(q->vibsweep,writer);
+		_mm_write_UBYTE(q->vibdepth,writer);
+		_mm_write_UBYTE(q->vibrate,writer);
+		/* the position of the data is known once it is written */
+		fields[t]=writer->Tell(writer);
+		_mm_write_M_ULONG(0,writer);
+		writestring(q->samplename,writer);
+	}
+
+	if(mf->flags&UF_INST)
+		for(t=0,i=mf->instruments;t<mf->numins;t++,i++) {
+			_mm_write_UBYTE(i->flags,writer);
+			_mm_write_UBYTE(i->nnatype,writer);
+			_mm_write_UBYTE(i->dca,writer);
+			_mm_write_UBYTE(i->dct,writer);
+			_mm_write_UBYTE(i->globvol,writer);
+			_mm_write_M_SWORD(i->panning,writer);
+			_mm_write_UBYTE(i->pitpansep,writer);
+			_mm_write_UBYTE(i->pitpancenter,writer);
+			_mm_write_UBYTE(i->rvolvar,writer);
+			_mm_write_UBYTE(i->rpanvar,writer);
+			_mm_write_M_UWORD(i->volfade,writer);
+
+#define UNI_WriteEnvelope(name) 										\
+			_mm_write_UBYTE(i-> name##flg,writer);						\
+			_mm_write_UBYTE(i-> name##pts,writer);						\
+			_mm_write_UBYTE(i-> name##susbeg,writer);					\
+			_mm_write_UBYTE(i-> name##susend,writer);					\
+			_mm_write_UBYTE(i-> name##beg,writer);						\
+			_mm_write_UBYTE(i-> name##end,writer);						\
+			_mm_write_M_SWORDS((SWORD*)i-> name##env,ENVPOINTS*2,writer);
+
+			UNI_WriteEnvelope(vol);
+			UNI_WriteEnvelope(pan);
+			UNI_WriteEnvelope(pit);
+#undef UNI_WriteEnvelope
+
+			writeindexes(i->samplenumber,INSTNOTES,mf->numsmp,writer);
+			_mm_write_UBYTES(i->samplenote,INSTNOTES,writer);
+			_mm_write_UBYTE(i->filtercutoff,writer);
+			_mm_write_UBYTE(i->filterresonance,writer);
+			writestring(i->insname,writer);
+		}
+
+	_mm_write_M_UWORDS(mf->pattrows,mf->numpat,writer);
+	writeindexes(mf->patterns,mf->numpat*mf->numchn,mf->numtrk,writer);
+
+	for(t=0;t<mf->numtrk;t++) {
+		UWORD len=tracklength(mf->tracks[t]);
+
+		_mm_write_M_UWORD(len,writer);
+		_mm_write_UBYTES(mf->tracks[t],len,writer);
+	}
+
+	/* sample data, aligned for the drivers to use it in place */
+	for(t=0,q=mf->samples;t<mf->numsmp;t++,q++) {
+		long pos;
+
+		if(!q->length) continue;
+		data=SL_Decoded(q,&format);
+		pos=writer->Tell(writer);
+		if(pos&15) {
+			_mm_write_UBYTES(pad,16-(pos&15),writer);
+			pos=writer->Tell(writer);
+		}
+		_mm_write_UBYTES(data,q->length*sizeof(SWORD),writer);
+		/* room for the software mixer to unroll loops in place */
+		_mm_write_UBYTES(pad,16,writer);
+		_mm_write_UBYTES(pad,16,writer);
+		_mm_write_UBYTES(pad,8,writer);
+
+		writer->Seek(writer,fields[t],SEEK_SET);
+		_mm_write_M_ULONG(pos,writer);
+		writer->Seek(writer,0,SEEK_END);
+	}
+
+	MikMod_free(fields);
+	return 1;
+}
+
 /*========== Loader information */
 
+static const MLOADERSIG UNI_Magic[]={
+	{0,3,"UN0"},
+	{0,5,"APUN\x01"},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_uni={
 	NULL,
 	"UNI",
@@ -730,7 +1122,8 @@ MIKMODAPI MLOADER load_uni={
 	UNI_Test,
 	UNI_Load,
 	UNI_Cleanup,
-	UNI_LoadTitle
+	UNI_LoadTitle,
+	UNI_Magic
 };
 
 /* ex:set ts=4: */
@@ -841,6 +841,11 @@ static CHAR *XM_LoadTitle(void)
 
 /*========== Loader information */
 
+static const MLOADERSIG XM_Magic[]={
+	{0,17,"Extended Module: "},
+	{0,0,NULL}
+};
+
 MIKMODAPI MLOADER load_xm={
 	NULL,
 	"XM",
@@ -849,7 +854,8 @@ MIKMODAPI MLOADER load_xm={
 	XM_Test,
 	XM_Load,
 	XM_Cleanup,
-	XM_LoadTitle
+	XM_LoadTitle,
+	XM_Magic
 };
 
 /* ex:set ts=4: */
@@ -277,6 +277,15 @@ static const char *_mm_errmsg[MMERR_MAX+1] =
 	_mmerr_invalid, _mmerr_invalid,
 #endif
 
+/* Player errors */
+	"Requested voices are not available for mixing",
+	"Too many modules mixed together",
+	"Rendering requires a software mixing driver",
+	"Can not render while the driver is playing",
+	"Seeking requires the module to play alone on a software mixer",
+	"Player state does not match the module",
+	"Splitting a song requires reverb, noise reduction and SIMD HQ mixing to be off",
+
 /* Invalid error */
 
 	_mmerr_invalid
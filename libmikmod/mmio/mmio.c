@@ -55,6 +55,13 @@
 #include <limits.h>
 #endif
 
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define MIKMOD_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include <stdio.h>
 #include <string.h>
 
@@ -72,9 +79,11 @@ extern size_t fwrite(const void *, size_t, size_t, FILE *);
 /* some prototypes */
 static BOOL _mm_MemReader_Eof(MREADER* reader);
 static BOOL _mm_MemReader_Read(MREADER* reader,void* ptr,size_t size);
-static int _mm_MemReader_Get(MREADER* reader);
+static BOOL _mm_MemReader_Fill(MBUFREADER* reader);
 static int _mm_MemReader_Seek(MREADER* reader,long offset,int whence);
 static long _mm_MemReader_Tell(MREADER* reader);
+static BOOL _mm_UnpackReader_Read(MREADER* reader,void* ptr,size_t size);
+static MREADER* _mm_UnpackReader_View(MREADER* reader);
 
 FILE* _mm_fopen(const CHAR* fname, const CHAR* attrib)
 {
@@ -97,6 +106,27 @@ BOOL _mm_FileExists(const CHAR* fname)
 	return 1;
 }
 
+/* Identifies the contents of a file by its name, size and modification time,
+   for modules derived from it to be kept. Returns 0 when this is not
+   possible. */
+BOOL _mm_file_key(const CHAR *fname,CHAR *key,size_t size)
+{
+#ifdef MIKMOD_MMAP
+	struct stat st;
+	int len;
+
+	if(stat(fname,&st)||!S_ISREG(st.st_mode)) return 0;
+	len=snprintf(key,size,"%s|%lu|%lu",fname,(unsigned long)st.st_size,
+	             (unsigned long)st.st_mtime);
+	return (len>0)&&((size_t)len<size);
+#else
+	(void)fname;
+	(void)key;
+	(void)size;
+	return 0;
+#endif
+}
+
 int _mm_fclose(FILE *fp)
 {
 	return fclose(fp);
@@ -115,56 +145,141 @@ void _mm_iobase_revert(MREADER* reader)
 	reader->iobase=reader->prev_iobase;
 }
 
+/*========== Buffered readers */
+
+int _mm_BufReader_Get(MREADER* reader)
+{
+	MBUFREADER* br=(MBUFREADER*)reader;
+
+	if(br->ptr>=br->end && !br->Fill(br)) return EOF;
+	return *br->ptr++;
+}
+
 /*========== File Reader */
 
+/* size of the window of file readers */
+#define FILEBUFSIZE 4096
+
 typedef struct MFILEREADER {
-	MREADER core;
+	MBUFREADER core;
 	FILE*   file;
+	long    filepos;	/* file position of the end of the window, or -1 */
+	BOOL    eof;		/* a read went past the end of the file */
+	UBYTE   buf[FILEBUFSIZE];
 } MFILEREADER;
 
-static BOOL _mm_FileReader_Eof(MREADER* reader)
+static BOOL _mm_FileReader_Fill(MBUFREADER* reader)
 {
-	return feof(((MFILEREADER*)reader)->file);
+	MFILEREADER* fr=(MFILEREADER*)reader;
+	size_t n=fread(fr->buf,1,FILEBUFSIZE,fr->file);
+
+	fr->core.ptr=fr->buf;
+	fr->core.end=fr->buf+n;
+	if(fr->filepos>=0) fr->filepos+=(long)n;
+	if(!n) fr->eof=1;
+	return n!=0;
 }
 
-static BOOL _mm_FileReader_Read(MREADER* reader,void* ptr,size_t size)
+static BOOL _mm_FileReader_Eof(MREADER* reader)
 {
-	return !!fread(ptr,size,1,((MFILEREADER*)reader)->file);
+	return ((MFILEREADER*)reader)->eof;
 }
 
-static int _mm_FileReader_Get(MREADER* reader)
+static BOOL _mm_FileReader_Read(MREADER* reader,void* ptr,size_t size)
 {
-	return fgetc(((MFILEREADER*)reader)->file);
+	MFILEREADER* fr=(MFILEREADER*)reader;
+	UBYTE *dest=(UBYTE*)ptr;
+	size_t n;
+
+	if(!size) return 0;
+	for(;;) {
+		n=fr->core.end-fr->core.ptr;
+		if(n>size) n=size;
+		memcpy(dest,fr->core.ptr,n);
+		fr->core.ptr+=n;
+		dest+=n;
+		if(!(size-=n)) return 1;
+
+		/* large reads skip the window */
+		if(size>=FILEBUFSIZE) {
+			fr->core.ptr=fr->core.end=fr->buf;
+			n=fread(dest,1,size,fr->file);
+			if(fr->filepos>=0) fr->filepos+=(long)n;
+			if(n==size) return 1;
+			fr->eof=1;
+			return 0;
+		}
+		if(!_mm_FileReader_Fill(&fr->core)) return 0;
+	}
 }
 
 static int _mm_FileReader_Seek(MREADER* reader,long offset,int whence)
 {
-	return fseek(((MFILEREADER*)reader)->file,
-				 (whence==SEEK_SET)?offset+reader->iobase:offset,whence);
+	MFILEREADER* fr=(MFILEREADER*)reader;
+	long ahead=(long)(fr->core.end-fr->core.ptr);
+	long behind=(long)(fr->core.ptr-fr->buf);
+	int result;
+
+	fr->eof=0;
+	if(whence==SEEK_SET) {
+		offset+=reader->iobase;
+		/* turn it into a move in the window when the position is known */
+		if(fr->filepos>=0) {
+			offset-=fr->filepos-ahead;
+			whence=SEEK_CUR;
+		}
+	}
+	if(whence==SEEK_CUR) {
+		if((offset>=-behind)&&(offset<=ahead)) {
+			fr->core.ptr+=offset;
+			return 0;
+		}
+		offset-=ahead;
+	}
+	/* a failed seek leaves the file, and so the window, where it was */
+	if((result=fseek(fr->file,offset,whence))) return result;
+	fr->core.ptr=fr->core.end=fr->buf;
+	fr->filepos=ftell(fr->file);
+	return 0;
 }
 
 static long _mm_FileReader_Tell(MREADER* reader)
 {
-	return ftell(((MFILEREADER*)reader)->file)-reader->iobase;
+	MFILEREADER* fr=(MFILEREADER*)reader;
+	long pos=(fr->filepos>=0)?fr->filepos:ftell(fr->file);
+
+	return pos-(long)(fr->core.end-fr->core.ptr)-reader->iobase;
 }
 
 MREADER *_mm_new_file_reader(FILE* fp)
 {
 	MFILEREADER* reader=(MFILEREADER*)MikMod_calloc(1,sizeof(MFILEREADER));
 	if (reader) {
-		reader->core.Eof =&_mm_FileReader_Eof;
-		reader->core.Read=&_mm_FileReader_Read;
-		reader->core.Get =&_mm_FileReader_Get;
-		reader->core.Seek=&_mm_FileReader_Seek;
-		reader->core.Tell=&_mm_FileReader_Tell;
+		reader->core.core.Eof =&_mm_FileReader_Eof;
+		reader->core.core.Read=&_mm_FileReader_Read;
+		reader->core.core.Get =&_mm_BufReader_Get;
+		reader->core.core.Seek=&_mm_FileReader_Seek;
+		reader->core.core.Tell=&_mm_FileReader_Tell;
+		reader->core.ptr=reader->core.end=reader->buf;
+		reader->core.Fill=&_mm_FileReader_Fill;
 		reader->file=fp;
+		reader->filepos=ftell(fp);
 	}
 	return (MREADER*)reader;
 }
 
-void _mm_delete_file_reader (MREADER* reader)
+/* Deletes a file reader, leaving the file where the reader was by giving back
+   the bytes it read ahead. Returns 0 if this was not possible: pipes can't
+   seek back, and are left after these bytes. */
+BOOL _mm_delete_file_reader (MREADER* reader)
 {
+	MFILEREADER* fr=(MFILEREADER*)reader;
+	BOOL ok=1;
+
+	if(fr && fr->core.end>fr->core.ptr)
+		ok=!fseek(fr->file,-(long)(fr->core.end-fr->core.ptr),SEEK_CUR);
 	MikMod_free(reader);
+	return ok;
 }
 
 /*========== File Writer */
@@ -214,13 +329,23 @@ void _mm_delete_file_writer (MWRITER* writer)
 
 /*========== Memory Reader */
 
+/* The window of memory readers is the rest of their buffer */
 typedef struct MMEMREADER {
-	MREADER core;
-	const void *buffer;
+	MBUFREADER core;
+	const UBYTE *buffer;
 	long len;
-	long pos;
+	MMAPPING *mapping;	/* file mapping holding the buffer, if any */
 } MMEMREADER;
 
+#define MEMPOS(mr)	((long)((mr)->core.ptr-(mr)->buffer))
+
+struct MMAPPING {
+	void *base;
+	size_t size;
+	int refcount;
+	BOOL borrowed;		/* storage was handed out by _mm_reader_storage */
+};
+
 void _mm_delete_mem_reader(MREADER* reader)
 {
 	MikMod_free(reader);
@@ -231,30 +356,158 @@ MREADER *_mm_new_mem_reader(const void *buffer, long len)
 	MMEMREADER* reader=(MMEMREADER*)MikMod_calloc(1,sizeof(MMEMREADER));
 	if (reader)
 	{
-		reader->core.Eof =&_mm_MemReader_Eof;
-		reader->core.Read=&_mm_MemReader_Read;
-		reader->core.Get =&_mm_MemReader_Get;
-		reader->core.Seek=&_mm_MemReader_Seek;
-		reader->core.Tell=&_mm_MemReader_Tell;
-		reader->buffer = buffer;
+		reader->core.core.Eof =&_mm_MemReader_Eof;
+		reader->core.core.Read=&_mm_MemReader_Read;
+		reader->core.core.Get =&_mm_BufReader_Get;
+		reader->core.core.Seek=&_mm_MemReader_Seek;
+		reader->core.core.Tell=&_mm_MemReader_Tell;
+		reader->core.Fill=&_mm_MemReader_Fill;
+		reader->buffer = (const UBYTE*) buffer;
 		reader->len = len;
-		reader->pos = 0;
+		reader->core.ptr = reader->buffer;
+		reader->core.end = reader->buffer + len;
+	}
+	return (MREADER*)reader;
+}
+
+/*========== Mapped file reader */
+
+/* The mapping is private and writable: the storage of samples used in place
+   can then be touched up by the mixer without changing the file. */
+MREADER *_mm_new_map_reader(const CHAR *filename)
+{
+#ifdef MIKMOD_MMAP
+	MMEMREADER* reader;
+	MMAPPING* map;
+	struct stat st;
+	void *base;
+	int fd;
+
+	if((fd=open(filename,O_RDONLY))<0) return NULL;
+	if(fstat(fd,&st)||!S_ISREG(st.st_mode)||
+	   (st.st_size<=0)||(st.st_size>LONG_MAX)) {
+		close(fd);
+		return NULL;
+	}
+	base=mmap(NULL,(size_t)st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(base==MAP_FAILED) return NULL;
+
+	if(!(map=(MMAPPING*)MikMod_calloc(1,sizeof(MMAPPING)))) {
+		munmap(base,(size_t)st.st_size);
+		return NULL;
 	}
+	map->base=base;
+	map->size=(size_t)st.st_size;
+	map->refcount=1;
+	if(!(reader=(MMEMREADER*)_mm_new_mem_reader(base,(long)map->size))) {
+		_mm_map_release(map);
+		return NULL;
+	}
+	reader->mapping=map;
 	return (MREADER*)reader;
+#else
+	(void)filename;
+	return NULL;
+#endif
+}
+
+void _mm_delete_map_reader(MREADER* reader)
+{
+	if(reader) _mm_map_release(((MMEMREADER*)reader)->mapping);
+	_mm_delete_mem_reader(reader);
+}
+
+/* Returns where the next 'size' bytes of a mapped file reader are, if they
+   are in the file and suitably aligned, or NULL. The storage may be written
+   to, and stays valid while the mapping is referenced. */
+void* _mm_reader_storage(MREADER* reader,size_t size,size_t align)
+{
+	MMEMREADER* mr=(MMEMREADER*)reader;
+	UBYTE *storage;
+
+	if(!reader||(reader->Read!=&_mm_MemReader_Read)||!mr->mapping)
+		return NULL;
+	if(size>(size_t)(mr->len-MEMPOS(mr)))
+		return NULL;
+	storage=(UBYTE*)mr->mapping->base+MEMPOS(mr);
+	if(align && ((size_t)storage%align)) return NULL;
+
+	mr->mapping->borrowed=1;
+	return storage;
+}
+
+/* Returns a new reference to the mapping of a mapped file reader, or NULL
+   if the reader has none or no storage was borrowed from it */
+MMAPPING* _mm_reader_mapping(MREADER* reader)
+{
+	MMEMREADER* mr=(MMEMREADER*)reader;
+
+	if(!reader||(reader->Read!=&_mm_MemReader_Read)||!mr->mapping||
+	   !mr->mapping->borrowed)
+		return NULL;
+	mr->mapping->refcount++;
+	return mr->mapping;
+}
+
+/* Returns a reader of its own over the buffer of a memory reader, at the
+   same position and with the same base, or NULL if the reader can not be
+   shared. The view is deleted with _mm_delete_mem_reader, before the reader
+   it was taken from or the last reference to its mapping. */
+MREADER* _mm_reader_view(MREADER* reader)
+{
+	MMEMREADER *mr=(MMEMREADER*)reader,*view;
+
+	if(reader&&(reader->Read==&_mm_UnpackReader_Read))
+		return _mm_UnpackReader_View(reader);
+	if(!reader||(reader->Read!=&_mm_MemReader_Read))
+		return NULL;
+	if(!(view=(MMEMREADER*)_mm_new_mem_reader(mr->buffer,mr->len)))
+		return NULL;
+	view->core.core.iobase=reader->iobase;
+	view->core.core.prev_iobase=reader->prev_iobase;
+	view->core.ptr=mr->core.ptr;
+	view->mapping=mr->mapping;
+	return (MREADER*)view;
+}
+
+/* Returns a new reference to the mapping of a mapped file reader, whether
+   storage was borrowed from it or not, or NULL */
+MMAPPING* _mm_map_retain(MREADER* reader)
+{
+	MMEMREADER* mr=(MMEMREADER*)reader;
+
+	if(!reader||(reader->Read!=&_mm_MemReader_Read)||!mr->mapping)
+		return NULL;
+	mr->mapping->refcount++;
+	return mr->mapping;
+}
+
+void _mm_map_release(MMAPPING* map)
+{
+	if(!map||--map->refcount) return;
+#ifdef MIKMOD_MMAP
+	munmap(map->base,map->size);
+#endif
+	MikMod_free(map);
 }
 
 static BOOL _mm_MemReader_Eof(MREADER* reader)
 {
 	MMEMREADER* mr = (MMEMREADER*) reader;
 	if (!mr) return 1;
-	if (mr->pos >= mr->len) return 1;
+	if (mr->core.ptr >= mr->core.end) return 1;
+	return 0;
+}
+
+static BOOL _mm_MemReader_Fill(MBUFREADER* reader)
+{
+	(void)reader;
 	return 0;
 }
 
 static BOOL _mm_MemReader_Read(MREADER* reader,void* ptr,size_t size)
 {
-	unsigned char *d;
-	const unsigned char *s;
 	MMEMREADER* mr;
 	long siz;
 	BOOL ret;
@@ -264,79 +517,242 @@ static BOOL _mm_MemReader_Read(MREADER* reader,void* ptr,size_t size)
 
 	mr = (MMEMREADER*) reader;
 	siz = (long) size;
-	if (mr->pos >= mr->len) return 0;	/* @ eof */
-	if (mr->pos + siz > mr->len) {
-		siz = mr->len - mr->pos;
+	if (mr->core.ptr >= mr->core.end) return 0;	/* @ eof */
+	if (siz > mr->core.end - mr->core.ptr) {
+		siz = (long)(mr->core.end - mr->core.ptr);
 		ret = 0; /* not enough remaining bytes */
 	}
 	else {
 		ret = 1;
 	}
 
-	s = (const unsigned char *) mr->buffer;
-	s += mr->pos;
-	mr->pos += siz;
-	d = (unsigned char *) ptr;
-
-	while (siz) {
-		*d++ = *s++;
-		siz--;
-	}
+	memcpy(ptr, mr->core.ptr, siz);
+	mr->core.ptr += siz;
 
 	return ret;
 }
 
-static int _mm_MemReader_Get(MREADER* reader)
-{
-	MMEMREADER* mr;
-	int c;
-
-	mr = (MMEMREADER*) reader;
-	if (mr->pos >= mr->len) return EOF;
-	c = ((const unsigned char*) mr->buffer)[mr->pos];
-	mr->pos++;
-
-	return c;
-}
-
 static int _mm_MemReader_Seek(MREADER* reader,long offset,int whence)
 {
 	MMEMREADER* mr;
+	long pos;
 
 	if (!reader) return -1;
 	mr = (MMEMREADER*) reader;
 	switch(whence)
 	{
 	case SEEK_CUR:
-		mr->pos += offset;
+		pos = MEMPOS(mr) + offset;
 		break;
 	case SEEK_SET:
-		mr->pos = reader->iobase + offset;
+		pos = reader->iobase + offset;
 		break;
 	case SEEK_END:
-		mr->pos = mr->len + offset;
+		pos = mr->len + offset;
 		break;
 	default: /* invalid */
 		return -1;
 	}
-	if (mr->pos < reader->iobase) {
-		mr->pos = mr->core.iobase;
+	if (pos < reader->iobase) {
+		mr->core.ptr = mr->buffer + reader->iobase;
 		return -1;
 	}
-	if (mr->pos > mr->len) {
-		mr->pos = mr->len;
+	if (pos > mr->len) {
+		pos = mr->len;
 	}
+	mr->core.ptr = mr->buffer + pos;
 	return 0;
 }
 
 static long _mm_MemReader_Tell(MREADER* reader)
 {
 	if (reader) {
-		return ((MMEMREADER*)reader)->pos - reader->iobase;
+		return MEMPOS((MMEMREADER*)reader) - reader->iobase;
 	}
 	return 0;
 }
 
+/*========== Unpacking reader */
+
+/* The unpacked data is kept whole, for it can be read anywhere, but only as
+   much of it as has been read is unpacked. The window is the part unpacked
+   ahead of the position, and is empty past it. */
+typedef struct MUNPACKREADER {
+	MBUFREADER core;
+	UBYTE *buffer;
+	long len;
+	long valid;		/* length of the data unpacked so far */
+	BOOL failed;		/* the data could not be unpacked further */
+	const MUNPACKER *unpacker;
+	void *state;
+} MUNPACKREADER;
+
+#define UNPACKPOS(ur)	((long)((ur)->core.ptr-(ur)->buffer))
+
+/* least amount of data unpacked at once */
+#define UNPACKSTEP 4096
+
+static void _mm_UnpackReader_Window(MUNPACKREADER* ur)
+{
+	long pos=UNPACKPOS(ur);
+
+	ur->core.end=ur->buffer+((pos<ur->valid)?ur->valid:pos);
+}
+
+/* Unpacks the data up to 'wanted' bytes, returns 0 if they can't be */
+static BOOL _mm_UnpackReader_Unpack(MUNPACKREADER* ur,long wanted)
+{
+	long valid;
+
+	if(wanted>ur->len) wanted=ur->len;
+	if(wanted<=ur->valid) return 1;
+	if(ur->failed) return 0;
+
+	valid=ur->unpacker->Unpack(ur->state,ur->buffer,wanted);
+	if(valid<wanted) {
+		ur->failed=1;
+		return 0;
+	}
+	ur->valid=(valid<ur->len)?valid:ur->len;
+	_mm_UnpackReader_Window(ur);
+	return 1;
+}
+
+static BOOL _mm_UnpackReader_Eof(MREADER* reader)
+{
+	MUNPACKREADER* ur=(MUNPACKREADER*)reader;
+
+	return UNPACKPOS(ur)>=ur->len;
+}
+
+static BOOL _mm_UnpackReader_Fill(MBUFREADER* reader)
+{
+	MUNPACKREADER* ur=(MUNPACKREADER*)reader;
+	long pos=UNPACKPOS(ur);
+
+	if(pos>=ur->len) return 0;
+	_mm_UnpackReader_Unpack(ur,pos+UNPACKSTEP);
+	return pos<ur->valid;
+}
+
+static BOOL _mm_UnpackReader_Read(MREADER* reader,void* ptr,size_t size)
+{
+	MUNPACKREADER* ur=(MUNPACKREADER*)reader;
+	long pos=UNPACKPOS(ur),siz;
+	BOOL ret=1;
+
+	if(!size||(size>(size_t)LONG_MAX)) return 0;
+	if(pos>=ur->len) return 0;	/* @ eof */
+
+	siz=(long)size;
+	if(siz>ur->len-pos) {
+		siz=ur->len-pos;
+		ret=0; /* not enough remaining bytes */
+	}
+	if(!_mm_UnpackReader_Unpack(ur,pos+siz)) {
+		siz=(ur->valid>pos)?ur->valid-pos:0;
+		ret=0;
+	}
+
+	memcpy(ptr,ur->core.ptr,siz);
+	ur->core.ptr+=siz;
+	_mm_UnpackReader_Window(ur);
+	return ret;
+}
+
+/* Seeking unpacks nothing: the data is unpacked when it is read */
+static int _mm_UnpackReader_Seek(MREADER* reader,long offset,int whence)
+{
+	MUNPACKREADER* ur=(MUNPACKREADER*)reader;
+	long pos;
+	int ret=0;
+
+	switch(whence)
+	{
+	case SEEK_CUR:
+		pos = UNPACKPOS(ur) + offset;
+		break;
+	case SEEK_SET:
+		pos = reader->iobase + offset;
+		break;
+	case SEEK_END:
+		pos = ur->len + offset;
+		break;
+	default: /* invalid */
+		return -1;
+	}
+	if (pos < reader->iobase) {
+		pos = reader->iobase;
+		ret = -1;
+	}
+	if (pos > ur->len) {
+		pos = ur->len;
+	}
+	ur->core.ptr = ur->buffer + pos;
+	_mm_UnpackReader_Window(ur);
+	return ret;
+}
+
+static long _mm_UnpackReader_Tell(MREADER* reader)
+{
+	return UNPACKPOS((MUNPACKREADER*)reader) - reader->iobase;
+}
+
+/* Views of the unpacked data are memory readers, once it is all unpacked */
+static MREADER* _mm_UnpackReader_View(MREADER* reader)
+{
+	MUNPACKREADER* ur=(MUNPACKREADER*)reader;
+	MMEMREADER* view;
+
+	if(!_mm_UnpackReader_Unpack(ur,ur->len)) return NULL;
+	if(!(view=(MMEMREADER*)_mm_new_mem_reader(ur->buffer,ur->len)))
+		return NULL;
+	view->core.core.iobase=reader->iobase;
+	view->core.core.prev_iobase=reader->prev_iobase;
+	view->core.ptr=ur->core.ptr;
+	return (MREADER*)view;
+}
+
+/* Returns a reader of the data packed in 'reader', which is read from as
+   the data is unpacked, or NULL if the data isn't packed by 'unpacker' */
+MREADER* _mm_new_unpack_reader(MREADER* reader,const MUNPACKER* unpacker)
+{
+	MUNPACKREADER* ur;
+	void *state;
+	long len;
+
+	_mm_rewind(reader);
+	if(!(state=unpacker->Open(reader,&len))) return NULL;
+
+	if(!(ur=(MUNPACKREADER*)MikMod_calloc(1,sizeof(MUNPACKREADER)))||
+	   !(ur->buffer=(UBYTE*)MikMod_calloc(1,len+unpacker->slack))) {
+		MikMod_free(ur);
+		unpacker->Close(state);
+		return NULL;
+	}
+	ur->core.core.Eof =&_mm_UnpackReader_Eof;
+	ur->core.core.Read=&_mm_UnpackReader_Read;
+	ur->core.core.Get =&_mm_BufReader_Get;
+	ur->core.core.Seek=&_mm_UnpackReader_Seek;
+	ur->core.core.Tell=&_mm_UnpackReader_Tell;
+	ur->core.Fill=&_mm_UnpackReader_Fill;
+	ur->core.ptr=ur->core.end=ur->buffer;
+	ur->len=len;
+	ur->unpacker=unpacker;
+	ur->state=state;
+	return (MREADER*)ur;
+}
+
+void _mm_delete_unpack_reader(MREADER* reader)
+{
+	MUNPACKREADER* ur=(MUNPACKREADER*)reader;
+
+	if(!reader) return;
+	ur->unpacker->Close(ur->state);
+	MikMod_free(ur->buffer);
+	MikMod_free(ur);
+}
+
 /*========== Write functions */
 
 void _mm_write_string(const CHAR* data,MWRITER* writer)
@@ -436,50 +852,50 @@ BOOL _mm_read_string(CHAR* buffer,int cnt,MREADER* reader)
 	return reader->Read(reader,buffer,cnt);
 }
 
-UWORD _mm_read_M_UWORD(MREADER* reader)
+UWORD (_mm_read_M_UWORD)(MREADER* reader)
 {
 	UWORD result=((UWORD)_mm_read_UBYTE(reader))<<8;
 	result|=_mm_read_UBYTE(reader);
 	return result;
 }
 
-UWORD _mm_read_I_UWORD(MREADER* reader)
+UWORD (_mm_read_I_UWORD)(MREADER* reader)
 {
 	UWORD result=_mm_read_UBYTE(reader);
 	result|=((UWORD)_mm_read_UBYTE(reader))<<8;
 	return result;
 }
 
-ULONG _mm_read_M_ULONG(MREADER* reader)
+ULONG (_mm_read_M_ULONG)(MREADER* reader)
 {
 	ULONG result=((ULONG)_mm_read_M_UWORD(reader))<<16;
 	result|=_mm_read_M_UWORD(reader);
 	return result;
 }
 
-ULONG _mm_read_I_ULONG(MREADER* reader)
+ULONG (_mm_read_I_ULONG)(MREADER* reader)
 {
 	ULONG result=_mm_read_I_UWORD(reader);
 	result|=((ULONG)_mm_read_I_UWORD(reader))<<16;
 	return result;
 }
 
-SWORD _mm_read_M_SWORD(MREADER* reader)
+SWORD (_mm_read_M_SWORD)(MREADER* reader)
 {
 	return((SWORD)_mm_read_M_UWORD(reader));
 }
 
-SWORD _mm_read_I_SWORD(MREADER* reader)
+SWORD (_mm_read_I_SWORD)(MREADER* reader)
 {
 	return((SWORD)_mm_read_I_UWORD(reader));
 }
 
-SLONG _mm_read_M_SLONG(MREADER* reader)
+SLONG (_mm_read_M_SLONG)(MREADER* reader)
 {
 	return((SLONG)_mm_read_M_ULONG(reader));
 }
 
-SLONG _mm_read_I_SLONG(MREADER* reader)
+SLONG (_mm_read_I_SLONG)(MREADER* reader)
 {
 	return((SLONG)_mm_read_I_ULONG(reader));
 }
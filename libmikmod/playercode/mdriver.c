@@ -33,12 +33,14 @@
 #endif
 
 #include <string.h>
+#include <time.h>
 
 #include "mikmod_internals.h"
 
 #if (MIKMOD_UNIX)
 #include <pwd.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #endif
 
 #ifdef SUNOS
@@ -61,28 +63,59 @@ MIKMODAPI UBYTE md_reverb	= 0;	/* no reverb */
 MIKMODAPI UBYTE md_volume	= 128;	/* global sound volume (0-128) */
 MIKMODAPI UBYTE md_musicvolume	= 128;	/* volume of song */
 MIKMODAPI UBYTE md_sndfxvolume	= 128;	/* volume of sound effects */
+MIKMODAPI UBYTE md_loadthreads	= 0;	/* decode samples while loading them */
+MIKMODAPI UBYTE md_lazysamples	= 0;	/* load samples with their module */
+MIKMODAPI UBYTE md_prefetchorders = 2;	/* orders scanned for samples to decode */
+MIKMODAPI UBYTE md_mapsamples	= 0;	/* copy samples out of the module file */
+MIKMODAPI const CHAR* md_cachedir = NULL;	/* no module cache */
 
 /* INTERNAL GLOBALS */
 UWORD md_bpm = 125;	/* tempo */
 
 /* Do not modify the numchn variables yourself!  use MikMod_SetNumVoices() */
-UBYTE md_numchn  = 0, md_sngchn = 0, md_sfxchn = 0;
-UBYTE md_hardchn = 0, md_softchn= 0;
+UWORD md_numchn  = 0, md_sngchn = 0, md_sfxchn = 0;
+UWORD md_hardchn = 0, md_softchn= 0;
+
+SLONGLONG md_framepos = 0;	/* frames mixed since playback started */
+SLONGLONG md_tickpos = 0;	/* frame of the next md_player call */
+MD_TICKFRAC md_tickfrac = {0, 0};
 
 MikMod_player_t md_player  =  Player_HandleTick;
 
 MikMod_callback_t vc_callback = NULL;
+BOOL vc_sfxhold = 0;
+
+UBYTE md_mixquality = MIXQ_FULL;	/* adaptive mixing quality level */
 
 /* PRIVATE VARS */
 static MDRIVER *firstdriver = NULL;
 
 static volatile BOOL isplaying = 0, initialized = 0;
 
+/* Set when the software mixer is driven by Player_Render instead of the
+   driver output */
+static BOOL isrendering = 0;
+static UWORD renderformat = 0;
+
 static UBYTE *sfxinfo;
 static int sfxpool;
+static SLONGLONG *sfxstamp;
+static MP_VOICEHEAP *sfxheap = NULL;
 
 static SAMPLE **md_sample = NULL;
 
+/* Adaptive mixing quality: the time taken to mix each buffer is compared with
+   the time it takes to play, 256 meaning real time. The quality goes down one
+   level when the average load gets over MIXLOAD_HIGH, and back up when it
+   stays under MIXLOAD_LOW for MIXLOAD_HOLD buffers. */
+#define MIXLOAD_HIGH 218	/* 85% */
+#define MIXLOAD_LOW  128	/* 50% */
+#define MIXLOAD_HOLD 16
+
+static MIXLOAD mixload;
+static ULONG mixavg = 0;	/* average load, 8 times the MIXLOAD.load */
+static UWORD mixhold = 0;	/* buffers to wait before changing the level */
+
 /* Previous driver in use */
 static SWORD olddevice = -1;
 
@@ -306,7 +339,7 @@ MIKMODAPI MikMod_player_t MikMod_RegisterPlayer(MikMod_player_t player)
 MIKMODAPI void MikMod_Update(void)
 {
 	MUTEX_LOCK(vars);
-	if(isplaying) {
+	if(isplaying && !isrendering) {
 		if((!pf)||(!pf->forbid))
 			md_driver->Update();
 		else {
@@ -317,7 +350,7 @@ MIKMODAPI void MikMod_Update(void)
 	MUTEX_UNLOCK(vars);
 }
 
-void Voice_SetVolume_internal(SBYTE voice,UWORD vol)
+void Voice_SetVolume_internal(SWORD voice,UWORD vol)
 {
 	ULONG  tmp;
 
@@ -331,16 +364,21 @@ void Voice_SetVolume_internal(SBYTE voice,UWORD vol)
 	tmp=(ULONG)vol*(ULONG)md_volume*
 	     ((voice<md_sngchn)?(ULONG)md_musicvolume:(ULONG)md_sndfxvolume);
 	md_driver->VoiceSetVolume(voice,tmp/16384UL);
+
+	/* keep the stealing order of busy sound effects voices up to date */
+	if((voice>=md_sngchn)&&(sfxheap)&&(sfxheap->key[voice-md_sngchn]))
+		VoiceHeap_Update(sfxheap,voice-md_sngchn,
+		                 ((ULONG)(sfxinfo[voice-md_sngchn]+1)<<16)|vol);
 }
 
-MIKMODAPI void Voice_SetVolume(SBYTE voice,UWORD vol)
+MIKMODAPI void Voice_SetVolume(SWORD voice,UWORD vol)
 {
 	MUTEX_LOCK(vars);
 	Voice_SetVolume_internal(voice,vol);
 	MUTEX_UNLOCK(vars);
 }
 
-MIKMODAPI UWORD Voice_GetVolume(SBYTE voice)
+MIKMODAPI UWORD Voice_GetVolume(SWORD voice)
 {
 	UWORD result=0;
 
@@ -352,7 +390,7 @@ MIKMODAPI UWORD Voice_GetVolume(SBYTE voice)
 	return result;
 }
 
-void Voice_SetFrequency_internal(SBYTE voice,ULONG frq)
+void Voice_SetFrequency_internal(SWORD voice,ULONG frq)
 {
 	if((voice<0)||(voice>=md_numchn)) return;
 	if((md_sample[voice])&&(md_sample[voice]->divfactor))
@@ -360,14 +398,14 @@ void Voice_SetFrequency_internal(SBYTE voice,ULONG frq)
 	md_driver->VoiceSetFrequency(voice,frq);
 }
 
-MIKMODAPI void Voice_SetFrequency(SBYTE voice,ULONG frq)
+MIKMODAPI void Voice_SetFrequency(SWORD voice,ULONG frq)
 {
 	MUTEX_LOCK(vars);
 	Voice_SetFrequency_internal(voice,frq);
 	MUTEX_UNLOCK(vars);
 }
 
-MIKMODAPI ULONG Voice_GetFrequency(SBYTE voice)
+MIKMODAPI ULONG Voice_GetFrequency(SWORD voice)
 {
 	ULONG result=0;
 
@@ -379,7 +417,7 @@ MIKMODAPI ULONG Voice_GetFrequency(SBYTE voice)
 	return result;
 }
 
-void Voice_SetPanning_internal(SBYTE voice,ULONG pan)
+void Voice_SetPanning_internal(SWORD voice,ULONG pan)
 {
 	if((voice<0)||(voice>=md_numchn)) return;
 	if(pan!=PAN_SURROUND) {
@@ -390,7 +428,15 @@ void Voice_SetPanning_internal(SBYTE voice,ULONG pan)
 	md_driver->VoiceSetPanning(voice, pan);
 }
 
-MIKMODAPI void Voice_SetPanning(SBYTE voice,ULONG pan)
+/* Only the software mixers implement resonant filters */
+void Voice_SetFilter_internal(SWORD voice,UBYTE cutoff,UBYTE resonance)
+{
+	if((voice<0)||(voice>=md_numchn)) return;
+	if(md_driver->VoicePlay==VC_VoicePlay)
+		VC_VoiceSetFilter(voice,cutoff,resonance);
+}
+
+MIKMODAPI void Voice_SetPanning(SWORD voice,ULONG pan)
 {
 #ifdef MIKMOD_DEBUG
 	if((pan!=PAN_SURROUND)&&((pan<0)||(pan>255)))
@@ -402,7 +448,7 @@ MIKMODAPI void Voice_SetPanning(SBYTE voice,ULONG pan)
 	MUTEX_UNLOCK(vars);
 }
 
-MIKMODAPI ULONG Voice_GetPanning(SBYTE voice)
+MIKMODAPI ULONG Voice_GetPanning(SWORD voice)
 {
 	ULONG result=PAN_CENTER;
 
@@ -414,7 +460,7 @@ MIKMODAPI ULONG Voice_GetPanning(SBYTE voice)
 	return result;
 }
 
-void Voice_Play_internal(SBYTE voice,SAMPLE* s,ULONG start)
+void Voice_Play_internal(SWORD voice,SAMPLE* s,ULONG start)
 {
 	ULONG  repend;
 
@@ -430,7 +476,35 @@ void Voice_Play_internal(SBYTE voice,SAMPLE* s,ULONG start)
 	md_driver->VoicePlay(voice,s->handle,start,s->length,s->loopstart,repend,s->flags);
 }
 
-MIKMODAPI void Voice_Play(SBYTE voice,SAMPLE* s,ULONG start)
+/* Size of the mixing state of a voice, or 0 if the driver can not save it */
+ULONG Voice_StateSize_internal(void)
+{
+	if(md_driver->VoicePlay!=VC_VoicePlay) return 0;
+	return VC_VoiceStateSize();
+}
+
+void Voice_SaveState_internal(SWORD voice,void *state)
+{
+	if((voice<0)||(voice>=md_numchn)) return;
+	VC_VoiceSaveState(voice,state);
+}
+
+/* Resumes a voice from a saved mixing state; 's' is the sample it plays */
+void Voice_LoadState_internal(SWORD voice,const void *state,SAMPLE *s)
+{
+	if((voice<0)||(voice>=md_numchn)) return;
+	md_sample[voice]=s;
+	VC_VoiceLoadState(voice,state);
+}
+
+/* Tells whether a mixing state can be resumed with sample 's' */
+BOOL Voice_CheckState_internal(const void *state,SAMPLE *s)
+{
+	if(md_driver->VoicePlay!=VC_VoicePlay) return 0;
+	return VC_VoiceCheckState(state,s);
+}
+
+MIKMODAPI void Voice_Play(SWORD voice,SAMPLE* s,ULONG start)
 {
 	if(start>s->length) return;
 
@@ -439,29 +513,40 @@ MIKMODAPI void Voice_Play(SBYTE voice,SAMPLE* s,ULONG start)
 	MUTEX_UNLOCK(vars);
 }
 
-void Voice_Stop_internal(SBYTE voice)
+void Voice_Stop_internal(SWORD voice)
 {
 	if((voice<0)||(voice>=md_numchn)) return;
-	if(voice>=md_sngchn)
+	if(voice>=md_sngchn) {
 		/* It is a sound effects channel, so flag the voice as non-critical! */
 		sfxinfo[voice-md_sngchn]=0;
+		if(sfxheap) VoiceHeap_Update(sfxheap,voice-md_sngchn,0);
+	}
 	md_driver->VoiceStop(voice);
 }
 
-MIKMODAPI void Voice_Stop(SBYTE voice)
+/* Stops a voice, and makes the software mixer forget how it played, so that
+   it starts again as after MikMod_Init */
+void Voice_Reset_internal(SWORD voice)
+{
+	Voice_Stop_internal(voice);
+	if((voice>=0)&&(voice<md_numchn)&&(md_driver->VoicePlay==VC_VoicePlay))
+		VC_VoiceReset(voice);
+}
+
+MIKMODAPI void Voice_Stop(SWORD voice)
 {
 	MUTEX_LOCK(vars);
 	Voice_Stop_internal(voice);
 	MUTEX_UNLOCK(vars);
 }
 
-BOOL Voice_Stopped_internal(SBYTE voice)
+BOOL Voice_Stopped_internal(SWORD voice)
 {
 	if((voice<0)||(voice>=md_numchn)) return 0;
 	return(md_driver->VoiceStopped(voice));
 }
 
-MIKMODAPI BOOL Voice_Stopped(SBYTE voice)
+MIKMODAPI BOOL Voice_Stopped(SWORD voice)
 {
 	BOOL result;
 
@@ -472,7 +557,7 @@ MIKMODAPI BOOL Voice_Stopped(SBYTE voice)
 	return result;
 }
 
-MIKMODAPI SLONG Voice_GetPosition(SBYTE voice)
+MIKMODAPI SLONG Voice_GetPosition(SWORD voice)
 {
 	SLONG result=0;
 
@@ -488,15 +573,144 @@ MIKMODAPI SLONG Voice_GetPosition(SBYTE voice)
 	return result;
 }
 
-MIKMODAPI ULONG Voice_RealVolume(SBYTE voice)
+ULONG Voice_RealVolume_internal(SWORD voice)
 {
-	ULONG result=0;
+	if((voice>=0)&&(voice<md_numchn)&& md_driver->VoiceRealVolume)
+		return md_driver->VoiceRealVolume(voice);
+	return 0;
+}
+
+MIKMODAPI ULONG Voice_RealVolume(SWORD voice)
+{
+	ULONG result;
 
 	MUTEX_LOCK(vars);
-	if((voice>=0)&&(voice<md_numchn)&& md_driver->VoiceRealVolume)
-		result=(md_driver->VoiceRealVolume(voice));
+	result=Voice_RealVolume_internal(voice);
+	MUTEX_UNLOCK(vars);
+
+	return result;
+}
+
+/*========== Adaptive mixing quality */
+
+/* A clock in microseconds; only differences between two readings matter */
+ULONG MD_MixClock(void)
+{
+#if defined(_WIN32)||defined(__CYGWIN__)
+	LARGE_INTEGER freq,count;
+
+	if(QueryPerformanceFrequency(&freq)&&QueryPerformanceCounter(&count))
+		return (ULONG)((count.QuadPart/freq.QuadPart)*1000000+
+		               (count.QuadPart%freq.QuadPart)*1000000/freq.QuadPart);
+#elif (MIKMOD_UNIX)
+	struct timeval tv;
+
+	if(!gettimeofday(&tv,NULL))
+		return (ULONG)tv.tv_sec*1000000UL+(ULONG)tv.tv_usec;
+#endif
+	return (ULONG)((double)clock()*1000000.0/CLOCKS_PER_SEC);
+}
+
+static void MD_MixQualityReset(void)
+{
+	md_mixquality=MIXQ_FULL;
+	mixavg=mixhold=0;
+	mixload.level=MIXQ_FULL;
+	mixload.load=0;
+}
+
+/* Records that 'frames' sample frames were mixed in the time since the
+   MD_MixClock reading 'start', and moves the quality level accordingly */
+void MD_MixLoad(ULONG start,ULONG frames)
+{
+	ULONG elapsed=MD_MixClock()-start,budget,load;
+	UBYTE level=md_mixquality;
+
+	/* rendering isn't bound to real time */
+	if((isrendering)||(!frames)||(!md_mixfreq)) return;
+
+	budget=(ULONG)(((SLONGLONG)frames*1000000L)/md_mixfreq);
+	if(!budget) budget=1;
+	load=(elapsed>=budget*16)?4096:(elapsed<<8)/budget;
+	mixavg=mixavg-(mixavg>>3)+load;
+	mixload.load=(UWORD)(mixavg>>3);
+	mixload.buffers++;
+	if(load>=256) mixload.overruns++;
+
+	if(mixhold) {
+		mixhold--;
+		return;
+	}
+	if(mixload.load>MIXLOAD_HIGH) {
+		if(level+1<MIXQ_MAX) {
+			level++;
+			/* the standard mixer only interpolates when asked to */
+			if((level==MIXQ_NOINTERP)&&
+			   ((md_mode&DMODE_HQMIXER)||(!(md_mode&DMODE_INTERP))))
+				level++;
+			mixload.triggered[level]++;
+		}
+	} else if(mixload.load<MIXLOAD_LOW) {
+		if(level>MIXQ_FULL) {
+			level--;
+			if((level==MIXQ_NOINTERP)&&
+			   ((md_mode&DMODE_HQMIXER)||(!(md_mode&DMODE_INTERP))))
+				level--;
+			mixload.restored++;
+		}
+	}
+	if(level!=md_mixquality) {
+		md_mixquality=level;
+		mixload.level=level;
+		mixhold=MIXLOAD_HOLD;
+	}
+}
+
+/* Fills 'info' with the statistics of the adaptive mixing quality, and clears
+   the counters if 'reset' is set */
+MIKMODAPI void MikMod_GetMixLoad(MIXLOAD* info,BOOL reset)
+{
+	MUTEX_LOCK(vars);
+	if(info) *info=mixload;
+	if(reset) {
+		mixload.buffers=mixload.overruns=mixload.restored=0;
+		memset(mixload.triggered,0,sizeof(mixload.triggered));
+	}
+	MUTEX_UNLOCK(vars);
+}
+
+ULONG MD_TickLength(ULONG bpm,MD_TICKFRAC *frac)
+{
+	ULONG den=bpm*50L,num;
+
+	if(frac->den!=den) {
+		/* the tempo changed, keep the same part of a frame */
+		frac->rem=frac->den?(ULONG)((SLONGLONG)frac->rem*den/frac->den):0;
+		frac->den=den;
+	}
+	num=md_mixfreq*125L+frac->rem;
+	frac->rem=num%den;
+	return num/den;
+}
+
+/* Returns the number of frames the software mixer produces before the next
+   tick. The tick exactly falls 'num'/'den' of a frame after that. */
+MIKMODAPI ULONG MikMod_NextTick(ULONG* num,ULONG* den)
+{
+	ULONG result=0,n=0,d=1;
+
+	MUTEX_LOCK(vars);
+	if(isplaying && md_tickpos>md_framepos) {
+		result=(ULONG)(md_tickpos-md_framepos);
+		if(md_tickfrac.den) {
+			n=md_tickfrac.rem;
+			d=md_tickfrac.den;
+		}
+	}
 	MUTEX_UNLOCK(vars);
 
+	if(num) *num=n;
+	if(den) *den=d;
 	return result;
 }
 
@@ -584,9 +798,13 @@ void MikMod_Exit_internal(void)
 	md_driver = &drv_nos;
 
 	MikMod_free(sfxinfo);
+	MikMod_free(sfxstamp);
 	MikMod_free(md_sample);
+	VoiceHeap_Free(sfxheap);
 	md_sample  = NULL;
 	sfxinfo    = NULL;
+	sfxstamp   = NULL;
+	sfxheap    = NULL;
 
 	initialized = 0;
 }
@@ -604,13 +822,16 @@ MIKMODAPI void MikMod_Exit(void)
    If the driver has not been initialized, it will be now. */
 static int _mm_reset(const CHAR *cmdline)
 {
-	BOOL wasplaying = 0;
+	BOOL wasplaying = 0, wasrendering = isrendering;
 
 	if(!initialized) return _mm_init(cmdline);
 
 	if (isplaying) {
 		wasplaying = 1;
-		md_driver->PlayStop();
+		if (isrendering)
+			MikMod_DisableOutput_internal();
+		else
+			md_driver->PlayStop();
 	}
 
 	if((!md_driver->Reset)||(md_device != olddevice)) {
@@ -632,6 +853,7 @@ static int _mm_reset(const CHAR *cmdline)
 		}
 	}
 
+	if (wasrendering) return MikMod_StartRender_internal(renderformat);
 	if (wasplaying) return md_driver->PlayStart();
 	return 0;
 }
@@ -652,7 +874,7 @@ MIKMODAPI int MikMod_Reset(const CHAR *cmdline)
 /* If either parameter is -1, the current set value will be retained. */
 int MikMod_SetNumVoices_internal(int music, int sfx)
 {
-	BOOL resume = 0;
+	BOOL resume = 0, rerender = isrendering;
 	int t, oldchn = 0;
 
 	if((!music)&&(!sfx)) return 1;
@@ -664,9 +886,13 @@ int MikMod_SetNumVoices_internal(int music, int sfx)
 	}
 
 	MikMod_free(sfxinfo);
+	MikMod_free(sfxstamp);
 	MikMod_free(md_sample);
+	VoiceHeap_Free(sfxheap);
 	md_sample  = NULL;
 	sfxinfo    = NULL;
+	sfxstamp   = NULL;
+	sfxheap    = NULL;
 
 	if(music!=-1) md_sngchn = music;
 	if(sfx!=-1)   md_sfxchn = sfx;
@@ -685,14 +911,22 @@ int MikMod_SetNumVoices_internal(int music, int sfx)
 
 	if(md_sngchn+md_sfxchn)
 		md_sample=(SAMPLE**)MikMod_calloc(md_sngchn+md_sfxchn,sizeof(SAMPLE*));
-	if(md_sfxchn)
+	if(md_sfxchn) {
 		sfxinfo = (UBYTE *)MikMod_calloc(md_sfxchn,sizeof(UBYTE));
+		sfxstamp = (SLONGLONG *)MikMod_calloc(md_sfxchn,sizeof(SLONGLONG));
+		sfxheap = VoiceHeap_New(md_sfxchn);
+	}
 
 	/* make sure the player doesn't start with garbage */
 	for(t=oldchn;t<md_numchn;t++)  Voice_Stop_internal(t);
 
 	sfxpool = 0;
-	if(resume) MikMod_EnableOutput_internal();
+	if(resume) {
+		if(rerender)
+			MikMod_StartRender_internal(renderformat);
+		else
+			MikMod_EnableOutput_internal();
+	}
 	_mm_critical = 0;
 
 	return 0;
@@ -712,9 +946,11 @@ MIKMODAPI int MikMod_SetNumVoices(int music, int sfx)
 int MikMod_EnableOutput_internal(void)
 {
 	_mm_critical = 1;
+	if(isrendering) MikMod_DisableOutput_internal();
 	if(!isplaying) {
 		if(md_driver->PlayStart()) return 1;
 		isplaying = 1;
+		MD_MixQualityReset();
 	}
 	_mm_critical = 0;
 	return 0;
@@ -735,8 +971,58 @@ void MikMod_DisableOutput_internal(void)
 {
 	if(isplaying && md_driver) {
 		isplaying = 0;
-		md_driver->PlayStop();
+		if(isrendering) {
+			isrendering = 0;
+			VC_PlayStop();
+			VC_SetFormat(md_mode);
+		} else
+			md_driver->PlayStop();
+	}
+}
+
+/* Starts driving the software mixer from Player_Render, in the given output
+   format, instead of through the driver output. */
+int MikMod_StartRender_internal(UWORD format)
+{
+	SLONGLONG framepos = 0, tickpos = 0;
+	MD_TICKFRAC tickfrac = {0, 0};
+
+	format &= DMODE_FORMATMASK;
+	if(md_driver->VoicePlay != VC_VoicePlay) {
+		_mm_errno = MMERR_RENDER_DRIVER;
+		return 1;
+	}
+	if(isplaying && !isrendering) {
+		_mm_errno = MMERR_RENDER_BUSY;
+		return 1;
 	}
+
+	if(isrendering) {
+		if(format == renderformat) return 0;
+
+		/* only the output format changes, keep the song position */
+		framepos = md_framepos;
+		tickpos = md_tickpos;
+		tickfrac = md_tickfrac;
+		VC_PlayStop();
+		isplaying = isrendering = 0;
+	}
+
+	VC_SetFormat(format);
+	if(VC_PlayStart()) {
+		VC_PlayStop();
+		VC_SetFormat(md_mode);
+		_mm_errno = MMERR_INITIALIZING_MIXER;
+		return 1;
+	}
+	md_framepos = framepos;
+	md_tickpos = tickpos;
+	md_tickfrac = tickfrac;
+
+	renderformat = format;
+	isplaying = isrendering = 1;
+	MD_MixQualityReset();
+	return 0;
 }
 
 MIKMODAPI void MikMod_DisableOutput(void)
@@ -746,6 +1032,15 @@ MIKMODAPI void MikMod_DisableOutput(void)
 	MUTEX_UNLOCK(vars);
 }
 
+/* Size in bytes of a sample frame produced by the software mixer */
+int MikMod_FrameSize_internal(void)
+{
+	UWORD format=isrendering?renderformat:md_mode;
+	int size=(format&DMODE_FLOAT)?4:(format&DMODE_16BITS)?2:1;
+
+	return (format&DMODE_STEREO)?size<<1:size;
+}
+
 BOOL MikMod_Active_internal(void)
 {
 	return isplaying;
@@ -762,56 +1057,173 @@ MIKMODAPI BOOL MikMod_Active(void)
 	return result;
 }
 
-/* Plays a sound effects sample.  Picks a voice from the number of voices
-   allocated for use as sound effects (loops through voices, skipping all active
-   criticals).
+/*========== Voice allocation */
+
+MP_VOICEHEAP* VoiceHeap_New(int numvoices)
+{
+	MP_VOICEHEAP *h;
+	int t;
+
+	if(!(h=(MP_VOICEHEAP*)MikMod_calloc(1,sizeof(MP_VOICEHEAP))))
+		return NULL;
+	if(numvoices) {
+		h->heap=(int*)MikMod_malloc(numvoices*sizeof(int));
+		h->pos=(int*)MikMod_malloc(numvoices*sizeof(int));
+		h->key=(ULONG*)MikMod_calloc(numvoices,sizeof(ULONG));
+		if((!h->heap)||(!h->pos)||(!h->key)) {
+			VoiceHeap_Free(h);
+			return NULL;
+		}
+	}
+	/* all keys are equal, so the identity is a valid heap */
+	for(t=0;t<numvoices;t++)
+		h->heap[t]=h->pos[t]=t;
+	h->numvoices=numvoices;
+
+	return h;
+}
+
+void VoiceHeap_Free(MP_VOICEHEAP* h)
+{
+	if(!h) return;
+	MikMod_free(h->heap);
+	MikMod_free(h->pos);
+	MikMod_free(h->key);
+	MikMod_free(h);
+}
+
+/* heap order: lower key first, lower voice number on ties */
+#define VH_BEFORE(h,a,b) (((h)->key[a]<(h)->key[b])|| \
+                          (((h)->key[a]==(h)->key[b])&&((a)<(b))))
+
+void VoiceHeap_Update(MP_VOICEHEAP* h,int voice,ULONG key)
+{
+	int i,j,v;
+
+	if((voice<0)||(voice>=h->numvoices)||(h->key[voice]==key)) return;
+	h->key[voice]=key;
+	i=h->pos[voice];
+
+	/* sift up */
+	while(i) {
+		j=(i-1)>>1;
+		v=h->heap[j];
+		if(!VH_BEFORE(h,voice,v)) break;
+		h->heap[i]=v;h->pos[v]=i;
+		i=j;
+	}
+	/* sift down */
+	for(;;) {
+		j=(i<<1)+1;
+		if(j>=h->numvoices) break;
+		if((j+1<h->numvoices)&&(VH_BEFORE(h,h->heap[j+1],h->heap[j]))) j++;
+		v=h->heap[j];
+		if(!VH_BEFORE(h,v,voice)) break;
+		h->heap[i]=v;h->pos[v]=i;
+		i=j;
+	}
+	h->heap[i]=voice;h->pos[voice]=i;
+}
+
+/* Number of sound effects voices checked for natural end of playback on each
+   Sample_Play call, with drivers which don't report it. */
+#define SFX_SWEEP 4
+
+/* Called by the software mixer when a voice stops playing, so that the voice
+   allocation keys follow without polling the voices. */
+void MD_VoiceEnded(SWORD voice)
+{
+	if(voice<md_sngchn) {
+		Player_VoiceEnded(voice);
+		return;
+	}
+	voice-=md_sngchn;
+	if((voice<md_sfxchn)&&(sfxheap)&&(sfxheap->key[voice])) {
+		sfxinfo[voice]=0;
+		VoiceHeap_Update(sfxheap,voice,0);
+	}
+}
+
+/* Returns whether the sample on a sound effects voice has ended. */
+static BOOL Sample_Ended(int t)
+{
+	/* the software mixer only starts a voice when it next mixes, so a voice
+	   played since then still looks stopped */
+	if((md_mode&DMODE_SOFT_SNDFX)&&(sfxstamp[t]==md_framepos)) return 0;
+	return md_driver->VoiceStopped(t+md_sngchn);
+}
+
+/* Plays a sound effects sample. Sound effects voices are kept in a heap keyed
+   on priority, then volume; a free voice is used if there is one, otherwise
+   the quietest voice of the lowest priority is taken over, provided it does
+   not outrank the new sound. Critical voices are never taken over.
 
    Returns the voice that the sound is being played on. */
-static SBYTE Sample_Play_internal(SAMPLE *s,ULONG start,UBYTE flags)
+static SWORD Sample_PlayPriority_internal(SAMPLE *s,ULONG start,UBYTE priority)
 {
-	int orig=sfxpool;/* for cases where all channels are critical */
-	int c;
+	int t,c;
 
-	if(!md_sfxchn) return -1;
+	if((!md_sfxchn)||(!sfxheap)||(!sfxstamp)) return -1;
 	if(s->volume>64) s->volume = 64;
 
-	/* check the first location after sfxpool */
-	do {
-		if(sfxinfo[sfxpool]&SFX_CRITICAL) {
-			if(md_driver->VoiceStopped(c=sfxpool+md_sngchn)) {
-				sfxinfo[sfxpool]=flags;
-				Voice_Play_internal(c,s,start);
-				md_driver->VoiceSetVolume(c,s->volume<<2);
-				Voice_SetPanning_internal(c,s->panning);
-				md_driver->VoiceSetFrequency(c,s->speed);
-				sfxpool++;
-				if(sfxpool>=md_sfxchn) sfxpool=0;
-				return c;
+	/* the software mixer reports the voices which reach the end of their
+	   sample; with other drivers, they only notice it here, so look at a
+	   few of them each time */
+	if(MD_POLLVOICES) {
+		for(t=0;t<SFX_SWEEP&&t<md_sfxchn;t++) {
+			if((sfxheap->key[sfxpool])&&(Sample_Ended(sfxpool))) {
+				sfxinfo[sfxpool]=0;
+				VoiceHeap_Update(sfxheap,sfxpool,0);
 			}
-		} else {
-			sfxinfo[sfxpool]=flags;
-			Voice_Play_internal(c=sfxpool+md_sngchn,s,start);
-			md_driver->VoiceSetVolume(c,s->volume<<2);
-			Voice_SetPanning_internal(c,s->panning);
-			md_driver->VoiceSetFrequency(c,s->speed);
-			sfxpool++;
-			if(sfxpool>=md_sfxchn) sfxpool=0;
-			return c;
+			if(++sfxpool>=md_sfxchn) sfxpool=0;
 		}
 
-		sfxpool++;
-		if(sfxpool>=md_sfxchn) sfxpool = 0;
-	} while(sfxpool!=orig);
+		t=VoiceHeap_Top(sfxheap);
+		if((sfxheap->key[t])&&(!Sample_Ended(t)))
+			/* no voice is known to be free, so look for the ones which
+			   ended since the last sweeps */
+			for(c=0;c<md_sfxchn;c++)
+				if((sfxheap->key[c])&&(Sample_Ended(c))) {
+					sfxinfo[c]=0;
+					VoiceHeap_Update(sfxheap,c,0);
+				}
+	}
+
+	t=VoiceHeap_Top(sfxheap);
+	if(sfxheap->key[t])
+		if((sfxinfo[t]==SFX_PRIORITY_CRITICAL)||(sfxinfo[t]>priority))
+			return -1;
+	c=t+md_sngchn;
+
+	sfxinfo[t]=priority;
+	sfxstamp[t]=md_framepos;
+	Voice_Play_internal(c,s,start);
+	md_driver->VoiceSetVolume(c,s->volume<<2);
+	Voice_SetPanning_internal(c,s->panning);
+	md_driver->VoiceSetFrequency(c,s->speed);
+	VoiceHeap_Update(sfxheap,t,((ULONG)(priority+1)<<16)|(s->volume<<2));
+
+	return c;
+}
 
-	return -1;
+MIKMODAPI SWORD Sample_PlayPriority(SAMPLE *s,ULONG start,UBYTE priority)
+{
+	SWORD result;
+
+	MUTEX_LOCK(vars);
+	result=Sample_PlayPriority_internal(s,start,priority);
+	MUTEX_UNLOCK(vars);
+
+	return result;
 }
 
-MIKMODAPI SBYTE Sample_Play(SAMPLE *s,ULONG start,UBYTE flags)
+MIKMODAPI SWORD Sample_Play(SAMPLE *s,ULONG start,UBYTE flags)
 {
-	SBYTE result;
+	SWORD result;
 
 	MUTEX_LOCK(vars);
-	result=Sample_Play_internal(s,start,flags);
+	result=Sample_PlayPriority_internal(s,start,
+	           (flags&SFX_CRITICAL)?SFX_PRIORITY_CRITICAL:0);
 	MUTEX_UNLOCK(vars);
 
 	return result;
@@ -843,6 +1255,7 @@ MIKMODAPI long MikMod_GetVersion(void)
 
 INIT_MUTEX(vars);
 INIT_MUTEX(lists);
+INIT_MUTEX(events);
 
 MIKMODAPI BOOL MikMod_InitThreads(void)
 {
@@ -855,14 +1268,16 @@ MIKMODAPI BOOL MikMod_InitThreads(void)
 		result=1;
 #elif defined(__OS2__)||defined(__EMX__)
 		if(DosCreateMutexSem((PSZ)NULL,&_mm_mutex_lists,0,0) ||
-		   DosCreateMutexSem((PSZ)NULL,&_mm_mutex_vars,0,0)) {
-			_mm_mutex_lists=_mm_mutex_vars=(HMTX)NULL;
+		   DosCreateMutexSem((PSZ)NULL,&_mm_mutex_vars,0,0) ||
+		   DosCreateMutexSem((PSZ)NULL,&_mm_mutex_events,0,0)) {
+			_mm_mutex_lists=_mm_mutex_vars=_mm_mutex_events=(HMTX)NULL;
 			result=0;
 		} else
 			result=1;
 #elif defined(_WIN32)
 		if((!(_mm_mutex_lists=CreateMutex(NULL,FALSE,TEXT("libmikmod(lists)"))))||
-		   (!(_mm_mutex_vars=CreateMutex(NULL,FALSE,TEXT("libmikmod(vars)")))))
+		   (!(_mm_mutex_vars=CreateMutex(NULL,FALSE,TEXT("libmikmod(vars)"))))||
+		   (!(_mm_mutex_events=CreateMutex(NULL,FALSE,TEXT("libmikmod(events)")))))
 			result=0;
 		else
 			result=1;
@@ -50,12 +50,20 @@ MODULE of;
 
 static	MLOADER *firstloader=NULL;
 
+/* A module kept in md_cachedir: the identity of the file it was loaded from,
+   and the name of the cache file */
+typedef struct MLCACHE {
+	CHAR *key;
+	CHAR *name;
+	BOOL hit;		/* the cache file holds the module */
+} MLCACHE;
+
 #ifndef NO_DEPACKERS
-static	MUNPACKER unpackers[] = {
-	PP20_Unpack,
-	MMCMP_Unpack,
-	XPK_Unpack,
-	S404_Unpack,
+static	const MUNPACKER *unpackers[] = {
+	&PP20_Unpacker,
+	&MMCMP_Unpacker,
+	&XPK_Unpacker,
+	&S404_Unpacker,
 	NULL
 };
 #endif
@@ -316,6 +324,23 @@ static void ML_FreeEx(MODULE *mf)
 {
 	UWORD t;
 
+	if (mf->song) {
+		/* player instance: the song data belongs to another module, which
+		   may already have been released by its user */
+		MODULE *owner = mf->song;
+
+		MikMod_free(mf);
+		if (--owner->refcount) return;
+		mf = owner;
+	} else if (mf->refcount > 1) {
+		/* instances still play this song, keep the data around; the last
+		   one to go will free it */
+		mf->refcount--;
+		return;
+	}
+
+	/* stop decoding samples ahead before they go */
+	SL_FreeLazy(mf->lazy);
 	MikMod_free(mf->songname);
 	MikMod_free(mf->comment);
 
@@ -329,6 +354,7 @@ static void ML_FreeEx(MODULE *mf)
 			MikMod_free(mf->tracks[t]);
 		MikMod_free(mf->tracks);
 	}
+	MikMod_free(mf->rowindex);
 	if(mf->instruments) {
 		for(t=0;t<mf->numins;t++)
 			ML_XFreeInstrument(&mf->instruments[t]);
@@ -341,6 +367,7 @@ static void ML_FreeEx(MODULE *mf)
 		}
 		MikMod_free(mf->samples);
 	}
+	_mm_map_release(mf->storage);
 	memset(mf,0,sizeof(MODULE));
 	if(mf!=&of) MikMod_free(mf);
 }
@@ -351,18 +378,18 @@ static MODULE *ML_AllocUniMod(void)
 }
 
 #ifndef NO_DEPACKERS
-static BOOL ML_TryUnpack(MREADER *reader,void **out,long *outlen)
+/* Returns a reader of the unpacked module if the module in the reader is
+   packed, or NULL. Only the headers of packed data are read here; the data is
+   unpacked as far as it is read. */
+static MREADER* ML_TryUnpack(MREADER *reader)
 {
+	MREADER *unpk;
 	int i;
 
-	*out = NULL;
-	*outlen = 0;
-
-	for(i=0;unpackers[i]!=NULL;++i) {
-		_mm_rewind(reader);
-		if(unpackers[i](reader,out,outlen)) return 1;
-	}
-	return 0;
+	for(i=0;unpackers[i]!=NULL;++i)
+		if((unpk=_mm_new_unpack_reader(reader,unpackers[i])) != NULL)
+			return unpk;
+	return NULL;
 }
 #endif
 
@@ -381,13 +408,98 @@ MIKMODAPI void Player_Free(MODULE *mf)
 	MUTEX_UNLOCK(vars);
 }
 
+/* Creates a new player instance of an already loaded module. The instance
+   has its own playback state, but shares the patterns, instruments and
+   samples of the original module, which stay allocated until the original
+   and all its instances have been freed with Player_Free. */
+static MODULE* Player_CreateInstance_internal(MODULE *mf)
+{
+	MODULE *owner, *inst;
+
+	if (!mf) return NULL;
+	owner = mf->song ? mf->song : mf;
+
+	if (!(inst=ML_AllocUniMod())) return NULL;
+	memcpy(inst,owner,sizeof(MODULE));
+	inst->control=NULL;
+	inst->voice=NULL;
+	inst->events=NULL;
+	inst->voiceheap=NULL;
+	inst->timeline=NULL;
+	inst->forbid=1;
+	inst->song=owner;
+	inst->refcount=0;
+	/* the original module may have changed its panning while playing */
+	memcpy(inst->panning,owner->inipanning,sizeof(inst->panning));
+
+	if (Player_Init(inst)) {
+		MikMod_free(inst->control);
+		MikMod_free(inst->voice);
+		VoiceHeap_Free(inst->voiceheap);
+		MikMod_free(inst->timeline);
+		MikMod_free(inst);
+		return NULL;
+	}
+	owner->refcount++;
+
+	return inst;
+}
+
+MIKMODAPI MODULE* Player_CreateInstance(MODULE *mf)
+{
+	MODULE* result;
+
+	MUTEX_LOCK(vars);
+	result=Player_CreateInstance_internal(mf);
+	MUTEX_UNLOCK(vars);
+
+	return result;
+}
+
+/* Returns whether a module header of 'len' bytes holds one of the signatures
+   of a loader */
+static BOOL ML_Signed(const MLOADER *l,const UBYTE *header,long len)
+{
+	const MLOADERSIG *sig;
+
+	for(sig=l->signatures;sig->length;sig++)
+		if((sig->offset+sig->length<=len)&&
+		   (!memcmp(header+sig->offset,sig->magic,sig->length)))
+			return 1;
+	return 0;
+}
+
+/* Finds the loader of the module in modreader. The module header is read
+   once, and only the loaders whose signatures it holds, or which have none,
+   are tested. */
+static MLOADER* ML_FindLoader(void)
+{
+	UBYTE header[ML_HEADERSIZE];
+	MLOADER *l;
+	long len;
+
+	/* readers which can't tell their size get every loader tested */
+	_mm_fseek(modreader,0,SEEK_END);
+	len=_mm_ftell(modreader);
+	if(len>ML_HEADERSIZE) len=ML_HEADERSIZE;
+	_mm_rewind(modreader);
+	if((len<=0)||(!_mm_read_UBYTES(header,len,modreader))) len=-1;
+
+	for(l=firstloader;l;l=l->next) {
+		if((len>=0)&&(l->signatures)&&(!ML_Signed(l,header,len)))
+			continue;
+		_mm_rewind(modreader);
+		if(l->Test()) break;
+	}
+	return l;
+}
+
 static CHAR* Player_LoadTitle_internal(MREADER *reader)
 {
 	MLOADER *l;
 	CHAR *title;
 	#ifndef NO_DEPACKERS
-	void *unpk;
-	long newlen;
+	MREADER *unpk;
 	#endif
 
 	modreader=reader;
@@ -396,20 +508,12 @@ static CHAR* Player_LoadTitle_internal(MREADER *reader)
 	_mm_iobase_setcur(modreader);
 
 	#ifndef NO_DEPACKERS
-	if(ML_TryUnpack(modreader,&unpk,&newlen)) {
-		if(!(modreader=_mm_new_mem_reader(unpk,newlen))) {
-			modreader=reader;
-			MikMod_free(unpk);
-			return NULL;
-		}
-	}
+	if((unpk=ML_TryUnpack(modreader)) != NULL)
+		modreader=unpk;
 	#endif
 
 	/* Try to find a loader that recognizes the module */
-	for(l=firstloader;l;l=l->next) {
-		_mm_rewind(modreader);
-		if(l->Test()) break;
-	}
+	l=ML_FindLoader();
 
 	if(l) {
 		title = l->LoadTitle();
@@ -422,9 +526,8 @@ static CHAR* Player_LoadTitle_internal(MREADER *reader)
 
 	#ifndef NO_DEPACKERS
 	if (modreader!=reader) {
-		_mm_delete_mem_reader(modreader);
+		_mm_delete_unpack_reader(modreader);
 		modreader=reader;
-		MikMod_free(unpk);
 	}
 	#endif
 	return title;
@@ -491,71 +594,27 @@ MIKMODAPI CHAR* Player_LoadTitle(const CHAR* filename)
 	return result;
 }
 
-/* Loads a module given an reader */
-static MODULE* Player_LoadGeneric_internal(MREADER *reader,int maxchan,BOOL curious)
+/* Finds the loader of the module in modreader, and parses the module into
+   'of' without registering its samples. On failure, 'of' holds nothing. */
+static BOOL ML_Parse(MLOADER *l,BOOL curious)
 {
 	int t;
-	MLOADER *l;
 	BOOL ok;
-	MODULE *mf;
-	#ifndef NO_DEPACKERS
-	void *unpk;
-	long newlen;
-	#endif
-
-	modreader = reader;
-	_mm_errno = 0;
-	_mm_critical = 0;
-	_mm_iobase_setcur(modreader);
-
-	#ifndef NO_DEPACKERS
-	if(ML_TryUnpack(modreader,&unpk,&newlen)) {
-		if(!(modreader=_mm_new_mem_reader(unpk,newlen))) {
-			modreader=reader;
-			MikMod_free(unpk);
-			return NULL;
-		}
-	}
-	#endif
 
 	/* Try to find a loader that recognizes the module */
-	for(l=firstloader;l;l=l->next) {
-		_mm_rewind(modreader);
-		if(l->Test()) break;
-	}
+	if(!l) l=ML_FindLoader();
 
 	if(!l) {
 		_mm_errno = MMERR_NOT_A_MODULE;
-		#ifndef NO_DEPACKERS
-		if(modreader!=reader) {
-			_mm_delete_mem_reader(modreader);
-			modreader=reader;
-			MikMod_free(unpk);
-		}
-		#endif
-		if(_mm_errorhandler) _mm_errorhandler();
-		_mm_rewind(modreader);
-		_mm_iobase_revert(modreader);
-		return NULL;
+		return 0;
 	}
 
 	/* init unitrk routines */
-	if(!UniInit()) {
-		#ifndef NO_DEPACKERS
-		if(modreader!=reader) {
-			_mm_delete_mem_reader(modreader);
-			modreader=reader;
-			MikMod_free(unpk);
-		}
-		#endif
-		if(_mm_errorhandler) _mm_errorhandler();
-		_mm_rewind(modreader);
-		_mm_iobase_revert(modreader);
-		return NULL;
-	}
+	if(!UniInit()) return 0;
 
 	/* init the module structure with vanilla settings */
 	memset(&of,0,sizeof(MODULE));
+	of.refcount = 1;
 	of.bpmlimit = 33;
 	of.initvolume = 128;
 	for (t = 0; t < UF_MAXCHAN; t++) of.chanvol[t] = 64;
@@ -579,15 +638,74 @@ static MODULE* Player_LoadGeneric_internal(MREADER *reader,int maxchan,BOOL curi
 	if (l->Cleanup) l->Cleanup();
 	UniCleanup();
 
-	if(ok) ok = ML_LoadSamples();
-	if(ok) ok = ((mf=ML_AllocUniMod()) != NULL);
+	if(!ok) ML_FreeEx(&of);
+	return ok;
+}
+
+/* Writes the module parsed into 'of', whose samples are registered, to its
+   cache file. The samples are decoded for this, and loaded from their decoded
+   form afterwards. A module which can't be kept is simply not kept. */
+static void ML_WriteCache(const MLCACHE *cache)
+{
+	MWRITER *writer;
+	CHAR *tmp;
+	FILE *fp;
+	BOOL ok=0;
+
+	if(SL_DecodeSamples()) return;
+	if(!(tmp=(CHAR*)MikMod_malloc(strlen(cache->name)+5))) return;
+	strcpy(tmp,cache->name);
+	strcat(tmp,".tmp");
+
+	/* written aside, for no one to ever map an incomplete file */
+	if((fp=fopen(tmp,"wb")) != NULL) {
+		if((writer=_mm_new_file_writer(fp)) != NULL) {
+			ok=UNI_Write(writer,cache->key,&of);
+			_mm_delete_file_writer(writer);
+		}
+		if(ferror(fp)) ok=0;
+		if(fclose(fp)) ok=0;
+		if(ok) {
+			remove(cache->name);
+			ok=!rename(tmp,cache->name);
+		}
+		if(!ok) remove(tmp);
+	}
+	MikMod_free(tmp);
+}
+
+/* Loads a module given an reader, from or to its cache file if 'cache' is
+   not NULL */
+static MODULE* Player_LoadGeneric_internal(MREADER *reader,int maxchan,BOOL curious,const MLCACHE *cache)
+{
+	int t;
+	BOOL ok;
+	MODULE *mf;
+	#ifndef NO_DEPACKERS
+	MREADER *unpk;
+	#endif
+
+	modreader = reader;
+	_mm_errno = 0;
+	_mm_critical = 0;
+	_mm_iobase_setcur(modreader);
+
+	#ifndef NO_DEPACKERS
+	if((unpk=ML_TryUnpack(modreader)) != NULL)
+		modreader=unpk;
+	#endif
+
+	if((ok = ML_Parse((cache&&cache->hit)?&load_uni:NULL,curious)) != 0) {
+		ok = ML_LoadSamples();
+		if(ok && cache && !cache->hit) ML_WriteCache(cache);
+		if(ok) ok = ((mf=ML_AllocUniMod()) != NULL);
+		if(!ok) ML_FreeEx(&of);
+	}
 	if(!ok) {
-		ML_FreeEx(&of);
 		#ifndef NO_DEPACKERS
 		if(modreader!=reader) {
-			_mm_delete_mem_reader(modreader);
+			_mm_delete_unpack_reader(modreader);
 			modreader=reader;
-			MikMod_free(unpk);
 		}
 		#endif
 		if(_mm_errorhandler) _mm_errorhandler();
@@ -617,14 +735,20 @@ static MODULE* Player_LoadGeneric_internal(MREADER *reader,int maxchan,BOOL curi
 		ok = !MikMod_SetNumVoices_internal(maxchan,-1);
 	}
 
+	/* samples of mapped files may wait until they are played */
+	if(ok && md_lazysamples)
+		mf->lazy = SL_DeferSamples(modreader,mf->samples,mf->numsmp);
 	if(ok) ok = !SL_LoadSamples();
+	/* samples used in place keep the file mapping they point into */
+	if(ok) mf->storage = _mm_reader_mapping(modreader);
 	if(ok) ok = !Player_Init(mf);
+	/* the index only speeds up the player, which can do without it */
+	if(ok) mf->rowindex = UniIndexTracks(mf->tracks,mf->numtrk);
 
 	#ifndef NO_DEPACKERS
 	if(modreader!=reader) {
-		_mm_delete_mem_reader(modreader);
+		_mm_delete_unpack_reader(modreader);
 		modreader=reader;
-		MikMod_free(unpk);
 	}
 	#endif
 	_mm_iobase_revert(modreader);
@@ -642,7 +766,7 @@ MIKMODAPI MODULE* Player_LoadGeneric(MREADER *reader,int maxchan,BOOL curious)
 
 	MUTEX_LOCK(vars);
 	MUTEX_LOCK(lists);
-		result=Player_LoadGeneric_internal(reader,maxchan,curious);
+		result=Player_LoadGeneric_internal(reader,maxchan,curious,NULL);
 	MUTEX_UNLOCK(lists);
 	MUTEX_UNLOCK(vars);
 
@@ -676,13 +800,76 @@ MIKMODAPI MODULE* Player_LoadFP(FILE* fp,int maxchan,BOOL curious)
 	return result;
 }
 
+/* Finds the cache file of a module file in md_cachedir. Returns 0 if the
+   module can't be kept there. */
+static BOOL ML_FindCache(const CHAR *filename,BOOL curious,MLCACHE *cache)
+{
+	size_t len=strlen(filename)+48;
+	ULONG hash=2166136261UL;
+	const UBYTE *k;
+
+	cache->key=NULL;
+	cache->name=NULL;
+	cache->hit=0;
+	if(!md_cachedir) return 0;
+
+	if(!(cache->key=(CHAR*)MikMod_malloc(len))||
+	   !(cache->name=(CHAR*)MikMod_malloc(strlen(md_cachedir)+14)))
+		return 0;
+	/* leaving room for the suffixes */
+	if(!_mm_file_key(filename,cache->key,len-8)) return 0;
+	/* modules loaded curious have more samples */
+	if(curious) strcat(cache->key,"|c");
+	/* files of another layout, or made on a machine of another byte order,
+	   are not found */
+	sprintf(cache->key+strlen(cache->key),"|%c%d",UNI_CACHEORDER,
+	        UNI_CACHELAYOUT);
+
+	/* FNV-1a */
+	for(k=(const UBYTE*)cache->key;*k;k++)
+		hash=((hash^*k)*16777619UL)&0xffffffffUL;
+	sprintf(cache->name,"%s/%08lx.uni",md_cachedir,(unsigned long)hash);
+	return 1;
+}
+
 /* Open a module via its filename.  The loader will initialize the specified
    song-player 'player'. */
 MIKMODAPI MODULE* Player_Load(const CHAR* filename,int maxchan,BOOL curious)
 {
 	FILE *fp;
 	MODULE *mf=NULL;
+	MREADER *reader;
+	MLCACHE cache;
+	BOOL loaded=0;
 
+	MUTEX_LOCK(vars);
+	MUTEX_LOCK(lists);
+	if(ML_FindCache(filename,curious,&cache)) {
+		if((reader=_mm_new_map_reader(cache.name)) != NULL) {
+			if((cache.hit=UNI_IsCache(reader,cache.key)) != 0)
+				mf=Player_LoadGeneric_internal(reader,maxchan,curious,&cache);
+			_mm_delete_map_reader(reader);
+		}
+		/* a cache file which doesn't load is replaced */
+		cache.hit=0;
+		if(!mf && (reader=_mm_new_map_reader(filename)) != NULL) {
+			mf=Player_LoadGeneric_internal(reader,maxchan,curious,&cache);
+			_mm_delete_map_reader(reader);
+			loaded=1;
+		}
+	}
+	MikMod_free(cache.key);
+	MikMod_free(cache.name);
+	MUTEX_UNLOCK(lists);
+	MUTEX_UNLOCK(vars);
+	if(mf||loaded) return mf;
+
+	/* map the file when possible, so that samples can be used in place */
+	if((reader=_mm_new_map_reader(filename)) != NULL) {
+		mf=Player_LoadGeneric(reader,maxchan,curious);
+		_mm_delete_map_reader(reader);
+		return mf;
+	}
 	if((fp=_mm_fopen(filename,"rb")) != NULL) {
 		mf=Player_LoadFP(fp,maxchan,curious);
 		_mm_fclose(fp);
@@ -690,4 +877,140 @@ MIKMODAPI MODULE* Player_Load(const CHAR* filename,int maxchan,BOOL curious)
 	return mf;
 }
 
+/* Describes the module parsed into 'of', and frees it. The strings are
+   handed over to the description. */
+static MODULEINFO* ML_Describe(void)
+{
+	MODULEINFO *info;
+	SAMPLE *s;
+	int t;
+
+	if(!(info=(MODULEINFO*)MikMod_calloc(1,sizeof(MODULEINFO)))) {
+		_mm_errno=MMERR_OUT_OF_MEMORY;
+		ML_FreeEx(&of);
+		return NULL;
+	}
+	info->songname  = of.songname;
+	info->modtype   = of.modtype;
+	info->comment   = of.comment;
+	of.songname = of.modtype = of.comment = NULL;
+
+	info->flags     = of.flags;
+	info->numchn    = of.numchn;
+	info->numvoices = of.numvoices;
+	info->numpos    = of.numpos;
+	info->numpat    = of.numpat;
+	info->numtrk    = of.numtrk;
+	info->numins    = of.numins;
+	info->numsmp    = of.numsmp;
+	info->initspeed = of.initspeed;
+	info->inittempo = of.inittempo;
+	info->initvolume= of.initvolume;
+
+	/* the software mixer keeps samples in 16 bits */
+	for(t=0,s=of.samples;t<of.numsmp;t++,s++)
+		info->samplebytes+=s->length*((s->flags&SF_STEREO)?2:1)*sizeof(SWORD);
+
+	ML_FreeEx(&of);
+	return info;
+}
+
+/* Reads the description of a module, parsing its header and patterns only */
+static MODULEINFO* Player_Probe_internal(MREADER *reader)
+{
+	MODULEINFO *info=NULL;
+	#ifndef NO_DEPACKERS
+	MREADER *unpk;
+	#endif
+
+	modreader=reader;
+	_mm_errno = 0;
+	_mm_critical = 0;
+	_mm_iobase_setcur(modreader);
+
+	#ifndef NO_DEPACKERS
+	if((unpk=ML_TryUnpack(modreader)) != NULL)
+		modreader=unpk;
+	#endif
+
+	if(ML_Parse(NULL,0)) info=ML_Describe();
+	if(!info && _mm_errorhandler) _mm_errorhandler();
+
+	#ifndef NO_DEPACKERS
+	if(modreader!=reader) {
+		_mm_delete_unpack_reader(modreader);
+		modreader=reader;
+	}
+	#endif
+	_mm_iobase_revert(modreader);
+	return info;
+}
+
+MIKMODAPI MODULEINFO* Player_ProbeGeneric(MREADER *reader)
+{
+	MODULEINFO *result=NULL;
+
+	if (reader) {
+		MUTEX_LOCK(lists);
+		result=Player_Probe_internal(reader);
+		MUTEX_UNLOCK(lists);
+	}
+	return result;
+}
+
+MIKMODAPI MODULEINFO* Player_ProbeMem(const char *buffer,int len)
+{
+	MODULEINFO *result=NULL;
+	MREADER* reader;
+
+	if (!buffer || len <= 0) return NULL;
+	if ((reader=_mm_new_mem_reader(buffer,len)) != NULL) {
+		result=Player_ProbeGeneric(reader);
+		_mm_delete_mem_reader(reader);
+	}
+	return result;
+}
+
+MIKMODAPI MODULEINFO* Player_ProbeFP(FILE *fp)
+{
+	MODULEINFO *result=NULL;
+	MREADER* reader;
+
+	if (fp && (reader=_mm_new_file_reader(fp)) != NULL) {
+		result=Player_ProbeGeneric(reader);
+		_mm_delete_file_reader(reader);
+	}
+	return result;
+}
+
+/* Describes a module file without loading its samples. The file is mapped
+   when possible, so that only the pages holding the header and patterns are
+   read. */
+MIKMODAPI MODULEINFO* Player_Probe(const CHAR* filename)
+{
+	MODULEINFO *result=NULL;
+	MREADER *reader;
+	FILE *fp;
+
+	if((reader=_mm_new_map_reader(filename)) != NULL) {
+		result=Player_ProbeGeneric(reader);
+		_mm_delete_map_reader(reader);
+		return result;
+	}
+	if((fp=_mm_fopen(filename,"rb")) != NULL) {
+		result=Player_ProbeFP(fp);
+		_mm_fclose(fp);
+	}
+	return result;
+}
+
+MIKMODAPI void Player_FreeInfo(MODULEINFO *info)
+{
+	if (!info) return;
+	MikMod_free(info->songname);
+	MikMod_free(info->modtype);
+	MikMod_free(info->comment);
+	MikMod_free(info);
+}
+
 /* ex:set ts=4: */
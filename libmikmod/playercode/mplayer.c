@@ -32,6 +32,7 @@
 #include "config.h"
 #endif
 
+#include <stddef.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -48,8 +49,116 @@ MODULE *pf = NULL;
 
 #define NUMVOICES(mod) (md_sngchn < (mod)->numvoices ? md_sngchn : (mod)->numvoices)
 
+/* Whether the module is played ahead without being heard */
+#define SILENT(mod) ((mod)->timeline && (mod)->timeline->silent)
+
+/* Whether the player may wait for samples loaded as they are played: only
+   the output of a driver has to keep up with real time */
+#define CANWAIT(mod) (SILENT(mod) || ((mod)->timeline && (mod)->timeline->rendering))
+
 #define	HIGH_OCTAVE		2	/* number of above-range octaves */
 
+/* Playback event ring. The player is the only writer of 'head' and the
+   application the only writer of 'tail', so that draining the ring doesn't
+   wait for the mixer. The ring is only replaced or freed under both the
+   player lock, held while events are posted, and the events lock, held while
+   they are drained. */
+typedef struct MP_EVENTQUEUE {
+	MP_EVENT* events;
+	ULONG mask;					/* ring size - 1 (size is a power of two) */
+	volatile ULONG head;		/* next slot to be written by the player */
+	volatile ULONG tail;		/* next slot to be read by the application */
+} MP_EVENTQUEUE;
+
+/* A saved player state, taken on a tick boundary while the song played */
+typedef struct MP_CHECKPOINT {
+	SLONGLONG frame;			/* song position of the state, in frames */
+	ULONG     size;
+	void*     state;
+} MP_CHECKPOINT;
+
+/* Song position of a module in output frames, and the states recorded along
+   the song to seek quickly */
+typedef struct MP_TIMELINE {
+	SLONGLONG sngframe;			/* frames from the song start to the last tick */
+	SLONGLONG tickframe;		/* md_framepos at the last tick, -1 if none */
+	BOOL      natural;			/* the song played from its start, without
+								   position or speed changes from outside */
+	BOOL      held;				/* stopped or paused since the last tick */
+	ULONG     interval;			/* frames between checkpoints, 0 if disabled */
+	int       numcheck;
+	int       maxcheck;
+	MP_CHECKPOINT* check;		/* checkpoints, in song order */
+	BOOL      rendering;		/* played by Player_Render */
+	BOOL      silent;			/* played ahead without being heard, by
+								   Player_Seek or Player_SplitSong */
+	MODULEANALYSIS* visits;		/* song time at which Player_Render first
+								   played each row, to see the song loop */
+} MP_TIMELINE;
+
+static void pt_AddCheckpoint(MODULE *);
+static void pt_FreeCheckpoints(MP_TIMELINE *);
+static MODULEANALYSIS* pt_NewAnalysis(MODULE *);
+
+/* Returns whether the song has reached its end, either after its last order
+   or on an end of song marker */
+static BOOL pt_SongEnded(MODULE *mod)
+{
+	return (mod->sngpos>=mod->numpos)||
+	       (mod->positions[mod->sngpos]==LAST_PATTERN);
+}
+
+/* Stops counting song frames until the module plays its next tick */
+static void pt_HoldTimeline(MODULE *mod)
+{
+	MP_TIMELINE *tl=mod->timeline;
+
+	if ((tl)&&(tl->tickframe>=0)&&(!tl->held)) {
+		tl->sngframe+=md_framepos-tl->tickframe;
+		tl->held=1;
+	}
+}
+
+/* The ring positions are read with acquire and written with release
+   semantics, so that the events they cover are seen complete */
+#if defined(__ATOMIC_ACQUIRE)
+#define EVENT_LOAD(x)		__atomic_load_n(&(x),__ATOMIC_ACQUIRE)
+#define EVENT_STORE(x,v)	__atomic_store_n(&(x),(v),__ATOMIC_RELEASE)
+#define EVENT_BARRIER()
+#elif defined(__GNUC__)
+#define EVENT_BARRIER()	__sync_synchronize()
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define EVENT_BARRIER()	_ReadWriteBarrier()
+#else
+#define EVENT_BARRIER()
+#endif
+#ifndef EVENT_LOAD
+#define EVENT_LOAD(x)		(x)
+#define EVENT_STORE(x,v)	((x)=(v))
+#endif
+
+static void pt_PostEvent(MODULE *mod, UBYTE type, UBYTE channel, UWORD arg1, UWORD arg2)
+{
+	MP_EVENTQUEUE *q = mod->events;
+	MP_EVENT *e;
+
+	/* the part of the song played silently, to seek or split it, is not
+	   reported */
+	if ((!q) || SILENT(mod)) return;
+	/* ring full, the application does not keep up: drop the event */
+	if (q->head - EVENT_LOAD(q->tail) > q->mask) return;
+
+	e = &q->events[q->head & q->mask];
+	e->frame = md_framepos;
+	e->type = type;
+	e->channel = channel;
+	e->arg1 = arg1;
+	e->arg2 = arg2;
+	EVENT_BARRIER();
+	EVENT_STORE(q->head, q->head + 1);
+}
+
 enum vibratoflags {
 	VIB_PT_BUGS	= 0x01, /* MOD vibrato is not applied on tick 0. */
 	VIB_TICK_0	= 0x02, /* Increment LFO position on tick 0. */
@@ -244,36 +353,95 @@ static int getrandom(int ceilval)
 	3)	a foreground channel is a bonus x4
 	4)	an active envelope with keyoff is a handicap -x2
 */
-static int MP_FindEmptyChannel(MODULE *mod)
+/* Stealing key of a module voice: stopped voices go first, then voices
+   without a sample, then the quietest voices which are not about to start a
+   note. Looping samples and voices still driven by their channel count as
+   louder. */
+static ULONG pt_VoiceKey(MODULE *mod,int t)
 {
-	MP_VOICE *a;
-	ULONG t,k,tvol,pp;
+	MP_VOICE *a=&mod->voice[t];
+	ULONG pp;
 
-	for (t=0;t<NUMVOICES(mod);t++)
-		if (((mod->voice[t].main.kick==KICK_ABSENT)||
-			 (mod->voice[t].main.kick==KICK_ENV))&&
-		   Voice_Stopped_internal(t))
-			return t;
-
-	tvol=0xffffffUL;t=-1;a=mod->voice;
-	for (k=0;k<NUMVOICES(mod);k++,a++) {
-		/* allow us to take over a nonexisting sample */
-		if (!a->main.s)
-			return k;
-
-		if ((a->main.kick==KICK_ABSENT)||(a->main.kick==KICK_ENV)) {
-			pp=a->totalvol<<((a->main.s->flags&SF_LOOP)?1:0);
-			if ((a->master)&&(a==a->master->slave))
-				pp<<=2;
-
-			if (pp<tvol) {
-				tvol=pp;
-				t=k;
-			}
-		}
+	if (t>=NUMVOICES(mod)) return VOICEKEY_BUSY;
+
+	if (((a->main.kick==KICK_ABSENT)||(a->main.kick==KICK_ENV))&&
+	   Voice_Stopped_internal(mod->voicebase+t))
+		return 0;
+
+	/* allow us to take over a nonexisting sample */
+	if (!a->main.s) return 1;
+
+	if ((a->main.kick!=KICK_ABSENT)&&(a->main.kick!=KICK_ENV))
+		return VOICEKEY_BUSY;
+
+	pp=a->totalvol<<((a->main.s->flags&SF_LOOP)?1:0);
+	if ((a->master)&&(a==a->master->slave))
+		pp<<=2;
+	return pp+2;
+}
+
+/* Keys are updated when the volume or the state of a voice changes */
+static void pt_UpdateVoiceKey(MODULE *mod,int t)
+{
+	if ((mod->flags&UF_NNA)&&(mod->voiceheap))
+		VoiceHeap_Update(mod->voiceheap,t,pt_VoiceKey(mod,t));
+}
+
+/* Voices go to the background when a new note leaves them playing, and
+   leave it when they stop or are taken over */
+static void pt_SetBackground(MODULE *mod,MP_VOICE *aout,BOOL background)
+{
+	if (aout->background==background) return;
+	aout->background=background;
+	if (background)
+		mod->bgvoices++;
+	else
+		mod->bgvoices--;
+}
+
+/* Computes all the keys and the background voice count again, after the
+   voices were changed as a whole */
+static void pt_UpdateVoiceKeys(MODULE *mod)
+{
+	int t;
+
+	if (!mod->voiceheap) return;
+	mod->bgvoices=0;
+	for (t=0;t<mod->voiceheap->numvoices;t++) {
+		MP_VOICE *aout=&mod->voice[t];
+
+		aout->background=(t<NUMVOICES(mod))&&(!aout->mflag)&&
+		          (!Voice_Stopped_internal(mod->voicebase+t));
+		if (aout->background) mod->bgvoices++;
+		pt_UpdateVoiceKey(mod,t);
 	}
+	mod->voiceheap->swept=1;
+}
+
+/* With drivers which don't report when voices stop, catches up with the
+   voices which reached the end of their sample while mixing, or were stopped
+   or added from outside the player, since the last tick */
+static void pt_SweepVoiceKeys(MODULE *mod)
+{
+	MP_VOICEHEAP *h=mod->voiceheap;
+	int t;
 
-	if (tvol>8000*7) return -1;
+	for (t=0;t<h->numvoices;t++)
+		if ((t>=NUMVOICES(mod))||(h->key[t]==VOICEKEY_BUSY)||
+		    ((h->key[t])&&(Voice_Stopped_internal(mod->voicebase+t))))
+			pt_UpdateVoiceKey(mod,t);
+	h->swept=1;
+}
+
+static int MP_FindEmptyChannel(MODULE *mod)
+{
+	MP_VOICEHEAP *h=mod->voiceheap;
+	int t;
+
+	if ((!h)||(!h->numvoices)) return -1;
+	if ((!h->swept)&&(MD_POLLVOICES)) pt_SweepVoiceKeys(mod);
+	t=VoiceHeap_Top(h);
+	if (h->key[t]>8000*7+2) return -1;
 	return t;
 }
 
@@ -340,6 +508,44 @@ static SWORD InterpolateEnv(SWORD p,ENVPT *a,ENVPT *b)
 	return (Interpolate(p,a->pos,b->pos,a->val,b->val));
 }
 
+/* Same as InterpolateEnv at tick p between points a and b, but going on from
+   the previous tick without a division while p moves between the same
+   points */
+static SWORD StepEnvelope(ENVPR *t,UWORD a,UWORD b,SWORD p)
+{
+	ENVPT *pa=&t->env[a],*pb=&t->env[b];
+	SLONG dp=pb->pos-pa->pos,dv=pb->val-pa->val;
+	ULONG q,r;
+
+	if ((dp<=0)||(p<pa->pos)) {
+		t->ia=t->ib=0;
+		return InterpolateEnv(p,pa,pb);
+	}
+	if (dv<0) dv=-dv;
+
+	if ((t->ia==a)&&(t->ib==b)&&(t->ip+1==p)) {
+		q=t->iq+t->sq;
+		r=t->ir+t->sr;
+		if (r>=(ULONG)dp) {
+			r-=dp;
+			q++;
+		}
+	} else {
+		t->ia=a;
+		t->ib=b;
+		t->sq=dv/dp;
+		t->sr=dv%dp;
+		q=(ULONG)(p-pa->pos)*dv;
+		r=q%dp;
+		q/=dp;
+	}
+	t->ip=p;
+	t->iq=q;
+	t->ir=r;
+
+	return (pb->val<pa->val)?pa->val-(SWORD)q:pa->val+(SWORD)q;
+}
+
 static SWORD DoPan(SWORD envpan,SWORD pan)
 {
 	int newpan;
@@ -360,6 +566,7 @@ static SWORD StartEnvelope(ENVPR *t,UBYTE flg,UBYTE pts,UBYTE susbeg,UBYTE susen
 	t->env=p;
 	t->p=0;
 	t->a=0;
+	t->ia=t->ib=0;
 	t->b=((t->flg&EF_SUSTAIN)&&(!(keyoff&KEY_OFF)))?0:1;
 
 	if (!t->pts) { /* FIXME: bad/crafted file. better/more general solution? */
@@ -454,7 +661,7 @@ static SWORD ProcessEnvelope(MP_VOICE *aout, ENVPR *t, SWORD v)
 			 * Non looping situations.
 			 */
 			if (a != b)
-				v = InterpolateEnv(p, &t->env[a], &t->env[b]);
+				v = StepEnvelope(t, a, b, p);
 			else
 				v = t->env[a].val;
 
@@ -1034,6 +1241,7 @@ static void DoLoop(UWORD tick, UWORD flags, MP_CONTROL *a, MODULE *mod, UBYTE pa
 				mod->patpos=0;
 			} else
 				mod->patpos=a->pat_reppos;
+			pt_PostEvent(mod, MP_EVENT_LOOP, 0, mod->sngpos, a->pat_reppos+1);
 		} else a->pat_reppos=POS_NONE;
 	} else {
 		a->pat_reppos=mod->patpos-1; /* set reppos - can be (-1) */
@@ -2013,6 +2221,25 @@ static int DoITEffectY(UWORD tick, UWORD flags, MP_CONTROL *a, MODULE *mod, SWOR
 	return 0;
 }
 
+/* Impulse Tracker resonant filters, from the Zxx filter macros */
+static int DoITEffectZ(UWORD tick, UWORD flags, MP_CONTROL *a, MODULE *mod, SWORD channel)
+{
+	UBYTE filter, inf;
+
+	filter = UniGetByte();
+	inf = UniGetByte();
+	if (inf>127) inf=127;
+
+	if (!tick) {
+		if (filter==FILT_CUT)
+			a->main.cutoff=inf;
+		else if (filter==FILT_RESONANT)
+			a->main.resonance=inf;
+	}
+
+	return 0;
+}
+
 static void DoNNAEffects(MODULE *, MP_CONTROL *, UBYTE);
 
 /* Impulse/Scream Tracker Sxx effects.
@@ -2242,8 +2469,8 @@ static int DoMEDEffect16(UWORD tick, UWORD flags, MP_CONTROL *a, MODULE *mod, SW
 	   This fixes a playback bug found in "(brooker) #01.med", which sets
 	   the jump position in track 2 but jumps in track 1. */
 	reppos = a->pat_reppos;
-	for (i = 0; i < pf->numchn; i++)
-		pf->control[i].pat_reppos = reppos;
+	for (i = 0; i < mod->numchn; i++)
+		mod->control[i].pat_reppos = reppos;
 
 	return 0;
 }
@@ -2652,7 +2879,7 @@ static effect_func effects[UNI_LAST] = {
 	DoITEffectU,	/* UNI_ITEFFECTU */
 	DoITEffectW,	/* UNI_ITEFFECTW */
 	DoITEffectY,	/* UNI_ITEFFECTY */
-	DoNothing,	/* UNI_ITEFFECTZ */
+	DoITEffectZ,	/* UNI_ITEFFECTZ */
 	DoITEffectS0,	/* UNI_ITEFFECTS0 */
 	DoULTEffect9,	/* UNI_ULTEFFECT9 */
 	DoMEDSpeed,	/* UNI_MEDSPEED */
@@ -2771,12 +2998,17 @@ static void DoNNAEffects(MODULE *mod, MP_CONTROL *a, UBYTE dat)
 	}
 }
 
+/* Voice volume (0-256) times sample amplitude (0-65535) under which a voice
+   is considered inaudible, about -60dB */
+#define INAUDIBLE (256L*65536L/1024)
+
 static void pt_UpdateVoices(MODULE *mod, int max_volume)
 {
 	SWORD envpan,envvol,envpit,channel;
 	UWORD playperiod;
 	SLONG vibval,vibdpt;
 	ULONG tmpvol;
+	SWORD voice;
 
 	MP_VOICE *aout;
 	INSTRUMENT *i;
@@ -2785,10 +3017,17 @@ static void pt_UpdateVoices(MODULE *mod, int max_volume)
 	mod->totalchn=mod->realchn=0;
 	for (channel=0;channel<NUMVOICES(mod);channel++) {
 		aout=&mod->voice[channel];
+		voice=(SWORD)(mod->voicebase+channel);
 		i=aout->main.i;
 		s=aout->main.s;
 
-		if (!s || !s->length) continue;
+		/* a note held back until its sample is decoded plays once it is */
+		if ((s)&&(s->length)&&(s->handle<0)&&(mod->lazy))
+			SL_LoadLazy(mod->lazy,s,CANWAIT(mod));
+		if (!s || !s->length || s->handle<0) {
+			pt_UpdateVoiceKey(mod,channel);
+			continue;
+		}
 
 		if (aout->main.period<40)
 			aout->main.period=40;
@@ -2796,8 +3035,9 @@ static void pt_UpdateVoices(MODULE *mod, int max_volume)
 			aout->main.period=50000;
 
 		if ((aout->main.kick==KICK_NOTE)||(aout->main.kick==KICK_KEYOFF)) {
-			Voice_Play_internal(channel,s,(aout->main.start==-1)?
+			Voice_Play_internal(voice,s,(aout->main.start==-1)?
 			    ((s->flags&SF_UST_LOOP)?s->loopstart:0):aout->main.start);
+			if (!aout->mflag) pt_SetBackground(mod,aout,1);
 			aout->main.fadevol=32768;
 			aout->aswppos=0;
 		}
@@ -2851,22 +3091,34 @@ static void pt_UpdateVoices(MODULE *mod, int max_volume)
 			tmpvol=(tmpvol*max_volume)/128;
 
 		if ((aout->masterchn!=-1)&& mod->control[aout->masterchn].muted)
-			Voice_SetVolume_internal(channel,0);
+			aout->mixvol=0;
 		else {
-			Voice_SetVolume_internal(channel,tmpvol);
+			aout->mixvol=tmpvol;
 			if ((tmpvol)&&(aout->master)&&(aout->master->slave==aout))
 				mod->realchn++;
 			mod->totalchn++;
 		}
 
+		/* when mixing can't keep up, stop the background voices which
+		   can't be heard anymore */
+		if ((md_mixquality>=MIXQ_CULL)&&
+		    (!((aout->master)&&(aout->master->slave==aout)))&&
+		    (aout->mixvol*Voice_RealVolume_internal(voice)<INAUDIBLE)) {
+			Voice_Stop_internal(voice);
+			pt_UpdateVoiceKey(mod,channel);
+			continue;
+		}
+		Voice_SetVolume_internal(voice,(aout->mixvol*mod->mixgain)>>16);
+
 		if (aout->main.panning==PAN_SURROUND)
-			Voice_SetPanning_internal(channel,PAN_SURROUND);
+			Voice_SetPanning_internal(voice,PAN_SURROUND);
 		else
 			if ((mod->panflag)&&(aout->penv.flg & EF_ON))
-				Voice_SetPanning_internal(channel,
+				Voice_SetPanning_internal(voice,
 				    DoPan(envpan,aout->main.panning));
 			else
-				Voice_SetPanning_internal(channel,aout->main.panning);
+				Voice_SetPanning_internal(voice,aout->main.panning);
+		Voice_SetFilter_internal(voice,aout->main.cutoff,aout->main.resonance);
 
 		if (aout->main.period && s->vibdepth) {
 			if (s->vibflags & AV_IT) {
@@ -2944,13 +3196,18 @@ static void pt_UpdateVoices(MODULE *mod, int max_volume)
 		}
 
 		if (!aout->main.fadevol) { /* check for a dead note (fadevol=0) */
-			Voice_Stop_internal(channel);
+			Voice_Stop_internal(voice);
 			mod->totalchn--;
 			if ((tmpvol)&&(aout->master)&&(aout->master->slave==aout))
 				mod->realchn--;
 		} else {
-			Voice_SetFrequency_internal(channel,
-			                            getfrequency(mod->flags,playperiod));
+			/* Amiga periods take a division, which is only saved while
+			   the period holds */
+			if ((playperiod!=aout->freqperiod)||(!aout->frequency)) {
+				aout->freqperiod=playperiod;
+				aout->frequency=getfrequency(mod->flags,playperiod);
+			}
+			Voice_SetFrequency_internal(voice,aout->frequency);
 
 			/* if keyfade, start substracting fadeoutspeed from fadevol: */
 			if ((i)&&(aout->main.keyoff&KEY_FADE)) {
@@ -2961,6 +3218,8 @@ static void pt_UpdateVoices(MODULE *mod, int max_volume)
 			}
 		}
 
+		pt_UpdateVoiceKey(mod,channel);
+
 		md_bpm=mod->bpm+mod->relspd;
 		if (md_bpm<mod->bpmlimit)
 			md_bpm=mod->bpmlimit;
@@ -2969,6 +3228,59 @@ static void pt_UpdateVoices(MODULE *mod, int max_volume)
 	}
 }
 
+/* Queues the samples track 't' plays to be decoded ahead */
+static void pt_PrefetchTrack(MODULE *mod,UBYTE *t)
+{
+	int note=-1,inst=-1,smp;
+	UBYTE c;
+	BOOL changed;
+
+	for (;t && *t;t+=*t&0x1f) {
+		UniSetRow(t);
+		changed=0;
+		while((c=UniGetByte()) != 0)
+			if (c==UNI_NOTE) {
+				note=UniGetByte();
+				changed=1;
+			} else if (c==UNI_INSTRUMENT) {
+				inst=UniGetByte();
+				changed=1;
+			} else
+				UniSkipOpcode();
+
+		if (!changed || inst<0 || inst>=mod->numins) continue;
+		if (mod->flags&UF_INST) {
+			if (note<0 || note>=INSTNOTES) continue;
+			smp=mod->instruments[inst].samplenumber[note];
+		} else
+			smp=inst;
+		if (smp<mod->numsmp)
+			SL_PrefetchLazy(mod->lazy,&mod->samples[smp]);
+	}
+}
+
+/* Queues the samples of the current and next song positions to be decoded
+   ahead, when the module samples are loaded as they are played */
+static void pt_Prefetch(MODULE *mod)
+{
+	int pos,end,t;
+	UWORD pat,tr;
+
+	if (!SL_PrefetchPosition(mod->lazy,mod->sngpos)) return;
+
+	end=mod->sngpos+md_prefetchorders;
+	if (end>mod->numpos) end=mod->numpos;
+	for (pos=mod->sngpos;pos<end;pos++) {
+		pat=mod->positions[pos];
+		if (pat>=mod->numpat) continue;
+		for (t=0;t<mod->numchn;t++) {
+			tr=mod->patterns[pat*mod->numchn+t];
+			if (tr<mod->numtrk)
+				pt_PrefetchTrack(mod,mod->tracks[tr]);
+		}
+	}
+}
+
 /* Handles new notes or instruments */
 static void pt_Notes(MODULE *mod)
 {
@@ -2977,6 +3289,8 @@ static void pt_Notes(MODULE *mod)
 	UBYTE c,inst;
 	int tr,funky; /* funky is set to indicate note or instrument change */
 
+	if (mod->lazy) pt_Prefetch(mod);
+
 	for (channel=0;channel<mod->numchn;channel++) {
 		a=&mod->control[channel];
 
@@ -2988,7 +3302,13 @@ static void pt_Notes(MODULE *mod)
 			mod->numrow=mod->pattrows[mod->positions[mod->sngpos]];
 		}
 
-		a->row=(tr<mod->numtrk)?UniFindRow(mod->tracks[tr],mod->patpos):NULL;
+		if (tr>=mod->numtrk)
+			a->row=NULL;
+		else if (mod->rowindex)
+			a->row=UniFindIndexedRow(mod->tracks[tr],mod->rowindex[tr],mod->patpos);
+		else
+			a->row=UniFindRow(mod->tracks[tr],mod->patpos);
+		a->rowtrk=tr;
 		a->newnote=0;
 		a->newsamp=0;
 		if (!mod->vbtick) a->main.notedelay=0;
@@ -3053,6 +3373,8 @@ static void pt_Notes(MODULE *mod)
 			else if ((i)&&(i->flags & IF_OWNPAN))
 				a->main.panning=i->panning;
 
+			if ((s->handle<0)&&(mod->lazy))
+				SL_LoadLazy(mod->lazy,s,CANWAIT(mod));
 			a->main.handle=s->handle;
 			a->speed=s->speed;
 
@@ -3072,6 +3394,10 @@ static void pt_Notes(MODULE *mod)
 				a->main.nna=i->nnatype;
 				a->dca=i->dca;
 				a->dct=i->dct;
+				if (i->filtercutoff & 0x80)
+					a->main.cutoff=i->filtercutoff & 0x7f;
+				if (i->filterresonance & 0x80)
+					a->main.resonance=i->filterresonance & 0x7f;
 			} else {
 				a->main.pitflg=a->main.volflg=a->main.panflg=0;
 				a->main.nna=a->dca=0;
@@ -3106,6 +3432,10 @@ static void pt_Notes(MODULE *mod)
 			a->wantedperiod=a->tmpperiod=
 			    GetPeriod(mod->flags, (UWORD)a->main.note<<1,a->speed);
 			a->main.keyoff=KEY_KICK;
+
+			if (funky&1)
+				pt_PostEvent(mod, MP_EVENT_NOTE, (UBYTE)channel, a->anote,
+				             a->main.sample);
 		}
 	}
 }
@@ -3165,6 +3495,26 @@ static void pt_EffectsPass1(MODULE *mod)
 	}
 }
 
+/* When mixing can't keep up, new notes cut their previous note instead of
+   leaving it in the background, once half the channels have a background
+   voice playing */
+static BOOL pt_NNACapped(MODULE *mod)
+{
+	int t,count=0;
+
+	if (md_mixquality<MIXQ_NNACAP) return 0;
+
+	if (!MD_POLLVOICES)
+		count=mod->bgvoices;
+	else
+		/* the driver doesn't tell when voices stop */
+		for (t=0;t<NUMVOICES(mod);t++)
+			if ((!mod->voice[t].mflag)&&
+			    (!Voice_Stopped_internal(mod->voicebase+t)))
+				count++;
+	return count>=(mod->numchn+1)/2;
+}
+
 /* NNA management */
 static void pt_NNA(MODULE *mod)
 {
@@ -3181,12 +3531,16 @@ static void pt_NNA(MODULE *mod)
 				MP_VOICE *aout;
 
 				aout=a->slave;
-				if (aout->main.nna & NNA_MASK) {
+				if ((aout->main.nna & NNA_MASK)&&(!pt_NNACapped(mod))) {
 					/* Make sure the old MP_VOICE channel knows it has no
 					   master now ! */
 					a->slave=NULL;
 					/* assume the channel is taken by NNA */
 					aout->mflag=0;
+					if (!Voice_Stopped_internal(mod->voicebase+
+					                            (aout-mod->voice)))
+						pt_SetBackground(mod,aout,1);
+					pt_UpdateVoiceKey(mod,(int)(aout-mod->voice));
 
 					switch (aout->main.nna) {
 					case NNA_CONTINUE: /* continue note, do nothing */
@@ -3208,7 +3562,7 @@ static void pt_NNA(MODULE *mod)
 				int t;
 
 				for (t=0;t<NUMVOICES(mod);t++)
-					if ((!Voice_Stopped_internal(t))&&
+					if ((!Voice_Stopped_internal(mod->voicebase+t))&&
 					   (mod->voice[t].masterchn==channel)&&
 					   (a->main.sample==mod->voice[t].main.sample)) {
 						kill=0;
@@ -3253,6 +3607,10 @@ static void pt_SetupVoices(MODULE *mod)
 	MP_CONTROL *a;
 	MP_VOICE *aout;
 
+	/* voices may have stopped since the last tick */
+	if (mod->voiceheap)
+		mod->voiceheap->swept=0;
+
 	for (channel=0;channel<mod->numchn;channel++) {
 		a=&mod->control[channel];
 
@@ -3277,12 +3635,15 @@ static void pt_SetupVoices(MODULE *mod)
 				a->slave=aout;
 				aout->masterchn=channel;
 				aout->mflag=1;
+				pt_SetBackground(mod,aout,0);
 			}
 		} else
 			aout=a->slave;
 
-		if (aout)
+		if (aout) {
 			aout->main=a->main;
+			pt_UpdateVoiceKey(mod,(int)(aout-mod->voice));
+		}
 		a->main.kick=KICK_ABSENT;
 	}
 }
@@ -3310,112 +3671,395 @@ static void pt_EffectsPass2(MODULE *mod)
 	}
 }
 
-void Player_HandleTick(void)
+/* Ends a song rendered without wrapping once it comes back to a row already
+   played outside of a pattern loop, as Player_Analyze does. Returns 1 if the
+   song has ended. */
+static BOOL pt_CheckLoop(MODULE *mod)
 {
-	SWORD channel;
-	int max_volume;
+	MP_TIMELINE *tl=mod->timeline;
+	ULONG *rowtime;
+	int t;
 
-#if 0
-	/* don't handle the very first ticks, this allows the other hardware to
-	   settle down so we don't loose any starting notes */
-	if (isfirst) {
-		isfirst--;
-		return;
+	if ((mod->wrap)||(!tl)||(!tl->rendering)||(!tl->natural)||
+	    (pt_SongEnded(mod)))
+		return 0;
+	if ((!tl->visits)&&(!(tl->visits=pt_NewAnalysis(mod))))
+		return 0;
+	if (mod->patpos>=tl->visits->numrows[mod->sngpos])
+		return 0;
+
+	/* the song always plays a row at the same time, until it loops */
+	rowtime=&tl->visits->rowtime[mod->sngpos][mod->patpos];
+	if ((*rowtime==MP_ROW_UNPLAYED)||(*rowtime>mod->sngtime))
+		*rowtime=mod->sngtime;
+	else if (*rowtime<mod->sngtime) {
+		/* rows played again by a pattern loop are fine */
+		for (t=0;t<mod->numchn;t++)
+			if (mod->control[t].pat_repcnt) return 0;
+		pt_PostEvent(mod, MP_EVENT_END, 0, 0xffff, 0);
+		mod->sngpos=mod->numpos;
+		return 1;
 	}
-#endif
+	return 0;
+}
 
-	if ((!pf)||(pf->forbid)||(pf->sngpos>=pf->numpos)) return;
+/* Advances the module to its next tick and reads the notes of a new row, if
+   any. Returns 0 if the song has ended. */
+static BOOL pt_Sequence(MODULE *mod)
+{
+	SWORD channel;
+	BOOL jumped;
 
 	/* update time counter (sngtime is in milliseconds (in fact 2^-10)) */
-	pf->sngremainder+=(1<<9)*5; /* thus 2.5*(1<<10), since fps=0.4xtempo */
-	pf->sngtime+=pf->sngremainder/pf->bpm;
-	pf->sngremainder%=pf->bpm;
+	mod->sngremainder+=(1<<9)*5; /* thus 2.5*(1<<10), since fps=0.4xtempo */
+	mod->sngtime+=mod->sngremainder/mod->bpm;
+	mod->sngremainder%=mod->bpm;
 
-	if (++pf->vbtick>=pf->sngspd) {
-		if (pf->pat_repcrazy)
-			pf->pat_repcrazy=0; /* play 2 times row 0 */
+	if (++mod->vbtick>=mod->sngspd) {
+		if (mod->pat_repcrazy)
+			mod->pat_repcrazy=0; /* play 2 times row 0 */
 		else
-			pf->patpos++;
-		pf->vbtick=0;
+			mod->patpos++;
+		mod->vbtick=0;
 
-		/* process pattern-delay. pf->patdly2 is the counter and pf->patdly is
+		/* process pattern-delay. mod->patdly2 is the counter and mod->patdly is
 		   the command memory. */
-		if (pf->patdly)
-			pf->patdly2=pf->patdly,pf->patdly=0;
-		if (pf->patdly2) {
+		if (mod->patdly)
+			mod->patdly2=mod->patdly,mod->patdly=0;
+		if (mod->patdly2) {
 			/* patterndelay active */
-			if (--pf->patdly2)
-				/* so turn back pf->patpos by 1 */
-				if (pf->patpos) pf->patpos--;
+			if (--mod->patdly2)
+				/* so turn back mod->patpos by 1 */
+				if (mod->patpos) mod->patpos--;
 		}
 
-		/* do we have to get a new patternpointer ? (when pf->patpos reaches the
+		/* do we have to get a new patternpointer ? (when mod->patpos reaches the
 		   pattern size, or when a patternbreak is active) */
-		if ((pf->patpos>=pf->numrow)&&(!pf->posjmp))
-			pf->posjmp=3;
+		jumped=(mod->posjmp)&&(mod->numrow!=(UWORD)-1);
+		if ((mod->patpos>=mod->numrow)&&(!mod->posjmp))
+			mod->posjmp=3;
 
-		if (pf->posjmp) {
-			pf->patpos=pf->numrow?(pf->patbrk%pf->numrow):0;
-			pf->pat_repcrazy=0;
-			pf->sngpos+=(pf->posjmp-2);
-			for (channel=0;channel<pf->numchn;channel++)
-				pf->control[channel].pat_reppos=-1;
+		if (mod->posjmp) {
+			mod->patpos=mod->numrow?(mod->patbrk%mod->numrow):0;
+			mod->pat_repcrazy=0;
+			mod->sngpos+=(mod->posjmp-2);
+			for (channel=0;channel<mod->numchn;channel++)
+				mod->control[channel].pat_reppos=-1;
 
-			pf->patbrk=pf->posjmp=0;
+			mod->patbrk=mod->posjmp=0;
 
-			if (pf->sngpos<0) pf->sngpos=(SWORD)(pf->numpos-1);
+			if (mod->sngpos<0) mod->sngpos=(SWORD)(mod->numpos-1);
 
 			/* handle the "---" (end of song) pattern since it can occur
 			   *inside* the module in some formats */
-			if ((pf->sngpos>=pf->numpos)||
-				(pf->positions[pf->sngpos]==LAST_PATTERN)) {
-				if (!pf->wrap) return;
-				if (!(pf->sngpos=pf->reppos)) {
-				    pf->volume=pf->initvolume>128?128:pf->initvolume;
-					if (pf->flags & UF_FARTEMPO) {
-						pf->control[0].farcurtempo = pf->initspeed;
-						pf->control[0].fartempobend = 0;
-						SetFARTempo(pf);
+			if ((mod->sngpos>=mod->numpos)||
+				(mod->positions[mod->sngpos]==LAST_PATTERN)) {
+				pt_PostEvent(mod, MP_EVENT_END, 0,
+				             mod->wrap?mod->reppos:0xffff, 0);
+				if (!mod->wrap) return 0;
+				if (!(mod->sngpos=mod->reppos)) {
+				    mod->volume=mod->initvolume>128?128:mod->initvolume;
+					if (mod->flags & UF_FARTEMPO) {
+						mod->control[0].farcurtempo = mod->initspeed;
+						mod->control[0].fartempobend = 0;
+						SetFARTempo(mod);
 					}
 					else {
-						if(pf->initspeed!=0)
-							pf->sngspd=pf->initspeed<pf->bpmlimit?pf->initspeed:pf->bpmlimit;
+						if(mod->initspeed!=0)
+							mod->sngspd=mod->initspeed<mod->bpmlimit?mod->initspeed:mod->bpmlimit;
 						else
-							pf->sngspd=6;
-						pf->bpm=pf->inittempo<pf->bpmlimit?pf->bpmlimit:pf->inittempo;
+							mod->sngspd=6;
+						mod->bpm=mod->inittempo<mod->bpmlimit?mod->bpmlimit:mod->inittempo;
 					}
 				}
 			}
+			pt_PostEvent(mod, jumped?MP_EVENT_JUMP:MP_EVENT_ORDER, 0,
+			             mod->sngpos, mod->patpos);
+		}
+
+		if (!mod->patdly2) {
+			if (pt_CheckLoop(mod)) return 0;
+			pt_PostEvent(mod, MP_EVENT_ROW, 0, mod->sngpos, mod->patpos);
+			pt_Notes(mod);
 		}
+	}
 
-		if (!pf->patdly2)
-			pt_Notes(pf);
+	return 1;
+}
+
+/* Plays one tick of the given module */
+static void pt_PlayTick(MODULE *mod)
+{
+	MP_TIMELINE *tl;
+	int max_volume;
+
+#if 0
+	/* don't handle the very first ticks, this allows the other hardware to
+	   settle down so we don't loose any starting notes */
+	if (isfirst) {
+		isfirst--;
+		return;
+	}
+#endif
+
+	if (!mod) return;
+	if ((mod->forbid)||(pt_SongEnded(mod))) {
+		pt_HoldTimeline(mod);
+		return;
 	}
 
+	if ((tl=mod->timeline)) {
+		if ((tl->tickframe>=0)&&(!tl->held))
+			tl->sngframe+=md_framepos-tl->tickframe;
+		tl->tickframe=md_framepos;
+		tl->held=0;
+		if ((tl->interval)&&(tl->natural)&&((!tl->numcheck)||
+		    (tl->sngframe>=tl->check[tl->numcheck-1].frame+tl->interval)))
+			pt_AddCheckpoint(mod);
+	}
+
+	if (!pt_Sequence(mod)) return;
+
 	/* Fade global volume if enabled and we're playing the last pattern */
-	if (((pf->sngpos==pf->numpos-1)||
-		 (pf->positions[pf->sngpos+1]==LAST_PATTERN))&&
-	    (pf->fadeout))
-		max_volume=pf->numrow?((pf->numrow-pf->patpos)*128)/pf->numrow:0;
+	if (((mod->sngpos==mod->numpos-1)||
+		 (mod->positions[mod->sngpos+1]==LAST_PATTERN))&&
+	    (mod->fadeout))
+		max_volume=mod->numrow?((mod->numrow-mod->patpos)*128)/mod->numrow:0;
 	else
 		max_volume=128;
 
-	pt_EffectsPass1(pf);
-	if (pf->flags&UF_NNA)
-		pt_NNA(pf);
-	pt_SetupVoices(pf);
-	pt_EffectsPass2(pf);
+	pt_EffectsPass1(mod);
+	if (mod->flags&UF_NNA)
+		pt_NNA(mod);
+	pt_SetupVoices(mod);
+	pt_EffectsPass2(mod);
 
 	/* now set up the actual hardware channel playback information */
-	pt_UpdateVoices(pf, max_volume);
+	pt_UpdateVoices(mod, max_volume);
+}
+
+/*========== Mixing several modules */
+
+/* maximum number of modules mixed together with Player_AddToMix */
+#define MAXMIXED	8
+/* number of frames between two gain updates during a fade */
+#define FADESTEP	64
+
+typedef struct MP_MIXSLOT {
+	MODULE*   mod;
+	UWORD     numvoices;	/* mod->numvoices before the module was mixed */
+	SWORD     volume;		/* mix volume (0-128) */
+	SLONGLONG nexttick;		/* frame at which the next tick is due */
+	MD_TICKFRAC tickfrac;	/* fraction of nexttick */
+	SLONGLONG fadestart;	/* first frame of the fade */
+	ULONG     fadelength;	/* fade length in frames, 0 when not fading */
+	ULONG     fadefrom;		/* gain at the beginning of the fade (0-65536) */
+	ULONG     fadeto;		/* gain at the end of the fade */
+	ULONG     fadegain;		/* current fade gain */
+	BOOL      fadestop;		/* remove the module from the mix after the fade */
+} MP_MIXSLOT;
+
+static MP_MIXSLOT mixslots[MAXMIXED];
+static int nummixed = 0;
+static SLONGLONG pf_nexttick = 0; /* next tick of pf while modules are mixed */
+static MD_TICKFRAC pf_tickfrac;
+
+/* Returns the tempo the current tick of the module plays at */
+static SLONG pt_TickBPM(MODULE *mod)
+{
+	SLONG bpm=mod->bpm+mod->relspd;
+
+	if (bpm<mod->bpmlimit)
+		bpm=mod->bpmlimit;
+	else if ((!(mod->flags&UF_HIGHBPM)) && bpm>255)
+		bpm=255;
+	if (bpm<=0) bpm=125;
+
+	return bpm;
+}
+
+/* Returns the length of a tick of the module, in frames */
+static ULONG pt_TickLength(MODULE *mod,MD_TICKFRAC *frac)
+{
+	return MD_TickLength(pt_TickBPM(mod),frac);
+}
+
+static int pt_FindMixSlot(MODULE *mod)
+{
+	int t;
+
+	for (t=0;t<nummixed;t++)
+		if (mixslots[t].mod==mod) return t;
+	return -1;
+}
+
+/* Called when a song voice stops playing in the software mixer */
+void Player_VoiceEnded(SWORD voice)
+{
+	MODULE *mod=NULL;
+	int t;
+
+	if ((pf)&&(voice>=pf->voicebase)&&(voice<pf->voicebase+NUMVOICES(pf)))
+		mod=pf;
+	else
+		for (t=0;t<nummixed;t++)
+			if ((voice>=mixslots[t].mod->voicebase)&&
+			    (voice<mixslots[t].mod->voicebase+NUMVOICES(mixslots[t].mod))) {
+				mod=mixslots[t].mod;
+				break;
+			}
+	if ((!mod)||(!mod->voice)) return;
+
+	voice-=mod->voicebase;
+	pt_SetBackground(mod,&mod->voice[voice],0);
+	pt_UpdateVoiceKey(mod,voice);
+}
+
+/* Sets the volume of the module voices again, after a mix gain change */
+static void pt_ApplyMixGain(MODULE *mod)
+{
+	int t;
+
+	for (t=0;t<NUMVOICES(mod);t++)
+		Voice_SetVolume_internal((SWORD)(mod->voicebase+t),
+		                         (mod->voice[t].mixvol*mod->mixgain)>>16);
+}
+
+/* Computes the fade gain at the given frame. Returns 1 if the module has to
+   be removed from the mix. */
+static BOOL pt_UpdateFade(MP_MIXSLOT *slot, SLONGLONG now)
+{
+	BOOL done=0;
+
+	if (slot->fadelength) {
+		if (now<=slot->fadestart)
+			slot->fadegain=slot->fadefrom;
+		else if (now>=slot->fadestart+slot->fadelength) {
+			slot->fadegain=slot->fadeto;
+			slot->fadelength=0;
+			done=slot->fadestop;
+		} else
+			slot->fadegain=slot->fadefrom+(SLONG)(((SLONGLONG)
+			  ((SLONG)slot->fadeto-(SLONG)slot->fadefrom)*(now-slot->fadestart))/
+			  slot->fadelength);
+	}
+	slot->mod->mixgain=(slot->fadegain*slot->volume)>>7;
+
+	return done;
+}
+
+/* Schedules the next md_player call at the earliest tick or fade step of
+   all the modules being played */
+static void pt_MixSchedule(void)
+{
+	SLONGLONG next, now=md_framepos;
+	MD_TICKFRAC frac;
+	MP_MIXSLOT *slot;
+	int t;
+
+	if (!nummixed) {
+		if (pf) {
+			md_tickpos=pf_nexttick;
+			md_tickfrac=pf_tickfrac;
+		}
+		return;
+	}
+
+	next=pf?pf_nexttick:mixslots[0].nexttick;
+	frac=pf?pf_tickfrac:mixslots[0].tickfrac;
+	for (t=0,slot=mixslots;t<nummixed;t++,slot++) {
+		if (slot->nexttick<next) {
+			next=slot->nexttick;
+			frac=slot->tickfrac;
+		}
+		if (slot->fadelength) {
+			SLONGLONG fade;
+
+			if (now<slot->fadestart)
+				fade=slot->fadestart;
+			else {
+				fade=now+FADESTEP;
+				if (fade>slot->fadestart+slot->fadelength)
+					fade=slot->fadestart+slot->fadelength;
+			}
+			if (fade<next) {
+				next=fade;
+				frac.rem=0;
+			}
+		}
+	}
+	md_tickpos=next;
+	md_tickfrac=frac;
+}
+
+static void pt_RemoveFromMix(int n)
+{
+	MP_MIXSLOT *slot=&mixslots[n];
+	MODULE *mod=slot->mod;
+	int t;
+
+	for (t=0;t<NUMVOICES(mod);t++)
+		Voice_Stop_internal((SWORD)(mod->voicebase+t));
+
+	pt_HoldTimeline(mod);
+	mod->forbid=1;
+	mod->numvoices=slot->numvoices;
+	mod->voicebase=0;
+	mod->mixgain=65536;
+
+	*slot=mixslots[--nummixed];
+}
+
+/* Plays all the modules whose tick is due at the current output frame */
+static void pt_HandleMix(void)
+{
+	SLONGLONG now=md_framepos;
+	MP_MIXSLOT *slot;
+	int t;
+
+	for (t=0,slot=mixslots;t<nummixed;t++,slot++)
+		if (slot->fadelength && pt_UpdateFade(slot,now)) {
+			pt_RemoveFromMix(t--);
+			slot--;
+		}
+
+	if (pf && pf_nexttick<=now) {
+		pt_PlayTick(pf);
+		pf_nexttick=now+pt_TickLength(pf,&pf_tickfrac);
+	}
+	for (t=0,slot=mixslots;t<nummixed;t++,slot++) {
+		if (slot->nexttick<=now) {
+			pt_PlayTick(slot->mod);
+			slot->nexttick=now+pt_TickLength(slot->mod,&slot->tickfrac);
+		} else
+			pt_ApplyMixGain(slot->mod);
+
+		/* a mixed module leaves the mix when it ends */
+		if (slot->mod->sngpos>=slot->mod->numpos) {
+			pt_RemoveFromMix(t--);
+			slot--;
+		}
+	}
+
+	pt_MixSchedule();
+}
+
+void Player_HandleTick(void)
+{
+	if (nummixed)
+		pt_HandleMix();
+	else
+		pt_PlayTick(pf);
 }
 
 static void Player_Init_internal(MODULE* mod)
 {
 	int t;
 
+	memcpy(mod->panning,mod->inipanning,sizeof(mod->panning));
 	for (t=0;t<mod->numchn;t++) {
 		mod->control[t].main.chanvol=mod->chanvol[t];
+		mod->control[t].main.cutoff=127;
 		mod->control[t].main.panning=mod->panning[t];
 	}
 
@@ -3450,10 +4094,19 @@ static void Player_Init_internal(MODULE* mod)
 	mod->posjmp=2; /* make sure the player fetches the first note */
 	mod->numrow=-1;
 	mod->patbrk=0;
+
+	if (mod->timeline) {
+		mod->timeline->sngframe=0;
+		mod->timeline->tickframe=-1;
+		mod->timeline->natural=1;
+		mod->timeline->held=0;
+	}
 }
 
 int Player_Init(MODULE* mod)
 {
+	mod->voicebase=0;
+	mod->mixgain=65536;
 	mod->extspd=1;
 	mod->panflag=1;
 	mod->wrap=0;
@@ -3467,18 +4120,26 @@ int Player_Init(MODULE* mod)
 		return 1;
 	if (!(mod->voice=(MP_VOICE*)MikMod_calloc(md_sngchn,sizeof(MP_VOICE))))
 		return 1;
+	if (!(mod->voiceheap=VoiceHeap_New(md_sngchn)))
+		return 1;
+	mod->bgvoices=0;
+	if (!(mod->timeline=(MP_TIMELINE*)MikMod_calloc(1,sizeof(MP_TIMELINE))))
+		return 1;
 
 	/* mod->numvoices was used during loading to clamp md_sngchn.
 	   After loading it's used to remember how big mod->voice is.
 	*/
 	mod->numvoices = md_sngchn;
 
+	memcpy(mod->inipanning,mod->panning,sizeof(mod->panning));
 	Player_Init_internal(mod);
 	return 0;
 }
 
 void Player_Exit_internal(MODULE* mod)
 {
+	int t;
+
 	if (!mod)
 		return;
 
@@ -3487,11 +4148,32 @@ void Player_Exit_internal(MODULE* mod)
 		Player_Stop_internal();
 		pf=NULL;
 	}
+	if ((t=pt_FindMixSlot(mod))!=-1) {
+		pt_RemoveFromMix(t);
+		pt_MixSchedule();
+	}
 
 	MikMod_free(mod->control);
 	MikMod_free(mod->voice);
+	VoiceHeap_Free(mod->voiceheap);
 	mod->control=NULL;
 	mod->voice=NULL;
+	mod->voiceheap=NULL;
+
+	if (mod->timeline) {
+		pt_FreeCheckpoints(mod->timeline);
+		Player_FreeAnalysis(mod->timeline->visits);
+		MikMod_free(mod->timeline);
+		mod->timeline=NULL;
+	}
+
+	if (mod->events) {
+		MUTEX_LOCK(events);
+		MikMod_free(mod->events->events);
+		MikMod_free(mod->events);
+		mod->events=NULL;
+		MUTEX_UNLOCK(events);
+	}
 }
 
 void Player_Exit(MODULE* mod)
@@ -3522,34 +4204,157 @@ MIKMODAPI MODULE* Player_GetModule(void)
 	return result;
 }
 
-MIKMODAPI void Player_Start(MODULE *mod)
+static void pt_Start(MODULE *mod)
 {
 	int t;
 
+	if (pf!=mod || nummixed) {
+		/* new song is being started, so completely stop out the old one,
+		   and the modules mixed with it. */
+		while (nummixed) pt_RemoveFromMix(0);
+		if (pf && pf!=mod) {
+			pt_HoldTimeline(pf);
+			pf->forbid=1;
+		}
+		for (t=0;t<md_sngchn;t++) Voice_Stop_internal(t);
+	}
+	mod->forbid=0;
+	pf=mod;
+	pt_UpdateVoiceKeys(mod);
+}
+
+MIKMODAPI void Player_Start(MODULE *mod)
+{
 	if (!mod)
 		return;
 
 	if (!MikMod_Active())
 		MikMod_EnableOutput();
 
-	mod->forbid=0;
-
 	MUTEX_LOCK(vars);
-	if (pf!=mod) {
-		/* new song is being started, so completely stop out the old one. */
-		if (pf) pf->forbid=1;
-		for (t=0;t<md_sngchn;t++) Voice_Stop_internal(t);
-	}
-	pf=mod;
+	pt_Start(mod);
 	MUTEX_UNLOCK(vars);
 }
 
-void Player_Stop_internal(void)
+/* Routes each song voice of the module to the stem of its channel */
+static void pt_RouteStems(MODULE *mod)
 {
-	if (!md_sfxchn) MikMod_DisableOutput_internal();
-	if (pf) pf->forbid=1;
-	pf=NULL;
-}
+	SWORD chn;
+	int t;
+
+	for (t=0;t<NUMVOICES(mod);t++) {
+		chn=mod->voice[t].masterchn;
+		VC_VoiceSetStem((UWORD)(mod->voicebase+t),
+		                ((chn>=0)&&(chn<mod->numchn))?chn:-1);
+	}
+}
+
+static ULONG pt_Render(MODULE *mod,SBYTE *buf,SBYTE **stems,ULONG frames,UWORD format)
+{
+	ULONG done=0,left,framesize;
+	int t;
+
+	if (MikMod_StartRender_internal(format))
+		return 0;
+	if (pf!=mod)
+		pt_Start(mod);
+
+	framesize=MikMod_FrameSize_internal();
+	if (stems) pt_RouteStems(mod);
+	if (mod->timeline) mod->timeline->rendering=1;
+
+	while (done<frames) {
+		/* run the ticks here rather than in the mixer, so that the end of
+		   the song is seen on the exact frame it happens */
+		if (md_framepos>=md_tickpos) {
+			if (md_mode & DMODE_SOFT_MUSIC) md_player();
+			if (md_framepos>=md_tickpos)
+				md_tickpos=md_framepos+MD_TickLength(md_bpm,&md_tickfrac);
+			if (stems) pt_RouteStems(mod);
+		}
+		if (mod->forbid || pt_SongEnded(mod))
+			break;
+
+		left=frames-done;
+		if (md_tickpos-md_framepos<(SLONGLONG)left)
+			left=(ULONG)(md_tickpos-md_framepos);
+		if (stems) {
+			VC_WriteStems(buf,stems,left);
+			for (t=0;t<mod->numchn;t++)
+				if (stems[t]) stems[t]+=left*framesize;
+		} else
+			VC_WriteBytes(buf,left*framesize);
+		buf+=left*framesize;
+		done+=left;
+	}
+	if (mod->timeline) mod->timeline->rendering=0;
+
+	return done;
+}
+
+/* Mixes the next 'frames' sample frames of the module into 'buffer', in the
+   output format given by the DMODE_16BITS, DMODE_FLOAT and DMODE_STEREO bits
+   of 'format'. Returns the number of frames written; less than 'frames' means
+   the song ended on the last frame written. */
+MIKMODAPI ULONG Player_Render(MODULE *mod,void *buffer,ULONG frames,UWORD format)
+{
+	ULONG done;
+
+	if (!mod || !buffer)
+		return 0;
+
+	MUTEX_LOCK(vars);
+	done=pt_Render(mod,(SBYTE*)buffer,NULL,frames,format);
+	MUTEX_UNLOCK(vars);
+
+	return done;
+}
+
+/* Same as Player_Render, also writing the part of the output played by each
+   channel of the module, with its background (NNA) notes, to stems[channel].
+   'stems' holds mod->numchn buffers of 'frames' sample frames; channels with
+   a NULL buffer are only part of the full mix. The stems are dry: the reverb
+   and noise reduction filters only apply to the full mix. */
+MIKMODAPI ULONG Player_RenderStems(MODULE *mod,void *buffer,void **stems,ULONG frames,UWORD format)
+{
+	SBYTE **pos;
+	ULONG done=0;
+	int t;
+
+	if (!mod || !buffer || !stems)
+		return 0;
+
+	MUTEX_LOCK(vars);
+	if (MikMod_StartRender_internal(format))
+		goto done;
+	if (!(pos=(SBYTE**)MikMod_malloc(mod->numchn*sizeof(SBYTE*)))) {
+		_mm_errno=MMERR_OUT_OF_MEMORY;
+		goto done;
+	}
+	if (VC_SetStems(mod->numchn)) {
+		_mm_errno=MMERR_OUT_OF_MEMORY;
+		MikMod_free(pos);
+		goto done;
+	}
+	for (t=0;t<mod->numchn;t++)
+		pos[t]=(SBYTE*)stems[t];
+	done=pt_Render(mod,(SBYTE*)buffer,pos,frames,format);
+	MikMod_free(pos);
+done:
+	MUTEX_UNLOCK(vars);
+
+	return done;
+}
+
+void Player_Stop_internal(void)
+{
+	if (!md_sfxchn && !nummixed) MikMod_DisableOutput_internal();
+	if (pf) {
+		pt_HoldTimeline(pf);
+		pf->forbid=1;
+	}
+	pf=NULL;
+}
 
 MIKMODAPI void Player_Stop(void)
 {
@@ -3564,7 +4369,7 @@ MIKMODAPI BOOL Player_Active(void)
 
 	MUTEX_LOCK(vars);
 	if (pf)
-		result=(!(pf->sngpos>=pf->numpos));
+		result=(!pt_SongEnded(pf));
 	MUTEX_UNLOCK(vars);
 
 	return result;
@@ -3579,10 +4384,11 @@ MIKMODAPI void Player_NextPosition(void)
 		pf->forbid=1;
 		pf->posjmp=3;
 		pf->patbrk=0;
+		if (pf->timeline) pf->timeline->natural=0;
 		pf->vbtick=pf->sngspd;
 
 		for (t=0;t<NUMVOICES(pf);t++) {
-			Voice_Stop_internal(t);
+			Voice_Stop_internal((SWORD)(pf->voicebase+t));
 			pf->voice[t].main.i=NULL;
 			pf->voice[t].main.s=NULL;
 		}
@@ -3604,10 +4410,11 @@ MIKMODAPI void Player_PrevPosition(void)
 		pf->forbid=1;
 		pf->posjmp=1;
 		pf->patbrk=0;
+		if (pf->timeline) pf->timeline->natural=0;
 		pf->vbtick=pf->sngspd;
 
 		for (t=0;t<NUMVOICES(pf);t++) {
-			Voice_Stop_internal(t);
+			Voice_Stop_internal((SWORD)(pf->voicebase+t));
 			pf->voice[t].main.i=NULL;
 			pf->voice[t].main.s=NULL;
 		}
@@ -3630,11 +4437,12 @@ MIKMODAPI void Player_SetPosition(UWORD pos)
 		if (pos>=pf->numpos) pos=pf->numpos;
 		pf->posjmp=2;
 		pf->patbrk=0;
+		if (pf->timeline) pf->timeline->natural=0;
 		pf->sngpos=pos;
 		pf->vbtick=pf->sngspd;
 
 		for (t=0;t<NUMVOICES(pf);t++) {
-			Voice_Stop_internal(t);
+			Voice_Stop_internal((SWORD)(pf->voicebase+t));
 			pf->voice[t].main.i=NULL;
 			pf->voice[t].main.s=NULL;
 		}
@@ -3794,7 +4602,7 @@ MIKMODAPI int Player_GetChannelVoice(UBYTE chan)
 
 	MUTEX_LOCK(vars);
 	if (pf)
-		result=(chan<pf->numchn)?pf->control[chan].slavechn:-1;
+		result=(chan<pf->numchn)?pf->voicebase+pf->control[chan].slavechn:-1;
 	MUTEX_UNLOCK(vars);
 
 	return result;
@@ -3839,8 +4647,10 @@ MIKMODAPI void Player_TogglePause(void)
 MIKMODAPI void Player_SetSpeed(UWORD speed)
 {
 	MUTEX_LOCK(vars);
-	if (pf)
+	if (pf) {
 		pf->sngspd=speed?(speed<32?speed:32):1;
+		if (pf->timeline) pf->timeline->natural=0;
+	}
 	MUTEX_UNLOCK(vars);
 }
 
@@ -3851,6 +4661,7 @@ MIKMODAPI void Player_SetTempo(UWORD tempo)
 	if (pf) {
 		if ((!(pf->flags&UF_HIGHBPM))&&(tempo>255)) tempo=255;
 		pf->bpm=tempo;
+		if (pf->timeline) pf->timeline->natural=0;
 	}
 	MUTEX_UNLOCK(vars);
 }
@@ -3898,4 +4709,1068 @@ MIKMODAPI int Player_GetRow(void)
 	return ret;
 }
 
+/* Enables playback event reporting for a module, with room for 'count'
+   undrained events (rounded up to a power of two). A count of zero disables
+   event reporting. Returns 0 on success. */
+MIKMODAPI int Player_EnableEvents(MODULE *mod, int count)
+{
+	MP_EVENTQUEUE *q = NULL;
+	ULONG size = 1;
+
+	if (!mod) return 1;
+
+	if (count > 0) {
+		while (size < (ULONG)count) size <<= 1;
+		if (!(q = (MP_EVENTQUEUE*)MikMod_calloc(1, sizeof(MP_EVENTQUEUE))))
+			return 1;
+		if (!(q->events = (MP_EVENT*)MikMod_calloc(size, sizeof(MP_EVENT)))) {
+			MikMod_free(q);
+			return 1;
+		}
+		q->mask = size - 1;
+	}
+
+	MUTEX_LOCK(vars);
+	MUTEX_LOCK(events);
+	if (mod->events) {
+		MikMod_free(mod->events->events);
+		MikMod_free(mod->events);
+	}
+	mod->events = q;
+	MUTEX_UNLOCK(events);
+	MUTEX_UNLOCK(vars);
+
+	return 0;
+}
+
+/* Copies up to 'max' pending events, oldest first, and returns their number.
+   Event frames are those of the mixer, which runs ahead of the sound heard
+   by the length of the driver's buffer. */
+MIKMODAPI int Player_GetEvents(MODULE *mod, MP_EVENT *events, int max)
+{
+	MP_EVENTQUEUE *q;
+	ULONG head, tail;
+	int n = 0;
+
+	if (!mod || !events) return 0;
+
+	MUTEX_LOCK(events);
+	if ((q = mod->events) != NULL) {
+		head = EVENT_LOAD(q->head);
+		EVENT_BARRIER();
+		for (tail = q->tail; (n < max) && (tail != head); tail++)
+			events[n++] = q->events[tail & q->mask];
+		EVENT_BARRIER();
+		EVENT_STORE(q->tail, tail);
+	}
+	MUTEX_UNLOCK(events);
+
+	return n;
+}
+
+/* Longest song Player_Analyze follows, in microseconds */
+#define ANALYZE_MAXTIME ((SLONGLONG)24*3600*1000000)
+
+MIKMODAPI void Player_FreeAnalysis(MODULEANALYSIS *an)
+{
+	if (!an) return;
+	if (an->rowtime) MikMod_free(an->rowtime[0]);
+	MikMod_free(an->rowtime);
+	MikMod_free(an->numrows);
+	MikMod_free(an);
+}
+
+static MODULEANALYSIS* pt_NewAnalysis(MODULE *mod)
+{
+	MODULEANALYSIS *an;
+	ULONG rows=0,*times;
+	int t;
+
+	if (!(an=(MODULEANALYSIS*)MikMod_calloc(1,sizeof(MODULEANALYSIS))))
+		return NULL;
+	an->numpos=mod->numpos;
+	an->numrows=(UWORD*)MikMod_calloc(mod->numpos+1,sizeof(UWORD));
+	an->rowtime=(ULONG**)MikMod_calloc(mod->numpos+1,sizeof(ULONG*));
+	if (!an->numrows || !an->rowtime) {
+		Player_FreeAnalysis(an);
+		return NULL;
+	}
+	for (t=0;t<mod->numpos;t++) {
+		if (mod->positions[t]<mod->numpat)
+			an->numrows[t]=mod->pattrows[mod->positions[t]];
+		rows+=an->numrows[t];
+	}
+	if (!(times=(ULONG*)MikMod_malloc((rows+1)*sizeof(ULONG)))) {
+		Player_FreeAnalysis(an);
+		return NULL;
+	}
+	for (t=0;t<mod->numpos;t++) {
+		an->rowtime[t]=times;
+		times+=an->numrows[t];
+	}
+	an->rowtime[t]=times;
+	for (times=an->rowtime[0];times<an->rowtime[t];times++)
+		*times=MP_ROW_UNPLAYED;
+
+	return an;
+}
+
+/* Runs the song flow of the module, with its current loop and wrap settings,
+   from the start until it ends or comes back to a row already played outside
+   of a pattern loop. Only the effects are processed: no voice is touched, so
+   this can be used while the module is playing. */
+static MODULEANALYSIS* Player_Analyze_internal(MODULE *mod)
+{
+	MODULEANALYSIS *an;
+	MODULE sim;
+	SLONGLONG now=0;
+	ULONG remainder=0,*rowtime;
+	SLONG bpm;
+	int t;
+
+	if (!(an=pt_NewAnalysis(mod))) {
+		_mm_errno=MMERR_OUT_OF_MEMORY;
+		return NULL;
+	}
+
+	/* a private copy of the playback state, sharing the song data */
+	memcpy(&sim,mod,sizeof(MODULE));
+	sim.voice=NULL;
+	sim.voiceheap=NULL;
+	sim.bgvoices=0;
+	sim.events=NULL;
+	sim.timeline=NULL;
+	sim.numvoices=0;
+	sim.forbid=0;
+	/* the simulation plays no sample: don't load or prefetch them */
+	sim.lazy=NULL;
+	if (!(sim.control=(MP_CONTROL*)MikMod_calloc(mod->numchn,sizeof(MP_CONTROL)))) {
+		Player_FreeAnalysis(an);
+		_mm_errno=MMERR_OUT_OF_MEMORY;
+		return NULL;
+	}
+	Player_Init_internal(&sim);
+
+	while (pt_Sequence(&sim)) {
+		if ((!sim.vbtick)&&(!sim.patdly2)&&
+		    (sim.patpos<an->numrows[sim.sngpos])) {
+			rowtime=&an->rowtime[sim.sngpos][sim.patpos];
+
+			if (*rowtime==MP_ROW_UNPLAYED)
+				*rowtime=(ULONG)(now/1000);
+			else {
+				/* rows played again by a pattern loop are fine */
+				for (t=0;t<sim.numchn;t++)
+					if (sim.control[t].pat_repcnt) break;
+				if (t==sim.numchn) {
+					an->loops=1;
+					an->looppos=sim.sngpos;
+					an->looprow=sim.patpos;
+					an->looptime=*rowtime;
+					break;
+				}
+			}
+		}
+		pt_EffectsPass1(&sim);
+
+		/* a tick lasts 2.5 seconds divided by the tempo */
+		bpm=pt_TickBPM(&sim);
+		remainder+=2500000;
+		now+=remainder/bpm;
+		remainder%=bpm;
+
+		if (now>ANALYZE_MAXTIME) {
+			an->loops=1;
+			an->looppos=sim.sngpos;
+			an->looprow=sim.patpos;
+			an->looptime=(ULONG)(now/1000);
+			break;
+		}
+	}
+	an->duration=(ULONG)(now/1000);
+
+	MikMod_free(sim.control);
+	return an;
+}
+
+MIKMODAPI MODULEANALYSIS* Player_Analyze(MODULE *mod)
+{
+	MODULEANALYSIS *result=NULL;
+
+	if (!mod) return NULL;
+
+	MUTEX_LOCK(vars);
+	result=Player_Analyze_internal(mod);
+	MUTEX_UNLOCK(vars);
+
+	return result;
+}
+
+/*========== Player state snapshots and seeking */
+
+#define STATE_MAGIC	0x4d4d5354UL	/* "MMST" */
+/* frames mixed at once while seeking forward */
+#define SEEKCHUNK	4096
+
+/* The state starts with this header, followed by the channels, each an
+   MP_CONTROL and its MP_STATELINKS, then by the song voices, each an
+   MP_VOICE, its MP_STATELINKS and 'mixsize' bytes of mixer state. Pointers
+   are replaced by indexes in the links, so a state can be stored and loaded
+   again with the same module and library build. */
+typedef struct MP_STATEHEADER {
+	ULONG     magic;
+	ULONG     size;
+	UWORD     numchn;
+	UWORD     numvoices;
+	ULONG     controlsize;		/* sizeof(MP_CONTROL) */
+	ULONG     voicesize;		/* sizeof(MP_VOICE) */
+	ULONG     mixsize;			/* mixer state of a voice, 0 if none */
+	BOOL      natural;
+	BOOL      ticked;			/* the song played at least one tick */
+	SLONGLONG sngframe;
+	ULONG     elapsed;			/* frames mixed since the last tick */
+	ULONG     tickleft;			/* frames before the next tick */
+	MD_TICKFRAC tickfrac;		/* and the fraction of a frame after them */
+	ULONG     sngtime;
+	SLONG     sngremainder;
+	UWORD     bpm;
+	UWORD     sngspd;
+	SWORD     volume;
+	UWORD     patpos;
+	SWORD     sngpos;
+	UWORD     vbtick;
+	UWORD     numrow;
+	SBYTE     globalslide;
+	UBYTE     pat_repcrazy;
+	UWORD     patbrk;
+	UBYTE     patdly;
+	UBYTE     patdly2;
+	SWORD     posjmp;
+	UWORD     realchn;
+	UWORD     totalchn;
+	UWORD     panning[UF_MAXCHAN];	/* as changed by panning effects */
+} MP_STATEHEADER;
+
+typedef struct MP_STATELINKS {
+	SLONG     ins;				/* instrument index, -1 for none */
+	SLONG     smp;				/* sample index, -1 for none */
+	SLONG     link;				/* slave voice or master channel, -1 for none */
+	SLONG     row;				/* offset of the row in its track, -1 for none */
+	SLONG     env[3];			/* offsets of the envelopes in the instruments */
+} MP_STATELINKS;
+
+static ULONG pt_StateSize(UWORD numchn,UWORD numvoices,ULONG mixsize)
+{
+	return sizeof(MP_STATEHEADER)+
+	       numchn*(sizeof(MP_CONTROL)+sizeof(MP_STATELINKS))+
+	       numvoices*(sizeof(MP_VOICE)+sizeof(MP_STATELINKS)+mixsize);
+}
+
+/* Current song position of the module, in frames */
+static SLONGLONG pt_SongFrame(MODULE *mod)
+{
+	MP_TIMELINE *tl=mod->timeline;
+
+	if ((!tl)||(tl->tickframe<0)) return 0;
+	if (tl->held) return tl->sngframe;
+	return tl->sngframe+md_framepos-tl->tickframe;
+}
+
+static void pt_LinkChannel(MODULE *mod,MP_CHANNEL *c,MP_STATELINKS *l)
+{
+	l->ins=c->i?(SLONG)(c->i-mod->instruments):-1;
+	l->smp=c->s?(SLONG)(c->s-mod->samples):-1;
+	c->i=NULL;
+	c->s=NULL;
+}
+
+static void pt_UnlinkChannel(MODULE *mod,MP_CHANNEL *c,const MP_STATELINKS *l)
+{
+	c->i=((l->ins>=0)&&(l->ins<mod->numins))?&mod->instruments[l->ins]:NULL;
+	c->s=((l->smp>=0)&&(l->smp<mod->numsmp))?&mod->samples[l->smp]:NULL;
+}
+
+static SLONG pt_LinkEnvelope(MODULE *mod,ENVPR *e)
+{
+	SLONG offset=-1;
+
+	if (e->env) offset=(SLONG)((UBYTE*)e->env-(UBYTE*)mod->instruments);
+	e->env=NULL;
+	return offset;
+}
+
+static void pt_UnlinkEnvelope(MODULE *mod,ENVPR *e,SLONG offset)
+{
+	if ((offset<0)||(!mod->instruments)||
+	    (offset+sizeof(ENVPT)>mod->numins*sizeof(INSTRUMENT)))
+		e->env=NULL;
+	else
+		e->env=(ENVPT*)((UBYTE*)mod->instruments+offset);
+}
+
+/* Tells whether the instrument and sample links of a saved channel point
+   into the module */
+static BOOL pt_CheckChannel(MODULE *mod,const MP_STATELINKS *l)
+{
+	return (l->ins>=-1)&&(l->ins<mod->numins)&&
+	       (l->smp>=-1)&&(l->smp<mod->numsmp);
+}
+
+/* Tells whether the sample offset a saved channel starts its next note at is
+   within its sample, as the effects setting it make sure of */
+static BOOL pt_CheckStart(MODULE *mod,const MP_CHANNEL *c,const MP_STATELINKS *l)
+{
+	if (c->start==-1) return 1;
+	return (c->start>=0)&&
+	       ((l->smp<0)||((ULONG)c->start<=mod->samples[l->smp].length));
+}
+
+/* Tells whether a saved envelope is envelope 'field' of an instrument, and
+   its points are within the envelope */
+static BOOL pt_CheckEnvelope(MODULE *mod,const ENVPR *e,SLONG offset,ULONG field)
+{
+	if (offset==-1) return 1;
+	if ((offset<0)||(!mod->instruments)||
+	    ((ULONG)offset>=mod->numins*sizeof(INSTRUMENT))||
+	    ((ULONG)offset%sizeof(INSTRUMENT)!=field))
+		return 0;
+	return (e->pts<=ENVPOINTS)&&(e->susbeg<ENVPOINTS)&&(e->susend<ENVPOINTS)&&
+	       (e->beg<ENVPOINTS)&&(e->end<ENVPOINTS)&&
+	       (e->a<ENVPOINTS)&&(e->b<ENVPOINTS)&&
+	       (e->ia<ENVPOINTS)&&(e->ib<ENVPOINTS);
+}
+
+/* Checks the channels and voices of a state before any of it is restored:
+   the player and the mixer index the module and the samples with them */
+static BOOL pt_CheckState(MODULE *mod,const UBYTE *state,const MP_STATEHEADER *h,BOOL mixer)
+{
+	MP_STATELINKS l;
+	MP_CONTROL c;
+	MP_VOICE v;
+	SAMPLE *s;
+	int t;
+
+	if ((h->sngpos<0)||(h->sngpos>mod->numpos))
+		return 0;
+
+	for (t=0;t<h->numchn;t++) {
+		memcpy(&c,state,sizeof(MP_CONTROL));
+		state+=sizeof(MP_CONTROL);
+		memcpy(&l,state,sizeof(MP_STATELINKS));
+		state+=sizeof(MP_STATELINKS);
+		if ((!pt_CheckChannel(mod,&l))||
+		    (!pt_CheckStart(mod,&c.main,&l))||
+		    ((c.main.sample)&&(c.main.sample>=mod->numsmp))||
+		    (c.anote>=INSTNOTES)||
+		    ((c.slavechn>=h->numvoices)&&(c.slavechn>=h->numchn))||
+		    (l.link<-1)||(l.link>=h->numvoices)||
+		    ((l.link>=0)&&(l.link!=c.slavechn)))
+			return 0;
+		if ((l.row!=-1)&&((c.rowtrk>=mod->numtrk)||
+		    (!UniIsRowStart(mod->tracks[c.rowtrk],(ULONG)l.row))))
+			return 0;
+	}
+
+	for (t=0;t<h->numvoices;t++) {
+		memcpy(&v,state,sizeof(MP_VOICE));
+		state+=sizeof(MP_VOICE);
+		memcpy(&l,state,sizeof(MP_STATELINKS));
+		state+=sizeof(MP_STATELINKS);
+		if ((!pt_CheckChannel(mod,&l))||
+		    (!pt_CheckStart(mod,&v.main,&l))||
+		    (v.masterchn<-1)||(v.masterchn>=h->numchn)||
+		    (l.link<-1)||(l.link>=h->numchn)||
+		    (!pt_CheckEnvelope(mod,&v.venv,l.env[0],offsetof(INSTRUMENT,volenv)))||
+		    (!pt_CheckEnvelope(mod,&v.penv,l.env[1],offsetof(INSTRUMENT,panenv)))||
+		    (!pt_CheckEnvelope(mod,&v.cenv,l.env[2],offsetof(INSTRUMENT,pitenv))))
+			return 0;
+		s=(l.smp>=0)?&mod->samples[l.smp]:NULL;
+		if ((mixer)&&(!Voice_CheckState_internal(state,s)))
+			return 0;
+		state+=h->mixsize;
+	}
+
+	return 1;
+}
+
+/* Writes the state of the module into 'state', which must hold
+   pt_StateSize() bytes */
+static void pt_SaveState(MODULE *mod,UBYTE *state)
+{
+	MP_TIMELINE *tl=mod->timeline;
+	MP_STATEHEADER h;
+	MP_STATELINKS l;
+	MP_CONTROL c;
+	MP_VOICE v;
+	int t;
+
+	memset(&h,0,sizeof(MP_STATEHEADER));
+	h.magic=STATE_MAGIC;
+	h.numchn=mod->numchn;
+	h.numvoices=NUMVOICES(mod);
+	h.controlsize=sizeof(MP_CONTROL);
+	h.voicesize=sizeof(MP_VOICE);
+	h.mixsize=Voice_StateSize_internal();
+	h.size=pt_StateSize(h.numchn,h.numvoices,h.mixsize);
+	if (tl) {
+		h.natural=tl->natural;
+		h.ticked=(tl->tickframe>=0);
+		if (h.ticked) {
+			h.sngframe=tl->sngframe;
+			if (!tl->held)
+				h.elapsed=(ULONG)(md_framepos-tl->tickframe);
+		}
+	}
+	if ((mod==pf)&&(!nummixed)&&(md_tickpos>md_framepos))
+		h.tickleft=(ULONG)(md_tickpos-md_framepos);
+	if ((mod==pf)&&(!nummixed))
+		h.tickfrac=md_tickfrac;
+	h.sngtime=mod->sngtime;
+	h.sngremainder=mod->sngremainder;
+	h.bpm=mod->bpm;
+	h.sngspd=mod->sngspd;
+	h.volume=mod->volume;
+	h.patpos=mod->patpos;
+	h.sngpos=mod->sngpos;
+	h.vbtick=mod->vbtick;
+	h.numrow=mod->numrow;
+	h.globalslide=mod->globalslide;
+	h.pat_repcrazy=mod->pat_repcrazy;
+	h.patbrk=mod->patbrk;
+	h.patdly=mod->patdly;
+	h.patdly2=mod->patdly2;
+	h.posjmp=mod->posjmp;
+	h.realchn=mod->realchn;
+	h.totalchn=mod->totalchn;
+	memcpy(h.panning,mod->panning,sizeof(h.panning));
+	memcpy(state,&h,sizeof(MP_STATEHEADER));
+	state+=sizeof(MP_STATEHEADER);
+
+	for (t=0;t<mod->numchn;t++) {
+		memcpy(&c,&mod->control[t],sizeof(MP_CONTROL));
+		memset(&l,0xff,sizeof(MP_STATELINKS));
+		pt_LinkChannel(mod,&c.main,&l);
+		if (c.slave) l.link=(SLONG)(c.slave-mod->voice);
+		if ((c.row)&&(c.rowtrk<mod->numtrk))
+			l.row=(SLONG)(c.row-mod->tracks[c.rowtrk]);
+		c.slave=NULL;
+		c.row=NULL;
+		memcpy(state,&c,sizeof(MP_CONTROL));
+		state+=sizeof(MP_CONTROL);
+		memcpy(state,&l,sizeof(MP_STATELINKS));
+		state+=sizeof(MP_STATELINKS);
+	}
+
+	for (t=0;t<h.numvoices;t++) {
+		memcpy(&v,&mod->voice[t],sizeof(MP_VOICE));
+		memset(&l,0xff,sizeof(MP_STATELINKS));
+		pt_LinkChannel(mod,&v.main,&l);
+		if (v.master) l.link=(SLONG)(v.master-mod->control);
+		l.env[0]=pt_LinkEnvelope(mod,&v.venv);
+		l.env[1]=pt_LinkEnvelope(mod,&v.penv);
+		l.env[2]=pt_LinkEnvelope(mod,&v.cenv);
+		v.master=NULL;
+		memcpy(state,&v,sizeof(MP_VOICE));
+		state+=sizeof(MP_VOICE);
+		memcpy(state,&l,sizeof(MP_STATELINKS));
+		state+=sizeof(MP_STATELINKS);
+		if (h.mixsize) {
+			Voice_SaveState_internal((SWORD)(mod->voicebase+t),state);
+			state+=h.mixsize;
+		}
+	}
+}
+
+/* Puts the module back in a state saved by pt_SaveState */
+static int pt_LoadState(MODULE *mod,const UBYTE *state,ULONG size)
+{
+	MP_TIMELINE *tl=mod->timeline;
+	MP_STATEHEADER h;
+	MP_STATELINKS l;
+	MP_CONTROL *c;
+	MP_VOICE *v;
+	BOOL mixer;
+	UBYTE muted;
+	int t;
+
+	if (size<sizeof(MP_STATEHEADER)) {
+		_mm_errno=MMERR_BAD_STATE;
+		return 1;
+	}
+	memcpy(&h,state,sizeof(MP_STATEHEADER));
+	if ((h.magic!=STATE_MAGIC)||(h.size!=size)||
+	    (h.numchn!=mod->numchn)||(h.numvoices!=NUMVOICES(mod))||
+	    (mod->voicebase+h.numvoices>md_sngchn)||
+	    (h.controlsize!=sizeof(MP_CONTROL))||(h.voicesize!=sizeof(MP_VOICE))||
+	    (h.size!=pt_StateSize(h.numchn,h.numvoices,h.mixsize))) {
+		_mm_errno=MMERR_BAD_STATE;
+		return 1;
+	}
+	state+=sizeof(MP_STATEHEADER);
+	/* the voices can only be resumed by the mixer which saved them */
+	mixer=(h.mixsize)&&(h.mixsize==Voice_StateSize_internal());
+	if (!pt_CheckState(mod,state,&h,mixer)) {
+		_mm_errno=MMERR_BAD_STATE;
+		return 1;
+	}
+
+	mod->sngtime=h.sngtime;
+	mod->sngremainder=h.sngremainder;
+	mod->bpm=h.bpm;
+	mod->sngspd=h.sngspd;
+	mod->volume=h.volume;
+	mod->patpos=h.patpos;
+	mod->sngpos=h.sngpos;
+	mod->vbtick=h.vbtick;
+	mod->numrow=h.numrow;
+	mod->globalslide=h.globalslide;
+	mod->pat_repcrazy=h.pat_repcrazy;
+	mod->patbrk=h.patbrk;
+	mod->patdly=h.patdly;
+	mod->patdly2=h.patdly2;
+	mod->posjmp=h.posjmp;
+	mod->realchn=h.realchn;
+	mod->totalchn=h.totalchn;
+	memcpy(mod->panning,h.panning,sizeof(mod->panning));
+
+	for (t=0,c=mod->control;t<mod->numchn;t++,c++) {
+		muted=c->muted;
+		memcpy(c,state,sizeof(MP_CONTROL));
+		state+=sizeof(MP_CONTROL);
+		memcpy(&l,state,sizeof(MP_STATELINKS));
+		state+=sizeof(MP_STATELINKS);
+		pt_UnlinkChannel(mod,&c->main,&l);
+		c->slave=((l.link>=0)&&(l.link<h.numvoices))?&mod->voice[l.link]:NULL;
+		c->row=((l.row>=0)&&(c->rowtrk<mod->numtrk))?
+		       mod->tracks[c->rowtrk]+l.row:NULL;
+		c->muted=muted;
+	}
+
+	for (t=0,v=mod->voice;t<h.numvoices;t++,v++) {
+		memcpy(v,state,sizeof(MP_VOICE));
+		state+=sizeof(MP_VOICE);
+		memcpy(&l,state,sizeof(MP_STATELINKS));
+		state+=sizeof(MP_STATELINKS);
+		pt_UnlinkChannel(mod,&v->main,&l);
+		v->master=((l.link>=0)&&(l.link<mod->numchn))?&mod->control[l.link]:NULL;
+		pt_UnlinkEnvelope(mod,&v->venv,l.env[0]);
+		pt_UnlinkEnvelope(mod,&v->penv,l.env[1]);
+		pt_UnlinkEnvelope(mod,&v->cenv,l.env[2]);
+		v->frequency=0;		/* computed again from the period */
+		if (mixer)
+			Voice_LoadState_internal((SWORD)(mod->voicebase+t),state,v->main.s);
+		else
+			Voice_Reset_internal((SWORD)(mod->voicebase+t));
+		state+=h.mixsize;
+	}
+	pt_UpdateVoiceKeys(mod);
+
+	if (tl) {
+		tl->natural=h.natural;
+		tl->sngframe=h.sngframe;
+		tl->tickframe=h.ticked?md_framepos-h.elapsed:-1;
+		tl->held=0;
+	}
+	if ((mod==pf)&&(!nummixed)) {
+		md_tickpos=md_framepos+h.tickleft;
+		md_tickfrac=h.tickfrac;
+	}
+
+	return 0;
+}
+
+/* Restarts the song from its beginning, as if it had just been loaded */
+static void pt_ResetSong(MODULE *mod)
+{
+	UBYTE muted;
+	int t;
+
+	for (t=0;t<NUMVOICES(mod);t++)
+		Voice_Reset_internal((SWORD)(mod->voicebase+t));
+	for (t=0;t<mod->numchn;t++) {
+		muted=mod->control[t].muted;
+		memset(&mod->control[t],0,sizeof(MP_CONTROL));
+		mod->control[t].muted=muted;
+	}
+	memset(mod->voice,0,mod->numvoices*sizeof(MP_VOICE));
+	pt_UpdateVoiceKeys(mod);
+	Player_Init_internal(mod);
+
+	if ((mod==pf)&&(!nummixed)) {
+		md_tickpos=md_framepos;
+		md_tickfrac.rem=0;
+	}
+}
+
+static void pt_FreeCheckpoints(MP_TIMELINE *tl)
+{
+	int t;
+
+	for (t=0;t<tl->numcheck;t++)
+		MikMod_free(tl->check[t].state);
+	MikMod_free(tl->check);
+	tl->check=NULL;
+	tl->numcheck=tl->maxcheck=0;
+}
+
+/* Records the state of the module at the current tick; called by
+   pt_PlayTick before the tick is played */
+static void pt_AddCheckpoint(MODULE *mod)
+{
+	MP_TIMELINE *tl=mod->timeline;
+	MP_CHECKPOINT *cp;
+
+	if ((mod!=pf)||(nummixed)) return;
+
+	if (tl->numcheck==tl->maxcheck) {
+		int max=tl->maxcheck?tl->maxcheck*2:16;
+
+		if (!(cp=(MP_CHECKPOINT*)MikMod_realloc(tl->check,max*sizeof(MP_CHECKPOINT)))) {
+			tl->interval=0;
+			return;
+		}
+		tl->check=cp;
+		tl->maxcheck=max;
+	}
+
+	cp=&tl->check[tl->numcheck];
+	cp->frame=tl->sngframe;
+	cp->size=pt_StateSize(mod->numchn,NUMVOICES(mod),Voice_StateSize_internal());
+	if (!(cp->state=MikMod_malloc(cp->size))) {
+		/* out of memory: keep the checkpoints recorded so far */
+		tl->interval=0;
+		return;
+	}
+	pt_SaveState(mod,(UBYTE*)cp->state);
+	tl->numcheck++;
+}
+
+/* Returns a copy of the playback state of the module, to be freed with
+   MikMod_free, and its size in 'size'. */
+MIKMODAPI void* Player_SaveState(MODULE *mod,ULONG *size)
+{
+	void *state=NULL;
+	ULONG len;
+
+	if (!mod || !size) return NULL;
+
+	MUTEX_LOCK(vars);
+	len=pt_StateSize(mod->numchn,NUMVOICES(mod),Voice_StateSize_internal());
+	if ((state=MikMod_malloc(len))) {
+		pt_SaveState(mod,(UBYTE*)state);
+		*size=len;
+	} else
+		_mm_errno=MMERR_OUT_OF_MEMORY;
+	MUTEX_UNLOCK(vars);
+
+	return state;
+}
+
+/* Puts the module back in a state returned by Player_SaveState. The channels
+   keep their current mute settings. Returns 0 on success. */
+MIKMODAPI int Player_RestoreState(MODULE *mod,const void *state,ULONG size)
+{
+	int result;
+
+	if (!mod || !state) return 1;
+
+	MUTEX_LOCK(vars);
+	result=pt_LoadState(mod,(const UBYTE*)state,size);
+	MUTEX_UNLOCK(vars);
+
+	return result;
+}
+
+/* Makes the module record its state every 'interval' milliseconds while it
+   plays from the start of the song, so that Player_Seek does not have to
+   play the song from its beginning. An interval of 0 frees the recorded
+   states and stops recording. */
+MIKMODAPI int Player_SetCheckpoints(MODULE *mod,ULONG interval)
+{
+	MP_TIMELINE *tl;
+
+	if (!mod) return 1;
+
+	MUTEX_LOCK(vars);
+	if ((tl=mod->timeline)) {
+		pt_FreeCheckpoints(tl);
+		tl->interval=(ULONG)((SLONGLONG)interval*md_mixfreq/1000);
+	}
+	MUTEX_UNLOCK(vars);
+
+	return tl?0:1;
+}
+
+/* Moves the current module to 'time' milliseconds from the start of the
+   song. The song restarts from the closest checkpoint before that time, or
+   from its beginning, and is mixed silently up to it, without reporting
+   events or calling the mixer callback. The sound effects voices are left
+   alone. Returns 0 on success. */
+MIKMODAPI int Player_Seek(MODULE *mod,ULONG time)
+{
+	MP_TIMELINE *tl;
+	MP_CHECKPOINT *cp=NULL;
+	MikMod_callback_t callback;
+	SLONGLONG target,now;
+	SBYTE *scratch=NULL;
+	ULONG left;
+	BOOL forbid,skip;
+	int framesize,t,result=1;
+
+	if (!mod) return 1;
+
+	MUTEX_LOCK(vars);
+	tl=mod->timeline;
+	if ((mod!=pf)||(nummixed)||(!tl)||(!MikMod_Active_internal())||
+	    (md_driver->VoicePlay!=VC_VoicePlay)||(!md_softchn)||
+	    (!(md_mode&DMODE_SOFT_MUSIC))) {
+		_mm_errno=MMERR_SEEK;
+		goto done;
+	}
+	/* the reverb and the noise reduction filter need the mixed output;
+	   otherwise the voices are only moved forward */
+	framesize=MikMod_FrameSize_internal();
+	skip=(!md_reverb)&&(!(md_mode&DMODE_NOISEREDUCTION));
+	if ((!skip)&&(!(scratch=(SBYTE*)MikMod_malloc(SEEKCHUNK*framesize)))) {
+		_mm_errno=MMERR_OUT_OF_MEMORY;
+		goto done;
+	}
+
+	target=(SLONGLONG)time*md_mixfreq/1000;
+	now=pt_SongFrame(mod);
+	for (t=tl->numcheck-1;t>=0;t--)
+		if (tl->check[t].frame<=target) {
+			cp=&tl->check[t];
+			break;
+		}
+
+	/* go on from the current position, unless a checkpoint or the song
+	   start gets closer */
+	if ((!tl->natural)||(now>target)||((cp)&&(cp->frame>now))) {
+		if ((!cp)||(pt_LoadState(mod,(const UBYTE*)cp->state,cp->size)))
+			pt_ResetSong(mod);
+	}
+
+	forbid=mod->forbid;
+	mod->forbid=0;
+	callback=vc_callback;
+	vc_callback=NULL;
+	tl->silent=vc_sfxhold=1;
+	while (((now=pt_SongFrame(mod))<target)&&(mod->sngpos<mod->numpos)) {
+		left=(target-now<SEEKCHUNK)?(ULONG)(target-now):SEEKCHUNK;
+		if (skip)
+			VC_SkipSamples(left);
+		else
+			VC_WriteBytes(scratch,left*framesize);
+	}
+	tl->silent=vc_sfxhold=0;
+	vc_callback=callback;
+	mod->forbid=forbid;
+
+	MikMod_free(scratch);
+	result=0;
+done:
+	MUTEX_UNLOCK(vars);
+
+	return result;
+}
+
+/*========== Split song rendering */
+
+MIKMODAPI void Player_FreeSegments(MP_SEGMENT *seg,int count)
+{
+	int t;
+
+	if (!seg) return;
+
+	for (t=0;t<count;t++)
+		MikMod_free(seg[t].state);
+	MikMod_free(seg);
+}
+
+/* Cuts the song into about 'count' segments of the same length, each with
+   the player state at its start, so that the segments can be rendered
+   independently (for example by several processes) with
+   Player_StartSegment and Player_Render, and put back together. The song is
+   played once, without mixing the output, with the output format 'format';
+   a looping song is cut at the point it loops. Returns the segments, to be
+   freed with Player_FreeSegments, and their number in 'numsegments'. */
+MIKMODAPI MP_SEGMENT* Player_SplitSong(MODULE *mod,int count,UWORD format,int *numsegments)
+{
+	MODULEANALYSIS *an;
+	MP_TIMELINE *tl,saved;
+	MP_SEGMENT *seg=NULL;
+	SLONGLONG end=0,total;
+	ULONG left;
+	BOOL forbid;
+	int t,n=0;
+
+	if (!mod || !numsegments || count<1) return NULL;
+
+	MUTEX_LOCK(vars);
+	if (!(tl=mod->timeline)) {
+		_mm_errno=MMERR_SEEK;
+		goto done;
+	}
+	/* the reverb and the noise reduction filter depend on all the previous
+	   output, which is not part of the player state, and the SIMD 16 bit
+	   conversion of the high quality mixer rounds depending on the buffer
+	   alignment */
+	if ((md_reverb)||(md_mode&DMODE_NOISEREDUCTION)||
+	    ((md_mode&DMODE_HQMIXER)&&(md_mode&DMODE_SIMDMIXER))) {
+		_mm_errno=MMERR_SPLIT;
+		goto done;
+	}
+	if (MikMod_StartRender_internal(format))
+		goto done;
+	if (pf!=mod)
+		pt_Start(mod);
+	if (nummixed) {
+		_mm_errno=MMERR_SEEK;
+		goto done;
+	}
+	if (!(an=Player_Analyze_internal(mod)))
+		goto done;
+	if (an->loops)
+		end=(SLONGLONG)an->duration*md_mixfreq/1000;
+	total=(SLONGLONG)an->duration*md_mixfreq/1000;
+	Player_FreeAnalysis(an);
+
+	/* play the song silently, recording a checkpoint at each cut */
+	saved=*tl;
+	tl->check=NULL;
+	tl->numcheck=tl->maxcheck=0;
+	tl->interval=(ULONG)(total/count);
+	if (!tl->interval) tl->interval=1;
+	forbid=mod->forbid;
+	mod->forbid=0;
+	tl->silent=vc_sfxhold=1;
+	pt_ResetSong(mod);
+
+	while ((tl->interval)&&((!end)||(pt_SongFrame(mod)<end))) {
+		if (md_framepos>=md_tickpos) {
+			if (md_mode & DMODE_SOFT_MUSIC) md_player();
+			if (md_framepos>=md_tickpos)
+				md_tickpos=md_framepos+MD_TickLength(md_bpm,&md_tickfrac);
+		}
+		if (mod->forbid || pt_SongEnded(mod))
+			break;
+
+		left=(ULONG)(md_tickpos-md_framepos);
+		if ((end)&&(end-pt_SongFrame(mod)<(SLONGLONG)left))
+			left=(ULONG)(end-pt_SongFrame(mod));
+		VC_SkipSamples(left);
+	}
+	total=pt_SongFrame(mod);
+	tl->silent=vc_sfxhold=0;
+
+	/* a checkpoint failed to be recorded */
+	if (!tl->interval)
+		_mm_errno=MMERR_OUT_OF_MEMORY;
+	else if (!(seg=(MP_SEGMENT*)MikMod_calloc(tl->numcheck?tl->numcheck:1,sizeof(MP_SEGMENT))))
+		_mm_errno=MMERR_OUT_OF_MEMORY;
+	else
+		for (t=0;t<tl->numcheck;t++) {
+			MP_CHECKPOINT *cp=&tl->check[t];
+
+			/* a cut on the very last tick leaves nothing to render */
+			if (cp->frame>=total) break;
+			seg[n].start=(ULONG)cp->frame;
+			seg[n].frames=(ULONG)((t+1<tl->numcheck && tl->check[t+1].frame<total?
+			                       tl->check[t+1].frame:total)-cp->frame);
+			seg[n].size=cp->size;
+			seg[n].state=cp->state;
+			cp->state=NULL;
+			n++;
+		}
+	if ((seg)&&(!n)) {
+		MikMod_free(seg);
+		seg=NULL;
+		_mm_errno=MMERR_SEEK;
+	}
+
+	pt_FreeCheckpoints(tl);
+	tl->check=saved.check;
+	tl->numcheck=saved.numcheck;
+	tl->maxcheck=saved.maxcheck;
+	tl->interval=saved.interval;
+	pt_ResetSong(mod);
+	mod->forbid=forbid;
+done:
+	MUTEX_UNLOCK(vars);
+
+	*numsegments=n;
+	return seg;
+}
+
+/* Prepares the module to render the given segment of its song, as returned
+   by Player_SplitSong, with Player_Render in the same output format. Returns
+   0 on success. */
+MIKMODAPI int Player_StartSegment(MODULE *mod,const MP_SEGMENT *seg,UWORD format)
+{
+	int result=1;
+
+	if (!mod || !seg) return 1;
+
+	MUTEX_LOCK(vars);
+	if (MikMod_StartRender_internal(format))
+		goto done;
+	if (pf!=mod)
+		pt_Start(mod);
+	result=pt_LoadState(mod,(const UBYTE*)seg->state,seg->size);
+done:
+	MUTEX_UNLOCK(vars);
+
+	return result;
+}
+
+/* Plays a module together with the current module and the other mixed
+   modules, on the song voices first..first+count-1, starting 'delay' frames
+   after the last frame produced by the software mixer. Returns 0 on
+   success. */
+MIKMODAPI int Player_AddToMix(MODULE *mod, int first, int count, ULONG delay)
+{
+	MP_MIXSLOT *slot;
+	int t,result=1;
+
+	if (!mod) return 1;
+
+	if (!MikMod_Active())
+		MikMod_EnableOutput();
+
+	MUTEX_LOCK(vars);
+	if ((!(md_mode & DMODE_SOFT_MUSIC))||(mod==pf)||(pt_FindMixSlot(mod)!=-1)||
+	    (first<0)||(count<=0)||(first+count>md_sngchn)||(count>mod->numvoices)) {
+		_mm_errno=MMERR_MIX_VOICES;
+		goto done;
+	}
+	if (pf && first<NUMVOICES(pf)) {
+		_mm_errno=MMERR_MIX_VOICES;
+		goto done;
+	}
+	for (t=0;t<nummixed;t++)
+		if ((first<mixslots[t].mod->voicebase+NUMVOICES(mixslots[t].mod))&&
+		    (mixslots[t].mod->voicebase<first+count)) {
+			_mm_errno=MMERR_MIX_VOICES;
+			goto done;
+		}
+	if (nummixed==MAXMIXED) {
+		_mm_errno=MMERR_MIX_FULL;
+		goto done;
+	}
+
+	/* entering mixed playback: pf keeps its current tick schedule */
+	if (!nummixed) {
+		pf_nexttick=md_tickpos;
+		pf_tickfrac=md_tickfrac;
+	}
+
+	slot=&mixslots[nummixed++];
+	slot->mod=mod;
+	slot->numvoices=mod->numvoices;
+	slot->volume=128;
+	slot->nexttick=md_framepos+delay;
+	slot->tickfrac.rem=slot->tickfrac.den=0;
+	slot->fadelength=0;
+	slot->fadegain=65536;
+	slot->fadestop=0;
+
+	for (t=0;t<count;t++)
+		Voice_Stop_internal((SWORD)(first+t));
+	mod->voicebase=first;
+	mod->numvoices=count;
+	mod->mixgain=65536;
+	mod->forbid=0;
+	pt_UpdateVoiceKeys(mod);
+
+	pt_MixSchedule();
+	result=0;
+done:
+	MUTEX_UNLOCK(vars);
+	return result;
+}
+
+MIKMODAPI void Player_RemoveFromMix(MODULE *mod)
+{
+	int t;
+
+	MUTEX_LOCK(vars);
+	if ((t=pt_FindMixSlot(mod))!=-1) {
+		pt_RemoveFromMix(t);
+		pt_MixSchedule();
+	}
+	MUTEX_UNLOCK(vars);
+}
+
+/* Sets the mix volume (0-128) of a mixed module, independently of its
+   song volume */
+MIKMODAPI void Player_SetMixVolume(MODULE *mod, SWORD volume)
+{
+	int t;
+
+	MUTEX_LOCK(vars);
+	if ((t=pt_FindMixSlot(mod))!=-1) {
+		mixslots[t].volume=(volume<0)?0:(volume>128)?128:volume;
+		pt_UpdateFade(&mixslots[t],md_framepos);
+		pt_ApplyMixGain(mod);
+	}
+	MUTEX_UNLOCK(vars);
+}
+
+static void pt_FadeMix(MP_MIXSLOT *slot, ULONG from, SWORD volume, ULONG delay, ULONG length, BOOL stop)
+{
+	slot->fadefrom=from;
+	slot->fadeto=((ULONG)((volume<0)?0:(volume>128)?128:volume))<<9;
+	slot->fadestart=md_framepos+delay;
+	slot->fadelength=length?length:1;
+	slot->fadestop=stop;
+}
+
+/* Fades a mixed module to 'volume' (0-128, relative to its mix volume),
+   starting 'delay' frames after the last frame produced by the software
+   mixer and lasting 'length' frames. If 'stop' is set, the module leaves
+   the mix once the fade is complete. Returns 0 on success. */
+MIKMODAPI int Player_FadeMix(MODULE *mod, SWORD volume, ULONG delay, ULONG length, BOOL stop)
+{
+	MP_MIXSLOT *slot;
+	int t,result=1;
+
+	MUTEX_LOCK(vars);
+	if ((t=pt_FindMixSlot(mod))!=-1) {
+		slot=&mixslots[t];
+		pt_UpdateFade(slot,md_framepos);
+		pt_FadeMix(slot,slot->fadegain,volume,delay,length,stop);
+		pt_MixSchedule();
+		result=0;
+	} else
+		_mm_errno=MMERR_MIX_VOICES;
+	MUTEX_UNLOCK(vars);
+
+	return result;
+}
+
+/* Crossfades from one mixed module to another over 'length' frames,
+   starting 'delay' frames after the last frame produced by the software
+   mixer. The module faded in is silent until the crossfade starts, the
+   module faded out leaves the mix at the end of the crossfade. */
+MIKMODAPI int Player_Crossfade(MODULE *from, MODULE *to, ULONG delay, ULONG length)
+{
+	int f,t,result=1;
+
+	MUTEX_LOCK(vars);
+	if ((from!=to)&&((f=pt_FindMixSlot(from))!=-1)&&((t=pt_FindMixSlot(to))!=-1)) {
+		pt_UpdateFade(&mixslots[f],md_framepos);
+		pt_FadeMix(&mixslots[f],mixslots[f].fadegain,0,delay,length,1);
+		pt_FadeMix(&mixslots[t],0,128,delay,length,0);
+		pt_UpdateFade(&mixslots[t],md_framepos);
+		pt_ApplyMixGain(to);
+		pt_MixSchedule();
+		result=0;
+	} else
+		_mm_errno=MMERR_MIX_VOICES;
+	MUTEX_UNLOCK(vars);
+
+	return result;
+}
+
 /* ex:set ts=4: */
@@ -203,6 +203,66 @@ UBYTE *UniFindRow(UBYTE* t,UWORD row)
 	return t;
 }
 
+/* Tells whether 'offset' is the start of a row of the UniMod(tm) stream 't' */
+BOOL UniIsRowStart(UBYTE* t,ULONG offset)
+{
+	ULONG pos=0;
+	UBYTE c;
+
+	if(!t) return 0;
+	while((pos<offset)&&(c=t[pos])&&(c&0x1f))
+		pos+=c&0x1f;
+	return (pos==offset)&&(t[pos]);
+}
+
+/* Stores the offset of each row of track 't' in 'offsets' (if not NULL), and
+   returns the number of rows. */
+static UWORD UniScanTrack(UBYTE* t,UWORD* offsets)
+{
+	UWORD n=0,offset=0,r;
+	UBYTE c;
+
+	if(t)
+		while((c=t[offset])&&(n<0xffff)) {
+			for(r=(c>>5)+1;r&&(n<0xffff);r--)
+				if(offsets) offsets[n++]=offset;
+				else n++;
+			offset+=c&0x1f;
+		}
+	return n;
+}
+
+/* Builds an index of the rows of the 'numtrk' tracks, so that rows can be
+   found without walking the tracks. index[t][0] is the number of rows of
+   track t, followed by the offset of each row in the track. The index is a
+   single block, to be freed with MikMod_free. */
+UWORD** UniIndexTracks(UBYTE** tracks,UWORD numtrk)
+{
+	UWORD **index,*p;
+	ULONG total=0;
+	int t;
+
+	if(!numtrk) return NULL;
+	for(t=0;t<numtrk;t++)
+		total+=UniScanTrack(tracks[t],NULL)+1;
+
+	if(!(index=(UWORD**)MikMod_malloc(numtrk*sizeof(UWORD*)+total*sizeof(UWORD))))
+		return NULL;
+	p=(UWORD*)(index+numtrk);
+	for(t=0;t<numtrk;t++) {
+		index[t]=p;
+		p[0]=UniScanTrack(tracks[t],p+1);
+		p+=p[0]+1;
+	}
+	return index;
+}
+
+/* Same as UniFindRow, using the track index built by UniIndexTracks */
+UBYTE *UniFindIndexedRow(UBYTE* t,const UWORD* index,UWORD row)
+{
+	return (t&&(row<index[0]))?t+index[row+1]:NULL;
+}
+
 /*========== Writing routines */
 
 static	UBYTE *unibuf; /* pointer to the temporary unitrk buffer */
@@ -35,193 +35,317 @@
 #include <unistd.h>
 #endif
 
+#include <string.h>
+
 #include "mikmod_internals.h"
 
-static	int sl_rlength;
-static	SWORD sl_old;
-static	SWORD *sl_buffer=NULL;
+/* state of a sample decoder */
+typedef struct SLSTATE {
+	SWORD *buffer;	/* conversion buffer of SLBUFSIZE words */
+	SWORD old;	/* last value of delta samples */
+	int rlength;	/* words of the sample left unread */
+} SLSTATE;
+
+static	SLSTATE sl={NULL,0,0};
 static	SAMPLOAD *musiclist=NULL,*sndfxlist=NULL;
+static	SAMPLOAD *sl_loading=NULL;	/* list being loaded */
+
+/* 16 bit signed samples in the byte order of the machine */
+#ifdef WORDS_BIGENDIAN
+#define SF_NATIVE16	(SF_16BITS|SF_SIGNED|SF_BIG_ENDIAN)
+#else
+#define SF_NATIVE16	(SF_16BITS|SF_SIGNED)
+#endif
+
+/* format of samples decoded ahead, which keep the signedness of the input */
+#define SF_DECODED(infmt)	((SF_NATIVE16&~SF_SIGNED)|((infmt)&SF_SIGNED))
 
 /* size of the loader buffer in words */
 #define SLBUFSIZE 2048
 
 /* IT-Compressed status structure */
 typedef struct ITPACK {
-	UWORD bits;    /* current number of bits */
-	UWORD bufbits; /* bits in buffer */
-	SWORD last;    /* last output */
-	UBYTE buf;     /* bit buffer */
+	ULONG bitbuf;      /* bits not used yet, lowest first */
+	UWORD bitcount;    /* bits in buffer */
+	UWORD bits;        /* current number of bits */
+	SWORD last;        /* last output */
+	UWORD incnt;       /* bytes of the block after the ones in memory */
+	const UBYTE *ptr;  /* next byte of the block in memory */
+	const UBYTE *end;  /* end of the bytes in memory */
+	const UBYTE *start;/* first byte in memory, NULL when there are none */
+	BOOL copied;       /* the bytes are a copy and the reader is past them */
+	UBYTE *copy;       /* storage of copies */
 } ITPACK;
 
+/* Width changes of IT-Compressed samples: at a given width, values from lo
+   to lo+span-1 set a new width instead of being samples, which, below 7 bits,
+   follows in 'extra' bits. Samples are sign extended by 'shift' bits. */
+typedef struct ITWIDTH {
+	ULONG lo,span;
+	UBYTE extra,shift;
+} ITWIDTH;
+
+static const ITWIDTH itwidth8[10]={
+	{0,0,0,0},
+	{1,1,3,31},{2,1,3,30},{4,1,3,29},{8,1,3,28},{16,1,3,27},{32,1,3,26},
+	{60,8,0,25},{124,8,0,24},
+	{0x100,0x100,0,24}
+};
+
+static const ITWIDTH itwidth16[18]={
+	{0,0,0,0},
+	{1,1,4,31},{2,1,4,30},{4,1,4,29},{8,1,4,28},{16,1,4,27},{32,1,4,26},
+	{56,16,0,25},{120,16,0,24},{248,16,0,23},{504,16,0,22},{1016,16,0,21},
+	{2040,16,0,20},{4088,16,0,19},{8184,16,0,18},{16376,16,0,17},
+	{32760,16,0,16},
+	{0x10000,0x10000,0,16}
+};
+
 BOOL SL_Init(SAMPLOAD* s)
 {
-	if(!sl_buffer)
-		if(!(sl_buffer=(SWORD*)MikMod_malloc(SLBUFSIZE*sizeof(SWORD)))) return 0;
+	if(!sl.buffer)
+		if(!(sl.buffer=(SWORD*)MikMod_malloc(SLBUFSIZE*sizeof(SWORD)))) return 0;
 
-	sl_rlength = s->length;
-	if(s->infmt & SF_16BITS) sl_rlength>>=1;
-	sl_old = 0;
+	sl.rlength = s->length;
+	if(s->infmt & SF_16BITS) sl.rlength>>=1;
+	sl.old = 0;
 
 	return 1;
 }
 
 void SL_Exit(SAMPLOAD *s)
 {
-	if(sl_rlength>0) _mm_fseek(s->reader,sl_rlength,SEEK_CUR);
+	if(sl.rlength>0) _mm_fseek(s->reader,sl.rlength,SEEK_CUR);
+
+	MikMod_free(sl.buffer);
+	sl.buffer=NULL;
+}
+
+/* Starts an IT-Compressed block of 'count' bytes, which are decoded in place
+   when they are all in the window of the reader, or from a copy. */
+static BOOL itpack_start(ITPACK *status,MREADER *reader,UWORD count)
+{
+	long pos,got;
+
+	status->bitbuf = 0;
+	status->bitcount = 0;
+	if(_mm_window(reader,count)) {
+		status->start = ((MBUFREADER*)reader)->ptr;
+		status->copied = 0;
+		got = count;
+	} else {
+		if(!status->copy)
+			if(!(status->copy=(UBYTE*)MikMod_malloc(65535))) {
+				_mm_errno = MMERR_OUT_OF_MEMORY;
+				return 0;
+			}
+		pos = _mm_ftell(reader);
+		_mm_read_UBYTES(status->copy,count,reader);
+		got = _mm_ftell(reader)-pos;
+		if(got<0) got=0;
+		if(got>count) got=count;
+		status->start = status->copy;
+		status->copied = 1;
+	}
+	status->ptr = status->start;
+	status->end = status->start+got;
+	status->incnt = count-(UWORD)got;
+	return 1;
+}
+
+/* Leaves the reader after the bytes of the block used so far, or after all
+   the bytes in memory, and stops decoding from memory. */
+static void itpack_sync(ITPACK *status,MREADER *reader,BOOL all)
+{
+	long used;
+
+	if(!status->start) return;
+	used = all?(long)(status->end-status->start):
+	           (long)(status->ptr-status->start)-(status->bitcount>>3);
+	if(status->copied) {
+		if(status->end-status->start>used)
+			_mm_fseek(reader,(long)(status->start-status->end)+used,SEEK_CUR);
+	} else
+		_mm_wskip(reader,used);
+	status->start = status->ptr = status->end = NULL;
+}
+
+static void itpack_done(ITPACK *status,MREADER *reader)
+{
+	itpack_sync(status,reader,0);
+	MikMod_free(status->copy);
+	status->copy = NULL;
+}
+
+/* Returns the next 'n' bits of the block. Bytes past the ones in memory are
+   read one at a time, as many as the block has and zeroes after them. */
+static ULONG itpack_read(ITPACK *status,MREADER *reader,UWORD n)
+{
+	ULONG x;
+
+	if(status->bitcount<n) {
+		while(status->bitcount<=24 && status->ptr<status->end) {
+			status->bitbuf|=(ULONG)*status->ptr++<<status->bitcount;
+			status->bitcount+=8;
+		}
+		while(status->bitcount<n) {
+			itpack_sync(status,reader,1);
+			if(status->incnt--)
+				status->bitbuf|=(ULONG)_mm_read_UBYTE(reader)<<status->bitcount;
+			status->bitcount+=8;
+		}
+	}
+	x = status->bitbuf&((1UL<<n)-1);
+	status->bitbuf>>=n;
+	status->bitcount-=n;
+	return x;
+}
+
+/* Returns the width set by a width change value, or 0 if it is invalid */
+static UWORD itpack_width(ITPACK *status,MREADER *reader,const ITWIDTH *w,
+                          ULONG x,UWORD maxbits)
+{
+	UWORD bits = status->bits;
 
-	MikMod_free(sl_buffer);
-	sl_buffer=NULL;
+	x = (w->extra?itpack_read(status,reader,w->extra):x-w->lo)+1;
+	if((bits<maxbits)&&(x>=bits)) x++;
+	return (x>maxbits)?0:(UWORD)x;
 }
 
 /* unpack a 8bit IT packed sample */
-static int read_itcompr8(ITPACK* status,MREADER *reader,SWORD *out,UWORD count,UWORD* incnt)
+static int read_itcompr8(ITPACK* status,MREADER *reader,SWORD *out,UWORD count)
 {
 	SWORD *dest=out,*end=out+count;
-	UWORD x,y,needbits,havebits,new_count=0;
-	UWORD bits = status->bits;
-	UWORD bufbits = status->bufbits;
+	const ITWIDTH *w=&itwidth8[status->bits];
 	SBYTE last = status->last;
-	UBYTE buf = status->buf;
+	ULONG x;
 
 	while (dest<end) {
-		needbits=new_count?3:bits;
-		x=havebits=0;
-		while (needbits) {
-			/* feed buffer */
-			if (!bufbits) {
-				if((*incnt)--)
-					buf=_mm_read_UBYTE(reader);
-				else
-					buf=0;
-				bufbits=8;
+		x = itpack_read(status,reader,status->bits);
+		if (x-w->lo<w->span) {
+			if (!(status->bits=itpack_width(status,reader,w,x,9))) {
+				/* error in compressed data... */
+				_mm_errno=MMERR_ITPACK_INVALID_DATA;
+				return 0;
 			}
-			/* get as many bits as necessary */
-			y = needbits<bufbits?needbits:bufbits;
-			x|= (buf & ((1<<y)- 1))<<havebits;
-			buf>>=y;
-			bufbits-=y;
-			needbits-=y;
-			havebits+=y;
-		}
-		if (new_count) {
-			new_count = 0;
-			if (++x >= bits)
-				x++;
-			bits = x;
+			w = &itwidth8[status->bits];
 			continue;
 		}
-		if (bits<7) {
-			if (x==(1<<(bits-1))) {
-				new_count = 1;
-				continue;
-			}
-		}
-		else if (bits<9) {
-			y = (0xff >> (9-bits)) - 4;
-			if ((x>y)&&(x<=y+8)) {
-				if ((x-=y)>=bits)
-					x++;
-				bits = x;
-				continue;
-			}
-		}
-		else if (bits<10) {
-			if (x>=0x100) {
-				bits=x-0x100+1;
-				continue;
-			}
-		} else {
-			/* error in compressed data... */
-			_mm_errno=MMERR_ITPACK_INVALID_DATA;
-			return 0;
-		}
-
-		if (bits<8) /* extend sign */
-			x = ((SBYTE)(x <<(8-bits))) >> (8-bits);
+		/* extend sign */
+		x = (ULONG)((SLONG)(x<<w->shift)>>w->shift);
 		*(dest++)= (last+=x) << 8; /* convert to 16 bit */
 	}
-	status->bits = bits;
-	status->bufbits = bufbits;
 	status->last = last;
-	status->buf = buf;
 	return (dest-out);
 }
 
 /* unpack a 16bit IT packed sample */
-static int read_itcompr16(ITPACK *status,MREADER *reader,SWORD *out,UWORD count,UWORD* incnt)
+static int read_itcompr16(ITPACK *status,MREADER *reader,SWORD *out,UWORD count)
 {
 	SWORD *dest=out,*end=out+count;
-	SLONG x,y,needbits,havebits,new_count=0;
-	UWORD bits = status->bits;
-	UWORD bufbits = status->bufbits;
+	const ITWIDTH *w=&itwidth16[status->bits];
 	SWORD last = status->last;
-	UBYTE buf = status->buf;
+	ULONG x;
 
 	while (dest<end) {
-		needbits=new_count?4:bits;
-		x=havebits=0;
-		while (needbits) {
-			/* feed buffer */
-			if (!bufbits) {
-				if((*incnt)--)
-					buf=_mm_read_UBYTE(reader);
-				else
-					buf=0;
-				bufbits=8;
+		x = itpack_read(status,reader,status->bits);
+		if (x-w->lo<w->span) {
+			if (!(status->bits=itpack_width(status,reader,w,x,17))) {
+				/* error in compressed data... */
+				_mm_errno=MMERR_ITPACK_INVALID_DATA;
+				return 0;
 			}
-			/* get as many bits as necessary */
-			y=needbits<bufbits?needbits:bufbits;
-			x|=(buf &((1<<y)-1))<<havebits;
-			buf>>=y;
-			bufbits-=(UWORD)y;
-			needbits-=(UWORD)y;
-			havebits+=(UWORD)y;
-		}
-		if (new_count) {
-			new_count = 0;
-			if (++x >= bits)
-				x++;
-			bits = (UWORD)x;
+			w = &itwidth16[status->bits];
 			continue;
 		}
-		if (bits<7) {
-			if (x==(1<<(bits-1))) {
-				new_count=1;
-				continue;
-			}
+		/* extend sign */
+		x = (ULONG)((SLONG)(x<<w->shift)>>w->shift);
+		*(dest++)=(last+=x);
+	}
+	status->last = last;
+	return (dest-out);
+}
+
+/* Converts a chunk of plain samples, 'load' being the 16 bit value of the
+   input sample t and 'store' the output for value v. */
+#define SL_CONVERT(load,store)						\
+	if(delta)							\
+		for(t=0;t<stodo;t++) {					\
+			old+=(SWORD)(load);				\
+			store((SWORD)(old^flip));			\
+		}							\
+	else								\
+		for(t=0;t<stodo;t++)					\
+			store((SWORD)((SWORD)(load)^flip))
+
+#define SL_STORE16(v)	(w[t]=(v))
+#define SL_STORE8(v)	(b[t]=(SBYTE)((v)>>8))
+
+/* Loads plain samples with the conversions of the output format done in a
+   single pass. The data is read where the output goes when it has the same
+   size, and converted in place; reads and end of data checks are the same as
+   in SL_LoadInternal, chunk by chunk. */
+static int SL_LoadPlain(SLSTATE *st,void *buffer,UWORD infmt,UWORD outfmt,ULONG length,MREADER *reader)
+{
+	UBYTE *out = (UBYTE*)buffer;
+	int insize = (infmt&SF_16BITS)?2:1, outsize = (outfmt&SF_16BITS)?2:1;
+	BOOL delta = (infmt&SF_DELTA)?1:0;
+	UWORD flip = ((infmt^outfmt)&SF_SIGNED)?0x8000:0;
+	SWORD old = st->old;
+	int stodo,t;
+	long pos,got;
+
+	while(length) {
+		UBYTE *src;
+		SWORD *w = (SWORD*)out;
+		SBYTE *b = (SBYTE*)out;
+
+		stodo=(length<SLBUFSIZE)?length:SLBUFSIZE;
+		if(_mm_eof(reader)) {
+			st->old = old;
+			_mm_errno=MMERR_NOT_A_STREAM;/* better error? */
+			return 1;
 		}
-		else if (bits<17) {
-			y=(0xffff>>(17-bits))-8;
-			if ((x>y)&&(x<=y+16)) {
-				if ((x-=y)>=bits)
-					x++;
-				bits = (UWORD)x;
-				continue;
-			}
+		src = (insize==outsize)?out:(UBYTE*)st->buffer;
+		pos = _mm_ftell(reader);
+		if(!reader->Read(reader,src,insize*stodo)) {
+			/* what was not there reads as EOF, as with the byte readers */
+			got = _mm_ftell(reader)-pos;
+			if(got<0) got=0;
+			if(got<insize*stodo)
+				memset(src+got,0xff,insize*stodo-got);
 		}
-		else if (bits<18) {
-			if (x>=0x10000) {
-				bits=(UWORD)(x-0x10000+1);
-				continue;
+
+		if(insize==1) {
+			const SBYTE *s8 = (const SBYTE*)src;
+			if(outsize==2) {
+				SL_CONVERT(s8[t]<<8,SL_STORE16);
+			} else {
+				SL_CONVERT(s8[t]<<8,SL_STORE8);
+			}
+		} else if(infmt&SF_BIG_ENDIAN) {
+			if(outsize==2) {
+				SL_CONVERT((src[2*t]<<8)|src[2*t+1],SL_STORE16);
+			} else {
+				SL_CONVERT((src[2*t]<<8)|src[2*t+1],SL_STORE8);
 			}
 		} else {
-			 /* error in compressed data... */
-			_mm_errno=MMERR_ITPACK_INVALID_DATA;
-			return 0;
+			if(outsize==2) {
+				SL_CONVERT(src[2*t]|(src[2*t+1]<<8),SL_STORE16);
+			} else {
+				SL_CONVERT(src[2*t]|(src[2*t+1]<<8),SL_STORE8);
+			}
 		}
 
-		if (bits<16) /* extend sign */
-			x = ((SWORD)(x<<(16-bits)))>>(16-bits);
-		*(dest++)=(last+=x);
+		st->rlength-=stodo;
+		length-=stodo;
+		out+=outsize*stodo;
 	}
-	status->bits = bits;
-	status->bufbits = bufbits;
-	status->last = last;
-	status->buf = buf;
-	return (dest-out);
+	st->old = old;
+	return 0;
 }
 
-static int SL_LoadInternal(void *buffer,UWORD infmt,UWORD outfmt,int scalefactor,ULONG length,MREADER *reader,BOOL dither)
+static int SL_LoadInternal(SLSTATE *st,void *buffer,UWORD infmt,UWORD outfmt,int scalefactor,ULONG length,MREADER *reader,BOOL dither)
 {
 	SBYTE *bptr = (SBYTE*)buffer;
 	SWORD *wptr = (SWORD*)buffer;
@@ -229,38 +353,43 @@ static int SL_LoadInternal(void *buffer,UWORD infmt,UWORD outfmt,int scalefactor
 
 	int result,c_block=0;	/* compression bytes until next block */
 	ITPACK status;
-	UWORD incnt = 0;
 
 	SBYTE compressionTable[16];
 	SWORD adpcmDelta = 0;
 	BOOL hasTable = 0;
 
-	status.buf = 0;
 	status.last = 0;
-	status.bufbits = 0;
 	status.bits = 0;
+	status.start = NULL;
+	status.copy = NULL;
+
+	if(!(infmt&(SF_ITPACKED|SF_ADPCM4))&&(!scalefactor)&&
+	   !(dither && (infmt&SF_STEREO) && !(outfmt&SF_STEREO)))
+		return SL_LoadPlain(st,buffer,infmt,outfmt,length,reader);
 
 	while(length) {
 		stodo=(length<SLBUFSIZE)?length:SLBUFSIZE;
 
 		if(infmt&SF_ITPACKED) {
-			sl_rlength=0;
+			st->rlength=0;
 			if (!c_block) {
+				itpack_sync(&status,reader,0);
 				status.bits = (infmt & SF_16BITS) ? 17 : 9;
-				status.last = status.bufbits = 0;
-				incnt=_mm_read_I_UWORD(reader);
-				c_block = (infmt & SF_16BITS) ? 0x4000 : 0x8000;
-				if(infmt&SF_DELTA) sl_old=0;
-			}
-			if (infmt & SF_16BITS) {
-				if(!(result=read_itcompr16(&status,reader,sl_buffer,stodo,&incnt)))
-					return 1;
-			} else {
-				if(!(result=read_itcompr8(&status,reader,sl_buffer,stodo,&incnt)))
+				status.last = 0;
+				if(!itpack_start(&status,reader,_mm_read_I_UWORD(reader))) {
+					itpack_done(&status,reader);
 					return 1;
+				}
+				c_block = (infmt & SF_16BITS) ? 0x4000 : 0x8000;
+				if(infmt&SF_DELTA) st->old=0;
 			}
+			if (infmt & SF_16BITS)
+				result=read_itcompr16(&status,reader,st->buffer,stodo);
+			else
+				result=read_itcompr8(&status,reader,st->buffer,stodo);
 			if(result!=stodo) {
-				_mm_errno=MMERR_ITPACK_INVALID_DATA;
+				if(result) _mm_errno=MMERR_ITPACK_INVALID_DATA;
+				itpack_done(&status,reader);
 				return 1;
 			}
 			c_block -= stodo;
@@ -276,9 +405,9 @@ static int SL_LoadInternal(void *buffer,UWORD infmt,UWORD outfmt,int scalefactor
 				UBYTE b = _mm_read_UBYTE(reader);
 
 				adpcmDelta += compressionTable[b & 0x0f];
-				sl_buffer[t] = adpcmDelta << 8;
+				st->buffer[t] = adpcmDelta << 8;
 				adpcmDelta += compressionTable[(b >> 4) & 0x0f];
-				sl_buffer[t+1] = adpcmDelta << 8;
+				st->buffer[t+1] = adpcmDelta << 8;
 			}
 		} else {
 			if(infmt&SF_16BITS) {
@@ -287,9 +416,9 @@ static int SL_LoadInternal(void *buffer,UWORD infmt,UWORD outfmt,int scalefactor
 					return 1;
 				}
 				if(infmt&SF_BIG_ENDIAN)
-					_mm_read_M_SWORDS(sl_buffer,stodo,reader);
+					_mm_read_M_SWORDS(st->buffer,stodo,reader);
 				else
-					_mm_read_I_SWORDS(sl_buffer,stodo,reader);
+					_mm_read_I_SWORDS(st->buffer,stodo,reader);
 			} else {
 				SBYTE *src;
 				SWORD *dest;
@@ -298,9 +427,9 @@ static int SL_LoadInternal(void *buffer,UWORD infmt,UWORD outfmt,int scalefactor
 					_mm_errno=MMERR_NOT_A_STREAM;/* better error? */
 					return 1;
 				}
-				reader->Read(reader,sl_buffer,sizeof(SBYTE)*stodo);
-				src = (SBYTE*)sl_buffer;
-				dest  = sl_buffer;
+				reader->Read(reader,st->buffer,sizeof(SBYTE)*stodo);
+				src = (SBYTE*)st->buffer;
+				dest  = st->buffer;
 				src += stodo;dest += stodo;
 
 				for(t=0;t<stodo;t++) {
@@ -308,18 +437,18 @@ static int SL_LoadInternal(void *buffer,UWORD infmt,UWORD outfmt,int scalefactor
 					*dest = (*src)<<8;
 				}
 			}
-			sl_rlength-=stodo;
+			st->rlength-=stodo;
 		}
 
 		if(infmt & SF_DELTA)
 			for(t=0;t<stodo;t++) {
-				sl_buffer[t] += sl_old;
-				sl_old = sl_buffer[t];
+				st->buffer[t] += st->old;
+				st->old = st->buffer[t];
 			}
 
 		if((infmt^outfmt) & SF_SIGNED)
 			for(t=0;t<stodo;t++)
-				sl_buffer[t]^= 0x8000;
+				st->buffer[t]^= 0x8000;
 
 		if(scalefactor) {
 			int idx = 0;
@@ -330,8 +459,8 @@ static int SL_LoadInternal(void *buffer,UWORD infmt,UWORD outfmt,int scalefactor
 			while(t<stodo && length) {
 				scaleval = 0;
 				for(u=scalefactor;u && t<stodo;u--,t++)
-					scaleval+=sl_buffer[t];
-				sl_buffer[idx++]=(UWORD)(scaleval/(scalefactor-u));
+					scaleval+=st->buffer[t];
+				st->buffer[idx++]=(UWORD)(scaleval/(scalefactor-u));
 				length--;
 			}
 			stodo = idx;
@@ -346,9 +475,9 @@ static int SL_LoadInternal(void *buffer,UWORD infmt,UWORD outfmt,int scalefactor
 
 				t=0;
 				while(t<stodo && length) {
-					avgval=sl_buffer[t++];
-					avgval+=sl_buffer[t++];
-					sl_buffer[idx++]=(SWORD)(avgval>>1);
+					avgval=st->buffer[t++];
+					avgval+=st->buffer[t++];
+					st->buffer[idx++]=(SWORD)(avgval>>1);
 					length-=2;
 				}
 				stodo = idx;
@@ -357,21 +486,246 @@ static int SL_LoadInternal(void *buffer,UWORD infmt,UWORD outfmt,int scalefactor
 
 		if(outfmt & SF_16BITS) {
 			for(t=0;t<stodo;t++)
-				*(wptr++)=sl_buffer[t];
+				*(wptr++)=st->buffer[t];
 		} else {
 			for(t=0;t<stodo;t++)
-				*(bptr++)=sl_buffer[t]>>8;
+				*(bptr++)=st->buffer[t]>>8;
 		}
 	}
+	itpack_done(&status,reader);
 	return 0;
 }
 
 int SL_Load(void* buffer,SAMPLOAD *smp,ULONG length)
 {
-	return SL_LoadInternal(buffer,smp->infmt,smp->outfmt,smp->scalefactor,
+	MREADER *reader;
+	int result;
+
+	/* convert samples decoded ahead from their words, and leave the reader
+	   where decoding them did */
+	if(smp->decoded && (length==smp->length) &&
+	   (reader=_mm_new_mem_reader(smp->decoded,length*sizeof(SWORD)))) {
+		result=SL_LoadInternal(&sl,buffer,SF_DECODED(smp->infmt),smp->outfmt,
+					smp->scalefactor,length,reader,0);
+		_mm_delete_mem_reader(reader);
+		_mm_fseek(smp->reader,smp->decodedpos,SEEK_SET);
+		sl.rlength=0;
+		return result;
+	}
+
+	return SL_LoadInternal(&sl,buffer,smp->infmt,smp->outfmt,smp->scalefactor,
 				length,smp->reader,0);
 }
 
+/*========== Decoding samples ahead */
+
+/* Samples compressed in the module are the ones worth decoding in parallel;
+   their position has to be known for a reader of their own to find them. */
+static BOOL SL_Decodable(SAMPLOAD *s,MREADER *reader)
+{
+	return (s->reader==reader)&&(s->sample->length)&&(s->sample->seekpos)&&
+	       (!s->scalefactor)&&(s->infmt&(SF_ITPACKED|SF_ADPCM4))&&
+	       (!s->decoded);
+}
+
+/* Decodes a sample in 16 bit words, with the given view of its reader. On
+   failure, nothing is decoded and the sample is left to the usual loading,
+   which will report the error. */
+static void SL_Decode(SAMPLOAD *s,MREADER *view,SWORD *buffer)
+{
+	SLSTATE st;
+
+	if(!(s->decoded=(SWORD*)MikMod_malloc(s->length*sizeof(SWORD)))) return;
+
+	st.buffer=buffer;
+	st.old=0;
+	st.rlength=s->length;
+	if(s->infmt & SF_16BITS) st.rlength>>=1;
+
+	_mm_fseek(view,s->sample->seekpos,SEEK_SET);
+	if(SL_LoadInternal(&st,s->decoded,s->infmt,s->infmt|SF_16BITS,0,
+	                   s->length,view,0)) {
+		MikMod_free(s->decoded);
+		s->decoded=NULL;
+		return;
+	}
+	s->decodedpos=_mm_ftell(view)+(st.rlength>0?st.rlength:0);
+}
+
+#ifdef HAVE_PTHREAD
+
+typedef struct SLWORKER {
+	pthread_t thread;
+	MREADER *view;		/* reader of its own */
+	SWORD *buffer;		/* conversion buffer of its own */
+	struct SLPOOL *pool;
+} SLWORKER;
+
+typedef struct SLPOOL {
+	pthread_mutex_t lock;
+	SAMPLOAD *next;		/* next sample to decode */
+	MREADER *reader;	/* reader of the samples */
+} SLPOOL;
+
+static void* SL_DecodeWorker(void *arg)
+{
+	SLWORKER *w=(SLWORKER*)arg;
+	SLPOOL *pool=w->pool;
+	SAMPLOAD *s;
+
+	for(;;) {
+		pthread_mutex_lock(&pool->lock);
+		if((s=pool->next)) {
+			do
+				pool->next=pool->next->next;
+			while(pool->next && !SL_Decodable(pool->next,pool->reader));
+		}
+		pthread_mutex_unlock(&pool->lock);
+		if(!s) break;
+		SL_Decode(s,w->view,w->buffer);
+	}
+	return NULL;
+}
+
+/* Decodes the compressed samples of the list with md_loadthreads threads,
+   the calling one included, before they are handed to the driver. Only
+   readers which can be shared, i.e. memory readers, are decoded this way. */
+static void DecodeSamples(SAMPLOAD *samplist)
+{
+	SLWORKER *workers;
+	SLPOOL pool;
+	SAMPLOAD *s;
+	int count=0,n,t;
+
+	if(md_loadthreads<2) return;
+
+	for(s=samplist;s && !SL_Decodable(s,s->reader);s=s->next);
+	if(!s) return;
+	pool.next=s;
+	pool.reader=s->reader;
+	for(;s;s=s->next)
+		if(SL_Decodable(s,pool.reader)) count++;
+	if((n=md_loadthreads)>count) n=count;
+	if(n<2) return;
+
+	if(!(workers=(SLWORKER*)MikMod_calloc(n,sizeof(SLWORKER)))) return;
+	for(t=0;t<n;t++) {
+		if(!(workers[t].view=_mm_reader_view(pool.reader))) break;
+		if(!(workers[t].buffer=(SWORD*)MikMod_malloc(SLBUFSIZE*sizeof(SWORD)))) {
+			_mm_delete_mem_reader(workers[t].view);
+			break;
+		}
+		workers[t].pool=&pool;
+	}
+	if((n=t)) {
+		pthread_mutex_init(&pool.lock,NULL);
+		for(t=1;t<n;t++)
+			if(pthread_create(&workers[t].thread,NULL,SL_DecodeWorker,&workers[t]))
+				break;
+		SL_DecodeWorker(&workers[0]);
+		while(--t>0)
+			pthread_join(workers[t].thread,NULL);
+		pthread_mutex_destroy(&pool.lock);
+	}
+	for(t=0;t<n;t++) {
+		_mm_delete_mem_reader(workers[t].view);
+		MikMod_free(workers[t].buffer);
+	}
+	MikMod_free(workers);
+}
+
+#else
+
+/* Without threads, samples are decoded while they are loaded */
+static void DecodeSamples(SAMPLOAD *samplist)
+{
+	(void)samplist;
+}
+
+#endif
+
+/* Decodes every registered music sample ahead, for the module to be saved
+   with its samples decoded, and sets the position of the samples read in
+   sequence. Returns 0 when all samples could be decoded. */
+int SL_DecodeSamples(void)
+{
+	SAMPLOAD *s;
+	SWORD *buffer;
+
+	for(s=musiclist;s;s=s->next)
+		if(s->infmt&SF_STEREO) return 1;
+	if(!(buffer=(SWORD*)MikMod_malloc(SLBUFSIZE*sizeof(SWORD)))) return 1;
+
+	DecodeSamples(musiclist);
+	for(s=musiclist;s;s=s->next) {
+		if(!s->sample->length) continue;
+		if(s->sample->seekpos)
+			_mm_fseek(s->reader,s->sample->seekpos,SEEK_SET);
+		else
+			s->sample->seekpos=_mm_ftell(s->reader);
+		if(!s->decoded) SL_Decode(s,s->reader,buffer);
+		if(!s->decoded) break;
+		_mm_fseek(s->reader,s->decodedpos,SEEK_SET);
+	}
+	MikMod_free(buffer);
+	return s!=NULL;
+}
+
+/* Returns the samples of a registered music sample decoded by
+   SL_DecodeSamples, and their format, or NULL */
+SWORD* SL_Decoded(SAMPLE *sample,UWORD *format)
+{
+	SAMPLOAD *s;
+
+	for(s=musiclist;s;s=s->next)
+		if(s->sample==sample) {
+			*format=SF_DECODED(s->infmt);
+			return s->decoded;
+		}
+	return NULL;
+}
+
+/* Returns the size in bytes a sample takes in its module, or, for compressed
+   samples, a bound of it */
+static ULONG SampleBytes(SAMPLOAD *s)
+{
+	ULONG size=s->length;
+
+	if((s->infmt&SF_16BITS)||(s->infmt&(SF_ITPACKED|SF_ADPCM4))) size<<=1;
+	if(s->infmt&SF_STEREO) size<<=1;
+	return size;
+}
+
+/* Returns the sample data in the storage of its reader, when the driver can
+   use it in place instead of loading it: the sample must need no conversion,
+   and the first 'size' bytes from its beginning, which the driver may modify
+   past the sample end, must not hold another sample. */
+void* SL_Borrow(SAMPLOAD *s,ULONG size)
+{
+	ULONG start=s->sample->seekpos,end=start+size;
+	SAMPLOAD *o;
+	void *storage;
+
+	if((!md_mapsamples)||(s->infmt!=s->outfmt)||(s->scalefactor)||(!start)||
+	   ((s->infmt&SF_FORMATMASK)!=SF_NATIVE16))
+		return NULL;
+
+	for(o=sl_loading;o;o=o->next)
+		if((o!=s)&&(o->sample->length)) {
+			/* the position of samples read in sequence is unknown */
+			if(!o->sample->seekpos) return NULL;
+			if((o->sample->seekpos<end)&&
+			   (start<o->sample->seekpos+SampleBytes(o)))
+				return NULL;
+		}
+
+	if(!(storage=_mm_reader_storage(s->reader,size,sizeof(SWORD))))
+		return NULL;
+	_mm_fseek(s->reader,s->length*sizeof(SWORD),SEEK_CUR);
+	sl.rlength=0;
+	return storage;
+}
+
 /* Registers a sample for loading when SL_LoadSamples() is called. */
 SAMPLOAD* SL_RegisterSample(SAMPLE* s,int type,MREADER* reader)
 {
@@ -414,6 +768,7 @@ static void FreeSampleList(SAMPLOAD* s)
 	while(s) {
 		old = s;
 		s = s->next;
+		MikMod_free(old->decoded);
 		MikMod_free(old);
 	}
 }
@@ -475,7 +830,8 @@ static int DitherSamples(SAMPLOAD* samplist,int type)
 		}
 
 	/* Samples dithered, now load them ! */
-	s = samplist;
+	DecodeSamples(samplist);
+	sl_loading = s = samplist;
 	while(s) {
 		/* sample has to be loaded ? -> increase number of samples, allocate
 		   memory and load sample. */
@@ -487,7 +843,10 @@ static int DitherSamples(SAMPLOAD* samplist,int type)
 			   return a 'handle' (>=0) that identifies the sample. */
 			s->sample->handle = MD_SampleLoad(s, type);
 			s->sample->flags  = (s->sample->flags & ~SF_FORMATMASK) | s->outfmt;
+			MikMod_free(s->decoded);
+			s->decoded = NULL;
 			if(s->sample->handle<0) {
+				sl_loading=NULL;
 				FreeSampleList(samplist);
 				if(_mm_errorhandler) _mm_errorhandler();
 				return 1;
@@ -496,6 +855,7 @@ static int DitherSamples(SAMPLOAD* samplist,int type)
 		s = s->next;
 	}
 
+	sl_loading=NULL;
 	FreeSampleList(samplist);
 	return 0;
 }
@@ -513,6 +873,282 @@ int SL_LoadSamples(void)
 	return rc;
 }
 
+/*========== Loading samples when first played */
+
+#define LAZY_IDLE     0	/* not loaded yet */
+#define LAZY_QUEUED   1	/* waiting to be decoded ahead */
+#define LAZY_DECODING 2	/* being decoded ahead */
+#define LAZY_DECODED  3	/* decoded ahead, to be loaded */
+#define LAZY_LOADED   4	/* handed to the driver, or failed to load */
+
+struct SLLAZY {
+	SAMPLOAD *loads;	/* one per sample of the module */
+	SAMPLOAD *list;		/* the registered ones, linked */
+	UBYTE *state;		/* LAZY_xx state of each sample */
+	SAMPLE *samples;	/* samples of the module */
+	int numsmp;
+	int position;		/* last song position prefetched, or -1 */
+	MMAPPING *map;		/* mapping holding the sample data */
+	MREADER *reader;	/* reader of the player over the mapping */
+#ifdef HAVE_PTHREAD
+	int started;		/* 1 when the thread runs, -1 if it can't */
+	BOOL quit;
+	pthread_t thread;
+	pthread_mutex_t lock;	/* protects state, the queue and quit */
+	pthread_cond_t cond;
+	int *queue;		/* samples to decode ahead */
+	int head,count;
+	MREADER *view;		/* reader of the thread */
+	SWORD *buffer;		/* conversion buffer of the thread */
+#endif
+};
+
+/* Takes the samples registered by a module loader and keeps them for loading
+   when they are first played. This requires a mapped file, which stays valid
+   as long as the module, a driver without memory limits, and the position of
+   every sample; otherwise NULL is returned and the samples stay registered. */
+SLLAZY* SL_DeferSamples(MREADER *reader,SAMPLE *samples,int numsmp)
+{
+	SLLAZY *lazy;
+	SAMPLOAD *s,*prev=NULL;
+	long pos,size;
+	BOOL known=1;
+
+	if(!musiclist||MD_SampleSpace(MD_MUSIC)) return NULL;
+
+	/* find where the samples read in sequence are, and check they are all
+	   in the file */
+	pos=_mm_ftell(reader);
+	_mm_fseek(reader,0,SEEK_END);
+	size=_mm_ftell(reader);
+	_mm_fseek(reader,pos,SEEK_SET);
+	for(s=musiclist;s;s=s->next) {
+		if((s->sample<samples)||(s->sample>=samples+numsmp)) return NULL;
+		if(s->sample->seekpos) {
+			pos=s->sample->seekpos;
+			known=1;
+		} else if(!known) return NULL;
+		if(s->infmt&(SF_ITPACKED|SF_ADPCM4))
+			known=0;
+		else {
+			pos+=(s->infmt&SF_16BITS)?s->length<<1:s->length;
+			if(pos>size) return NULL;
+		}
+	}
+
+	if(!(lazy=(SLLAZY*)MikMod_calloc(1,sizeof(SLLAZY)))) return NULL;
+	lazy->loads=(SAMPLOAD*)MikMod_calloc(numsmp,sizeof(SAMPLOAD));
+	lazy->state=(UBYTE*)MikMod_calloc(numsmp,sizeof(UBYTE));
+	lazy->map=_mm_map_retain(reader);
+	lazy->reader=_mm_reader_view(reader);
+	if(!lazy->loads||!lazy->state||!lazy->map||!lazy->reader) {
+		lazy->numsmp=0;
+		SL_FreeLazy(lazy);
+		return NULL;
+	}
+	lazy->samples=samples;
+	lazy->numsmp=numsmp;
+	lazy->position=-1;
+
+	pos=_mm_ftell(reader);
+	for(s=musiclist;s;s=s->next) {
+		SAMPLOAD *l=&lazy->loads[s->sample-samples];
+
+		if(s->sample->seekpos)
+			pos=s->sample->seekpos;
+		else
+			s->sample->seekpos=pos;
+		pos+=(s->infmt&SF_16BITS)?s->length<<1:s->length;
+
+		*l=*s;
+		s->decoded=NULL;
+		l->next=NULL;
+		l->reader=lazy->reader;
+		if(prev) prev->next=l; else lazy->list=l;
+		prev=l;
+	}
+	FreeSampleList(musiclist);
+	musiclist=NULL;
+
+	return lazy;
+}
+
+/* Loads a sample of a lazily loaded module, if it is not loaded yet. Unless
+   'wait' is set, compressed samples are not decoded here, in the player:
+   they are queued to the prefetch thread, and keep a negative handle, so
+   that their notes are held back, until they are decoded. Without the
+   thread, they are decoded here. On failure, the sample keeps a negative
+   handle and is not played. */
+void SL_LoadLazy(SLLAZY *lazy,SAMPLE *s,BOOL wait)
+{
+	int i=(int)(s-lazy->samples),state;
+	SAMPLOAD *l;
+
+	if((i<0)||(i>=lazy->numsmp)) return;
+	l=&lazy->loads[i];
+#ifdef HAVE_PTHREAD
+	if(!wait) SL_PrefetchLazy(lazy,s);
+	if(lazy->started>0) {
+		pthread_mutex_lock(&lazy->lock);
+		if(!wait && ((lazy->state[i]==LAZY_QUEUED)||
+		             (lazy->state[i]==LAZY_DECODING))) {
+			pthread_mutex_unlock(&lazy->lock);
+			return;
+		}
+		while(lazy->state[i]==LAZY_DECODING)
+			pthread_cond_wait(&lazy->cond,&lazy->lock);
+		state=lazy->state[i];
+		lazy->state[i]=LAZY_LOADED;
+		pthread_mutex_unlock(&lazy->lock);
+	} else
+#endif
+	{
+		state=lazy->state[i];
+		lazy->state[i]=LAZY_LOADED;
+	}
+	if((state==LAZY_LOADED)||(!l->sample)||(!s->length)) return;
+
+	_mm_fseek(lazy->reader,s->seekpos,SEEK_SET);
+	sl_loading=lazy->list;
+	s->handle=MD_SampleLoad(l,MD_MUSIC);
+	sl_loading=NULL;
+	if(s->handle>=0)
+		s->flags=(s->flags&~SF_FORMATMASK)|l->outfmt;
+	MikMod_free(l->decoded);
+	l->decoded=NULL;
+}
+
+#ifdef HAVE_PTHREAD
+
+static void* SL_LazyWorker(void *arg)
+{
+	SLLAZY *lazy=(SLLAZY*)arg;
+	int i;
+
+	pthread_mutex_lock(&lazy->lock);
+	for(;;) {
+		while(!lazy->quit && !lazy->count)
+			pthread_cond_wait(&lazy->cond,&lazy->lock);
+		if(lazy->quit) break;
+
+		i=lazy->queue[lazy->head];
+		lazy->head=(lazy->head+1)%lazy->numsmp;
+		lazy->count--;
+		if(lazy->state[i]!=LAZY_QUEUED) continue;
+
+		lazy->state[i]=LAZY_DECODING;
+		pthread_mutex_unlock(&lazy->lock);
+		SL_Decode(&lazy->loads[i],lazy->view,lazy->buffer);
+		pthread_mutex_lock(&lazy->lock);
+		lazy->state[i]=LAZY_DECODED;
+		pthread_cond_broadcast(&lazy->cond);
+	}
+	pthread_mutex_unlock(&lazy->lock);
+	return NULL;
+}
+
+static BOOL SL_StartLazy(SLLAZY *lazy)
+{
+	if(lazy->started) return lazy->started>0;
+
+	lazy->started=-1;
+	if(!(lazy->queue=(int*)MikMod_malloc(lazy->numsmp*sizeof(int))))
+		return 0;
+	if(!(lazy->buffer=(SWORD*)MikMod_malloc(SLBUFSIZE*sizeof(SWORD))))
+		return 0;
+	if(!(lazy->view=_mm_reader_view(lazy->reader)))
+		return 0;
+	pthread_mutex_init(&lazy->lock,NULL);
+	pthread_cond_init(&lazy->cond,NULL);
+	if(pthread_create(&lazy->thread,NULL,SL_LazyWorker,lazy)) {
+		pthread_cond_destroy(&lazy->cond);
+		pthread_mutex_destroy(&lazy->lock);
+		return 0;
+	}
+	lazy->started=1;
+	return 1;
+}
+
+/* Queues a sample of a lazily loaded module to be decoded ahead. Only
+   compressed samples are, the others being quick enough to load when played. */
+void SL_PrefetchLazy(SLLAZY *lazy,SAMPLE *s)
+{
+	int i=(int)(s-lazy->samples);
+	SAMPLOAD *l;
+
+	if((i<0)||(i>=lazy->numsmp)) return;
+	l=&lazy->loads[i];
+	if((!l->sample)||(lazy->started<0)) return;
+	/* until the thread runs, the player is the only one to use the states */
+	if((!lazy->started)&&((lazy->state[i]!=LAZY_IDLE)||
+	   (!SL_Decodable(l,lazy->reader))||(!SL_StartLazy(lazy))))
+		return;
+
+	pthread_mutex_lock(&lazy->lock);
+	if((lazy->state[i]==LAZY_IDLE)&&(SL_Decodable(l,lazy->reader))) {
+		lazy->state[i]=LAZY_QUEUED;
+		lazy->queue[(lazy->head+lazy->count++)%lazy->numsmp]=i;
+		pthread_cond_broadcast(&lazy->cond);
+	}
+	pthread_mutex_unlock(&lazy->lock);
+}
+
+/* Returns whether the samples of the song position 'pos' and the next ones
+   have to be queued, which they have once per position */
+int SL_PrefetchPosition(SLLAZY *lazy,int pos)
+{
+	if((!md_prefetchorders)||(lazy->started<0)||(lazy->position==pos))
+		return 0;
+	lazy->position=pos;
+	return 1;
+}
+
+#else
+
+void SL_PrefetchLazy(SLLAZY *lazy,SAMPLE *s)
+{
+	(void)lazy;
+	(void)s;
+}
+
+/* Without threads, samples are only loaded when played */
+int SL_PrefetchPosition(SLLAZY *lazy,int pos)
+{
+	(void)lazy;
+	(void)pos;
+	return 0;
+}
+
+#endif
+
+void SL_FreeLazy(SLLAZY *lazy)
+{
+	int i;
+
+	if(!lazy) return;
+#ifdef HAVE_PTHREAD
+	if(lazy->started>0) {
+		pthread_mutex_lock(&lazy->lock);
+		lazy->quit=1;
+		pthread_cond_broadcast(&lazy->cond);
+		pthread_mutex_unlock(&lazy->lock);
+		pthread_join(lazy->thread,NULL);
+		pthread_cond_destroy(&lazy->cond);
+		pthread_mutex_destroy(&lazy->lock);
+	}
+	if(lazy->view) _mm_delete_mem_reader(lazy->view);
+	MikMod_free(lazy->buffer);
+	MikMod_free(lazy->queue);
+#endif
+	for(i=0;i<lazy->numsmp;i++)
+		MikMod_free(lazy->loads[i].decoded);
+	if(lazy->reader) _mm_delete_mem_reader(lazy->reader);
+	_mm_map_release(lazy->map);
+	MikMod_free(lazy->loads);
+	MikMod_free(lazy->state);
+	MikMod_free(lazy);
+}
+
 void SL_Sample16to8(SAMPLOAD* s)
 {
 	s->outfmt &= ~SF_16BITS;
@@ -74,6 +74,15 @@
 #define CLICK_SHIFT  6
 #define CLICK_BUFFER (1L<<CLICK_SHIFT)
 
+/* interpolate, unless the adaptive mixing quality turned it off */
+#define VC_INTERP ((md_mode&DMODE_INTERP)&&(md_mixquality<MIXQ_NOINTERP))
+
+/* fractional bits of the increment of a voice, per md_mixfreq frame */
+#define STEPSHIFT FRACBITS
+
+/* rate the voices are mixed at, for the resonant filters */
+#define FILTER_MIXRATE (md_mixfreq)
+
 #ifndef MIN
 #define MIN(a,b) (((a)<(b)) ? (a) : (b))
 #endif
@@ -81,6 +90,7 @@
 typedef struct VINFO {
 	UBYTE     kick;              /* =1 -> sample has to be restarted */
 	UBYTE     active;            /* =1 -> sample is playing */
+	UBYTE     live;              /* =1 -> voice is in vc_live */
 	UWORD     flags;             /* 16/8 bits looping/one-shot */
 	SWORD     handle;            /* identifies the sample */
 	ULONG     start;             /* start index */
@@ -97,14 +107,24 @@ typedef struct VINFO {
 
 	SLONGLONG current;           /* current index in the sample */
 	SLONGLONG increment;         /* increment value */
+	SLONGLONG step;              /* increment for frq, playing forward */
+	SWORD     stem;              /* output stem, -1 for the mix only */
+	UBYTE     cutoff,resonance;  /* resonant filter settings (0-127) */
+	UBYTE     filter;            /* =1 -> voice is mixed through its filter */
+	SLONG     fa0,fb0,fb1;       /* filter coefficients */
+	SLONG     fhist[4];          /* last two filter outputs, left and right */
 } VINFO;
 
 static	SWORD **Samples;
+static	UBYTE *vc_borrowed=NULL;     /* =1 -> sample is used in place */
 static	VINFO *vinf=NULL,*vnf;
-static	long tickleft,samplesthatfit,vc_memory=0;
+static	long samplesthatfit,vc_memory=0;
 static	int vc_softchn;
+static	UWORD *vc_live=NULL;         /* voices which are kicked or playing */
+static	int vc_numlive=0;
 static	SLONGLONG idxsize,idxlpos,idxlend;
 static	SLONG *vc_tickbuf=NULL;
+static	SLONG *vc_filterbuf=NULL;       /* voice being filtered */
 static	UWORD vc_mode;
 
 /* Reverb control variables */
@@ -962,14 +982,18 @@ static void Mix32To8_SIMD(SBYTE* dste,const SLONG* srce,NATIVE count)
 #endif
 
 
-static void AddChannel(SLONG* ptr,NATIVE todo)
+/* Mixes the next 'todo' samples of the voice into 'ptr', or only moves the
+   voice on if 'ptr' is NULL. Returns the number of samples played before the
+   voice stopped, if it did. */
+static NATIVE AddChannel(SLONG* ptr,NATIVE todo)
 {
 	SLONGLONG end,done;
+	NATIVE total=todo;
 	SWORD *s;
 
 	if(!(s=Samples[vnf->handle])) {
 		vnf->current = vnf->active  = 0;
-		return;
+		return 0;
 	}
 
 	/* update the 'current' index so the sample loops, or stops playing if it
@@ -980,7 +1004,11 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 		if(vnf->flags & SF_REVERSE) {
 			/* The sample is playing in reverse */
 			if((vnf->flags&SF_LOOP)&&(vnf->current<idxlpos)) {
-				/* the sample is looping and has reached the loopstart index */
+				/* the sample is looping and has reached the loopstart index;
+				   at pitches which step over the whole loop, the index goes
+				   around it more than once */
+				if((idxlend>idxlpos)&&(idxlpos-vnf->current>=idxlend-idxlpos))
+					vnf->current=idxlpos-(idxlpos-vnf->current)%(idxlend-idxlpos);
 				if(vnf->flags & SF_BIDI) {
 					/* sample is doing bidirectional loops, so 'bounce' the
 					   current index against the idxlpos */
@@ -1004,6 +1032,8 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 			if((vnf->flags & SF_LOOP) &&
 			   (vnf->current >= idxlend)) {
 				/* the sample is looping, check the loopend index */
+				if((idxlend>idxlpos)&&(vnf->current-idxlend>=idxlend-idxlpos))
+					vnf->current=idxlend+(vnf->current-idxlend)%(idxlend-idxlpos);
 				if(vnf->flags & SF_BIDI) {
 					/* sample is doing bidirectional loops, so 'bounce' the
 					   current index against the idxlend */
@@ -1043,11 +1073,17 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 
 		endpos=vnf->current+done*vnf->increment;
 
-		if(vnf->vol) {
+		if(!ptr) {
+			/* only move on, the interpolating mixers would have gone
+			   through 'done' samples of the volume ramp */
+			if((vnf->vol)&&(vnf->rampvol)&&(VC_INTERP))
+				vnf->rampvol-=(int)MIN(done,vnf->rampvol);
+			vnf->current=endpos;
+		} else if(vnf->vol) {
 #ifndef NATIVE_64BIT_INT
 			/* use the 32 bit mixers as often as we can (they're much faster) */
 			if((vnf->current<0x7fffffff)&&(endpos<0x7fffffff)) {
-				if((md_mode & DMODE_INTERP)) {
+				if(VC_INTERP) {
 					if(vc_mode & DMODE_STEREO) {
 						if((vnf->pan==PAN_SURROUND)&&(md_mode&DMODE_SURROUND))
 							vnf->current=Mix32SurroundInterp
@@ -1080,7 +1116,7 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 			else
 #endif
 			{
-				if((md_mode & DMODE_INTERP)) {
+				if(VC_INTERP) {
 					if(vc_mode & DMODE_STEREO) {
 						if((vnf->pan==PAN_SURROUND)&&(md_mode&DMODE_SURROUND))
 							vnf->current=MixSurroundInterp
@@ -1115,8 +1151,10 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 			vnf->current=endpos;
 
 		todo-=done;
-		ptr +=(vc_mode & DMODE_STEREO)?(done<<1):done;
+		if(ptr) ptr +=(vc_mode & DMODE_STEREO)?(done<<1):done;
 	}
+
+	return total-todo;
 }
 
 #ifdef NO_HQMIXER
@@ -1129,6 +1167,7 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 #define VC1_SampleSpace VC_SampleSpace
 #define VC1_SampleLoad VC_SampleLoad
 #define VC1_SampleUnload VC_SampleUnload
+#define VC1_SetFormat VC_SetFormat
 #define VC1_SetNumVoices VC_SetNumVoices
 #define VC1_SilenceBytes VC_SilenceBytes
 #define VC1_VoicePlay VC_VoicePlay
@@ -1138,6 +1177,16 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 #define VC1_VoiceGetPosition VC_VoiceGetPosition
 #define VC1_VoiceGetVolume VC_VoiceGetVolume
 #define VC1_VoiceRealVolume VC_VoiceRealVolume
+#define VC1_VoiceStateSize VC_VoiceStateSize
+#define VC1_VoiceSaveState VC_VoiceSaveState
+#define VC1_VoiceLoadState VC_VoiceLoadState
+#define VC1_VoiceCheckState VC_VoiceCheckState
+#define VC1_VoiceReset VC_VoiceReset
+#define VC1_SkipSamples VC_SkipSamples
+#define VC1_SetStems VC_SetStems
+#define VC1_VoiceSetStem VC_VoiceSetStem
+#define VC1_WriteStems VC_WriteStems
+#define VC1_VoiceSetFilter VC_VoiceSetFilter
 #define VC1_VoiceSetFrequency VC_VoiceSetFrequency
 #define VC1_VoiceSetPanning VC_VoiceSetPanning
 #define VC1_VoiceSetVolume VC_VoiceSetVolume
@@ -1150,6 +1199,36 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 #include "virtch_common.c"
 #undef _IN_VIRTCH_
 
+/* Converts 'portion' mixed sample frames to the output format, and returns
+   the number of bytes written */
+static ULONG Mix32ToOutput(SBYTE* buffer,const SLONG* srce,NATIVE portion)
+{
+	NATIVE count=(vc_mode & DMODE_STEREO)?(portion<<1):portion;
+
+#if defined HAVE_ALTIVEC || defined HAVE_SSE2
+	if (md_mode & DMODE_SIMDMIXER)
+	{
+		if(vc_mode & DMODE_FLOAT)
+			Mix32ToFP_SIMD((float*) buffer, srce, count);
+		else if(vc_mode & DMODE_16BITS)
+			Mix32To16_SIMD((SWORD*) buffer, srce, count);
+		else
+			Mix32To8_SIMD((SBYTE*) buffer, srce, count);
+	}
+	else
+#endif
+	{
+		if(vc_mode & DMODE_FLOAT)
+			Mix32ToFP((float*) buffer, srce, count);
+		else if(vc_mode & DMODE_16BITS)
+			Mix32To16((SWORD*) buffer, srce, count);
+		else
+			Mix32To8((SBYTE*) buffer, srce, count);
+	}
+	return samples2bytes(portion);
+}
+
+
 void VC1_WriteSamples(SBYTE* buf,ULONG todo)
 {
 	int left,portion=0,count;
@@ -1157,37 +1236,48 @@ void VC1_WriteSamples(SBYTE* buf,ULONG todo)
 	int t, pan, vol;
 
 	while(todo) {
-		if(!tickleft) {
+		if(md_framepos>=md_tickpos) {
 			if(vc_mode & DMODE_SOFT_MUSIC) md_player();
-			tickleft=(md_mixfreq*125L)/(md_bpm*50L);
+			if(md_framepos>=md_tickpos)
+				md_tickpos=md_framepos+MD_TickLength(md_bpm,&md_tickfrac);
 		}
-		left = MIN(tickleft, todo);
+		left = (int)MIN(md_tickpos-md_framepos, (SLONGLONG)todo);
 		buffer    = buf;
-		tickleft -= left;
 		todo     -= left;
-		buf += samples2bytes(left);
+		if(buf) buf += samples2bytes(left);
+		md_framepos += left;
 
 		while(left) {
 			portion = MIN(left, samplesthatfit);
 			count   = (vc_mode & DMODE_STEREO)?(portion<<1):portion;
-			memset(vc_tickbuf, 0, count<<2);
-			for(t=0;t<vc_softchn;t++) {
-				vnf = &vinf[t];
+			if(buffer) {
+				memset(vc_tickbuf, 0, count<<2);
+				if(vc_stemming) ClearStems(count);
+			}
+			/* only voices which were played since they last stopped */
+			for(t=0;t<vc_numlive;) {
+				vnf = &vinf[vc_live[t]];
+
+				/* while the song is played silently, the sound effects
+				   voices don't move */
+				if((vc_sfxhold)&&(vc_live[t]>=md_sngchn)) {
+					t++;
+					continue;
+				}
 
 				if(vnf->kick) {
 					vnf->current=((SLONGLONG)vnf->start)<<FRACBITS;
 					vnf->kick   =0;
+					memset(vnf->fhist,0,sizeof(vnf->fhist));
 					vnf->active =1;
 				}
 
 				if(!vnf->frq) vnf->active = 0;
 
 				if(vnf->active) {
-					vnf->increment=((SLONGLONG)(vnf->frq<<FRACBITS))/md_mixfreq;
-					if(vnf->flags&SF_REVERSE) vnf->increment=-vnf->increment;
+					vnf->increment=(vnf->flags&SF_REVERSE)?-vnf->step:vnf->step;
 					vol = vnf->vol;  pan = vnf->pan;
 
-					vnf->oldlvol=vnf->lvolsel;vnf->oldrvol=vnf->rvolsel;
 					if(vc_mode & DMODE_STEREO) {
 						if(pan != PAN_SURROUND) {
 							vnf->lvolsel=(vol*(PAN_RIGHT-pan))>>8;
@@ -1200,10 +1290,24 @@ void VC1_WriteSamples(SBYTE* buf,ULONG todo)
 					idxsize = (vnf->size)? ((SLONGLONG)vnf->size << FRACBITS)-1 : 0;
 					idxlend = (vnf->repend)? ((SLONGLONG)vnf->repend << FRACBITS)-1 : 0;
 					idxlpos = (SLONGLONG)vnf->reppos << FRACBITS;
-					AddChannel(vc_tickbuf, portion);
+					AddFilteredChannel(buffer?VoiceBuffer():NULL, portion);
 				}
+
+				if(!vnf->active) {
+					vnf->live = 0;
+					vc_live[t] = vc_live[--vc_numlive];
+					MD_VoiceEnded((SWORD)(vnf-vinf));
+				} else
+					t++;
 			}
 
+			if(!buffer) {
+				left -= portion;
+				continue;
+			}
+
+			if(vc_stemming) MixStems(portion);
+
 			if(md_mode & DMODE_NOISEREDUCTION) {
 				MixLowPass(vc_tickbuf, portion);
 			}
@@ -1217,27 +1321,7 @@ void VC1_WriteSamples(SBYTE* buf,ULONG todo)
 				vc_callback((unsigned char*)vc_tickbuf, portion);
 			}
 
-#if defined HAVE_ALTIVEC || defined HAVE_SSE2
-			if (md_mode & DMODE_SIMDMIXER)
-			{
-				if(vc_mode & DMODE_FLOAT)
-					Mix32ToFP_SIMD((float*) buffer, vc_tickbuf, count);
-				else if(vc_mode & DMODE_16BITS)
-					Mix32To16_SIMD((SWORD*) buffer, vc_tickbuf, count);
-				else
-					Mix32To8_SIMD((SBYTE*) buffer, vc_tickbuf, count);
-			}
-			else
-#endif
-			{
-				if(vc_mode & DMODE_FLOAT)
-					Mix32ToFP((float*) buffer, vc_tickbuf, count);
-				else if(vc_mode & DMODE_16BITS)
-					Mix32To16((SWORD*) buffer, vc_tickbuf, count);
-				else
-					Mix32To8((SBYTE*) buffer, vc_tickbuf, count);
-			}
-			buffer += samples2bytes(portion);
+			buffer += Mix32ToOutput(buffer, vc_tickbuf, portion);
 			left   -= portion;
 		}
 	}
@@ -1256,12 +1340,22 @@ int VC1_Init(void)
 		_mm_errno = MMERR_INITIALIZING_MIXER;
 		return 1;
 	}
+	if(!(vc_borrowed=(UBYTE*)MikMod_calloc(MAXSAMPLEHANDLES,sizeof(UBYTE)))) {
+		_mm_errno = MMERR_INITIALIZING_MIXER;
+		return 1;
+	}
 	if(!vc_tickbuf) {
 		if(!(vc_tickbuf=(SLONG*)MikMod_amalloc((TICKLSIZE+32)*sizeof(SLONG)))) {
 			_mm_errno = MMERR_INITIALIZING_MIXER;
 			return 1;
 		}
 	}
+	if(!vc_filterbuf) {
+		if(!(vc_filterbuf=(SLONG*)MikMod_amalloc((TICKLSIZE+32)*sizeof(SLONG)))) {
+			_mm_errno = MMERR_INITIALIZING_MIXER;
+			return 1;
+		}
+	}
 
 	MixReverb=(md_mode&DMODE_STEREO)?MixReverb_Stereo:MixReverb_Normal;
 	MixLowPass=(md_mode&DMODE_STEREO)?MixLowPass_Stereo:MixLowPass_Normal;
@@ -1269,11 +1363,21 @@ int VC1_Init(void)
 	return 0;
 }
 
+/* Changes the output format of the mixer. Only valid while it is stopped. */
+void VC1_SetFormat(UWORD format)
+{
+	vc_mode = (vc_mode&~DMODE_FORMATMASK)|(format&DMODE_FORMATMASK);
+	MixReverb=(vc_mode&DMODE_STEREO)?MixReverb_Stereo:MixReverb_Normal;
+	MixLowPass=(vc_mode&DMODE_STEREO)?MixLowPass_Stereo:MixLowPass_Normal;
+}
+
 int VC1_PlayStart(void)
 {
+	SetupSteps();
 	samplesthatfit=TICKLSIZE;
 	if(vc_mode & DMODE_STEREO) samplesthatfit >>= 1;
-	tickleft = 0;
+	md_framepos = md_tickpos = 0;
+	md_tickfrac.rem = 0;
 
 	RVc1 = (5000L * md_mixfreq) / REVERBERATION;
 	RVc2 = (5078L * md_mixfreq) / REVERBERATION;
@@ -1338,11 +1442,14 @@ int VC1_SetNumVoices(void)
 	if(!(vc_softchn=md_softchn)) return 0;
 
 	MikMod_free(vinf);
+	MikMod_free(vc_live);
+	vc_numlive=0;
 	if(!(vinf=(VINFO*)MikMod_calloc(vc_softchn,sizeof(VINFO)))) return 1;
+	if(!(vc_live=(UWORD*)MikMod_malloc(vc_softchn*sizeof(UWORD)))) return 1;
 
 	for(t=0;t<vc_softchn;t++) {
-		vinf[t].frq=10000;
-		vinf[t].pan=(t&1)?PAN_LEFT:PAN_RIGHT;
+		InitVoice((UWORD)t);
+		vinf[t].stem=-1;
 	}
 
 	return 0;
@@ -96,6 +96,12 @@
 #define CLICK_SHIFT (CLICK_SHIFT_BASE + SAMPLING_SHIFT)
 #define CLICK_BUFFER (1L << CLICK_SHIFT)
 
+/* fractional bits of the increment of a voice, per md_mixfreq frame */
+#define STEPSHIFT (FRACBITS-SAMPLING_SHIFT)
+
+/* rate the voices are mixed at, for the resonant filters */
+#define FILTER_MIXRATE (md_mixfreq*SAMPLING_FACTOR)
+
 #ifndef MIN
 #define MIN(a,b) (((a)<(b)) ? (a) : (b))
 #endif
@@ -103,6 +109,7 @@
 typedef struct VINFO {
 	UBYTE     kick;              /* =1 -> sample has to be restarted */
 	UBYTE     active;            /* =1 -> sample is playing */
+	UBYTE     live;              /* =1 -> voice is in vc_live */
 	UWORD     flags;             /* 16/8 bits looping/one-shot */
 	SWORD     handle;            /* identifies the sample */
 	ULONG     start;             /* start index */
@@ -121,14 +128,24 @@ typedef struct VINFO {
 
 	SLONGLONG current;           /* current index in the sample */
 	SLONGLONG increment;         /* increment value */
+	SLONGLONG step;              /* increment for frq, playing forward */
+	SWORD     stem;              /* output stem, -1 for the mix only */
+	UBYTE     cutoff,resonance;  /* resonant filter settings (0-127) */
+	UBYTE     filter;            /* =1 -> voice is mixed through its filter */
+	SLONG     fa0,fb0,fb1;       /* filter coefficients */
+	SLONG     fhist[4];          /* last two filter outputs, left and right */
 } VINFO;
 
 static	SWORD **Samples;
+static	UBYTE *vc_borrowed=NULL;     /* =1 -> sample is used in place */
 static	VINFO *vinf=NULL,*vnf;
-static	long tickleft,samplesthatfit,vc_memory=0;
+static	long samplesthatfit,vc_memory=0;
 static	int vc_softchn;
+static	UWORD *vc_live=NULL;         /* voices which are kicked or playing */
+static	int vc_numlive=0;
 static	SLONGLONG idxsize,idxlpos,idxlend;
 static	SLONG *vc_tickbuf=NULL;
+static	SLONG *vc_filterbuf=NULL;       /* voice being filtered */
 static	UWORD vc_mode;
 
 #ifdef _MSC_VER
@@ -328,7 +345,7 @@ static SLONGLONG MixSIMDStereoNormal(const SWORD* const srce,SLONG* dest,SLONGLO
 
 	/* Dest can be misaligned */
 	while(!IS_ALIGNED_16(dest)) {
-		sample=srce[idx >> FRACBITS];
+		sample=GetSample(srce, idx);
 		idx += increment;
 		*dest++ += vol[0] * sample;
 		*dest++ += vol[1] * sample;
@@ -359,6 +376,7 @@ static SLONGLONG MixSIMDStereoNormal(const SWORD* const srce,SLONG* dest,SLONGLO
 			_mm_store_si128((__m128i*)(dest+4), _mm_add_epi32(v4, _mm_madd_epi16(v0, v2)));
 			dest+=8;
 			idx += increment;
+			sample = s3;
 		}
 	}
 
@@ -422,6 +440,7 @@ static SLONGLONG MixSIMDStereoNormal(const SWORD* const srce,SLONG* dest,SLONGLO
 
 			dest+=8;
 			idx += increment;
+			sample = s[3];
 		}
 	}
 #endif /* HAVE_ALTIVEC */
@@ -1004,15 +1023,85 @@ static void Mix32To16_Stereo_SIMD_4Tap(SWORD* dste, const SLONG* srce, NATIVE co
 #endif
 
 
-static void AddChannel(SLONG* ptr,NATIVE todo)
+/* Mixes the next 'done' samples of the voice */
+static void MixVoice(const SWORD* s,SLONG* ptr,SLONGLONG done)
+{
+	SLONG lastvalL=vnf->lastvalL,lastvalR=vnf->lastvalR;
+#ifndef NATIVE_64BIT_INT
+	SLONGLONG endpos=vnf->current+done*vnf->increment;
+#endif
+
+#ifndef NATIVE_64BIT_INT
+	/* use the 32 bit mixers as often as we can (they're much faster) */
+	if((vnf->current<0x7fffffff)&&(endpos<0x7fffffff)) {
+		if(vc_mode & DMODE_STEREO) {
+			if((vnf->pan==PAN_SURROUND)&&(vc_mode&DMODE_SURROUND))
+				vnf->current=(SLONGLONG)Mix32StereoSurround
+						(s,ptr,vnf->current,vnf->increment,done);
+			else
+				vnf->current=Mix32StereoNormal
+						(s,ptr,vnf->current,vnf->increment,done);
+		} else
+			vnf->current=Mix32MonoNormal
+						(s,ptr,vnf->current,vnf->increment,done);
+	}
+	else
+#endif
+	{
+		if(vc_mode & DMODE_STEREO) {
+			if((vnf->pan==PAN_SURROUND)&&(vc_mode&DMODE_SURROUND))
+				vnf->current=MixStereoSurround
+						(s,ptr,vnf->current,vnf->increment,done);
+			else
+				vnf->current=MixStereoNormal
+						(s,ptr,vnf->current,vnf->increment,done);
+		} else
+			vnf->current=MixMonoNormal
+						(s,ptr,vnf->current,vnf->increment,done);
+	}
+
+	/* while declicking, keep fading from the last value of the previous
+	   sample, even if the voice is mixed in several parts */
+	if(vnf->click) {
+		vnf->lastvalL=lastvalL;
+		vnf->lastvalR=lastvalR;
+	}
+}
+
+/* Moves the voice on by 'done' samples exactly as MixVoice would, without
+   mixing them. Only the last sample is mixed, aside, to get the same
+   declicking state. */
+static void SkipVoice(const SWORD* s,SLONGLONG done)
+{
+	SLONG last[2];
+	SLONGLONG n=done-1,k;
+
+	if(vnf->rampvol) {
+		k=MIN(n,vnf->rampvol);
+		vnf->rampvol-=(int)k;
+		n-=k;
+	}
+	if(vnf->click) {
+		k=MIN(n,vnf->click);
+		vnf->click-=(int)k;
+	}
+	vnf->current+=(done-1)*vnf->increment;
+	MixVoice(s,last,1);
+}
+
+/* Mixes the next 'todo' samples of the voice into 'ptr', or only moves the
+   voice on if 'ptr' is NULL. Returns the number of samples played before the
+   voice stopped, if it did. */
+static NATIVE AddChannel(SLONG* ptr,NATIVE todo)
 {
 	SLONGLONG end,done;
+	NATIVE total=todo;
 	SWORD *s;
 
 	if(!(s=Samples[vnf->handle])) {
 		vnf->current = vnf->active  = 0;
 		vnf->lastvalL = vnf->lastvalR = 0;
-		return;
+		return 0;
 	}
 
 	/* update the 'current' index so the sample loops, or stops playing if it
@@ -1023,7 +1112,11 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 		if(vnf->flags & SF_REVERSE) {
 			/* The sample is playing in reverse */
 			if((vnf->flags&SF_LOOP)&&(vnf->current<idxlpos)) {
-				/* the sample is looping and has reached the loopstart index */
+				/* the sample is looping and has reached the loopstart index;
+				   at pitches which step over the whole loop, the index goes
+				   around it more than once */
+				if((idxlend>idxlpos)&&(idxlpos-vnf->current>=idxlend-idxlpos))
+					vnf->current=idxlpos-(idxlpos-vnf->current)%(idxlend-idxlpos);
 				if(vnf->flags & SF_BIDI) {
 					/* sample is doing bidirectional loops, so 'bounce' the
 					   current index against the idxlpos */
@@ -1047,6 +1140,8 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 			if((vnf->flags & SF_LOOP) &&
 			   (vnf->current >= idxlend)) {
 				/* the sample is looping, check the loopend index */
+				if((idxlend>idxlpos)&&(vnf->current-idxlend>=idxlend-idxlpos))
+					vnf->current=idxlend+(vnf->current-idxlend)%(idxlend-idxlpos);
 				if(vnf->flags & SF_BIDI) {
 					/* sample is doing bidirectional loops, so 'bounce' the
 					   current index against the idxlend */
@@ -1086,44 +1181,20 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 
 		endpos=vnf->current+done*vnf->increment;
 
-		if(vnf->vol || vnf->rampvol) {
-#ifndef NATIVE_64BIT_INT
-			/* use the 32 bit mixers as often as we can (they're much faster) */
-			if((vnf->current<0x7fffffff)&&(endpos<0x7fffffff)) {
-				if(vc_mode & DMODE_STEREO) {
-					if((vnf->pan==PAN_SURROUND)&&(vc_mode&DMODE_SURROUND))
-						vnf->current=(SLONGLONG)Mix32StereoSurround
-								(s,ptr,vnf->current,vnf->increment,done);
-					else
-						vnf->current=Mix32StereoNormal
-								(s,ptr,vnf->current,vnf->increment,done);
-				} else
-					vnf->current=Mix32MonoNormal
-								(s,ptr,vnf->current,vnf->increment,done);
-			}
-			else
-#endif
-			{
-				if(vc_mode & DMODE_STEREO) {
-					if((vnf->pan==PAN_SURROUND)&&(vc_mode&DMODE_SURROUND))
-						vnf->current=MixStereoSurround
-								(s,ptr,vnf->current,vnf->increment,done);
-					else
-						vnf->current=MixStereoNormal
-								(s,ptr,vnf->current,vnf->increment,done);
-				} else
-					vnf->current=MixMonoNormal
-								(s,ptr,vnf->current,vnf->increment,done);
-			}
-		} else  {
+		if(!(vnf->vol || vnf->rampvol)) {
 			vnf->lastvalL = vnf->lastvalR = 0;
 			/* update sample position */
 			vnf->current=endpos;
-		}
+		} else if(ptr)
+			MixVoice(s,ptr,done);
+		else
+			SkipVoice(s,done);
 
 		todo -= done;
-		ptr += (vc_mode & DMODE_STEREO)?(done<<1):done;
+		if(ptr) ptr += (vc_mode & DMODE_STEREO)?(done<<1):done;
 	}
+
+	return total-todo;
 }
 
 #define _IN_VIRTCH_
@@ -1147,10 +1218,34 @@ static void AddChannel(SLONG* ptr,NATIVE todo)
 #define VC1_SampleSpace       VC2_SampleSpace
 #define VC1_SampleLength      VC2_SampleLength
 #define VC1_VoiceRealVolume   VC2_VoiceRealVolume
+#define VC1_VoiceStateSize    VC2_VoiceStateSize
+#define VC1_VoiceSaveState    VC2_VoiceSaveState
+#define VC1_VoiceLoadState    VC2_VoiceLoadState
+#define VC1_VoiceCheckState   VC2_VoiceCheckState
+#define VC1_VoiceReset        VC2_VoiceReset
+#define VC1_SkipSamples       VC2_SkipSamples
+#define VC1_SetStems          VC2_SetStems
+#define VC1_VoiceSetStem      VC2_VoiceSetStem
+#define VC1_WriteStems        VC2_WriteStems
+#define VC1_VoiceSetFilter    VC2_VoiceSetFilter
 
 #include "virtch_common.c"
 #undef _IN_VIRTCH_
 
+/* Converts 'portion' mixed samples to the output format, and returns the
+   number of bytes written */
+static ULONG Mix32ToOutput(SBYTE* buffer,const SLONG* srce,NATIVE portion)
+{
+	if(vc_mode & DMODE_FLOAT)
+		Mix32toFP((float*)buffer,srce,portion);
+	else if(vc_mode & DMODE_16BITS)
+		Mix32to16((SWORD*)buffer,srce,portion);
+	else
+		Mix32to8((SBYTE*)buffer,srce,portion);
+
+	return samples2bytes(portion) / SAMPLING_FACTOR;
+}
+
 void VC2_WriteSamples(SBYTE* buf,ULONG todo)
 {
 	int left,portion=0;
@@ -1160,26 +1255,39 @@ void VC2_WriteSamples(SBYTE* buf,ULONG todo)
 	todo*=SAMPLING_FACTOR;
 
 	while(todo) {
-		if(!tickleft) {
+		if(md_framepos>=md_tickpos) {
 			if(vc_mode & DMODE_SOFT_MUSIC) md_player();
-			tickleft=(md_mixfreq*125L*SAMPLING_FACTOR)/(md_bpm*50L);
-			tickleft&=~(SAMPLING_FACTOR-1);
+			if(md_framepos>=md_tickpos)
+				md_tickpos=md_framepos+MD_TickLength(md_bpm,&md_tickfrac);
 		}
-		left = MIN(tickleft, todo);
+		left = (int)MIN((md_tickpos-md_framepos)*SAMPLING_FACTOR, (SLONGLONG)todo);
 		buffer    = buf;
-		tickleft -= left;
 		todo     -= left;
-		buf += samples2bytes(left)/SAMPLING_FACTOR;
+		if(buf) buf += samples2bytes(left)/SAMPLING_FACTOR;
+		md_framepos += left/SAMPLING_FACTOR;
 
 		while(left) {
 			portion = MIN(left, samplesthatfit);
-			memset(vc_tickbuf,0,portion<<((vc_mode&DMODE_STEREO)?3:2));
-			for(t=0;t<vc_softchn;t++) {
-				vnf = &vinf[t];
+			if(buffer) {
+				memset(vc_tickbuf,0,portion<<((vc_mode&DMODE_STEREO)?3:2));
+				if(vc_stemming)
+					ClearStems((vc_mode&DMODE_STEREO)?portion<<1:portion);
+			}
+			/* only voices which were played since they last stopped */
+			for(t=0;t<vc_numlive;) {
+				vnf = &vinf[vc_live[t]];
+
+				/* while the song is played silently, the sound effects
+				   voices don't move */
+				if((vc_sfxhold)&&(vc_live[t]>=md_sngchn)) {
+					t++;
+					continue;
+				}
 
 				if(vnf->kick) {
 					vnf->current=((SLONGLONG)(vnf->start))<<FRACBITS;
 					vnf->kick    = 0;
+					memset(vnf->fhist,0,sizeof(vnf->fhist));
 					vnf->active  = 1;
 					vnf->click   = CLICK_BUFFER;
 					vnf->rampvol = 0;
@@ -1188,12 +1296,9 @@ void VC2_WriteSamples(SBYTE* buf,ULONG todo)
 				if(!vnf->frq) vnf->active = 0;
 
 				if(vnf->active) {
-					vnf->increment=((SLONGLONG)(vnf->frq)<<(FRACBITS-SAMPLING_SHIFT))
-					               /md_mixfreq;
-					if(vnf->flags&SF_REVERSE) vnf->increment=-vnf->increment;
+					vnf->increment=(vnf->flags&SF_REVERSE)?-vnf->step:vnf->step;
 					vol = vnf->vol;  pan = vnf->pan;
 
-					vnf->oldlvol=vnf->lvolsel;vnf->oldrvol=vnf->rvolsel;
 					if(vc_mode & DMODE_STEREO) {
 						if(pan!=PAN_SURROUND) {
 							vnf->lvolsel=(vol*(PAN_RIGHT-pan))>>8;
@@ -1207,10 +1312,24 @@ void VC2_WriteSamples(SBYTE* buf,ULONG todo)
 					idxsize=(vnf->size)?((SLONGLONG)(vnf->size)<<FRACBITS)-1:0;
 					idxlend=(vnf->repend)?((SLONGLONG)(vnf->repend)<<FRACBITS)-1:0;
 					idxlpos=(SLONGLONG)(vnf->reppos)<<FRACBITS;
-					AddChannel(vc_tickbuf,portion);
+					AddFilteredChannel(buffer?VoiceBuffer():NULL,portion);
 				}
+
+				if(!vnf->active) {
+					vnf->live = 0;
+					vc_live[t] = vc_live[--vc_numlive];
+					MD_VoiceEnded((SWORD)(vnf-vinf));
+				} else
+					t++;
 			}
 
+			if(!buffer) {
+				left -= portion;
+				continue;
+			}
+
+			if(vc_stemming) MixStems(portion);
+
 			if(md_mode & DMODE_NOISEREDUCTION) {
 				MixLowPass(vc_tickbuf, portion);
 			}
@@ -1224,19 +1343,34 @@ void VC2_WriteSamples(SBYTE* buf,ULONG todo)
 				vc_callback((unsigned char*)vc_tickbuf, portion);
 			}
 
-			if(vc_mode & DMODE_FLOAT)
-				Mix32toFP((float*)buffer,vc_tickbuf,portion);
-			else if(vc_mode & DMODE_16BITS)
-				Mix32to16((SWORD*)buffer,vc_tickbuf,portion);
-			else
-				Mix32to8((SBYTE*)buffer,vc_tickbuf,portion);
-
-			buffer += samples2bytes(portion) / SAMPLING_FACTOR;
+			buffer += Mix32ToOutput(buffer,vc_tickbuf,portion);
 			left   -= portion;
 		}
 	}
 }
 
+static void VC2_SetupMixers(void)
+{
+	if(vc_mode & DMODE_STEREO) {
+		Mix32toFP  = Mix32ToFP_Stereo;
+#if ((defined HAVE_ALTIVEC || defined HAVE_SSE2) && (SAMPLING_FACTOR == 4))
+		if (vc_mode & DMODE_SIMDMIXER)
+			Mix32to16  = Mix32To16_Stereo_SIMD_4Tap;
+		else
+#endif
+			Mix32to16  = Mix32To16_Stereo;
+		Mix32to8   = Mix32To8_Stereo;
+		MixReverb  = MixReverb_Stereo;
+		MixLowPass = MixLowPass_Stereo;
+	} else {
+		Mix32toFP  = Mix32ToFP_Normal;
+		Mix32to16  = Mix32To16_Normal;
+		Mix32to8   = Mix32To8_Normal;
+		MixReverb  = MixReverb_Normal;
+		MixLowPass = MixLowPass_Normal;
+	}
+}
+
 int VC2_Init(void)
 {
 	VC_SetupPointers();
@@ -1248,44 +1382,45 @@ int VC2_Init(void)
 		_mm_errno = MMERR_INITIALIZING_MIXER;
 		return 1;
 	}
+	if(!(vc_borrowed=(UBYTE*)MikMod_calloc(MAXSAMPLEHANDLES,sizeof(UBYTE)))) {
+		_mm_errno = MMERR_INITIALIZING_MIXER;
+		return 1;
+	}
 	if(!vc_tickbuf) {
 		if(!(vc_tickbuf=(SLONG*)MikMod_amalloc((TICKLSIZE+32)*sizeof(SLONG)))) {
 			_mm_errno = MMERR_INITIALIZING_MIXER;
 			return 1;
 		}
 	}
-
-	if(md_mode & DMODE_STEREO) {
-		Mix32toFP  = Mix32ToFP_Stereo;
-#if ((defined HAVE_ALTIVEC || defined HAVE_SSE2) && (SAMPLING_FACTOR == 4))
-		if (md_mode & DMODE_SIMDMIXER)
-			Mix32to16  = Mix32To16_Stereo_SIMD_4Tap;
-		else
-#endif
-			Mix32to16  = Mix32To16_Stereo;
-		Mix32to8   = Mix32To8_Stereo;
-		MixReverb  = MixReverb_Stereo;
-		MixLowPass = MixLowPass_Stereo;
-	} else {
-		Mix32toFP  = Mix32ToFP_Normal;
-		Mix32to16  = Mix32To16_Normal;
-		Mix32to8   = Mix32To8_Normal;
-		MixReverb  = MixReverb_Normal;
-		MixLowPass = MixLowPass_Normal;
+	if(!vc_filterbuf) {
+		if(!(vc_filterbuf=(SLONG*)MikMod_amalloc((TICKLSIZE+32)*sizeof(SLONG)))) {
+			_mm_errno = MMERR_INITIALIZING_MIXER;
+			return 1;
+		}
 	}
 
 	md_mode |= DMODE_INTERP;
 	vc_mode = md_mode;
+	VC2_SetupMixers();
 	return 0;
 }
 
+/* Changes the output format of the mixer. Only valid while it is stopped. */
+void VC2_SetFormat(UWORD format)
+{
+	vc_mode = (vc_mode&~DMODE_FORMATMASK)|(format&DMODE_FORMATMASK);
+	VC2_SetupMixers();
+}
+
 int VC2_PlayStart(void)
 {
 	md_mode|=DMODE_INTERP;
+	SetupSteps();
 
 	samplesthatfit = TICKLSIZE;
 	if(vc_mode & DMODE_STEREO) samplesthatfit >>= 1;
-	tickleft = 0;
+	md_framepos = md_tickpos = 0;
+	md_tickfrac.rem = 0;
 
 	RVc1 = (5000L * md_mixfreq) / (REVERBERATION * 10);
 	RVc2 = (5078L * md_mixfreq) / (REVERBERATION * 10);
@@ -1353,11 +1488,14 @@ int VC2_SetNumVoices(void)
 	if(!(vc_softchn=md_softchn)) return 0;
 
 	MikMod_free(vinf);
+	MikMod_free(vc_live);
+	vc_numlive=0;
 	if(!(vinf=(VINFO*)MikMod_calloc(vc_softchn,sizeof(VINFO)))) return 1;
+	if(!(vc_live=(UWORD*)MikMod_malloc(vc_softchn*sizeof(UWORD)))) return 1;
 
 	for(t=0;t<vc_softchn;t++) {
-		vinf[t].frq=10000;
-		vinf[t].pan=(t&1)?PAN_LEFT:PAN_RIGHT;
+		InitVoice((UWORD)t);
+		vinf[t].stem=-1;
 	}
 
 	return 0;
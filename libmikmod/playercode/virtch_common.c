@@ -39,26 +39,26 @@ extern ULONG VC1_WriteBytes(SBYTE*,ULONG);
 extern ULONG VC2_WriteBytes(SBYTE*,ULONG);
 extern void  VC1_Exit(void);
 extern void  VC2_Exit(void);
-extern UWORD VC1_VoiceGetVolume(UBYTE);
-extern UWORD VC2_VoiceGetVolume(UBYTE);
-extern ULONG VC1_VoiceGetPanning(UBYTE);
-extern ULONG VC2_VoiceGetPanning(UBYTE);
-extern void  VC1_VoiceSetFrequency(UBYTE,ULONG);
-extern void  VC2_VoiceSetFrequency(UBYTE,ULONG);
-extern ULONG VC1_VoiceGetFrequency(UBYTE);
-extern ULONG VC2_VoiceGetFrequency(UBYTE);
-extern void  VC1_VoicePlay(UBYTE,SWORD,ULONG,ULONG,ULONG,ULONG,UWORD);
-extern void  VC2_VoicePlay(UBYTE,SWORD,ULONG,ULONG,ULONG,ULONG,UWORD);
-extern void  VC1_VoiceStop(UBYTE);
-extern void  VC2_VoiceStop(UBYTE);
-extern BOOL  VC1_VoiceStopped(UBYTE);
-extern BOOL  VC2_VoiceStopped(UBYTE);
-extern SLONG VC1_VoiceGetPosition(UBYTE);
-extern SLONG VC2_VoiceGetPosition(UBYTE);
-extern void  VC1_VoiceSetVolume(UBYTE,UWORD);
-extern void  VC2_VoiceSetVolume(UBYTE,UWORD);
-extern void  VC1_VoiceSetPanning(UBYTE,ULONG);
-extern void  VC2_VoiceSetPanning(UBYTE,ULONG);
+extern UWORD VC1_VoiceGetVolume(UWORD);
+extern UWORD VC2_VoiceGetVolume(UWORD);
+extern ULONG VC1_VoiceGetPanning(UWORD);
+extern ULONG VC2_VoiceGetPanning(UWORD);
+extern void  VC1_VoiceSetFrequency(UWORD,ULONG);
+extern void  VC2_VoiceSetFrequency(UWORD,ULONG);
+extern ULONG VC1_VoiceGetFrequency(UWORD);
+extern ULONG VC2_VoiceGetFrequency(UWORD);
+extern void  VC1_VoicePlay(UWORD,SWORD,ULONG,ULONG,ULONG,ULONG,UWORD);
+extern void  VC2_VoicePlay(UWORD,SWORD,ULONG,ULONG,ULONG,ULONG,UWORD);
+extern void  VC1_VoiceStop(UWORD);
+extern void  VC2_VoiceStop(UWORD);
+extern BOOL  VC1_VoiceStopped(UWORD);
+extern BOOL  VC2_VoiceStopped(UWORD);
+extern SLONG VC1_VoiceGetPosition(UWORD);
+extern SLONG VC2_VoiceGetPosition(UWORD);
+extern void  VC1_VoiceSetVolume(UWORD,UWORD);
+extern void  VC2_VoiceSetVolume(UWORD,UWORD);
+extern void  VC1_VoiceSetPanning(UWORD,ULONG);
+extern void  VC2_VoiceSetPanning(UWORD,ULONG);
 extern void  VC1_SampleUnload(SWORD);
 extern void  VC2_SampleUnload(SWORD);
 extern SWORD VC1_SampleLoad(struct SAMPLOAD*,int);
@@ -67,8 +67,28 @@ extern ULONG VC1_SampleSpace(int);
 extern ULONG VC2_SampleSpace(int);
 extern ULONG VC1_SampleLength(int,SAMPLE*);
 extern ULONG VC2_SampleLength(int,SAMPLE*);
-extern ULONG VC1_VoiceRealVolume(UBYTE);
-extern ULONG VC2_VoiceRealVolume(UBYTE);
+extern ULONG VC1_VoiceRealVolume(UWORD);
+extern ULONG VC2_VoiceRealVolume(UWORD);
+extern ULONG VC1_VoiceStateSize(void);
+extern ULONG VC2_VoiceStateSize(void);
+extern void  VC1_VoiceSaveState(UWORD,void*);
+extern void  VC2_VoiceSaveState(UWORD,void*);
+extern void  VC1_VoiceLoadState(UWORD,const void*);
+extern void  VC2_VoiceLoadState(UWORD,const void*);
+extern BOOL  VC1_VoiceCheckState(const void*,SAMPLE*);
+extern BOOL  VC2_VoiceCheckState(const void*,SAMPLE*);
+extern void  VC1_VoiceReset(UWORD);
+extern void  VC2_VoiceReset(UWORD);
+extern void  VC1_SkipSamples(ULONG);
+extern void  VC2_SkipSamples(ULONG);
+extern int   VC1_SetStems(int);
+extern int   VC2_SetStems(int);
+extern void  VC1_VoiceSetStem(UWORD,SWORD);
+extern void  VC2_VoiceSetStem(UWORD,SWORD);
+extern void  VC1_WriteStems(SBYTE*,SBYTE**,ULONG);
+extern void  VC2_WriteStems(SBYTE*,SBYTE**,ULONG);
+extern void  VC1_VoiceSetFilter(UWORD,UBYTE,UBYTE);
+extern void  VC2_VoiceSetFilter(UWORD,UBYTE,UBYTE);
 #endif
 
 
@@ -82,6 +102,9 @@ static void (*VC_Exit_ptr)(void)=VC1_Exit;
 extern int   VC1_SetNumVoices(void);
 extern int   VC2_SetNumVoices(void);
 static int  (*VC_SetNumVoices_ptr)(void);
+extern void  VC1_SetFormat(UWORD);
+extern void  VC2_SetFormat(UWORD);
+static void (*VC_SetFormat_ptr)(UWORD);
 static ULONG (*VC_SampleSpace_ptr)(int);
 static ULONG (*VC_SampleLength_ptr)(int,SAMPLE*);
 
@@ -96,18 +119,28 @@ static void (*VC_SampleUnload_ptr)(SWORD);
 static ULONG (*VC_WriteBytes_ptr)(SBYTE*,ULONG);
 static ULONG (*VC_SilenceBytes_ptr)(SBYTE*,ULONG);
 
-static void (*VC_VoiceSetVolume_ptr)(UBYTE,UWORD);
-static UWORD (*VC_VoiceGetVolume_ptr)(UBYTE);
-static void (*VC_VoiceSetFrequency_ptr)(UBYTE,ULONG);
-static ULONG (*VC_VoiceGetFrequency_ptr)(UBYTE);
-static void (*VC_VoiceSetPanning_ptr)(UBYTE,ULONG);
-static ULONG (*VC_VoiceGetPanning_ptr)(UBYTE);
-static void (*VC_VoicePlay_ptr)(UBYTE,SWORD,ULONG,ULONG,ULONG,ULONG,UWORD);
-
-static void (*VC_VoiceStop_ptr)(UBYTE);
-static BOOL (*VC_VoiceStopped_ptr)(UBYTE);
-static SLONG (*VC_VoiceGetPosition_ptr)(UBYTE);
-static ULONG (*VC_VoiceRealVolume_ptr)(UBYTE);
+static void (*VC_VoiceSetVolume_ptr)(UWORD,UWORD);
+static UWORD (*VC_VoiceGetVolume_ptr)(UWORD);
+static void (*VC_VoiceSetFrequency_ptr)(UWORD,ULONG);
+static ULONG (*VC_VoiceGetFrequency_ptr)(UWORD);
+static void (*VC_VoiceSetPanning_ptr)(UWORD,ULONG);
+static ULONG (*VC_VoiceGetPanning_ptr)(UWORD);
+static void (*VC_VoicePlay_ptr)(UWORD,SWORD,ULONG,ULONG,ULONG,ULONG,UWORD);
+
+static void (*VC_VoiceStop_ptr)(UWORD);
+static BOOL (*VC_VoiceStopped_ptr)(UWORD);
+static SLONG (*VC_VoiceGetPosition_ptr)(UWORD);
+static ULONG (*VC_VoiceRealVolume_ptr)(UWORD);
+static ULONG (*VC_VoiceStateSize_ptr)(void);
+static void (*VC_VoiceSaveState_ptr)(UWORD,void*);
+static void (*VC_VoiceLoadState_ptr)(UWORD,const void*);
+static BOOL (*VC_VoiceCheckState_ptr)(const void*,SAMPLE*);
+static void (*VC_VoiceReset_ptr)(UWORD);
+static void (*VC_SkipSamples_ptr)(ULONG);
+static int (*VC_SetStems_ptr)(int);
+static void (*VC_VoiceSetStem_ptr)(UWORD,SWORD);
+static void (*VC_WriteStems_ptr)(SBYTE*,SBYTE**,ULONG);
+static void (*VC_VoiceSetFilter_ptr)(UWORD,UBYTE,UBYTE);
 
 #if defined __STDC__ || defined _MSC_VER || defined __WATCOMC__ || defined MPW_C
 #define VC_PROC0(suffix) \
@@ -152,6 +185,7 @@ MIKMODAPI ret VC_/**/suffix (typ1 a,typ2 b) { return VC_/**/suffix/**/_ptr(a,b);
 VC_FUNC0(Init,int)
 VC_PROC0(Exit)
 VC_FUNC0(SetNumVoices,int)
+VC_PROC1(SetFormat,UWORD)
 VC_FUNC1(SampleSpace,ULONG,int)
 VC_FUNC2(SampleLength,ULONG,int,SAMPLE*)
 VC_FUNC0(PlayStart,int)
@@ -160,21 +194,37 @@ VC_FUNC2(SampleLoad,SWORD,struct SAMPLOAD*,int)
 VC_PROC1(SampleUnload,SWORD)
 VC_FUNC2(WriteBytes,ULONG,SBYTE*,ULONG)
 VC_FUNC2(SilenceBytes,ULONG,SBYTE*,ULONG)
-VC_PROC2(VoiceSetVolume,UBYTE,UWORD)
-VC_FUNC1(VoiceGetVolume,UWORD,UBYTE)
-VC_PROC2(VoiceSetFrequency,UBYTE,ULONG)
-VC_FUNC1(VoiceGetFrequency,ULONG,UBYTE)
-VC_PROC2(VoiceSetPanning,UBYTE,ULONG)
-VC_FUNC1(VoiceGetPanning,ULONG,UBYTE)
-
-void VC_VoicePlay(UBYTE a,SWORD b,ULONG c,ULONG d,ULONG e,ULONG f,UWORD g) {
+VC_PROC2(VoiceSetVolume,UWORD,UWORD)
+VC_FUNC1(VoiceGetVolume,UWORD,UWORD)
+VC_PROC2(VoiceSetFrequency,UWORD,ULONG)
+VC_FUNC1(VoiceGetFrequency,ULONG,UWORD)
+VC_PROC2(VoiceSetPanning,UWORD,ULONG)
+VC_FUNC1(VoiceGetPanning,ULONG,UWORD)
+
+void VC_VoicePlay(UWORD a,SWORD b,ULONG c,ULONG d,ULONG e,ULONG f,UWORD g) {
      VC_VoicePlay_ptr(a,b,c,d,e,f,g);
 }
 
-VC_PROC1(VoiceStop,UBYTE)
-VC_FUNC1(VoiceStopped,BOOL,UBYTE)
-VC_FUNC1(VoiceGetPosition,SLONG,UBYTE)
-VC_FUNC1(VoiceRealVolume,ULONG,UBYTE)
+VC_PROC1(VoiceStop,UWORD)
+VC_FUNC1(VoiceStopped,BOOL,UWORD)
+VC_FUNC1(VoiceGetPosition,SLONG,UWORD)
+VC_FUNC1(VoiceRealVolume,ULONG,UWORD)
+VC_FUNC0(VoiceStateSize,ULONG)
+VC_PROC2(VoiceSaveState,UWORD,void*)
+VC_PROC2(VoiceLoadState,UWORD,const void*)
+VC_FUNC2(VoiceCheckState,BOOL,const void*,SAMPLE*)
+VC_PROC1(VoiceReset,UWORD)
+VC_PROC1(SkipSamples,ULONG)
+VC_FUNC1(SetStems,int,int)
+VC_PROC2(VoiceSetStem,UWORD,SWORD)
+
+void VC_WriteStems(SBYTE* a,SBYTE** b,ULONG c) {
+     VC_WriteStems_ptr(a,b,c);
+}
+
+void VC_VoiceSetFilter(UWORD a,UBYTE b,UBYTE c) {
+     VC_VoiceSetFilter_ptr(a,b,c);
+}
 
 void VC_SetupPointers(void)
 {
@@ -182,6 +232,7 @@ void VC_SetupPointers(void)
 		VC_Init_ptr=VC2_Init;
 		VC_Exit_ptr=VC2_Exit;
 		VC_SetNumVoices_ptr=VC2_SetNumVoices;
+		VC_SetFormat_ptr=VC2_SetFormat;
 		VC_SampleSpace_ptr=VC2_SampleSpace;
 		VC_SampleLength_ptr=VC2_SampleLength;
 		VC_PlayStart_ptr=VC2_PlayStart;
@@ -201,10 +252,21 @@ void VC_SetupPointers(void)
 		VC_VoiceStopped_ptr=VC2_VoiceStopped;
 		VC_VoiceGetPosition_ptr=VC2_VoiceGetPosition;
 		VC_VoiceRealVolume_ptr=VC2_VoiceRealVolume;
+		VC_VoiceStateSize_ptr=VC2_VoiceStateSize;
+		VC_VoiceSaveState_ptr=VC2_VoiceSaveState;
+		VC_VoiceLoadState_ptr=VC2_VoiceLoadState;
+		VC_VoiceCheckState_ptr=VC2_VoiceCheckState;
+		VC_VoiceReset_ptr=VC2_VoiceReset;
+		VC_SkipSamples_ptr=VC2_SkipSamples;
+		VC_SetStems_ptr=VC2_SetStems;
+		VC_VoiceSetStem_ptr=VC2_VoiceSetStem;
+		VC_WriteStems_ptr=VC2_WriteStems;
+		VC_VoiceSetFilter_ptr=VC2_VoiceSetFilter;
 	} else {
 		VC_Init_ptr=VC1_Init;
 		VC_Exit_ptr=VC1_Exit;
 		VC_SetNumVoices_ptr=VC1_SetNumVoices;
+		VC_SetFormat_ptr=VC1_SetFormat;
 		VC_SampleSpace_ptr=VC1_SampleSpace;
 		VC_SampleLength_ptr=VC1_SampleLength;
 		VC_PlayStart_ptr=VC1_PlayStart;
@@ -224,6 +286,16 @@ void VC_SetupPointers(void)
 		VC_VoiceStopped_ptr=VC1_VoiceStopped;
 		VC_VoiceGetPosition_ptr=VC1_VoiceGetPosition;
 		VC_VoiceRealVolume_ptr=VC1_VoiceRealVolume;
+		VC_VoiceStateSize_ptr=VC1_VoiceStateSize;
+		VC_VoiceSaveState_ptr=VC1_VoiceSaveState;
+		VC_VoiceLoadState_ptr=VC1_VoiceLoadState;
+		VC_VoiceCheckState_ptr=VC1_VoiceCheckState;
+		VC_VoiceReset_ptr=VC1_VoiceReset;
+		VC_SkipSamples_ptr=VC1_SkipSamples;
+		VC_SetStems_ptr=VC1_SetStems;
+		VC_VoiceSetStem_ptr=VC1_VoiceSetStem;
+		VC_WriteStems_ptr=VC1_WriteStems;
+		VC_VoiceSetFilter_ptr=VC1_VoiceSetFilter;
 	}
 }
 #endif/* !NO_HQMIXER */
@@ -233,6 +305,40 @@ void VC_SetupPointers(void)
 #ifndef _VIRTCH_COMMON_
 #define _VIRTCH_COMMON_
 
+/* The increment of a voice is its frequency divided by the mixing frequency;
+   it is computed when the frequency changes, with a reciprocal of the mixing
+   frequency and a last correction which makes it the exact quotient. */
+#define RECIPSHIFT 28
+static UWORD vc_recipfreq=0;   /* mixing frequency vc_recip was computed for */
+static SLONGLONG vc_recip;     /* 2^(STEPSHIFT+RECIPSHIFT)/md_mixfreq */
+
+static SLONGLONG FrequencyStep(ULONG frq)
+{
+	SLONGLONG step;
+
+	/* keep the product below 2^63 */
+	if((frq>=(1UL<<21))||(md_mixfreq<4096))
+		return ((SLONGLONG)frq<<STEPSHIFT)/md_mixfreq;
+
+	if(vc_recipfreq!=md_mixfreq) {
+		vc_recipfreq=md_mixfreq;
+		vc_recip=((SLONGLONG)1<<(STEPSHIFT+RECIPSHIFT))/md_mixfreq;
+	}
+	step=((SLONGLONG)frq*vc_recip)>>RECIPSHIFT;
+	if((step+1)*md_mixfreq<=((SLONGLONG)frq<<STEPSHIFT)) step++;
+	return step;
+}
+
+/* The mixing frequency may have changed since the voices were set up */
+static void SetupSteps(void)
+{
+	int t;
+
+	if(!vinf) return;
+	for(t=0;t<vc_softchn;t++)
+		vinf[t].step=FrequencyStep(vinf[t].frq);
+}
+
 static ULONG samples2bytes(ULONG samples)
 {
 	if(vc_mode & DMODE_FLOAT) samples <<= 2;
@@ -275,45 +381,183 @@ ULONG VC1_WriteBytes(SBYTE* buf,ULONG todo)
 		return VC1_SilenceBytes(buf,todo);
 
 	todo = bytes2samples(todo);
-	VC1_WriteSamples(buf,todo);
+	if(md_mode & DMODE_ADAPTIVE) {
+		ULONG start=MD_MixClock();
+
+		VC1_WriteSamples(buf,todo);
+		MD_MixLoad(start,todo);
+	} else
+		VC1_WriteSamples(buf,todo);
 
 	return samples2bytes(todo);
 }
 
+/* Moves the player and the voices on by 'todo' sample frames, exactly as if
+   they had been mixed, without producing any output. The reverb and noise
+   reduction filters are not run. */
+void VC1_SkipSamples(ULONG todo)
+{
+	if(vc_softchn)
+		VC1_WriteSamples(NULL,todo);
+}
+
+/*========== Stems */
+
+/* The voices routed to a stem are mixed in its own buffer, which is then
+   added to the mix and written to the stem output */
+static SLONG **vc_stembuf=NULL;  /* mixing buffers of the stems */
+static SBYTE **vc_stempos=NULL;  /* current output position of the stems */
+static int vc_numstems=0;
+static BOOL vc_stemming=0;       /* the stems are being written */
+
+static void FreeStems(void)
+{
+	int t;
+
+	if(vc_stembuf)
+		for(t=0;t<vc_numstems;t++)
+			MikMod_afree(vc_stembuf[t]);
+	MikMod_free(vc_stembuf);
+	MikMod_free(vc_stempos);
+	vc_stembuf=NULL;
+	vc_stempos=NULL;
+	vc_numstems=0;
+}
+
+/* Sets the number of stems which can be written by VC1_WriteStems, 0 to free
+   their buffers */
+int VC1_SetStems(int numstems)
+{
+	int t;
+
+	if(numstems==vc_numstems) return 0;
+	FreeStems();
+	if(numstems<=0) return 0;
+
+	if(!(vc_stembuf=(SLONG**)MikMod_calloc(numstems,sizeof(SLONG*))) ||
+	   !(vc_stempos=(SBYTE**)MikMod_calloc(numstems,sizeof(SBYTE*)))) {
+		FreeStems();
+		return 1;
+	}
+	vc_numstems=numstems;
+	for(t=0;t<numstems;t++)
+		if(!(vc_stembuf[t]=(SLONG*)MikMod_amalloc((TICKLSIZE+32)*sizeof(SLONG)))) {
+			FreeStems();
+			return 1;
+		}
+	return 0;
+}
+
+/* Routes a voice to a stem, or only to the mix if 'stem' is -1 */
+void VC1_VoiceSetStem(UWORD voice,SWORD stem)
+{
+	vinf[voice].stem=stem;
+}
+
+/* Mixes 'todo' sample frames like VC1_WriteSamples, and also writes the part
+   of the output played by the voices of each stem to stems[stem]. Stems with
+   a NULL output only go to the mix. The reverb and noise reduction filters
+   are only applied to the mix. */
+void VC1_WriteStems(SBYTE* buf,SBYTE** stems,ULONG todo)
+{
+	int t;
+
+	if(!vc_softchn) {
+		VC1_SilenceBytes(buf,samples2bytes(todo));
+		for(t=0;t<vc_numstems;t++)
+			if(stems[t]) VC1_SilenceBytes(stems[t],samples2bytes(todo));
+		return;
+	}
+
+	for(t=0;t<vc_numstems;t++)
+		vc_stempos[t]=stems[t];
+	vc_stemming=1;
+	VC1_WriteSamples(buf,todo);
+	vc_stemming=0;
+}
+
+/* Buffer the current voice is mixed in */
+static SLONG* VoiceBuffer(void)
+{
+	if((vc_stemming)&&(vnf->stem>=0)&&(vnf->stem<vc_numstems)&&
+	   (vc_stempos[vnf->stem]))
+		return vc_stembuf[vnf->stem];
+	return vc_tickbuf;
+}
+
+static void ClearStems(int count)
+{
+	int t;
+
+	for(t=0;t<vc_numstems;t++)
+		if(vc_stempos[t])
+			memset(vc_stembuf[t],0,count*sizeof(SLONG));
+}
+
+static ULONG Mix32ToOutput(SBYTE*,const SLONG*,NATIVE);
+
+/* Adds the stems to the mix, and converts them to the output format */
+static void MixStems(int portion)
+{
+	SLONG *src,*dst;
+	int t,n,count;
+
+	count=(vc_mode&DMODE_STEREO)?portion<<1:portion;
+	for(t=0;t<vc_numstems;t++)
+		if(vc_stempos[t]) {
+			src=vc_stembuf[t];
+			dst=vc_tickbuf;
+			for(n=count;n;n--)
+				*dst++ += *src++;
+			vc_stempos[t]+=Mix32ToOutput(vc_stempos[t],vc_stembuf[t],portion);
+		}
+}
+
 void VC1_Exit(void)
 {
+	FreeStems();
 	MikMod_free(vinf);
+	MikMod_free(vc_live);
 	MikMod_afree(vc_tickbuf);
+	MikMod_afree(vc_filterbuf);
 	MikMod_afree(Samples);
+	MikMod_free(vc_borrowed);
 
 	vc_tickbuf = NULL;
+	vc_filterbuf = NULL;
 	vinf = NULL;
+	vc_live = NULL;
+	vc_numlive = 0;
 	Samples = NULL;
+	vc_borrowed = NULL;
 
 	VC_SetupPointers();
 }
 
-UWORD VC1_VoiceGetVolume(UBYTE voice)
+UWORD VC1_VoiceGetVolume(UWORD voice)
 {
 	return vinf[voice].vol;
 }
 
-ULONG VC1_VoiceGetPanning(UBYTE voice)
+ULONG VC1_VoiceGetPanning(UWORD voice)
 {
 	return vinf[voice].pan;
 }
 
-void VC1_VoiceSetFrequency(UBYTE voice,ULONG frq)
+void VC1_VoiceSetFrequency(UWORD voice,ULONG frq)
 {
-	vinf[voice].frq=frq;
+	if(vinf[voice].frq!=frq) {
+		vinf[voice].frq=frq;
+		vinf[voice].step=FrequencyStep(frq);
+	}
 }
 
-ULONG VC1_VoiceGetFrequency(UBYTE voice)
+ULONG VC1_VoiceGetFrequency(UWORD voice)
 {
 	return vinf[voice].frq;
 }
 
-void VC1_VoicePlay(UBYTE voice,SWORD handle,ULONG start,ULONG size,ULONG reppos,ULONG repend,UWORD flags)
+void VC1_VoicePlay(UWORD voice,SWORD handle,ULONG start,ULONG size,ULONG reppos,ULONG repend,UWORD flags)
 {
 	vinf[voice].flags  = flags;
 	vinf[voice].handle = handle;
@@ -322,46 +566,262 @@ void VC1_VoicePlay(UBYTE voice,SWORD handle,ULONG start,ULONG size,ULONG reppos,
 	vinf[voice].reppos = reppos;
 	vinf[voice].repend = repend;
 	vinf[voice].kick   = 1;
+
+	if(!vinf[voice].live) {
+		vinf[voice].live = 1;
+		vc_live[vc_numlive++] = voice;
+	}
 }
 
-void VC1_VoiceStop(UBYTE voice)
+void VC1_VoiceStop(UWORD voice)
 {
 	vinf[voice].active = 0;
 }
 
-BOOL VC1_VoiceStopped(UBYTE voice)
+BOOL VC1_VoiceStopped(UWORD voice)
 {
 	return(vinf[voice].active==0);
 }
 
-SLONG VC1_VoiceGetPosition(UBYTE voice)
+SLONG VC1_VoiceGetPosition(UWORD voice)
 {
 	return (SLONG)(vinf[voice].current>>FRACBITS);
 }
 
-void VC1_VoiceSetVolume(UBYTE voice,UWORD vol)
+/* The volume ramp starts from the volumes the voice was last mixed at. They
+   are kept here rather than when mixing, so that a ramp goes on unchanged
+   when the output is mixed in several parts. */
+static void StartRamp(UWORD voice)
+{
+	vinf[voice].oldlvol=vinf[voice].lvolsel;
+	vinf[voice].oldrvol=vinf[voice].rvolsel;
+	vinf[voice].rampvol=CLICK_BUFFER;
+}
+
+void VC1_VoiceSetVolume(UWORD voice,UWORD vol)
 {
 	/* protect against clicks if volume variation is too high */
 	if(abs((int)vinf[voice].vol-(int)vol)>32)
-		vinf[voice].rampvol=CLICK_BUFFER;
+		StartRamp(voice);
 	vinf[voice].vol=vol;
 }
 
-void VC1_VoiceSetPanning(UBYTE voice,ULONG pan)
+void VC1_VoiceSetPanning(UWORD voice,ULONG pan)
 {
 	/* protect against clicks if panning variation is too high */
 	if(abs((int)vinf[voice].pan-(int)pan)>48)
-		vinf[voice].rampvol=CLICK_BUFFER;
+		StartRamp(voice);
 	vinf[voice].pan=pan;
 }
 
+/*========== Resonant filters */
+
+/* Impulse Tracker filter cutoff frequencies: 110*2^(0.25+cutoff/24) Hz */
+static const UWORD filtercutoff[128] = {
+	130,134,138,142,146,151,155,160,164,169,174,179,
+	184,190,195,201,207,213,220,226,233,239,246,254,
+	261,269,277,285,293,302,311,320,329,339,349,359,
+	369,380,391,403,415,427,440,452,466,479,493,508,
+	523,538,554,570,587,604,622,640,659,678,698,718,
+	739,761,783,806,830,854,880,905,932,959,987,1016,
+	1046,1077,1108,1141,1174,1209,1244,1280,1318,1357,1396,1437,
+	1479,1523,1567,1613,1661,1709,1760,1811,1864,1919,1975,2033,
+	2093,2154,2217,2282,2349,2418,2489,2561,2637,2714,2793,2875,
+	2959,3046,3135,3227,3322,3419,3520,3623,3729,3838,3951,4066,
+	4186,4308,4434,4564,4698,4836,4978,5123
+};
+
+/* Impulse Tracker filter damping: 10^(-resonance*24/(128*20)), 16.16 fixed
+   point */
+static const ULONG filterdamping[128] = {
+	65536,64136,62767,61426,60115,58831,57574,56345,55142,53964,
+	52812,51684,50580,49500,48443,47408,46396,45405,44435,43487,
+	42558,41649,40760,39889,39037,38204,37388,36589,35808,35043,
+	34295,33563,32846,32144,31458,30786,30129,29485,28856,28239,
+	27636,27046,26469,25903,25350,24809,24279,23760,23253,22756,
+	22270,21795,21329,20874,20428,19992,19565,19147,18738,18338,
+	17947,17563,17188,16821,16462,16110,15766,15430,15100,14778,
+	14462,14153,13851,13555,13266,12982,12705,12434,12168,11908,
+	11654,11405,11162,10923,10690,10462,10238,10020,9806,9596,
+	9391,9191,8995,8802,8614,8431,8250,8074,7902,7733,
+	7568,7406,7248,7093,6942,6794,6649,6507,6368,6232,
+	6099,5968,5841,5716,5594,5475,5358,5243,5131,5022,
+	4915,4810,4707,4606,4508,4412,4317,4225
+};
+
+#define FILTER_SHIFT 24
+#define FILTER_ONE   (1L<<FILTER_SHIFT)
+#define FILTER_MAX   0x3fffffffL
+
+/* Computes the two-pole low-pass filter of a voice from its cutoff and
+   resonance, as Impulse Tracker does. The tables keep this free of libm. */
+static void SetupFilter(VINFO *v)
+{
+	double w,damp,d,e;
+	ULONG freq=filtercutoff[v->cutoff];
+
+	if(freq*2>(ULONG)FILTER_MIXRATE) freq=FILTER_MIXRATE/2;
+	w=2.0*3.14159265358979*freq/(double)FILTER_MIXRATE;
+	damp=(double)filterdamping[v->resonance]/65536.0;
+	d=(1.0-2.0*damp)*w;
+	if(d>2.0) d=2.0;
+	d=(2.0*damp-d)/w;
+	e=1.0/(w*w);
+
+	v->fa0=(SLONG)(FILTER_ONE/(1.0+d+e)+0.5);
+	v->fb0=(SLONG)(FILTER_ONE*(d+e+e)/(1.0+d+e)+0.5);
+	/* keep the gain at exactly 1 for a constant signal */
+	v->fb1=FILTER_ONE-v->fa0-v->fb0;
+}
+
+/* Sets the resonant filter of a voice; a cutoff of 127 without resonance
+   turns it off */
+void VC1_VoiceSetFilter(UWORD voice,UBYTE cutoff,UBYTE resonance)
+{
+	VINFO *v=&vinf[voice];
+
+	if(cutoff>127) cutoff=127;
+	if(resonance>127) resonance=127;
+	if((v->cutoff==cutoff)&&(v->resonance==resonance)) return;
+
+	v->cutoff=cutoff;
+	v->resonance=resonance;
+	v->filter=(cutoff<127)||(resonance);
+	if(v->filter) SetupFilter(v);
+}
+
+static SLONG FilterSample(SLONG x,SLONG *hist)
+{
+	SLONGLONG y=((SLONGLONG)vnf->fa0*x+(SLONGLONG)vnf->fb0*hist[0]+
+	             (SLONGLONG)vnf->fb1*hist[1])>>FILTER_SHIFT;
+
+	if(y>FILTER_MAX) y=FILTER_MAX;
+	else if(y<-FILTER_MAX) y=-FILTER_MAX;
+	hist[1]=hist[0];
+	hist[0]=(SLONG)y;
+	return (SLONG)y;
+}
+
+/* Mixes the current voice into 'ptr' like AddChannel, through its resonant
+   filter when it has one. The voice is mixed in its own buffer first and
+   filtered there, both channels at once. A filtered voice is mixed even
+   when skipped (NULL 'ptr'), so that the filter keeps its exact state. */
+static void AddFilteredChannel(SLONG* ptr,NATIVE todo)
+{
+	SLONG *src=vc_filterbuf;
+
+	if(!vnf->filter) {
+		AddChannel(ptr,todo);
+		return;
+	}
+
+	/* the filter stops on the sample the voice stops, like Impulse Tracker */
+	memset(vc_filterbuf,0,((vc_mode&DMODE_STEREO)?todo<<1:todo)*sizeof(SLONG));
+	todo=AddChannel(vc_filterbuf,todo);
+
+	if(vc_mode&DMODE_STEREO) {
+		SLONG l,r;
+
+		for(;todo;todo--) {
+			l=FilterSample(*src++,vnf->fhist);
+			r=FilterSample(*src++,vnf->fhist+2);
+			if(ptr) {
+				*ptr++ += l;
+				*ptr++ += r;
+			}
+		}
+	} else {
+		SLONG m;
+
+		for(;todo;todo--) {
+			m=FilterSample(*src++,vnf->fhist);
+			if(ptr) *ptr++ += m;
+		}
+	}
+}
+
+/* Sets up a cleared voice as it is before it first plays */
+static void InitVoice(UWORD voice)
+{
+	vinf[voice].frq=10000;
+	vinf[voice].step=FrequencyStep(10000);
+	vinf[voice].pan=(voice&1)?PAN_LEFT:PAN_RIGHT;
+	vinf[voice].cutoff=127;
+}
+
+/* Stops a voice and forgets its volume ramp, declicking and filter history,
+   so that it plays again exactly as after the mixer was set up. The output
+   stem of the voice is kept. */
+void VC1_VoiceReset(UWORD voice)
+{
+	UBYTE live=vinf[voice].live;
+	SWORD stem=vinf[voice].stem;
+
+	memset(&vinf[voice],0,sizeof(VINFO));
+	InitVoice(voice);
+	vinf[voice].live=live;
+	vinf[voice].stem=stem;
+}
+
+/* The mixing state of a voice can be saved and restored, so that playback
+   resumes on the same sample frame */
+ULONG VC1_VoiceStateSize(void)
+{
+	return sizeof(VINFO);
+}
+
+void VC1_VoiceSaveState(UWORD voice,void *state)
+{
+	memcpy(state,&vinf[voice],sizeof(VINFO));
+}
+
+void VC1_VoiceLoadState(UWORD voice,const void *state)
+{
+	UBYTE live=vinf[voice].live;
+
+	memcpy(&vinf[voice],state,sizeof(VINFO));
+	vinf[voice].live=live;
+	/* the step follows from the frequency, at the current mixing rate */
+	vinf[voice].step=FrequencyStep(vinf[voice].frq);
+	if(!live && (vinf[voice].active || vinf[voice].kick)) {
+		vinf[voice].live = 1;
+		vc_live[vc_numlive++] = voice;
+	}
+}
+
+/* Tells whether a saved mixing state can be resumed with sample 's'. The
+   mixer reads the sample data from the indexes in the state, so they must
+   fit the sample as it is loaded now. */
+BOOL VC1_VoiceCheckState(const void *state,SAMPLE *s)
+{
+	VINFO v;
+
+	memcpy(&v,state,sizeof(VINFO));
+	if(!v.active && !v.kick) return 1;
+	if((!s)||(v.handle<0)||(v.handle>=MAXSAMPLEHANDLES)||
+	   (v.handle!=s->handle)||(!Samples)||(!Samples[v.handle]))
+		return 0;
+	if((v.size>s->length)||(v.start>v.size)) return 0;
+	if((v.flags&SF_LOOP)&&((v.reppos>v.repend)||(v.repend>v.size)))
+		return 0;
+	if(v.kick) return 1;
+
+	/* playing forward, the index may only be past the end of the sample, and
+	   playing backward, before its start */
+	if(v.flags&SF_REVERSE)
+		return v.current<=((SLONGLONG)v.size<<FRACBITS);
+	return v.current>=0;
+}
+
 /*========== External mixer interface */
 
 void VC1_SampleUnload(SWORD handle)
 {
 	if (Samples && (handle < MAXSAMPLEHANDLES)) {
-		MikMod_afree(Samples[handle]);
+		if (!vc_borrowed[handle])
+			MikMod_afree(Samples[handle]);
 		Samples[handle]=NULL;
+		vc_borrowed[handle]=0;
 	}
 }
 
@@ -400,16 +860,21 @@ SWORD VC1_SampleLoad(struct SAMPLOAD* sload,int type)
 	SL_SampleSigned(sload);
 	SL_Sample8to16(sload);
 
-	if(!(Samples[handle]=(SWORD*)MikMod_amalloc((length+20)<<1))) {
-		_mm_errno = MMERR_SAMPLE_TOO_BIG;
-		return -1;
-	}
-
-	/* read sample into buffer */
-	if (SL_Load(Samples[handle],sload,length)) {
-		MikMod_afree(Samples[handle]);
-		Samples[handle]=NULL;
-		return -1;
+	/* use the sample in place when it is stored in the mixer format */
+	if((Samples[handle]=(SWORD*)SL_Borrow(sload,(length+20)<<1)))
+		vc_borrowed[handle]=1;
+	else {
+		if(!(Samples[handle]=(SWORD*)MikMod_amalloc((length+20)<<1))) {
+			_mm_errno = MMERR_SAMPLE_TOO_BIG;
+			return -1;
+		}
+
+		/* read sample into buffer */
+		if (SL_Load(Samples[handle],sload,length)) {
+			MikMod_afree(Samples[handle]);
+			Samples[handle]=NULL;
+			return -1;
+		}
 	}
 
 	/* Unclick sample */
@@ -440,7 +905,7 @@ ULONG VC1_SampleLength(int type,SAMPLE* s)
 	return (s->length*((s->flags&SF_16BITS)?2:1))+16;
 }
 
-ULONG VC1_VoiceRealVolume(UBYTE voice)
+ULONG VC1_VoiceRealVolume(UWORD voice)
 {
 	ULONG i,s,size;
 	int k,j;
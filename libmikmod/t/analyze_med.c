@@ -0,0 +1,133 @@
+/*	MikMod sound library - regression test
+
+	Analyzes an OctaMED song using the loop effect (16) while no module is
+	playing. The effect used to reset the loop position of the channels of
+	the playing module instead of those of the analyzed one, and crashed
+	when there was none.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <mikmod.h>
+
+#define NUMCHN	4
+#define NUMROWS	16
+
+/* offsets in the generated MMD1 module */
+#define SONG	52
+#define SMPARR	(SONG+788)
+#define SMPHDR	(SMPARR+4)
+#define SMPLEN	16
+#define BLKARR	(SMPHDR+6+SMPLEN+2)
+#define BLOCK	(BLKARR+4)
+#define MODLEN	(BLOCK+8+NUMROWS*NUMCHN*4)
+
+static UBYTE med[MODLEN];
+
+static void put_word(int pos,UWORD v)
+{
+	med[pos]=v>>8;
+	med[pos+1]=v&0xff;
+}
+
+static void put_long(int pos,ULONG v)
+{
+	put_word(pos,v>>16);
+	put_word(pos+2,v&0xffff);
+}
+
+static void put_note(int row,int chn,UBYTE note,UBYTE ins,UBYTE eff,UBYTE dat)
+{
+	UBYTE *n=&med[BLOCK+8+(row*NUMCHN+chn)*4];
+
+	n[0]=note;
+	n[1]=ins;
+	n[2]=eff;
+	n[3]=dat;
+}
+
+/* One block of 16 rows played once, with its rows 4 to 11 repeated twice */
+static void build_med(void)
+{
+	int t;
+
+	memcpy(med,"MMD1",4);
+	put_long(4,MODLEN);
+	put_long(8,SONG);
+	put_long(16,BLKARR);
+	put_long(24,SMPARR);
+
+	/* song: sample 1 at full volume, one block played once, BPM tempo
+	   mode with 4 rows per beat, 125 BPM, speed 6 */
+	med[SONG+6]=64;
+	put_word(SONG+504,1);
+	put_word(SONG+506,1);
+	put_word(SONG+764,125);
+	med[SONG+767]=0x10;
+	med[SONG+768]=0x20|3;
+	med[SONG+769]=6;
+	for (t=0;t<16;t++)
+		med[SONG+770+t]=64;
+	med[SONG+786]=64;
+	med[SONG+787]=1;
+
+	put_long(SMPARR,SMPHDR);
+	put_long(SMPHDR,SMPLEN);
+	for (t=0;t<SMPLEN;t++)
+		med[SMPHDR+6+t]=(t&4)?0x40:0xc0;
+
+	put_long(BLKARR,BLOCK);
+	put_word(BLOCK,NUMCHN);
+	put_word(BLOCK+2,NUMROWS-1);
+	put_note(0,0,25,1,0,0);
+	put_note(4,1,0,0,0x16,0);
+	put_note(11,1,0,0,0x16,2);
+}
+
+int main(void)
+{
+	MODULE *mod;
+	MODULEANALYSIS *an;
+	ULONG expected;
+	int result=1;
+
+	build_med();
+
+	MikMod_RegisterDriver(&drv_nos);
+	MikMod_RegisterLoader(&load_med);
+	md_mode|=DMODE_SOFT_MUSIC;
+	if (MikMod_Init("")) {
+		fprintf(stderr,"MikMod_Init: %s\n",MikMod_strerror(MikMod_errno));
+		return 1;
+	}
+
+	if (!(mod=Player_LoadMem((const char*)med,MODLEN,NUMCHN,0))) {
+		fprintf(stderr,"Player_LoadMem: %s\n",MikMod_strerror(MikMod_errno));
+		goto done;
+	}
+	mod->loop=0;
+	mod->wrap=0;
+
+	if (!(an=Player_Analyze(mod))) {
+		fprintf(stderr,"Player_Analyze: %s\n",MikMod_strerror(MikMod_errno));
+		Player_Free(mod);
+		goto done;
+	}
+
+	/* 16 rows plus 2 repeats of 8 rows, of 6 ticks of 20 ms */
+	expected=(NUMROWS+2*8)*6*20;
+	if (an->duration!=expected)
+		fprintf(stderr,"duration %lu ms, expected %lu ms\n",
+		        (unsigned long)an->duration,(unsigned long)expected);
+	else
+		result=0;
+
+	Player_FreeAnalysis(an);
+	Player_Free(mod);
+done:
+	MikMod_Exit();
+	return result;
+}
+
+/* ex:set ts=4: */
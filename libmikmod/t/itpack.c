@@ -0,0 +1,327 @@
+/*	MikMod sound library - regression test
+
+	Decodes IT-Compressed samples, 8 and 16 bit, with and without the
+	second delta of IT 2.15, and checks that they come out exactly as they
+	were encoded, from a memory reader, which the decoder reads in place, and
+	from a file reader, which it reads from a copy. The samples change their
+	bit width all the time, to go through every width change.
+
+	Their decoding speed is also compared with the one of a decoder reading
+	the bits one byte at a time, as libmikmod did up to 3.3.11.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "mikmod_internals.h"
+
+#define NUMSMP		100000
+#define BENCHSMP	(1<<22)
+
+static SWORD  values[BENCHSMP];		/* values encoded, per block */
+static SWORD  expected[BENCHSMP];
+static SWORD  decoded[BENCHSMP];
+static UBYTE  packed[BENCHSMP*3];
+
+static ULONG seed=1;
+
+static ULONG rnd(void)
+{
+	seed=seed*1103515245UL+12345UL;
+	return (seed>>16)&0x7fff;
+}
+
+/*========== Encoder */
+
+static UBYTE *bitptr;
+static ULONG bitbuf;
+static int bitcount;
+
+static void put_bits(ULONG x,int n)
+{
+	bitbuf|=(x&((1UL<<n)-1))<<bitcount;
+	bitcount+=n;
+	while (bitcount>=8) {
+		*bitptr++=(UBYTE)bitbuf;
+		bitbuf>>=8;
+		bitcount-=8;
+	}
+}
+
+/* Tells whether value 'd' can be stored in 'w' bits, which can't hold the
+   values they use for width changes */
+static int fits(int d,int w,int is16)
+{
+	int maxw=is16?17:9,half,res=is16?8:4;
+
+	if (w==maxw) return 1;
+	half=1<<(w-1);
+	if (w<7) return (d>-half)&&(d<half);
+	return (d>=res-half)&&(d<half-res);
+}
+
+static void put_width(int from,int to,int is16)
+{
+	int maxw=is16?17:9;
+
+	if (from<7) {
+		put_bits(1UL<<(from-1),from);
+		put_bits((to<from)?to-1:to-2,is16?4:3);
+	} else if (from<maxw)
+		put_bits((is16?(0xffff>>(17-from))-8:(0xff>>(9-from))-4)+
+		         ((to<from)?to:to-1),from);
+	else
+		put_bits((1UL<<(maxw-1))+to-1,from);
+}
+
+/* Encodes 'count' values, in blocks of 'block' values, each in the smallest
+   width it fits in */
+static long encode(const SWORD *v,long count,int is16,int block)
+{
+	int maxw=is16?17:9,bits=maxw,w,t;
+	UBYTE *len=NULL;
+
+	bitptr=packed;
+	bitbuf=bitcount=0;
+	for (t=0;t<count;t++) {
+		if (!(t%block)) {
+			if (len) {
+				put_bits(0,(8-bitcount)&7);
+				len[0]=(UBYTE)(bitptr-len-2);
+				len[1]=(UBYTE)((bitptr-len-2)>>8);
+			}
+			len=bitptr;
+			bitptr+=2;
+			bits=maxw;
+		}
+		for (w=1;!fits(v[t],w,is16);w++);
+		if (w!=bits) {
+			put_width(bits,w,is16);
+			bits=w;
+		}
+		/* the top bit of the widest values tells width changes */
+		put_bits((ULONG)v[t]&((1UL<<((w<maxw)?w:w-1))-1),w);
+	}
+	put_bits(0,(8-bitcount)&7);
+	len[0]=(UBYTE)(bitptr-len-2);
+	len[1]=(UBYTE)((bitptr-len-2)>>8);
+	return bitptr-packed;
+}
+
+/* Values spanning each width in turn, and what they decode to */
+static void generate(long count,int is16,int delta,int block)
+{
+	int w=1,range=1;
+	SWORD last=0,old=0;
+	long t;
+
+	for (t=0;t<count;t++) {
+		if (!(t%97)) {
+			w=1+rnd()%(is16?16:8);
+			range=1<<(w-1);
+		}
+		values[t]=(SWORD)((int)(rnd()%(2*range))-range);
+		if (!is16) values[t]=(SBYTE)values[t];
+
+		if (!(t%block)) last=old=0;
+		if (is16)
+			last+=values[t];
+		else
+			last=(SBYTE)(last+values[t]);
+		expected[t]=is16?last:(SWORD)(last*256);
+		if (delta) expected[t]=old+=expected[t];
+	}
+}
+
+/*========== Reference decoder */
+
+/* The decoder of libmikmod 3.3.11, on a whole sample */
+static void reference(MREADER *reader,SWORD *out,long count,int is16,int delta)
+{
+	long t,left=0;
+	SLONG x,y,needbits,havebits,new_count=0;
+	UWORD bits=0,bufbits=0,incnt=0;
+	SWORD last=0,old=0;
+	UBYTE buf=0;
+
+	for (t=0;t<count;) {
+		if (!left) {
+			incnt=_mm_read_I_UWORD(reader);
+			bits=is16?17:9;
+			bufbits=0;
+			last=old=0;
+			left=is16?0x4000:0x8000;
+		}
+		needbits=new_count?(is16?4:3):bits;
+		x=havebits=0;
+		while (needbits) {
+			if (!bufbits) {
+				buf=(incnt--)?_mm_read_UBYTE(reader):0;
+				bufbits=8;
+			}
+			y=needbits<bufbits?needbits:bufbits;
+			x|=(buf&((1<<y)-1))<<havebits;
+			buf>>=y;
+			bufbits-=(UWORD)y;
+			needbits-=y;
+			havebits+=y;
+		}
+		if (new_count) {
+			new_count=0;
+			if (++x>=bits) x++;
+			bits=(UWORD)x;
+			continue;
+		}
+		if (bits<7) {
+			if (x==(1<<(bits-1))) {
+				new_count=1;
+				continue;
+			}
+		} else if (bits<(is16?17:9)) {
+			y=is16?(0xffff>>(17-bits))-8:(0xff>>(9-bits))-4;
+			if ((x>y)&&(x<=y+(is16?16:8))) {
+				if ((x-=y)>=bits) x++;
+				bits=(UWORD)x;
+				continue;
+			}
+		} else if (x>=(is16?0x10000:0x100)) {
+			bits=(UWORD)(x-(is16?0x10000:0x100)+1);
+			continue;
+		}
+
+		if (is16) {
+			if (bits<16) x=((SWORD)(x<<(16-bits)))>>(16-bits);
+			last+=(SWORD)x;
+			out[t]=last;
+		} else {
+			if (bits<8) x=((SBYTE)(x<<(8-bits)))>>(8-bits);
+			last=(SBYTE)(last+x);
+			out[t]=(SWORD)(last*256);
+		}
+		if (delta) out[t]=old+=out[t];
+		t++;
+		left--;
+	}
+}
+
+/*========== Tests */
+
+static UWORD format(int is16,int delta)
+{
+	return SF_ITPACKED|SF_SIGNED|(is16?SF_16BITS:0)|(delta?SF_DELTA:0);
+}
+
+static int load(MREADER *reader,long count,int is16,int delta)
+{
+	SAMPLOAD s;
+	int result;
+
+	memset(&s,0,sizeof(SAMPLOAD));
+	s.length=count;
+	s.infmt=format(is16,delta);
+	s.outfmt=SF_16BITS|SF_SIGNED;
+	s.reader=reader;
+	if (!SL_Init(&s)) return 1;
+	result=SL_Load(decoded,&s,count);
+	SL_Exit(&s);
+	return result;
+}
+
+static int check(const char *what,long count,int is16,int delta)
+{
+	long t;
+
+	for (t=0;t<count;t++)
+		if (decoded[t]!=expected[t]) {
+			fprintf(stderr,"%d bit%s, %s: sample %ld is %d, expected %d\n",
+			        is16?16:8,delta?" delta":"",what,t,decoded[t],expected[t]);
+			return 1;
+		}
+	return 0;
+}
+
+static int test(int is16,int delta)
+{
+	MREADER *reader;
+	FILE *fp;
+	long len;
+	int result=0;
+
+	generate(NUMSMP,is16,delta,is16?0x4000:0x8000);
+	len=encode(values,NUMSMP,is16,is16?0x4000:0x8000);
+
+	memset(decoded,0,sizeof(decoded));
+	if (!(reader=_mm_new_mem_reader(packed,len))) return 1;
+	if (load(reader,NUMSMP,is16,delta)||check("memory",NUMSMP,is16,delta))
+		result=1;
+	_mm_delete_mem_reader(reader);
+
+	memset(decoded,0,sizeof(decoded));
+	if (!(fp=tmpfile())) return 1;
+	fwrite(packed,1,len,fp);
+	rewind(fp);
+	if (!(reader=_mm_new_file_reader(fp))) result=1;
+	else {
+		if (load(reader,NUMSMP,is16,delta)||check("file",NUMSMP,is16,delta))
+			result=1;
+		_mm_delete_file_reader(reader);
+	}
+	fclose(fp);
+
+	return result;
+}
+
+static double seconds(clock_t start)
+{
+	return (double)(clock()-start)/CLOCKS_PER_SEC;
+}
+
+/* Decodes the same 16 bit sample with both decoders */
+static int bench(void)
+{
+	MREADER *reader;
+	clock_t start;
+	double lib,ref;
+	long len;
+
+	generate(BENCHSMP,1,0,0x4000);
+	len=encode(values,BENCHSMP,1,0x4000);
+
+	if (!(reader=_mm_new_mem_reader(packed,len))) return 1;
+	start=clock();
+	if (load(reader,BENCHSMP,1,0)) return 1;
+	lib=seconds(start);
+	_mm_delete_mem_reader(reader);
+	if (check("benchmark",BENCHSMP,1,0)) return 1;
+
+	if (!(reader=_mm_new_mem_reader(packed,len))) return 1;
+	start=clock();
+	reference(reader,decoded,BENCHSMP,1,0);
+	ref=seconds(start);
+	_mm_delete_mem_reader(reader);
+	if (check("reference",BENCHSMP,1,0)) return 1;
+
+	printf("%d samples: %.1f ms, %.1f ms with the 3.3.11 decoder\n",
+	       BENCHSMP,lib*1000,ref*1000);
+	return 0;
+}
+
+int main(void)
+{
+	int is16,delta,result=0;
+
+	for (is16=0;is16<2;is16++)
+		for (delta=0;delta<2;delta++)
+			result|=test(is16,delta);
+	result|=bench();
+
+	return result;
+}
+
+/* ex:set ts=4: */
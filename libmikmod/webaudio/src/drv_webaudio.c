@@ -80,7 +80,7 @@ MDRIVER drv_webaudio = {
 	NULL, // next
 	"Web Audio",
 	"Web Audio driver v0.1",
-	0, 255,
+	0, MAXSOFTVOICES,
 	"webaudio",
 	NULL, // CmdLineHelp
 	NULL, // CommandLine
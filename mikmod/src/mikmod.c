@@ -805,6 +805,19 @@ static BOOL player_timeout (MWINDOW *win, void *data)
 			mf->wrap = (BTST(config.playmode, PM_MODULE) ? 1 : 0);
 			mf->loop = config.loop;
 			mf->fadeout = config.fade;
+			/* know the song length before it has been heard */
+			if (!BTST(config.playmode, PM_MODULE)) {
+				MODULEANALYSIS *an = Player_Analyze(mf);
+
+				if (an) {
+					/* milliseconds to 2^-10 s, without overflowing a
+					   32-bit long */
+					PL_SetTimeCurrent(&playlist,
+									  (long)(an->duration / 1000) * 1024 +
+									  (long)(an->duration % 1000) * 1024 / 1000);
+					Player_FreeAnalysis(an);
+				}
+			}
 			Player_Start(mf);
 			if (mf->volume > uservolume)
 				Player_SetVolume(uservolume);